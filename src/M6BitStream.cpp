@@ -575,6 +575,12 @@ void WriteBits(M6OBitStream& inBits, const M6OBitStream& inValue)
     CopyBits(inBits, inValue);
 }
 
+void WriteBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount)
+{
+    WriteGamma(inBits, static_cast<int64>(inBitCount));
+    CopyBits(inBits, inData, inBitCount);
+}
+
 void CopyBits(M6OBitStream& inBits, const M6OBitStream&    inValue)
 {
     M6IBitStream bits(inValue);
@@ -592,6 +598,18 @@ void CopyBits(M6OBitStream& inBits, const M6OBitStream&    inValue)
         inBits << bits();
 }
 
+void CopyBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount)
+{
+    while (inBitCount >= 8)
+    {
+        inBits.Add(*inData++);
+        inBitCount -= 8;
+    }
+
+    for (uint8 mask = 0x80; inBitCount > 0; --inBitCount, mask >>= 1)
+        inBits << ((*inData & mask) != 0);
+}
+
 // --------------------------------------------------------------------
 //    Arrays
 //    This is a simplified version of the array compression routines in MRS
@@ -72,7 +72,9 @@ class M6OBitStream
     friend struct M6IBitStreamOBitImpl;
     friend void ReadBits(M6IBitStream& inBits, M6OBitStream& outValue);
     friend void WriteBits(M6OBitStream& inBits, const M6OBitStream& inValue);
+    friend void WriteBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount);
     friend void CopyBits(M6OBitStream& inBits, const M6OBitStream& inValue);
+    friend void CopyBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount);
 
   private:
 
@@ -281,6 +283,11 @@ void ReadBits(M6IBitStream& inBits, M6OBitStream& outValue);
 void WriteBits(M6OBitStream& inBits, const M6OBitStream& inValue);
 void CopyBits(M6OBitStream& inBits, const M6OBitStream& inValue);
 
+// Same as WriteBits above, but for inBitCount bits stored in a plain
+// buffer, most significant bit first, as copied from a synced M6OBitStream.
+void WriteBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount);
+void CopyBits(M6OBitStream& inBits, const uint8* inData, size_t inBitCount);
+
 // --------------------------------------------------------------------
 //    Arrays are a bit more complex
 
@@ -9,13 +9,16 @@
 #include <memory>
 #include <list>
 #include <cctype>
+#include <cstring>
 #include <functional>
+#include <numeric>
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/date_time/local_time/local_time.hpp"
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
@@ -46,6 +49,10 @@
 #include "M6Parser.h"
 #include "M6Utilities.h"
 #include "M6Log.h"
+#include "M6MD5.h"
+#include "M6XMLChunker.h"
+#include "M6LineMatcher.h"
+#include "M6Tokenizer.h"
 
 using namespace std;
 namespace zx = zeep::xml;
@@ -59,9 +66,23 @@ class M6Processor
 {
   public:
     typedef M6Queue<fs::path>                    M6FileQueue;
-    typedef M6Queue<tuple<string,string>>    M6DocQueue;
 
-    static const tuple<string,string> kSentinel;
+    // Documents are passed to the parser threads as a slice of a block
+    // of input text. The block is shared by all documents cut from it.
+    struct M6DocSlice
+    {
+        shared_ptr<const string>    mBlock;
+        size_t                        mOffset, mLength;
+        string                        mFileName;
+        uint32                        mSourceNr;
+    };
+
+    typedef M6Queue<M6DocSlice>                    M6DocQueue;
+
+    static const M6DocSlice kSentinel;
+
+    // larger members are processed while they are read
+    static const int64        kMaxMemberSize = 4 * 1024 * 1024;
 
                     M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
                         const zx::element* inTemplate);
@@ -73,6 +94,13 @@ class M6Processor
     M6InputDocument*
                     IndexDocument(const string& inText, const string& inFileName);
 
+    // Record the source file for each document in inSourceMap, a table
+    // with a source number for each document number offset by inDocBase.
+    // The source number of the files passed to Process is their index
+    // in the list plus inFirstSourceNr.
+    void            TrackSources(M6File& inSourceMap, uint32 inDocBase,
+                        uint32 inFirstSourceNr);
+
   private:
     void            ProcessFile(const string& inFileName, istream& inFileStream);
 
@@ -82,22 +110,57 @@ class M6Processor
                         const string& inIndex, M6DataType inDataType, bool isUnique);
 
     void            ProcessFile(M6Progress& inProgress);
+    void            ProcessArchive(M6DataSource& inArchive, const fs::path& inPath,
+                        uint32 inNrOfThreads);
     void            ProcessDocument();
     void            ProcessDocument(const string& inDoc);
 
     void            PutDocument(const string& inDoc)
+                    {
+                        PutDocument(make_shared<const string>(inDoc), 0, inDoc.length());
+                    }
+
+    void            PutDocument(const shared_ptr<const string>& inBlock,
+                        size_t inOffset, size_t inLength)
                     {
                         if (not (mException == exception_ptr()))
                             rethrow_exception(mException);
 
                         if (mUseDocQueue)
-                            mDocQueue.Put(make_tuple(inDoc, *mFileName));
+                        {
+                            M6DocSlice slice = { inBlock, inOffset, inLength, *mFileName, GetSourceNr() };
+                            if (not PutUnlessError(mDocQueue, move(slice)))
+                                rethrow_exception(mException);
+                        }
                         else
-                            ProcessDocument(inDoc);
+                            ProcessDocument(GetText(*inBlock, inOffset, inLength));
+                    }
+
+    static string    GetText(const string& inBlock, size_t inOffset, size_t inLength);
+
+    uint32            GetSourceNr() const
+                    {
+                        return mSourceNr.get() != nullptr ? *mSourceNr : 0;
                     }
 
+    void            SetSourceNr(const fs::path& inFile);
+    void            StoreDocument(M6InputDocument* inDocument, uint32 inSourceNr);
+
     void            Error(exception_ptr e);
 
+    // After an error the threads taking items from a queue have been
+    // interrupted, waiting for room in that queue would never end.
+    template<class Q, class T>
+    bool            PutUnlessError(Q& inQueue, T inValue)
+                    {
+                        while (not inQueue.TimedPut(inValue, boost::posix_time::milliseconds(100)))
+                        {
+                            if (not (mException == exception_ptr()))
+                                return false;
+                        }
+                        return true;
+                    }
+
     struct XMLIndex
     {
         string        name;
@@ -113,6 +176,7 @@ class M6Processor
     M6Parser*                mParser;
     vector<XMLIndex>        mXMLIndexInfo;
     string                    mChunkXPath;
+    M6XMLChunker*            mChunker;
     M6FileQueue                mFileQueue;
     M6DocQueue                mDocQueue;
     bool                    mUseDocQueue;
@@ -121,17 +185,24 @@ class M6Processor
     string                    mDbHeader;
     boost::thread_specific_ptr<string>
                             mFileName;
+    boost::thread_specific_ptr<uint32>
+                            mSourceNr;
+    map<fs::path,uint32>    mSourceNrs;
+    M6File*                    mSourceMap;
+    uint32                    mDocBase, mFirstSourceNr;
+    boost::mutex            mSourceMapMutex;
     boost::thread_group        mFileThreads, mDocThreads;
     exception_ptr            mException;
 };
 
-const tuple<string,string> M6Processor::kSentinel;
+const M6Processor::M6DocSlice M6Processor::kSentinel = {};
 
 // --------------------------------------------------------------------
 
 M6Processor::M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
         const zx::element* inTemplate)
     : mDatabank(inDatabank), mLexicon(inLexicon), mConfig(inTemplate), mParser(nullptr)
+    , mChunker(nullptr), mSourceMap(nullptr), mDocBase(0), mFirstSourceNr(0)
 {
     string parser = mConfig->get_attribute("parser");
     if (parser.empty())
@@ -140,13 +211,23 @@ M6Processor::M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
     // see if this is an XML parser
     const zx::element* p = M6Config::GetParser(parser);
     if (p == nullptr)
-        mParser = new M6Parser(parser);
+    {
+        mParser = new M6Parser(parser, mConfig->get_attribute("native-parser") == "true");
+        LOG(INFO, "M6Processor: using the %s parser %s for %s",
+            mParser->IsNative() ? "native" : "Perl", parser.c_str(),
+            mConfig->get_attribute("id").c_str());
+    }
     else
     {
         mChunkXPath = p->get_attribute("chunk");
         if (mChunkXPath.empty())
             THROW(("Missing chunk XPath attribute in XML parser"));
 
+        // the streaming chunker is opt-in, it stores the original markup
+        // and skips comments. Complex XPaths still need zeep.
+        if (p->get_attribute("streaming") == "true")
+            mChunker = M6XMLChunker::Create(mChunkXPath);
+
         for (zx::element* ix : p->find("index"))
         {
             string tt = ix->get_attribute("type");
@@ -158,16 +239,28 @@ M6Processor::M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
             else if (tt == "float")
                 type = eM6FloatData;
 
+            string xpath = ix->get_attribute("xpath");
+
             XMLIndex info = {
                 ix->get_attribute("name"),
-                ix->get_attribute("xpath"),
+                xpath,
                 ix->get_attribute("unique") == "true",
                 type,
                 ix->get_attribute("attr") == "true"
             };
 
             mXMLIndexInfo.push_back(info);
+
+            if (mChunker != nullptr and not mChunker->AddIndex(xpath, info.attr))
+            {
+                delete mChunker;
+                mChunker = nullptr;
+            }
         }
+
+        LOG(INFO, "M6Processor: using %s XML parser %s for %s",
+            mChunker != nullptr ? "the streaming" : "the XPath", parser.c_str(),
+            mConfig->get_attribute("id").c_str());
     }
 
     mWriteFasta = mConfig->get_attribute("fasta") == "true";
@@ -176,42 +269,40 @@ M6Processor::M6Processor(M6Databank& inDatabank, M6Lexicon& inLexicon,
 M6Processor::~M6Processor()
 {
     delete mParser;
+    delete mChunker;
 }
 
-void M6Processor::Error(exception_ptr e)
+void M6Processor::TrackSources(M6File& inSourceMap, uint32 inDocBase, uint32 inFirstSourceNr)
 {
-    mException = e;
-    mFileThreads.interrupt_all();
-    mDocThreads.interrupt_all();
+    mSourceMap = &inSourceMap;
+    mDocBase = inDocBase;
+    mFirstSourceNr = inFirstSourceNr;
 }
 
-struct M6LineMatcher
+void M6Processor::SetSourceNr(const fs::path& inFile)
 {
-  public:
-            M6LineMatcher(const string& inMatch)
-                : mStr(inMatch)
-            {
-                if (ba::starts_with(mStr, "(?^:"))
-                    mRE.assign(mStr.substr(4, mStr.length() - 5));
-            }
-
-    bool    Match(const string& inStr) const
-            {
-                bool result = false;
-
-                if (mRE.empty())
-                    result = mStr.empty() == false and mStr == inStr;
-                else
-                    result = boost::regex_match(inStr, mRE);
+    auto i = mSourceNrs.find(inFile);
+    mSourceNr.reset(new uint32(i == mSourceNrs.end() ? 0 : i->second));
+}
 
-                return result;
-            }
+void M6Processor::StoreDocument(M6InputDocument* inDocument, uint32 inSourceNr)
+{
+    if (mSourceMap != nullptr and inSourceNr != 0)
+    {
+        boost::mutex::scoped_lock lock(mSourceMapMutex);
+        mSourceMap->PWrite(&inSourceNr, sizeof(inSourceNr),
+            static_cast<int64>(mDocBase + inDocument->GetDocNr()) * sizeof(uint32));
+    }
 
-            operator bool() { return mRE.empty() == false or mStr.empty() == false; }
+    mDatabank.Store(inDocument);
+}
 
-    string            mStr;
-    boost::regex    mRE;
-};
+void M6Processor::Error(exception_ptr e)
+{
+    mException = e;
+    mFileThreads.interrupt_all();
+    mDocThreads.interrupt_all();
+}
 
 void M6Processor::ProcessFile(const string& inFileName, istream& inFileStream)
 {
@@ -263,7 +354,39 @@ void M6Processor::ParseXML(const string& inFileName, istream& inFileStream)
     if (inFileStream.peek() != '<') // not xml
         return;
 
-    zx::process_document_elements(inFileStream, mChunkXPath, [&] (zx::node* root, zx::element* xml) -> bool
+    string head;
+
+    if (mChunker != nullptr and mChunker->Process(inFileStream,
+        [this](const string& inText, const M6XMLChunker::M6IndexValues& inValues)
+        {
+            unique_ptr<M6InputDocument> doc(new M6InputDocument(mDatabank, inText));
+
+            for (size_t i = 0; i < mXMLIndexInfo.size(); ++i)
+            {
+                XMLIndex& ix = mXMLIndexInfo[i];
+
+                for (const string& text : inValues[i])
+                {
+                    doc->Index(ix.name, ix.type, ix.unique, text.c_str(), text.length());
+                    if (ix.attr)
+                        doc->SetAttribute(ix.name, text.c_str(), text.length());
+                }
+            }
+
+            doc->Tokenize(mLexicon, 0);
+            doc->Compress();
+
+            StoreDocument(doc.release(), GetSourceNr());
+        }, head))
+    {
+        return;
+    }
+
+    // The chunker could not handle this file, hand the data it read to
+    // zeep followed by the rest of the file.
+    io::stream<M6PrefixedSource> in(M6PrefixedSource(head, inFileStream));
+
+    zx::process_document_elements(in, mChunkXPath, [&] (zx::node* root, zx::element* xml) -> bool
     {
         stringstream text;
         zx::writer w(text);
@@ -290,7 +413,7 @@ void M6Processor::ParseXML(const string& inFileName, istream& inFileStream)
         doc->Tokenize(mLexicon, 0);
         doc->Compress();
 
-        mDatabank.Store(doc.release());
+        StoreDocument(doc.release(), GetSourceNr());
 
         return true;
     });
@@ -304,6 +427,18 @@ void M6Processor::ParseFile(const string& inFileName, istream& inFileStream)
                   firstline(mParser->GetValue("firstdocline")),
                   lastline(mParser->GetValue("lastdocline"));
 
+    // Without a header or trailer the file is a plain list of records,
+    // these can be cut from large blocks of text directly.
+    if (not header and not lastheaderline and not trailer and (firstline or lastline))
+    {
+        M6SplitRecords(inFileStream, firstline, lastline,
+            [this](const shared_ptr<const string>& inBlock, size_t inOffset, size_t inLength)
+            {
+                PutDocument(inBlock, inOffset, inLength);
+            });
+        return;
+    }
+
     enum State { eHeader, eStart, eDoc, eTail } state = eHeader;
 
     if (not header and not lastheaderline)
@@ -329,7 +464,7 @@ void M6Processor::ParseFile(const string& inFileName, istream& inFileStream)
         switch (state)
         {
             case eHeader:
-                mDbHeader += line + '\n';
+                mDbHeader.append(line).append(1, '\n');
                 if (lastheaderline)
                 {
                     if (lastheaderline.Match(line))
@@ -342,7 +477,7 @@ void M6Processor::ParseFile(const string& inFileName, istream& inFileStream)
             case eStart:
                 if (not firstline or firstline.Match(line))
                 {
-                    document = line + '\n';
+                    document.assign(line).append(1, '\n');
                     state = eDoc;
                 }
                 else if (trailer and trailer.Match(line))
@@ -353,7 +488,7 @@ void M6Processor::ParseFile(const string& inFileName, istream& inFileStream)
                 if (not lastline and firstline and firstline.Match(line))
                 {
                     PutDocument(document);
-                    document = line + '\n';
+                    document.assign(line).append(1, '\n');
                 }
                 else if (trailer and trailer.Match(line))
                 {
@@ -363,7 +498,7 @@ void M6Processor::ParseFile(const string& inFileName, istream& inFileStream)
                 }
                 else
                 {
-                    document += line + '\n';
+                    document.append(line).append(1, '\n');
                     if (lastline and lastline.Match(line))
                     {
                         PutDocument(document);
@@ -389,6 +524,8 @@ void M6Processor::ProcessFile(M6Progress& inProgress)
             if (path.empty())
                 break;
 
+            SetSourceNr(path);
+
             try
             {
                 M6DataSource data(path, inProgress);
@@ -415,6 +552,42 @@ void M6Processor::ProcessFile(M6Progress& inProgress)
     }
 }
 
+// Members of an archive are only processed in parallel when the parser
+// does not collect a databank header, mDbHeader is not shared safely.
+
+void M6Processor::ProcessArchive(M6DataSource& inArchive, const fs::path& inPath,
+    uint32 inNrOfThreads)
+{
+    bool parallel = inNrOfThreads > 1 and (mParser == nullptr or
+        (mParser->GetValue("header").empty() and mParser->GetValue("lastheaderline").empty()));
+
+    try
+    {
+        // ProcessFile records a parse error in mException, rethrowing it
+        // stops the other members
+        M6ProcessArchive(inArchive, parallel ? inNrOfThreads : 1, kMaxMemberSize,
+            [this](const string& inFileName, istream& inStream)
+            {
+                if (not (mException == exception_ptr()))
+                    rethrow_exception(mException);
+
+                LOG(INFO, "M6Processor: processing file %s", inFileName.c_str());
+                ProcessFile(inFileName, inStream);
+                LOG(INFO, "M6Processor: done processing file %s", inFileName.c_str());
+
+                if (not (mException == exception_ptr()))
+                    rethrow_exception(mException);
+            },
+            [&inPath, this]() { SetSourceNr(inPath); });
+    }
+    catch (exception&)
+    {
+        // Process rethrows the exception once the document threads are done
+        if (mException == exception_ptr())
+            Error(current_exception());
+    }
+}
+
 void M6Processor::ProcessDocument(const string& inDoc)
 {
     M6InputDocument* doc = new M6InputDocument(mDatabank, inDoc);
@@ -432,7 +605,7 @@ void M6Processor::ProcessDocument(const string& inDoc)
     doc->Tokenize(mLexicon, 0);
     doc->Compress();
 
-    mDatabank.Store(doc);
+    StoreDocument(doc, GetSourceNr());
 }
 
 M6InputDocument* M6Processor::IndexDocument(const string& inDoc, const string& inFileName)
@@ -448,66 +621,44 @@ M6InputDocument* M6Processor::IndexDocument(const string& inDoc, const string& i
     return doc;
 }
 
+// The text of a slice, with the line ends of files in DOS format
+// converted the same way as in ParseFile.
+
+string M6Processor::GetText(const string& inBlock, size_t inOffset, size_t inLength)
+{
+    string result(inBlock, inOffset, inLength);
+
+    if (result.find('\r') != string::npos)
+    {
+        string::iterator e = result.begin();
+        for (string::iterator i = result.begin(); i != result.end(); ++i)
+        {
+            if (*i == '\r' and i + 1 != result.end() and *(i + 1) == '\n')
+                continue;
+            *e++ = *i;
+        }
+        result.erase(e, result.end());
+    }
+
+    return result;
+}
+
 void M6Processor::ProcessDocument()
 {
     try
     {
-        unique_ptr<M6Lexicon> tsLexicon(new M6Lexicon);
-        vector<M6InputDocument*> docs;
-
         for (;;)
         {
-            string text, filename;
-            tie(text, filename) = mDocQueue.Get();
-
-            if (text.empty() or docs.size() == 100)
-            {
-                // remap tokens
-                vector<uint32> remapped(tsLexicon->Count() + 1, 0);
-
-                {
-                    M6Lexicon::M6SharedLock sharedLock(mLexicon);
-
-                    for (uint32 t = 1; t < tsLexicon->Count(); ++t)
-                    {
-                        const char* w;
-                        size_t l;
-                        tsLexicon->GetString(t, w, l);
-                        remapped[t] = mLexicon.Lookup(w, l);
-                    }
-                }
-
-                {
-                    M6Lexicon::M6UniqueLock uniqueLock(mLexicon);
-
-                    for (uint32 t = 1; t < tsLexicon->Count(); ++t)
-                    {
-                        if (remapped[t] != 0)
-                            continue;
-
-                        const char* w;
-                        size_t l;
-                        tsLexicon->GetString(t, w, l);
-                        remapped[t] = mLexicon.Store(w, l);
-                    }
-                }
-
-                for (M6InputDocument* doc : docs)
-                {
-                    doc->RemapTokens(&remapped[0]);
-                    mDatabank.Store(doc);
-                }
+            M6DocSlice slice = mDocQueue.Get();
 
-                docs.clear();
-                tsLexicon.reset(new M6Lexicon);
-            }
-
-            if (text.empty())
+            if (not slice.mBlock)
                 break;
 
+            string text = GetText(*slice.mBlock, slice.mOffset, slice.mLength);
+
             M6InputDocument* doc = new M6InputDocument(mDatabank, text);
 
-            mParser->ParseDocument(doc, filename, mDbHeader);
+            mParser->ParseDocument(doc, slice.mFileName, mDbHeader);
             if (mWriteFasta)
             {
                 string fasta;
@@ -517,12 +668,12 @@ void M6Processor::ProcessDocument()
                     doc->SetFasta(fasta);
             }
 
-            doc->Tokenize(*tsLexicon, 0);
+            // the shared lexicon is safe to use from all threads
+            doc->Tokenize(mLexicon, 0);
             doc->Compress();
-            docs.push_back(doc);
-        }
 
-        assert(docs.empty());
+            StoreDocument(doc, slice.mSourceNr);
+        }
 
         mDocQueue.Put(kSentinel);
     }
@@ -535,6 +686,12 @@ void M6Processor::ProcessDocument()
 void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
     uint32 inNrOfThreads)
 {
+    if (mSourceMap != nullptr)
+    {
+        for (uint32 i = 0; i < inFiles.size(); ++i)
+            mSourceNrs[inFiles[i]] = mFirstSourceNr + i;
+    }
+
     if (inFiles.size() >= inNrOfThreads)
         mUseDocQueue = false;
     else
@@ -546,13 +703,13 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
 
     if (inFiles.size() == 1)
     {
-        M6DataSource data(inFiles.front(), inProgress);
-        for (M6DataSource::iterator i = data.begin(); i != data.end(); ++i)
-        {
-            LOG(INFO, "M6Processor: processing file %s", i->mFilename.c_str());
-            ProcessFile(i->mFilename, i->mStream);
-            LOG(INFO, "M6Processor: done processing file %s", i->mFilename.c_str());
-        }
+        SetSourceNr(inFiles.front());
+
+        // a single file is read by this thread only, let the decompression
+        // of the file and the processing of the members of an archive use
+        // the threads as well
+        M6DataSource data(inFiles.front(), inProgress, inNrOfThreads);
+        ProcessArchive(data, inFiles.front(), inNrOfThreads);
     }
     else
     {
@@ -567,7 +724,7 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
         for (fs::path& file : inFiles)
         {
             if (not (mException == std::exception_ptr()))
-                rethrow_exception(mException);
+                break;
 
             if (not fs::exists(file))
             {
@@ -575,10 +732,11 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
                 continue;
             }
 
-            mFileQueue.Put(file);
+            if (not PutUnlessError(mFileQueue, file))
+                break;
         }
 
-        mFileQueue.Put(fs::path());
+        PutUnlessError(mFileQueue, fs::path());
 
         // Now all the input files have been added to the queue.
 
@@ -587,8 +745,14 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
 
     if (mUseDocQueue)
     {
-        mDocQueue.Put(kSentinel);
+        PutUnlessError(mDocQueue, kSentinel);
         mDocThreads.join_all();
+
+        M6QueueStats stats = mDocQueue.GetStats();
+        LOG(INFO, "M6Processor: document queue, %lld documents, full %lld times (%.1fs), empty %lld times (%.1fs)",
+            static_cast<long long>(stats.mPut),
+            static_cast<long long>(stats.mFullWaits), stats.mFullWaitTime / 1e6,
+            static_cast<long long>(stats.mEmptyWaits), stats.mEmptyWaitTime / 1e6);
     }
 
     if (not (mException == std::exception_ptr()))
@@ -600,6 +764,7 @@ void M6Processor::Process(vector<fs::path>& inFiles, M6Progress& inProgress,
 M6Builder::M6Builder(const string& inDatabank)
     : mConfig(M6Config::GetEnabledDatabank(inDatabank))
     , mDatabank(nullptr)
+    , mLexicon(M6Lexicon::kConcurrentShardCount)
 {
     if (mConfig == nullptr)
         THROW(("Databank %s not known or not enabled", inDatabank.c_str()));
@@ -663,6 +828,215 @@ int64 M6Builder::Glob(boost::filesystem::path inRawDir,
      return result;
 }
 
+// --------------------------------------------------------------------
+//    For incremental updates the builder keeps a list of the source files
+//    in the databank directory, sources.txt. Each file has a number and
+//    the table in sources.map contains the source number for each document.
+
+struct M6SourceFile
+{
+    uint32            mNr;
+    int64            mSize;
+    time_t            mTime;
+    string            mChecksum;
+    string            mPath;
+};
+
+typedef vector<M6SourceFile> M6SourceFileList;
+
+namespace
+{
+
+string Checksum(const fs::path& inFile)
+{
+    fs::ifstream file(inFile, ios::binary);
+    if (not file.is_open())
+        THROW(("Could not open file %s", inFile.string().c_str()));
+
+    M6MD5 md5;
+    vector<char> buffer(1024 * 1024);
+
+    while (file.read(&buffer[0], buffer.size()) or file.gcount() > 0)
+        md5.Update(&buffer[0], static_cast<size_t>(file.gcount()));
+
+    return md5.Finalise();
+}
+
+void ReadSourceFiles(const fs::path& inDbDirectory, M6SourceFileList& outSources)
+{
+    fs::ifstream file(inDbDirectory / "sources.txt");
+
+    string line;
+    while (getline(file, line))
+    {
+        vector<string> fields;
+        ba::split(fields, line, ba::is_any_of("\t"));
+        if (fields.size() != 5)
+            continue;
+
+        M6SourceFile source = {
+            boost::lexical_cast<uint32>(fields[0]),
+            boost::lexical_cast<int64>(fields[1]),
+            boost::lexical_cast<time_t>(fields[2]),
+            fields[3],
+            fields[4]
+        };
+
+        outSources.push_back(source);
+    }
+}
+
+void WriteSourceFiles(const fs::path& inDbDirectory, const M6SourceFileList& inSources)
+{
+    {
+        fs::ofstream file(inDbDirectory / "sources.tmp", ios::trunc);
+
+        for (const M6SourceFile& source : inSources)
+            file << source.mNr << '\t' << source.mSize << '\t' << source.mTime << '\t'
+                 << source.mChecksum << '\t' << source.mPath << endl;
+
+        if (not file)
+            THROW(("Error writing source file list"));
+    }
+
+    fs::rename(inDbDirectory / "sources.tmp", inDbDirectory / "sources.txt");
+}
+
+// The source map is changed in a copy. The copy replaces sources.map right
+// after the manifest was updated, so an update that fails halfway leaves
+// the map matching the segments listed in segments.txt.
+
+fs::path CopySourceMap(const fs::path& inDbDirectory)
+{
+    fs::path result = inDbDirectory / "sources.map.tmp";
+    if (fs::exists(result))
+        fs::remove(result);
+    fs::copy_file(inDbDirectory / "sources.map", result);
+    return result;
+}
+
+void AddSourceFiles(M6SourceFileList& ioSources, const vector<fs::path>& inFiles,
+    uint32 inFirstSourceNr)
+{
+    for (uint32 i = 0; i < inFiles.size(); ++i)
+    {
+        if (not fs::exists(inFiles[i]))
+            continue;
+
+        M6SourceFile source = {
+            inFirstSourceNr + i,
+            static_cast<int64>(fs::file_size(inFiles[i])),
+            fs::last_write_time(inFiles[i]),
+            Checksum(inFiles[i]),
+            inFiles[i].string()
+        };
+
+        ioSources.push_back(source);
+    }
+}
+
+// Databanks built with another tokenizer version index other terms than
+// the queries now produce, but only for the few words that contain a
+// character with a multi-character case fold. Rebuilding every existing
+// databank for that is not worth it, so this is left to a mrs build.
+void WarnIfTokenizerIsOutdated(const fs::path& inDbDirectory, const string& inDbID)
+{
+    uint32 version = M6Databank::GetTokenizerVersion(inDbDirectory);
+
+    if (version != M6Tokenizer::kVersion)
+        LOG(WARN, "%s was built with tokenizer version %d instead of %d, words with a multi-character case fold (like U+FB01) may not be found until it is rebuilt with 'mrs build %s'",
+            inDbID.c_str(), version, M6Tokenizer::kVersion, inDbID.c_str());
+}
+
+// Segments are merged using a tiered policy. The tier of a segment is the
+// logarithm of its document count in base inMergeFactor. When the newest
+// inMergeFactor segments are in the same tier, they are replaced by one
+// segment of the next tier, which in turn may cause another merge. This
+// keeps the number of segments logarithmic in the number of documents.
+// Returns the index of the first segment to merge, or the number of
+// segments if nothing needs to be merged.
+uint32 SelectSegmentsToMerge(const M6SegmentInfoList& inSegments, uint32 inMergeFactor)
+{
+    auto tier = [inMergeFactor](uint32 inSize) -> uint32
+    {
+        uint32 result = 0;
+        while (inSize >= inMergeFactor)
+        {
+            inSize /= inMergeFactor;
+            ++result;
+        }
+        return result;
+    };
+
+    vector<uint32> sizes;
+    for (const M6SegmentInfo& segment : inSegments)
+        sizes.push_back(segment.mDocCount);
+
+    uint32 result = static_cast<uint32>(sizes.size());
+
+    while (not sizes.empty())
+    {
+        uint32 t = tier(sizes.back()), n = 0;
+        while (n < sizes.size() and tier(sizes[sizes.size() - n - 1]) == t)
+            ++n;
+
+        if (n < inMergeFactor)
+            break;
+
+        uint32 merged = accumulate(sizes.end() - n, sizes.end(), 0U);
+        sizes.erase(sizes.end() - n, sizes.end());
+        sizes.push_back(merged);
+
+        result = static_cast<uint32>(sizes.size() - 1);
+    }
+
+    return result;
+}
+
+}
+
+void M6Builder::Import(const fs::path& inPath, const string& inVersion,
+    vector<fs::path>& inFiles, int64 inRawBytes, uint32 inNrOfThreads,
+    M6File* inSourceMap, uint32 inDocBase, uint32 inFirstSourceNr)
+{
+    string dbID = mConfig->get_attribute("id");
+
+    vector<pair<string,string>> indexNames;
+    {
+        try
+        {
+            M6Parser parser(mConfig->get_attribute("parser"), mConfig->get_attribute("native-parser") == "true");
+            parser.GetIndexNames(indexNames);
+        }
+        catch (...) {}
+    }
+
+    // the memory used for sorting the full text entries, in megabytes
+    uint32 indexMemory = 1024;
+    const zx::element* builder = M6Config::GetServer()->find_first("builder");
+    if (builder != nullptr and not builder->get_attribute("memory").empty())
+        indexMemory = boost::lexical_cast<uint32>(builder->get_attribute("memory"));
+
+    mDatabank = M6Databank::CreateNew(dbID, inPath.string(), inVersion, indexNames);
+    mDatabank->StartBatchImport(mLexicon, inNrOfThreads, indexMemory);
+
+    {
+        M6Progress progress(dbID, inRawBytes + 1, "parsing");
+
+        M6Processor processor(*mDatabank, mLexicon, mConfig);
+        if (inSourceMap != nullptr)
+            processor.TrackSources(*inSourceMap, inDocBase, inFirstSourceNr);
+        processor.Process(inFiles, progress, inNrOfThreads);
+
+        mDatabank->EndBatchImport();
+    }
+
+    mDatabank->FinishBatchImport();
+
+    delete mDatabank;
+    mDatabank = nullptr;
+}
+
 void M6Builder::Build(uint32 inNrOfThreads)
 {
     string dbID = mConfig->get_attribute("id");
@@ -686,38 +1060,44 @@ void M6Builder::Build(uint32 inNrOfThreads)
         THROW(("Missing source specification for databank '%s'", dbID.c_str()));
 
     string version;
-    vector<pair<string,string>> indexNames;
     {
         try
         {
-            M6Parser parser(mConfig->get_attribute("parser"));
+            M6Parser parser(mConfig->get_attribute("parser"), mConfig->get_attribute("native-parser") == "true");
             version = parser.GetVersion(source->content());
-            parser.GetIndexNames(indexNames);
         }
         catch (...) {}
     }
 
     // TODO fetch version string?
 
-    mDatabank = M6Databank::CreateNew(dbID, path.string(), version, indexNames);
-    mDatabank->StartBatchImport(mLexicon);
-
     vector<fs::path> files;
     int64 rawBytes = Glob(M6Config::GetDirectory("raw"), source, files);
 
+    // Incremental databanks record the source file of each document and
+    // the checksums of the source files. The checksums are used to skip
+    // files that were fetched again without changing.
+    if (mConfig->get_attribute("incremental") == "true")
     {
-        M6Progress progress(dbID, rawBytes + 1, "parsing");
-
-        M6Processor processor(*mDatabank, mLexicon, mConfig);
-        processor.Process(files, progress, inNrOfThreads);
+        // Import creates the directory, the source map is opened afterwards
+        // and so the map is written to a temporary file first.
+        fs::path sourceMapPath = path.string() + ".sources";
+        if (fs::exists(sourceMapPath))
+            fs::remove(sourceMapPath);
 
-        mDatabank->EndBatchImport();
-    }
+        {
+            M6File sourceMap(sourceMapPath, eReadWrite);
+            Import(path, version, files, rawBytes, inNrOfThreads, &sourceMap, 0, 1);
+        }
 
-    mDatabank->FinishBatchImport();
+        fs::rename(sourceMapPath, path / "sources.map");
 
-    delete mDatabank;
-    mDatabank = nullptr;
+        M6SourceFileList sources;
+        AddSourceFiles(sources, files, 1);
+        WriteSourceFiles(path, sources);
+    }
+    else
+        Import(path, version, files, rawBytes, inNrOfThreads, nullptr, 0, 0);
 
     // if we created a temporary db
     if (path != dstPath)
@@ -729,6 +1109,221 @@ void M6Builder::Build(uint32 inNrOfThreads)
     cout << "done" << endl;
 }
 
+void M6Builder::Update(uint32 inNrOfThreads)
+{
+    string dbID = mConfig->get_attribute("id");
+    fs::path path = M6Config::GetDbDirectory(dbID);
+
+    if (mConfig->get_attribute("incremental") != "true" or
+        not fs::exists(path / "sources.txt") or not fs::exists(path / "sources.map"))
+    {
+        Build(inNrOfThreads);
+        return;
+    }
+
+    LOG(DEBUG,"updating %s in %d threads",dbID.c_str(),inNrOfThreads);
+
+    WarnIfTokenizerIsOutdated(path, dbID);
+
+    M6SourceFileList sources;
+    ReadSourceFiles(path, sources);
+
+    vector<fs::path> files;
+    Glob(M6Config::GetDirectory("raw"), mConfig->find_first("source"), files);
+
+    // Find out which files were added, changed or removed. Only for files
+    // whose size or modification time differ the checksum is calculated.
+    set<uint32> obsolete;
+    vector<fs::path> changed;
+    int64 rawBytes = 0;
+    uint32 nextSourceNr = 1;
+
+    map<string,M6SourceFile*> known;
+    for (M6SourceFile& source : sources)
+    {
+        known[source.mPath] = &source;
+        obsolete.insert(source.mNr);
+
+        if (nextSourceNr <= source.mNr)
+            nextSourceNr = source.mNr + 1;
+    }
+
+    for (fs::path& file : files)
+    {
+        auto i = known.find(file.string());
+        if (i != known.end())
+        {
+            M6SourceFile& source = *i->second;
+
+            int64 size = fs::file_size(file);
+            time_t time = fs::last_write_time(file);
+
+            if (size == source.mSize and (time == source.mTime or Checksum(file) == source.mChecksum))
+            {
+                source.mTime = time;
+                obsolete.erase(source.mNr);
+                continue;
+            }
+        }
+
+        changed.push_back(file);
+        rawBytes += fs::file_size(file);
+    }
+
+    if (changed.empty() and obsolete.empty())
+    {
+        WriteSourceFiles(path, sources);
+        cout << dbID << " is up-to-date" << endl;
+        return;
+    }
+
+    // the documents from changed and removed files are deleted
+    uint32 docBase;
+    {
+        M6Databank databank(path, eReadOnly);
+        docBase = databank.GetMaxDocNr();
+    }
+
+    vector<uint32> deleted;
+    {
+        M6File sourceMap(path / "sources.map", eReadOnly);
+
+        vector<uint32> sourceNrs(static_cast<size_t>(sourceMap.Size() / sizeof(uint32)));
+        if (not sourceNrs.empty())
+            sourceMap.PRead(&sourceNrs[0], sourceNrs.size() * sizeof(uint32), 0);
+
+        for (uint32 docNr = 1; docNr < sourceNrs.size() and docNr <= docBase; ++docNr)
+        {
+            if (obsolete.count(sourceNrs[docNr]))
+                deleted.push_back(docNr);
+        }
+    }
+
+    string version;
+    {
+        try
+        {
+            M6Parser parser(mConfig->get_attribute("parser"), mConfig->get_attribute("native-parser") == "true");
+            version = parser.GetVersion(mConfig->find_first("source")->content());
+        }
+        catch (...) {}
+    }
+
+    string segment = to_string(boost::uuids::random_generator()());
+    fs::create_directories(path / "segments");
+
+    fs::path sourceMapPath = CopySourceMap(path);
+    {
+        M6File sourceMap(sourceMapPath, eReadWrite);
+        Import(path / "segments" / segment, version, changed, rawBytes,
+            inNrOfThreads, &sourceMap, docBase, nextSourceNr);
+    }
+
+    M6Databank::AddSegment(path, segment, docBase, deleted);
+    fs::rename(sourceMapPath, path / "sources.map");
+
+    sources.erase(remove_if(sources.begin(), sources.end(),
+        [&obsolete](const M6SourceFile& source) -> bool { return obsolete.count(source.mNr) > 0; }),
+        sources.end());
+    AddSourceFiles(sources, changed, nextSourceNr);
+    WriteSourceFiles(path, sources);
+
+    // merging is left to Merge, it runs after the server reloaded
+    if (NeedsMerge())
+        cout << "the segments of " << dbID << " can be merged with mrs merge" << endl;
+
+    cout << "done" << endl;
+}
+
+bool M6Builder::NeedsMerge()
+{
+    fs::path path = M6Config::GetDbDirectory(mConfig->get_attribute("id"));
+
+    M6SegmentInfoList segments;
+    M6Databank::GetSegments(path, segments);
+
+    return SelectSegmentsToMerge(segments, kM6SegmentMergeFactor) < segments.size();
+}
+
+void M6Builder::Merge()
+{
+    string dbID = mConfig->get_attribute("id");
+    fs::path path = M6Config::GetDbDirectory(dbID);
+
+    if (not fs::exists(path / "segments.txt"))
+    {
+        cout << dbID << " has no segments" << endl;
+        return;
+    }
+
+    // the segments replaced by the previous merge are no longer used
+    // once the server reloaded
+    M6Databank::CollectGarbage(path);
+
+    if (NeedsMerge())
+        MergeSegments(path);
+    else
+        cout << dbID << " has no segments to merge" << endl;
+
+    cout << "done" << endl;
+}
+
+void M6Builder::MergeSegments(const fs::path& inPath)
+{
+    M6SegmentInfoList segments;
+    M6Databank::GetSegments(inPath, segments);
+
+    uint32 first = SelectSegmentsToMerge(segments, kM6SegmentMergeFactor);
+    if (first >= segments.size())
+        return;
+
+    string dbID = mConfig->get_attribute("id");
+    LOG(INFO, "%s: merging %d segments", dbID.c_str(), segments.size() - first);
+
+    vector<string> merged;
+    for (uint32 s = first; s < segments.size(); ++s)
+        merged.push_back(segments[s].mName);
+
+    // the documents of the new segment are numbered after the last segment
+    uint32 docBase = segments.back().mDocBase + segments.back().mDocCount;
+    string segment = to_string(boost::uuids::random_generator()());
+
+    vector<uint32> docMap;
+    M6Databank::CreateMergedSegment(inPath, dbID, merged, segment, docMap);
+
+    // the source numbers move along with the documents, the source files
+    // themselves are unchanged.
+    fs::path sourceMapPath = CopySourceMap(inPath);
+    {
+        M6File sourceMap(sourceMapPath, eReadWrite);
+
+        vector<uint32> sourceNrs(static_cast<size_t>(sourceMap.Size() / sizeof(uint32)));
+        if (not sourceNrs.empty())
+            sourceMap.PRead(&sourceNrs[0], sourceNrs.size() * sizeof(uint32), 0);
+
+        uint32 last = docBase + *max_element(docMap.begin(), docMap.end());
+        if (sourceNrs.size() <= last)
+            sourceNrs.resize(last + 1, 0);
+
+        for (uint32 s = first; s < segments.size(); ++s)
+        {
+            for (uint32 docNr = segments[s].mDocBase + 1;
+                 docNr <= segments[s].mDocBase + segments[s].mDocCount;
+                 ++docNr)
+            {
+                if (docMap[docNr] != 0)
+                    sourceNrs[docBase + docMap[docNr]] = sourceNrs[docNr];
+                sourceNrs[docNr] = 0;
+            }
+        }
+
+        sourceMap.PWrite(&sourceNrs[0], sourceNrs.size() * sizeof(uint32), 0);
+    }
+
+    M6Databank::MergeSegments(inPath, merged, segment, docBase);
+    fs::rename(sourceMapPath, inPath / "sources.map");
+}
+
 void M6Builder::IndexDocument(const std::string& inDatabankID, M6Databank* inDatabank,
     const string& inText, const string& inFileName,
     vector<string>& outTerms)
@@ -754,7 +1349,33 @@ bool M6Builder::NeedsUpdate()
     bool result = true;
 
     fs::path path = M6Config::GetDbDirectory(mConfig->get_attribute("id"));
-    if (fs::exists(path))
+    if (fs::exists(path / "sources.txt"))
+    {
+        // compare with the recorded source files
+        M6SourceFileList sources;
+        ReadSourceFiles(path, sources);
+
+        vector<fs::path> files;
+        Glob(M6Config::GetDirectory("raw"), mConfig->find_first("source"), files);
+
+        result = files.size() != sources.size();
+
+        map<string,M6SourceFile*> known;
+        for (M6SourceFile& source : sources)
+            known[source.mPath] = &source;
+
+        for (auto file = files.begin(); result == false and file != files.end(); ++file)
+        {
+            auto i = known.find(file->string());
+            result = i == known.end() or
+                i->second->mSize != static_cast<int64>(fs::file_size(*file)) or
+                i->second->mTime != fs::last_write_time(*file);
+
+            if (result and VERBOSE)
+                cerr << "Needs update because " << *file << " was added or changed" << endl;
+        }
+    }
+    else if (fs::exists(path))
     {
         result = false;
 
@@ -865,6 +1486,8 @@ void M6Scheduler::Run()
         start += hours(24);
     time_iterator update(start, hours(24));        // daily
     bool writeNextUpdateTime = true, reload = false;
+    map<string,ptime> nextCheck;
+    vector<string> updated;        // incremental databanks to merge after the reload
 
     OpenBuildLog();
 
@@ -880,6 +1503,23 @@ void M6Scheduler::Run()
         {
             M6SignalCatcher::Signal(SIGHUP);
             reload = false;
+
+            // The segments are merged once the server uses the new ones,
+            // the segments replaced by a merge are removed by the next one.
+            for (const string& id : updated)
+            {
+                try
+                {
+                    if (M6Builder(id).NeedsMerge())
+                        Schedule(id, "merge");
+                }
+                catch (exception& e)
+                {
+                    *mLogFile << "Error checking " << id << " for segments to merge:" << endl
+                         << e.what() << endl;
+                }
+            }
+            updated.clear();
         }
 
         boost::this_thread::sleep(boost::posix_time::seconds(5));
@@ -917,6 +1557,50 @@ void M6Scheduler::Run()
                 }
             }
 
+            // Incremental databanks can be checked for new source files every
+            // few minutes, an update then only adds a small segment.
+            for (zx::element* db : M6Config::GetDatabanks())
+            {
+                if (db->get_attribute("enabled") != "true" or
+                    db->get_attribute("incremental") != "true" or
+                    db->get_attribute("interval").empty())
+                    continue;
+
+                string id = db->get_attribute("id");
+                if (nextCheck.count(id) and nextCheck[id] > now)
+                    continue;
+
+                // a problem with one databank should not stop the others
+                try
+                {
+                    uint32 interval = boost::lexical_cast<uint32>(db->get_attribute("interval"));
+                    if (interval == 0)
+                    {
+                        nextCheck[id] = ptime(pos_infin);
+                        continue;
+                    }
+
+                    nextCheck[id] = now + minutes(interval);
+
+                    if (M6Builder(id).NeedsUpdate())
+                        Schedule(id);
+                }
+                catch (boost::bad_lexical_cast&)
+                {
+                    nextCheck[id] = ptime(pos_infin);
+
+                    M6Status::Instance().SetError(id, "invalid interval");
+                    *mLogFile << "Invalid interval '" << db->get_attribute("interval")
+                         << "' for " << id << ", expected a number of minutes" << endl;
+                }
+                catch (exception& e)
+                {
+                    M6Status::Instance().SetError(id, e.what());
+                    *mLogFile << "Error checking " << id << " for updates:" << endl
+                         << e.what() << endl;
+                }
+            }
+
             for (;;)
             {
                 databank.clear();
@@ -950,7 +1634,13 @@ void M6Scheduler::Run()
                 int r = ForkExec(args, 0, in, *mLogFile, *mLogFile);
 
                 if (r == 0)
+                {
                     reload = true;    // signal to reload databanks
+
+                    if (action == "update" and
+                        M6Config::GetDatabankParam(databank, "@incremental") == "true")
+                        updated.push_back(databank);
+                }
                 else
                     *mLogFile << action << " of " << databank << " returned: " << r << endl;
 
@@ -16,6 +16,7 @@
 #include "M6Lexicon.h"
 
 class M6Databank;
+class M6File;
 
 class M6Builder
 {
@@ -25,8 +26,20 @@ class M6Builder
 
     void                Build(uint32 inNrOfThreads);
 
+    // Update only parses the source files that were added or changed since
+    // the last build and stores their documents in a new segment. Falls back
+    // to Build for databanks that are not incremental.
+    void                Update(uint32 inNrOfThreads);
+
     bool                NeedsUpdate();
 
+    // Merge replaces the newest segments of an incremental databank by one
+    // segment when the merge policy says so. It runs apart from Update, as
+    // mrs merge, and the scheduler runs it after the server reloaded. The
+    // segments replaced by the previous merge are removed first.
+    void                Merge();
+    bool                NeedsMerge();
+
     static void            IndexDocument(const std::string& inDatabankID,
                             M6Databank* inDatabank,
                             const std::string& inText,
@@ -41,6 +54,20 @@ class M6Builder
 
     void                Parse(const boost::filesystem::path& inFile);
 
+    void                Import(const boost::filesystem::path& inPath,
+                            const std::string& inVersion,
+                            std::vector<boost::filesystem::path>& inFiles,
+                            int64 inRawBytes, uint32 inNrOfThreads,
+                            M6File* inSourceMap, uint32 inDocBase,
+                            uint32 inFirstSourceNr);
+
+    // Replace the newest segments by one new segment when the merge policy
+    // says so. Deleted documents are dropped from the new segment.
+    void                MergeSegments(const boost::filesystem::path& inPath);
+
+    // the number of segments of about the same size that are merged
+    static const uint32    kM6SegmentMergeFactor = 4;
+
     const zeep::xml::element*
                         mConfig;
     M6Databank*            mDatabank;
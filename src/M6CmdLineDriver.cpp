@@ -586,11 +586,16 @@ int M6BuildDriver::Exec(const string& inCommand, po::variables_map& vm)
 
             M6Builder builder(databank);
 
-            if (inCommand == "build" or builder.NeedsUpdate())
+            if (inCommand == "merge" or inCommand == "build" or builder.NeedsUpdate())
             {
                 try
                 {
-                    builder.Build(nrOfThreads);
+                    if (inCommand == "merge")
+                        builder.Merge();
+                    else if (inCommand == "build")
+                        builder.Build(nrOfThreads);
+                    else
+                        builder.Update(nrOfThreads);
                 }
                 catch (exception& e)
                 {
@@ -868,7 +873,8 @@ int M6VacuumDriver::Exec(const string& inCommand, po::variables_map& vm)
 
     M6Databank db(path.string(), eReadWrite);
 
-    db.Vacuum();
+    int64 reclaimed = db.Vacuum();
+    cout << vm["databank"].as<string>() << ": reclaimed " << reclaimed << " bytes" << endl;
 
     return 0;
 }
@@ -1061,6 +1067,7 @@ int main(int argc, char* argv[])
         M6CmdLineDriver::Register<M6EntryDriver>    ("entry",    "Retrieve and print an entry");
         M6CmdLineDriver::Register<M6FetchDriver>    ("fetch",    "Fetch/mirror remote data for a databank");
         M6CmdLineDriver::Register<M6InfoDriver>        ("info",    "Display information and statistics for a databank");
+        M6CmdLineDriver::Register<M6BuildDriver>    ("merge",    "Merge the segments of an incremental databank");
         M6CmdLineDriver::Register<M6QueryDriver>    ("query",    "Perform a search in a databank");
         M6CmdLineDriver::Register<M6ServerDriver>    ("server",    "Start or Stop a server session, or query the status");
         M6CmdLineDriver::Register<M6VacuumDriver>    ("vacuum",    "Clean up a databank reclaiming unused disk space");
@@ -18,12 +18,19 @@
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include "M6DataSource.h"
 #include "M6Error.h"
 #include "M6Progress.h"
 #include "M6File.h"
 #include "M6Exec.h"
+#include "M6Log.h"
+#include "M6ParallelDecompressor.h"
+#include "M6Queue.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -111,7 +118,8 @@ struct M6DataSourceImpl
                     Next() = 0;
 
     static M6DataSourceImpl*
-                    Create(const fs::path& inFile, M6Progress& inProgress);
+                    Create(const fs::path& inFile, M6Progress& inProgress,
+                        uint32 inNrOfThreads);
 
     M6Progress&        mProgress;
 };
@@ -169,32 +177,248 @@ M6DataSource::iterator& M6DataSource::iterator::operator++()
 namespace
 {
 
+// m6file_device reads the file in large blocks on a thread of its own,
+// running at most two blocks ahead of the reader. Pages that have been read
+// are dropped from the page cache, scanning the raw files should not push
+// out the pages of the indices on a host that serves databanks.
+// Files smaller than kReadAheadThreshold are simply read in place, the
+// pages read are dropped when the device is closed.
+
+const size_t
+    kReadAheadBlockSize = 8 * 1024 * 1024,
+    kReadAheadThreshold = 2 * kReadAheadBlockSize;
+
+struct m6file_device_impl
+{
+                m6file_device_impl(const fs::path& inFile, M6Progress& inProgress);
+                ~m6file_device_impl();
+
+    streamsize    read(char* s, streamsize n);
+
+  private:
+                m6file_device_impl(const m6file_device_impl&);
+    m6file_device_impl&
+                operator=(const m6file_device_impl&);
+
+    void        ReadAhead();
+
+    struct block
+    {
+        vector<char>    mData;
+        size_t            mSize;
+        bool            mFull;
+    };
+
+    M6File        mFile;
+    string        mFileName;
+    int64        mSize;
+    M6Progress&    mProgress;
+    bool        mReadAhead;
+
+    block        mBlock[2];
+    uint32        mCurrent;
+    size_t        mOffset;
+    bool        mDone, mStop;
+    exception_ptr
+                mError;
+
+    boost::mutex
+                mMutex;
+    boost::condition_variable
+                mCondition;
+    boost::thread
+                mThread;
+
+    // statistics, times are in microseconds
+    boost::posix_time::ptime
+                mStart;
+    int64        mRead;
+    int64        mReaderWaits, mReaderWaitTime;
+    int64        mReadAheadWaits, mReadAheadWaitTime;
+};
+
+m6file_device_impl::m6file_device_impl(const fs::path& inFile, M6Progress& inProgress)
+    : mFile(inFile, eReadOnly), mFileName(inFile.filename().string())
+    , mSize(fs::file_size(inFile)), mProgress(inProgress)
+    , mReadAhead(mSize >= static_cast<int64>(kReadAheadThreshold))
+    , mCurrent(0), mOffset(0), mDone(false), mStop(false)
+    , mStart(boost::posix_time::microsec_clock::universal_time())
+    , mRead(0), mReaderWaits(0), mReaderWaitTime(0)
+    , mReadAheadWaits(0), mReadAheadWaitTime(0)
+{
+    mFile.Advise(0, 0, eSequentialAccess);
+
+    for (block& b : mBlock)
+    {
+        b.mSize = 0;
+        b.mFull = false;
+    }
+
+    if (mReadAhead)
+        mThread = boost::thread([this]() { this->ReadAhead(); });
+}
+
+m6file_device_impl::~m6file_device_impl()
+{
+    if (not mReadAhead)
+    {
+        mFile.Advise(0, mRead, eDontNeed);
+        return;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        mStop = true;
+        mCondition.notify_all();
+    }
+
+    mThread.join();
+
+    double seconds = (boost::posix_time::microsec_clock::universal_time() - mStart).total_microseconds() / 1e6;
+    LOG(DEBUG, "m6file_device: read %lld bytes of %s at %.1f MB/s, reader waited %lld times (%.1fs), read ahead waited %lld times (%.1fs)",
+        static_cast<long long>(mRead), mFileName.c_str(),
+        seconds > 0 ? mRead / seconds / (1024 * 1024) : 0.0,
+        static_cast<long long>(mReaderWaits), mReaderWaitTime / 1e6,
+        static_cast<long long>(mReadAheadWaits), mReadAheadWaitTime / 1e6);
+}
+
+void m6file_device_impl::ReadAhead()
+{
+    try
+    {
+        uint32 next = 0;
+
+        for (int64 offset = 0; offset < mSize; )
+        {
+            block& b = mBlock[next];
+
+            {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+
+                if (b.mFull and not mStop)
+                {
+                    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+                    while (b.mFull and not mStop)
+                        mCondition.wait(lock);
+
+                    mReadAheadWaits += 1;
+                    mReadAheadWaitTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+                }
+
+                if (mStop)
+                    break;
+            }
+
+            size_t n = static_cast<size_t>(min<int64>(kReadAheadBlockSize, mSize - offset));
+            if (b.mData.size() < n)
+                b.mData.resize(n);
+
+            mFile.PRead(&b.mData[0], n, offset);
+            mFile.Advise(offset, n, eDontNeed);
+            offset += n;
+
+            boost::lock_guard<boost::mutex> lock(mMutex);
+            b.mSize = n;
+            b.mFull = true;
+            mCondition.notify_all();
+
+            next = 1 - next;
+        }
+    }
+    catch (...)
+    {
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        mError = current_exception();
+    }
+
+    boost::lock_guard<boost::mutex> lock(mMutex);
+    mDone = true;
+    mCondition.notify_all();
+}
+
+streamsize m6file_device_impl::read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    if (not mReadAhead)
+    {
+        result = static_cast<streamsize>(min<int64>(n, mSize - mRead));
+        if (result <= 0)
+            return -1;
+
+        mFile.PRead(s, result, mRead);
+
+        mRead += result;
+        mProgress.Consumed(result);
+        return result;
+    }
+
+    while (result < n)
+    {
+        block& b = mBlock[mCurrent];
+
+        if (mOffset == 0)
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+
+            if (not b.mFull and not mDone)
+            {
+                boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+                while (not b.mFull and not mDone)
+                    mCondition.wait(lock);
+
+                mReaderWaits += 1;
+                mReaderWaitTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+            }
+
+            if (not b.mFull)
+            {
+                if (mError != exception_ptr())
+                    rethrow_exception(mError);
+                break;
+            }
+        }
+
+        size_t k = static_cast<size_t>(min<streamsize>(n - result, b.mSize - mOffset));
+        memcpy(s + result, &b.mData[mOffset], k);
+
+        result += k;
+        mOffset += k;
+
+        if (mOffset == b.mSize)
+        {
+            boost::lock_guard<boost::mutex> lock(mMutex);
+            b.mFull = false;
+            mCondition.notify_all();
+
+            mCurrent = 1 - mCurrent;
+            mOffset = 0;
+        }
+    }
+
+    if (result > 0)
+    {
+        mRead += result;
+        mProgress.Consumed(result);
+    }
+
+    return result > 0 ? result : -1;
+}
+
 struct m6file_device : public io::source
 {
     typedef char            char_type;
     typedef io::source_tag    category;
 
                 m6file_device(const fs::path inFile, M6Progress& inProgress)
-                    : mFile(inFile, eReadOnly), mSize(fs::file_size(inFile)), mProgress(inProgress) {}
+                    : mImpl(new m6file_device_impl(inFile, inProgress)) {}
 
-    streamsize    read(char* s, streamsize n)
-                {
-                    if (n > mSize)
-                        n = mSize;
-                    if (n > 0)
-                    {
-                        mFile.Read(s, n);
-                        mProgress.Consumed(n);
-                        mSize -= n;
-                    }
-                    else
-                        n = -1;
-                    return n;
-                }
+    streamsize    read(char* s, streamsize n)            { return mImpl->read(s, n); }
 
-    M6File        mFile;
-    streamsize    mSize;
-    M6Progress&    mProgress;
+    shared_ptr<m6file_device_impl>
+                mImpl;
 };
 
 }
@@ -205,14 +429,16 @@ struct M6PlainTextDataSourceImpl : public M6DataSourceImpl
 {
     typedef M6DataSource::M6DataFile M6DataFile;
 
-                            M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress);
+                            M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress,
+                                uint32 inNrOfThreads);
 
     virtual M6DataFile*        Next()    { return mNext.release(); }
 
     unique_ptr<M6DataFile>    mNext;
 };
 
-M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress)
+M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6Progress& inProgress,
+        uint32 inNrOfThreads)
     : M6DataSourceImpl(inProgress)
 {
     if (not inFile.empty())
@@ -220,14 +446,19 @@ M6PlainTextDataSourceImpl::M6PlainTextDataSourceImpl(const fs::path& inFile, M6P
         mNext.reset(new M6DataSource::M6DataFile);
         mNext->mFilename = inFile.filename().string();
 
-        if (inFile.extension() == ".gz")
-            mNext->mStream.push(io::gzip_decompressor());
-        else if (inFile.extension() == ".bz2")
-            mNext->mStream.push(io::bzip2_decompressor());
-        else if (inFile.extension() == ".Z")
-            mNext->mStream.push(compress_decompressor());
-
-        mNext->mStream.push(m6file_device(inFile, mProgress));
+        if (inNrOfThreads > 1 and (inFile.extension() == ".gz" or inFile.extension() == ".bz2"))
+            mNext->mStream.push(M6ParallelDecompressor(inFile, mProgress, inNrOfThreads));
+        else
+        {
+            if (inFile.extension() == ".gz")
+                mNext->mStream.push(io::gzip_decompressor());
+            else if (inFile.extension() == ".bz2")
+                mNext->mStream.push(io::bzip2_decompressor());
+            else if (inFile.extension() == ".Z")
+                mNext->mStream.push(compress_decompressor());
+
+            mNext->mStream.push(m6file_device(inFile, mProgress));
+        }
 
         mProgress.Message(inFile.filename().string());
     }
@@ -241,7 +472,8 @@ struct M6TarDataSourceImpl : public M6DataSourceImpl
     typedef M6DataSource::M6DataFile M6DataFile;
     typedef M6DataSource::istream_type istream_type;
 
-                        M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress);
+                        M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress,
+                            uint32 inNrOfThreads);
                         ~M6TarDataSourceImpl();
 
     struct device : public io::source
@@ -291,17 +523,26 @@ struct M6TarDataSourceImpl : public M6DataSourceImpl
     M6Progress&        mProgress;
 };
 
-M6TarDataSourceImpl::M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress)
+M6TarDataSourceImpl::M6TarDataSourceImpl(const fs::path& inArchive, M6Progress& inProgress,
+        uint32 inNrOfThreads)
     : M6DataSourceImpl(inProgress), mProgress(inProgress)
 {
-    if (inArchive.extension() == ".gz" or inArchive.extension() == ".tgz")
-        mStream.push(io::gzip_decompressor());
-    else if (inArchive.extension() == ".bz2" or inArchive.extension() == ".tbz")
-        mStream.push(io::bzip2_decompressor());
-    else if (inArchive.extension() == ".Z")
-        mStream.push(compress_decompressor());
-
-    mStream.push(m6file_device(inArchive, inProgress));
+    bool gzip = inArchive.extension() == ".gz" or inArchive.extension() == ".tgz";
+    bool bzip2 = inArchive.extension() == ".bz2" or inArchive.extension() == ".tbz";
+
+    if (inNrOfThreads > 1 and (gzip or bzip2))
+        mStream.push(M6ParallelDecompressor(inArchive, inProgress, inNrOfThreads));
+    else
+    {
+        if (gzip)
+            mStream.push(io::gzip_decompressor());
+        else if (bzip2)
+            mStream.push(io::bzip2_decompressor());
+        else if (inArchive.extension() == ".Z")
+            mStream.push(compress_decompressor());
+
+        mStream.push(m6file_device(inArchive, inProgress));
+    }
 }
 
 M6TarDataSourceImpl::~M6TarDataSourceImpl()
@@ -387,6 +628,7 @@ M6TarDataSourceImpl::M6DataFile* M6TarDataSourceImpl::Next()
             result = new M6DataFile;
             result->mFilename = fs::path(filename).filename().string();
             result->mStream.push(device(mStream, fileSize, mProgress));
+            result->mSize = fileSize;
 
             mProgress.Message(result->mFilename);
 
@@ -399,7 +641,8 @@ M6TarDataSourceImpl::M6DataFile* M6TarDataSourceImpl::Next()
 
 // --------------------------------------------------------------------
 
-M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& inProgress)
+M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& inProgress,
+    uint32 inNrOfThreads)
 {
     M6DataSourceImpl* result = nullptr;
 
@@ -414,10 +657,10 @@ M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& i
             ba::ends_with(name, ".tar.bz2") or
             ba::ends_with(name, ".tar.Z"))
         {
-            result = new M6TarDataSourceImpl(inFile, inProgress);
+            result = new M6TarDataSourceImpl(inFile, inProgress, inNrOfThreads);
         }
         else
-            result = new M6PlainTextDataSourceImpl(inFile, inProgress);
+            result = new M6PlainTextDataSourceImpl(inFile, inProgress, inNrOfThreads);
     }
 
     return result;
@@ -425,8 +668,9 @@ M6DataSourceImpl* M6DataSourceImpl::Create(const fs::path& inFile, M6Progress& i
 
 // --------------------------------------------------------------------
 
-M6DataSource::M6DataSource(const fs::path& inFile, M6Progress& inProgress)
-    : mImpl(M6DataSourceImpl::Create(inFile, inProgress))
+M6DataSource::M6DataSource(const fs::path& inFile, M6Progress& inProgress,
+        uint32 inNrOfThreads)
+    : mImpl(M6DataSourceImpl::Create(inFile, inProgress, inNrOfThreads))
 {
 }
 
@@ -435,4 +679,130 @@ M6DataSource::~M6DataSource()
     delete mImpl;
 }
 
+// --------------------------------------------------------------------
+//    The members of an archive are read on the calling thread and put in
+//    a queue for the pool. After an error the threads are interrupted and
+//    the reader stops waiting for room in the queue.
+
+namespace
+{
+
+struct M6ArchiveMember
+{
+    string                    mFileName;
+    shared_ptr<const string>    mText;
+};
+
+typedef M6Queue<M6ArchiveMember,32>    M6MemberQueue;
+
+}
+
+void M6ProcessArchive(M6DataSource& inArchive, uint32 inNrOfThreads, int64 inMaxMemberSize,
+    M6MemberHandler inHandler, function<void()> inThreadInit)
+{
+    M6MemberQueue queue;
+    boost::thread_group threads;
+    boost::mutex mutex;
+    exception_ptr error;
+    atomic<bool> failed(false);
+
+    auto fail = [&](exception_ptr e)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (error == exception_ptr())
+        {
+            error = e;
+            failed = true;
+            threads.interrupt_all();
+        }
+    };
+
+    // the consumers may have been interrupted, waiting for room would never end
+    auto put = [&](M6ArchiveMember& inMember) -> bool
+    {
+        while (not queue.TimedPut(inMember, boost::posix_time::milliseconds(100)))
+        {
+            if (failed)
+                return false;
+        }
+        return true;
+    };
+
+    auto process = [&]()
+    {
+        try
+        {
+            if (inThreadInit)
+                inThreadInit();
+
+            for (;;)
+            {
+                M6ArchiveMember member = queue.Get();
+                if (not member.mText)
+                    break;
+
+                io::stream<io::array_source> in(member.mText->data(), member.mText->length());
+                inHandler(member.mFileName, in);
+            }
+
+            // pass the sentinel on to the next thread
+            queue.Put(M6ArchiveMember());
+        }
+        catch (boost::thread_interrupted&)
+        {
+        }
+        catch (...)
+        {
+            fail(current_exception());
+        }
+    };
+
+    bool started = false;
+
+    try
+    {
+        for (M6DataSource::iterator i = inArchive.begin(); i != inArchive.end() and not failed; ++i)
+        {
+            if (inNrOfThreads <= 1 or i->mSize < 0 or i->mSize > inMaxMemberSize)
+            {
+                inHandler(i->mFilename, i->mStream);
+                continue;
+            }
+
+            // the threads are started for the first member that is read in memory
+            if (not started)
+            {
+                for (uint32 t = 0; t < inNrOfThreads; ++t)
+                    threads.create_thread(process);
+                started = true;
+            }
+
+            shared_ptr<string> text(new string(static_cast<size_t>(i->mSize), 0));
+            if (i->mSize > 0)
+            {
+                i->mStream.read(&(*text)[0], i->mSize);
+                text->resize(static_cast<size_t>(i->mStream.gcount()));
+            }
+
+            M6ArchiveMember member = { i->mFilename, text };
+            if (not put(member))
+                break;
+        }
+    }
+    catch (...)
+    {
+        fail(current_exception());
+    }
+
+    if (started)
+    {
+        M6ArchiveMember sentinel;
+        put(sentinel);
+        threads.join_all();
+    }
+
+    if (not (error == exception_ptr()))
+        rethrow_exception(error);
+}
+
 #include "M6Decompress.ipp"
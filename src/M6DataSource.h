@@ -6,6 +6,7 @@
 #pragma once
 
 #include <istream>
+#include <functional>
 #include <boost/filesystem/path.hpp>
 
 class M6Progress;
@@ -17,16 +18,19 @@ struct M6DataSource
   public:
     typedef boost::iostreams::filtering_stream<boost::iostreams::input> istream_type;
 
+                        // compressed files are decompressed by inNrOfThreads
+                        // threads, see M6ParallelDecompressor
                         M6DataSource(const boost::filesystem::path& inFile,
-                            M6Progress& inProgress);
+                            M6Progress& inProgress, uint32 inNrOfThreads = 1);
     virtual                ~M6DataSource();
 
     struct M6DataFile
     {
-                        M6DataFile() : mRefCount(1) {}
+                        M6DataFile() : mSize(-1), mRefCount(1) {}
 
         std::string        mFilename;
         istream_type    mStream;
+        int64            mSize;        // size of the contents, -1 if not known in advance
         uint32            mRefCount;
     };
 
@@ -65,3 +69,17 @@ struct M6DataSource
   private:
     M6DataSourceImpl*    mImpl;
 };
+
+// M6ProcessArchive passes each member of inArchive to inHandler. Members of
+// at most inMaxMemberSize bytes are read in memory on the calling thread
+// and handled by a pool of inNrOfThreads threads. Larger members, and those
+// of unknown size, are handled on the calling thread while they are read.
+// Each thread of the pool calls inThreadInit before handling a member.
+// The first exception thrown by the archive or by a handler stops the
+// reading and the threads, it is rethrown once the threads are joined.
+
+typedef std::function<void(const std::string& inFileName, std::istream& inStream)>
+    M6MemberHandler;
+
+void M6ProcessArchive(M6DataSource& inArchive, uint32 inNrOfThreads, int64 inMaxMemberSize,
+    M6MemberHandler inHandler, std::function<void()> inThreadInit = std::function<void()>());
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <iterator>
 #include <numeric>
+#include <atomic>
 
 #include <boost/array.hpp>
 #include <boost/filesystem.hpp>
@@ -35,6 +36,7 @@
 #include "M6Index.h"
 #include "M6Progress.h"
 #include "M6Queue.h"
+#include "M6Log.h"
 #include "M6Query.h"
 #include "M6Iterator.h"
 #include "M6Dictionary.h"
@@ -86,6 +88,111 @@ void unlock_memory(void* ptr, size_t size)
 #    error "Implement mlock for this OS"
 #endif
 
+// --------------------------------------------------------------------
+//    The fasta file written during batch import is accompanied by a table
+//    with the location of the fasta for each document, indexed by docNr.
+//    Documents without fasta have an empty entry.
+
+struct M6FastaOffset
+{
+    int64            mOffset;
+    int64            mSize;
+};
+
+BOOST_STATIC_ASSERT(sizeof(M6FastaOffset) == 16);
+
+// the offsets are collected and written to fasta.offsets in blocks
+const uint32 kFastaOffsetBlockSize = 4096;
+
+// --------------------------------------------------------------------
+//    A databank can consist of a base and a number of segments, each
+//    segment a databank of its own holding the documents of updated source
+//    files. Document numbers in a segment are offset by the document base
+//    of that segment. Documents that were superseded by a later segment are
+//    marked in a deleted bitmap, indexed by the global document number.
+
+class M6SegmentIterator : public M6Iterator
+{
+  public:
+                    M6SegmentIterator(M6Iterator* inIter, uint32 inDocBase,
+                        const vector<bool>& inDeleted)
+                        : mIter(inIter), mDocBase(inDocBase), mDeleted(inDeleted)
+                    {
+                        mCount = mIter->GetCount();
+                        mRanked = mIter->IsRanked();
+                    }
+
+                    ~M6SegmentIterator()                    { delete mIter; }
+
+    virtual bool    Next(uint32& outDoc, float& outRank)
+                    {
+                        bool result;
+                        while ((result = mIter->Next(outDoc, outRank)) == true)
+                        {
+                            outDoc += mDocBase;
+                            if (outDoc >= mDeleted.size() or not mDeleted[outDoc])
+                                break;
+                        }
+                        return result;
+                    }
+
+  private:
+    M6Iterator*        mIter;
+    uint32            mDocBase;
+    const vector<bool>&
+                    mDeleted;
+};
+
+// --------------------------------------------------------------------
+//    Throughput counters for the store and index stages of a batch import.
+//    Time is split in busy, starved (waiting for input) and blocked
+//    (waiting for the next stage) to see where the pipeline stalls.
+
+struct M6StageCounter
+{
+                    M6StageCounter() { Reset(0); }
+
+    void            Reset(uint32 inThreads)
+                    {
+                        mThreads = inThreads;
+                        mDocuments = mBytes = mBusy = mStarved = mBlocked = 0;
+                    }
+
+    static int64    Elapsed(boost::posix_time::ptime& ioStart)
+                    {
+                        boost::posix_time::ptime now =
+                            boost::posix_time::microsec_clock::universal_time();
+                        int64 result = (now - ioStart).total_microseconds();
+                        ioStart = now;
+                        return result;
+                    }
+
+    void            Report(const string& inDatabank, const char* inStage) const;
+
+    uint32            mThreads;
+    atomic<int64>    mDocuments, mBytes;
+    atomic<int64>    mBusy, mStarved, mBlocked;    // in microseconds
+};
+
+void M6StageCounter::Report(const string& inDatabank, const char* inStage) const
+{
+    double busy = mBusy / 1e6;
+
+    LOG(INFO, "%s: %s stage, %d threads, %lld documents, %lld bytes, %.1f docs/s, busy %.1fs, starved %.1fs, blocked %.1fs",
+        inDatabank.c_str(), inStage, mThreads,
+        static_cast<long long>(mDocuments), static_cast<long long>(mBytes),
+        busy > 0 ? mDocuments * mThreads / busy : 0.0,
+        busy, mStarved / 1e6, mBlocked / 1e6);
+}
+
+void ReportQueue(const string& inDatabank, const char* inQueue, const M6QueueStats& inStats)
+{
+    LOG(INFO, "%s: %s queue, %lld items, full %lld times (%.1fs), empty %lld times (%.1fs)",
+        inDatabank.c_str(), inQueue, static_cast<long long>(inStats.mPut),
+        static_cast<long long>(inStats.mFullWaits), inStats.mFullWaitTime / 1e6,
+        static_cast<long long>(inStats.mEmptyWaits), inStats.mEmptyWaitTime / 1e6);
+}
+
 // --------------------------------------------------------------------
 
 class M6DatabankImpl
@@ -104,13 +211,16 @@ class M6DatabankImpl
     string            GetID() const                        { return mID; }
     string            GetUUID() const                        { return mUUID; }
 
-    void            StartBatchImport(M6Lexicon& inLexicon);
+    void            StartBatchImport(M6Lexicon& inLexicon, uint32 inNrOfThreads,
+                        uint32 inIndexMemory);
     void            EndBatchImport();
     void            FinishBatchImport();
 
     void            Store(M6Document* inDocument);
 
     M6Document*        Fetch(uint32 inDocNr);
+    bool            Exists(uint32 inDocNr);
+    bool            GetFasta(uint32 inDocNr, string& outFasta);
     M6Iterator*        Find(const string& inQuery, bool inAllTermsRequired, uint32 inReportLimit);
     M6Iterator*     FindBoolean(const string& inQuery, uint32 inReportLimit);
     M6Iterator*        Find(const vector<string>& inQueryTerms,
@@ -118,6 +228,7 @@ class M6DatabankImpl
     M6Iterator*        Find(const string& inIndex, const string& inTerm, M6QueryOperator inOperator);
     M6Iterator*     Find(const string& inIndex, const string& inLowerBound, const string& inUpperBound);
     M6Iterator*        FindPattern(const string& inIndex, const string& inPattern);
+    M6Iterator*        FindAll();
     M6Iterator*        FindString(const string& inIndex, const string& inString);
     tuple<bool,uint32>
                     Exists(const string& inIndex, const string& inValue);
@@ -138,6 +249,10 @@ class M6DatabankImpl
     M6DocStore&        GetDocStore()                        { return *mStore; }
     uint32            GetMaxDocNr() const                 { return mStore->GetMaxDocNr(); }
 
+    // size and last document number including all segments
+    uint32            size() const;
+    uint32            GetLastDocNr() const;
+
     M6BasicIndexPtr    GetIndex(const string& inName);
     M6BasicIndexPtr    GetIndex(const string& inName, M6IndexType inType);
     M6BasicIndexPtr    CreateIndex(const string& inName, M6IndexType inType);
@@ -146,16 +261,47 @@ class M6DatabankImpl
 
     void            RecalculateDocumentWeights();
     void            CreateDictionary();
-    void            Vacuum();
+    int64            Vacuum();
 
     void            Validate();
     void            DumpIndex(const string& inIndex, ostream& inStream);
 
+    // Fill this new databank with the documents and index entries of
+    // inSegments, see M6Databank::CreateMergedSegment
+    void            Merge(const vector<M6Databank*>& inSegments,
+                        const vector<vector<uint32>>& inDocMaps);
+
     void            StoreThread();
+    void            StoreFasta(uint32 inDocNr, const string& inFasta);
+    void            FlushFastaOffsets();
     void            IndexThread();
 
   protected:
 
+    void            StopBatchThreads();
+    void            SetException(exception_ptr inException);
+
+    // When a databank has segments, inIDF holds the IDF of the query terms
+    // over the base and all segments together. Documents marked in
+    // inDeleted, after adding inDocBase, are neither counted nor returned.
+    M6Iterator*        FindInSegment(const vector<string>& inQueryTerms,
+                        M6Iterator* inFilter, bool inAllTermsRequired, uint32 inReportLimit,
+                        const map<string,float>* inIDF = nullptr, uint32 inDocBase = 0,
+                        const vector<bool>* inDeleted = nullptr);
+
+    void            LoadSegments();
+    bool            HasSegments() const                    { return not (mSegments.empty() and mDeleted.empty()); }
+    M6Iterator*        CombineSegments(M6Iterator* inIter,
+                        function<M6Iterator*(M6Databank&)> inFind);
+    M6Iterator*        FilterDeleted(M6Iterator* inIter);
+
+    struct M6Segment
+    {
+        M6Databank*            mDatabank;
+        uint32                mDocBase;
+    };
+    typedef vector<M6Segment>    M6SegmentList;
+
     struct M6IndexDesc
     {
                             M6IndexDesc(const string& inName, const string& inDesc, M6IndexType inType, M6BasicIndexPtr inIndex)
@@ -175,6 +321,11 @@ class M6DatabankImpl
     fs::path                mDbDirectory;
     string                    mVersion;
     fs::ofstream*            mFastaFile;
+    int64                    mFastaSize;
+    M6File*                    mFastaData;
+    M6File*                    mFastaOffsets;
+    vector<pair<uint32,M6FastaOffset>>
+                            mPendingFastaOffsets;
     MOpenMode                mMode;
     M6DocStore*                mStore;
     M6Dictionary*            mDictionary;
@@ -183,11 +334,15 @@ class M6DatabankImpl
     M6BasicIndexPtr            mAllTextIndex;
     vector<float>            mDocWeights;
     M6DocQueue                mStoreQueue, mIndexQueue;
-    boost::thread            mStoreThread, mIndexThread;
-    boost::mutex            mMutex;
+    boost::thread_group        mStoreThreads, mIndexThreads;
+    M6StageCounter            mStoreCounter, mIndexCounter;
+    boost::mutex            mMutex, mFastaMutex;
     exception_ptr            mException;
     M6IndexDescList            mLinkIndices;
     M6LinkMap                mLinkMap;
+    M6SegmentList            mSegments;
+    vector<bool>            mDeleted;
+    uint32                    mDeletedCount;
 };
 
 // --------------------------------------------------------------------
@@ -195,7 +350,8 @@ class M6DatabankImpl
 class M6FullTextIx
 {
   public:
-                    M6FullTextIx(const fs::path& inDBDirectory, const string& inName);
+                    M6FullTextIx(const fs::path& inDBDirectory, const string& inName,
+                        int64 inMemoryBudget);
     virtual            ~M6FullTextIx();
 
     void            SetUsesInDocLocation(uint32 inIndexNr)        { mDocLocationIxMap[inIndexNr] = true; }
@@ -205,8 +361,70 @@ class M6FullTextIx
     bool            ExcludesInFullText(uint32 inIndexNr) const    { return mFullTextIxMap[inIndexNr]; }
     M6IndexMap        GetFullTextIxMap() const                    { return mFullTextIxMap; }
 
-    void            AddWord(uint8 inIndex, uint32 inWord);
-    void            FlushDoc(uint32 inDocNr);
+    // Entries in a run are packed, the in document locations are stored
+    // in a separate arena, prefixed by their bit count. mIDL is the offset
+    // in this arena plus one, zero means no locations.
+    struct M6RunEntry
+    {
+        uint32            term;
+        uint32            doc;
+        uint32            idl;
+        uint8            ix;
+        uint8            weight;
+
+        bool            operator<(const M6RunEntry& inOther) const
+                            { return term < inOther.term or
+                                    (term == inOther.term and (doc < inOther.doc or
+                                        (doc == inOther.doc and ix < inOther.ix))); }
+    };
+
+    // The words of a document are collected in a M6DocWordBuffer, a flat
+    // hash table that keeps its memory between documents. Each indexing
+    // thread uses a buffer of its own.
+    class M6DocWordBuffer
+    {
+      public:
+                        M6DocWordBuffer();
+
+        void            Add(uint8 inIndex, uint32 inWord, bool inStoreLocation);
+        void            Clear();
+
+      private:
+        friend class M6FullTextIx;
+
+        struct M6DocWord
+        {
+            uint32        word;
+            uint32        freq;
+            uint32        slot;
+            uint32        firstLoc, lastLoc;    // list in mLocations, one based
+            uint8        index;
+        };
+
+        struct M6DocLoc
+        {
+            uint32        loc;
+            uint32        next;
+        };
+
+        uint32            Hash(uint8 inIndex, uint32 inWord) const
+                            { return ((inWord * 2654435761U) ^ (inIndex * 40503U)) & (mTable.size() - 1); }
+        void            Grow();
+
+        vector<M6DocWord>    mWords;
+        vector<uint32>        mTable;        // one based index in mWords, zero is empty
+        vector<M6DocLoc>    mLocations;
+        uint32                mLocation;
+
+        // scratch space for FlushDoc
+        vector<M6RunEntry>    mEntries;
+        vector<uint8>        mIDL;
+        vector<uint32>        mLoc;
+        M6OBitStream        mIDLBits;
+    };
+
+    void            AddWord(M6DocWordBuffer& ioBuffer, uint8 inIndex, uint32 inWord);
+    void            FlushDoc(M6DocWordBuffer& ioBuffer, uint32 inDocNr);
 
     struct M6BufferEntry
     {
@@ -239,89 +457,149 @@ class M6FullTextIx
                                     (term == inOther.term and doc < inOther.doc); }
     };
 
-    void            PushEntry(M6BufferEntry&& inEntry);
     int64            Finish();
-    bool            NextEntry(M6BufferEntry& outEntry);
+
+    // The runs are written as separate slices, each containing only the
+    // terms for which term % slice-count equals the slice number. That way
+    // each slice can be merged and assembled by a thread of its own.
+    uint32            GetSliceCount() const                        { return mSliceCount; }
+    bool            NextEntry(uint32 inSlice, M6BufferEntry& outEntry);
 
     fs::path        GetDbDirectory() const                        { return mDbDirectory; }
 
   private:
 
-    typedef vector<uint32>        DocLoc;
-
-    struct DocWord
-    {
-        uint32        word;
-        uint32        index;
-        uint32        freq;
-        DocLoc        loc;
-
-        bool        operator<(const DocWord& inOther) const
-                        { return word < inOther.word or (word == inOther.word and index < inOther.index); }
-    };
-
-    typedef set<DocWord> DocWords;
-
-    // the number of buffer entries is one of the most important
-    // variables affecting indexing speed and memory consumption.
-    // The value chosen here seems to be a reasonable tradeoff.
+    // The memory budget determines the size of the runs. The run being
+    // filled, one waiting run and the run being sorted each take a share,
+    // the sort needs a scratch copy of the entries and room for the
+    // encoded output.
     enum {
-        kM6BufferEntryCount = 8000000
-//        kM6BufferEntryCount = 8000
+        kM6MinRunEntryCount = 65536,
+        kM6MaxSliceCount = 8,
+        kM6MaxMergeFanIn = 64,
+        kM6RunBufferSize = 65536,
+        kM6RunFlushSize = 1024 * 1024
     };
 
     struct M6EntryRun
     {
-        uint32            mCount;
-        M6BufferEntry    mEntries[kM6BufferEntryCount];
+        vector<M6RunEntry>    mEntries;
+        vector<uint8>        mIDL;
     };
 
-    typedef M6Queue<M6EntryRun*>    M6EntryRunQueue;
+    void            PushEntry(const M6RunEntry& inEntry, const uint8* inIDL);
+
+    typedef M6Queue<M6EntryRun*,1>    M6EntryRunQueue;
+    struct M6BufferEntryIterator;
+    typedef vector<M6BufferEntryIterator*>    M6EntryQueue;
 
     void            FlushEntryRuns();
+    void            WriteEntryRun(unique_ptr<M6EntryRun> inRun, vector<M6RunEntry>& ioEntries);
+    void            MergeRuns(M6EntryQueue& ioRuns);
+
+    // Runs are stored byte aligned, each entry is a varint coded term delta
+    // and doc delta followed by the index number and weight bytes and for
+    // indices storing in document locations a varint bit count followed
+    // by the raw location bits.
+    struct M6RunWriter
+    {
+                        M6RunWriter(uint32 inFirstDoc)
+                            : mCount(0), mFirstDoc(inFirstDoc), mTerm(0), mDoc(inFirstDoc) {}
 
-    static const uint32 kM6LargeBitBufferSize = 65536;
+        void            Add(uint32 inTerm, uint32 inDoc, uint8 inIndex, uint8 inWeight);
+        void            AddIDL(const uint8* inIDL, uint32 inBitCount);
+        void            AddVarInt(uint32 inValue)
+                        {
+                            while (inValue >= 0x80)
+                            {
+                                mData.push_back(static_cast<uint8>(inValue | 0x80));
+                                inValue >>= 7;
+                            }
+                            mData.push_back(static_cast<uint8>(inValue));
+                        }
+
+        vector<uint8>    mData;
+        uint32            mCount;
+        uint32            mFirstDoc;
+        uint32            mTerm;
+        uint32            mDoc;
+    };
 
     struct M6BufferEntryIterator
     {
-                        M6BufferEntryIterator(M6File& inFile, int64 inOffset, uint32 inCount,
-                            uint32 inFirstDoc, const M6IndexMap& inIDLIxMap)
-                            : mBits(inFile, inOffset, kM6LargeBitBufferSize)
+                        M6BufferEntryIterator(M6File& inFile, int64 inOffset, int64 inSize,
+                            uint32 inCount, uint32 inFirstDoc, const M6IndexMap& inIDLIxMap)
+                            : mFile(inFile), mOffset(inOffset), mEnd(inOffset + inSize)
+                            , mBufferPtr(0), mBufferEnd(0)
                             , mCount(inCount), mFirstDoc(inFirstDoc), mIDLIxMap(inIDLIxMap)
-                            , mTerm(1), mDoc(inFirstDoc) {}
+                            , mTerm(0), mDoc(inFirstDoc), mIndex(0), mWeight(0), mIDLBitCount(0) {}
 
         bool            Next();
 
-        M6IBitStream    mBits;
+        uint8            ReadByte()
+                        {
+                            if (mBufferPtr == mBufferEnd)
+                                FillBuffer();
+                            return mBuffer[mBufferPtr++];
+                        }
+
+        uint32            ReadVarInt()
+                        {
+                            uint32 result = 0;
+                            for (uint32 shift = 0; ; shift += 7)
+                            {
+                                uint8 b = ReadByte();
+                                result |= static_cast<uint32>(b & 0x7f) << shift;
+                                if ((b & 0x80) == 0)
+                                    break;
+                            }
+                            return result;
+                        }
+
+        void            Read(uint8* outData, uint32 inSize);
+        void            FillBuffer();
+
+        M6File&            mFile;
+        int64            mOffset, mEnd;
+        vector<uint8>    mBuffer;
+        uint32            mBufferPtr, mBufferEnd;
         uint32            mCount;
         uint32            mFirstDoc;
         M6IndexMap        mIDLIxMap;
+
+        // the current entry
         uint32            mTerm;
         uint32            mDoc;
-        M6BufferEntry    mEntry;
+        uint8            mIndex;
+        uint8            mWeight;
+        vector<uint8>    mIDL;
+        uint32            mIDLBitCount;
     };
 
     struct CompareEntryIterator
     {
         bool operator()(const M6BufferEntryIterator* a, const M6BufferEntryIterator* b) const
         {
-            return a->mEntry.term > b->mEntry.term or
-                (a->mEntry.term == b->mEntry.term and a->mEntry.doc > b->mEntry.doc);
+            return a->mTerm > b->mTerm or
+                (a->mTerm == b->mTerm and (a->mDoc > b->mDoc or
+                    (a->mDoc == b->mDoc and a->mIndex > b->mIndex)));
         }
     };
 
-    typedef vector<M6BufferEntryIterator*>    M6EntryQueue;
-
-    DocWords        mDocWords;
     M6IndexMap        mDocLocationIxMap, mFullTextIxMap;
-    uint32            mDocWordLocation;
     fs::path        mDbDirectory;
 
     M6File            mEntryBuffer;
+    boost::mutex    mEntryMutex;
     M6EntryRun*        mEntryRun;
     M6EntryRunQueue    mEntryRunQueue;
     boost::thread    mEntryRunThread;
-    M6EntryQueue    mEntryQueue;
+    exception_ptr    mEntryRunException;
+    uint32            mRunEntryCount;
+    uint32            mRunIDLSize;
+    uint32            mSliceCount;
+    vector<M6EntryQueue>
+                    mEntryQueues;
     int64            mEntryCount;
 };
 
@@ -334,16 +612,40 @@ ostream& operator<<(ostream& os, const M6FullTextIx::M6BufferEntry& e)
     return os;
 }
 
-M6FullTextIx::M6FullTextIx(const fs::path& inDBDirectory, const string& inName)
-    : mDocWordLocation(1)
-    , mDbDirectory(inDBDirectory)
+M6FullTextIx::M6FullTextIx(const fs::path& inDBDirectory, const string& inName,
+        int64 inMemoryBudget)
+    : mDbDirectory(inDBDirectory)
     , mEntryBuffer(mDbDirectory / inName, eReadWrite)
     , mEntryRun(nullptr)
-    , mEntryRunThread(boost::bind(&M6FullTextIx::FlushEntryRuns, this))
+    , mSliceCount(boost::thread::hardware_concurrency())
     , mEntryCount(0)
 {
     mFullTextIxMap.assign(false);
     mDocLocationIxMap.assign(false);
+
+    if (mSliceCount < 1)
+        mSliceCount = 1;
+    else if (mSliceCount > kM6MaxSliceCount)
+        mSliceCount = kM6MaxSliceCount;
+
+    mEntryQueues.resize(mSliceCount);
+
+    // three runs may be in memory at the same time, the sort needs
+    // a copy of the entries and room for the encoded run.
+    int64 idlSize = inMemoryBudget / 16;
+    int64 entryCount = (inMemoryBudget - 4 * idlSize) / (5 * sizeof(M6RunEntry));
+
+    if (entryCount < kM6MinRunEntryCount)
+        entryCount = kM6MinRunEntryCount;
+    if (entryCount > numeric_limits<int32>::max())
+        entryCount = numeric_limits<int32>::max();
+    if (idlSize > numeric_limits<int32>::max())
+        idlSize = numeric_limits<int32>::max();
+
+    mRunEntryCount = static_cast<uint32>(entryCount);
+    mRunIDLSize = static_cast<uint32>(idlSize);
+
+    mEntryRunThread = boost::thread(boost::bind(&M6FullTextIx::FlushEntryRuns, this));
 }
 
 M6FullTextIx::~M6FullTextIx()
@@ -353,71 +655,165 @@ M6FullTextIx::~M6FullTextIx()
     {
         mEntryRunQueue.Put(nullptr);
         mEntryRunThread.join();
+    }
 
-        for (M6BufferEntryIterator* iter : mEntryQueue)
+    for (M6EntryQueue& queue : mEntryQueues)
+    {
+        for (M6BufferEntryIterator* iter : queue)
             delete iter;
     }
 }
 
-void M6FullTextIx::AddWord(uint8 inIndex, uint32 inWord)
+M6FullTextIx::M6DocWordBuffer::M6DocWordBuffer()
+    : mTable(1024, 0), mLocation(1)
 {
-    ++mDocWordLocation;    // always increment, even if we do not add the word
+}
 
-    if (inWord > 0)
+void M6FullTextIx::M6DocWordBuffer::Add(uint8 inIndex, uint32 inWord, bool inStoreLocation)
+{
+    uint32 mask = static_cast<uint32>(mTable.size() - 1);
+    uint32 slot = Hash(inIndex, inWord);
+
+    while (mTable[slot] != 0)
     {
-        DocWord w = { inWord, inIndex, 1 };
+        M6DocWord& w = mWords[mTable[slot] - 1];
+        if (w.word == inWord and w.index == inIndex)
+            break;
+        slot = (slot + 1) & mask;
+    }
+
+    if (mTable[slot] == 0)
+    {
+        M6DocWord w = { inWord, 0, slot, 0, 0, inIndex };
+        mWords.push_back(w);
+        mTable[slot] = static_cast<uint32>(mWords.size());
+    }
+
+    M6DocWord& w = mWords[mTable[slot] - 1];
+    w.freq += 1;
 
-        DocWords::iterator i = mDocWords.find(w);
-        if (i != mDocWords.end())
-            const_cast<DocWord&>(*i).freq += 1;
+    if (inStoreLocation)
+    {
+        M6DocLoc loc = { mLocation, 0 };
+        mLocations.push_back(loc);
+
+        uint32 l = static_cast<uint32>(mLocations.size());
+        if (w.lastLoc != 0)
+            mLocations[w.lastLoc - 1].next = l;
         else
-            i = mDocWords.insert(w).first;
+            w.firstLoc = l;
+        w.lastLoc = l;
+    }
 
-        if (UsesInDocLocation(inIndex))
-        {
-            DocWord& dw = const_cast<DocWord&>(*i);
-            dw.loc.push_back(mDocWordLocation);
-        }
+    // keep the table at most half full
+    if (mWords.size() * 2 > mTable.size())
+        Grow();
+}
+
+void M6FullTextIx::M6DocWordBuffer::Grow()
+{
+    mTable.assign(mTable.size() * 2, 0);
+    uint32 mask = static_cast<uint32>(mTable.size() - 1);
+
+    for (uint32 i = 0; i < mWords.size(); ++i)
+    {
+        uint32 slot = Hash(mWords[i].index, mWords[i].word);
+        while (mTable[slot] != 0)
+            slot = (slot + 1) & mask;
+
+        mTable[slot] = i + 1;
+        mWords[i].slot = slot;
     }
 }
 
-void M6FullTextIx::FlushDoc(uint32 inDoc)
+void M6FullTextIx::M6DocWordBuffer::Clear()
 {
+    if (mWords.size() * 8 > mTable.size())
+        fill(mTable.begin(), mTable.end(), 0);
+    else
+    {
+        for (M6DocWord& w : mWords)
+            mTable[w.slot] = 0;
+    }
+
+    mWords.clear();
+    mLocations.clear();
+    mLocation = 1;
+}
+
+void M6FullTextIx::AddWord(M6DocWordBuffer& ioBuffer, uint8 inIndex, uint32 inWord)
+{
+    ++ioBuffer.mLocation;    // always increment, even if we do not add the word
+
+    if (inWord > 0)
+        ioBuffer.Add(inIndex, inWord, UsesInDocLocation(inIndex));
+}
+
+void M6FullTextIx::FlushDoc(M6DocWordBuffer& ioBuffer, uint32 inDoc)
+{
+    typedef M6DocWordBuffer::M6DocWord M6DocWord;
+
     // normalize the frequencies.
     uint32 maxFreq = 1;
 
-    for (DocWords::iterator w = mDocWords.begin(); w != mDocWords.end(); ++w)
-        if (w->freq > maxFreq)
-            maxFreq = w->freq;
+    for (const M6DocWord& w : ioBuffer.mWords)
+        if (w.freq > maxFreq)
+            maxFreq = w.freq;
 
-    for (DocWords::iterator w = mDocWords.begin(); w != mDocWords.end(); ++w)
-    {
-        if (w->freq == 0)
-            continue;
+    // build the entries first, then push them in one go
+    vector<M6RunEntry>& entries = ioBuffer.mEntries;
+    vector<uint8>& idl = ioBuffer.mIDL;
 
-        M6BufferEntry e;
+    entries.clear();
+    idl.clear();
 
-        e.term = w->word;
-        e.doc = inDoc;
-        e.ix = w->index;
+    for (const M6DocWord& w : ioBuffer.mWords)
+    {
+        M6RunEntry e = { w.word, inDoc, 0, w.index };
 
-        e.weight = (w->freq * kM6MaxWeight) / maxFreq;
+        e.weight = (w.freq * kM6MaxWeight) / maxFreq;
         if (e.weight < 1)
             e.weight = 1;
 
-        if (UsesInDocLocation(w->index))
-            WriteArray(e.idl, w->loc);
+        if (UsesInDocLocation(w.index))
+        {
+            vector<uint32>& loc = ioBuffer.mLoc;
+            loc.clear();
+
+            for (uint32 l = w.firstLoc; l != 0; l = ioBuffer.mLocations[l - 1].next)
+                loc.push_back(ioBuffer.mLocations[l - 1].loc);
+
+            M6OBitStream& bits = ioBuffer.mIDLBits;
+            bits.Clear();
+            WriteArray(bits, loc);
+
+            uint32 bitCount = static_cast<uint32>(bits.BitSize());
+            bits.Sync();
+
+            e.idl = static_cast<uint32>(idl.size() + 1);
+
+            const uint8* b = reinterpret_cast<const uint8*>(&bitCount);
+            idl.insert(idl.end(), b, b + sizeof(bitCount));
+            idl.insert(idl.end(), bits.Peek(), bits.Peek() + (bitCount + 7) / 8);
+        }
+
+        entries.push_back(e);
+    }
+
+    {
+        boost::mutex::scoped_lock lock(mEntryMutex);
 
-        PushEntry(move(e));
+        for (const M6RunEntry& e : entries)
+            PushEntry(e, e.idl ? &idl[e.idl - 1] : nullptr);
     }
 
-    mDocWords.clear();
-    mDocWordLocation = 1;
+    ioBuffer.Clear();
 }
 
-void M6FullTextIx::PushEntry(M6BufferEntry&& inEntry)
+void M6FullTextIx::PushEntry(const M6RunEntry& inEntry, const uint8* inIDL)
 {
-    if (mEntryRun != nullptr and mEntryRun->mCount >= kM6BufferEntryCount)
+    if (mEntryRun != nullptr and
+        (mEntryRun->mEntries.size() >= mRunEntryCount or mEntryRun->mIDL.size() >= mRunIDLSize))
     {
         mEntryRunQueue.Put(mEntryRun);
         mEntryRun = nullptr;
@@ -426,69 +822,215 @@ void M6FullTextIx::PushEntry(M6BufferEntry&& inEntry)
     if (mEntryRun == nullptr)
     {
         mEntryRun = new M6EntryRun;
-        mEntryRun->mCount = 0;
+        mEntryRun->mEntries.reserve(mRunEntryCount);
+    }
+
+    mEntryRun->mEntries.push_back(inEntry);
+    M6RunEntry& e = mEntryRun->mEntries.back();
+
+    if (inIDL != nullptr)
+    {
+        vector<uint8>& arena = mEntryRun->mIDL;
+
+        uint32 bitCount;
+        memcpy(&bitCount, inIDL, sizeof(bitCount));
+
+        e.idl = static_cast<uint32>(arena.size() + 1);
+        arena.insert(arena.end(), inIDL, inIDL + sizeof(bitCount) + (bitCount + 7) / 8);
     }
 
-    mEntryRun->mEntries[mEntryRun->mCount] = move(inEntry);
-    ++mEntryRun->mCount;
     ++mEntryCount;
 }
 
 void M6FullTextIx::FlushEntryRuns()
 {
+    vector<M6RunEntry> entries;
+
     for (;;)
     {
-        M6EntryRun* run = mEntryRunQueue.Get();
-        if (run == nullptr)
+        unique_ptr<M6EntryRun> run(mEntryRunQueue.Get());
+        if (not run)
             break;
 
-        int64 offset = mEntryBuffer.Size();
-        M6OBitStream bits(mEntryBuffer);
+        // after a failure the remaining runs are dropped, PushEntry would
+        // block otherwise. Finish reports the exception.
+        if (not (mEntryRunException == exception_ptr()))
+            continue;
+
+        try
+        {
+            WriteEntryRun(move(run), entries);
+        }
+        catch (...)
+        {
+            mEntryRunException = current_exception();
+        }
+    }
+}
+
+// Sort and encode a run, each slice in a thread of its own, and append
+// the encoded slices to the entry buffer.
+void M6FullTextIx::WriteEntryRun(unique_ptr<M6EntryRun> inRun, vector<M6RunEntry>& ioEntries)
+{
+    const uint8* idl = inRun->mIDL.empty() ? nullptr : &inRun->mIDL[0];
+    uint32 count = static_cast<uint32>(inRun->mEntries.size());
+
+    uint32 firstDoc = accumulate(inRun->mEntries.begin(), inRun->mEntries.end(), inRun->mEntries.front().doc,
+                        [](uint32 minDocNr, const M6RunEntry& e) -> uint32
+                            {
+                                if (minDocNr > e.doc)
+                                    minDocNr = e.doc;
+                                return minDocNr;
+                            });
+
+    // distribute the entries over the slices first
+    vector<uint32> sliceStart(mSliceCount + 1, 0);
+    for (const M6RunEntry& e : inRun->mEntries)
+        ++sliceStart[e.term % mSliceCount + 1];
+    partial_sum(sliceStart.begin(), sliceStart.end(), sliceStart.begin());
+
+    ioEntries.resize(count);
+    vector<uint32> next(sliceStart.begin(), sliceStart.end() - 1);
+    for (const M6RunEntry& e : inRun->mEntries)
+        ioEntries[next[e.term % mSliceCount]++] = e;
+
+    // then sort and encode each slice in a thread of its own
+    vector<M6RunWriter> writers(mSliceCount, M6RunWriter(firstDoc));
+
+    auto encode = [&](uint32 inSlice)
+    {
+        auto b = ioEntries.begin() + sliceStart[inSlice], e = ioEntries.begin() + sliceStart[inSlice + 1];
+        sort(b, e);
+
+        M6RunWriter& writer = writers[inSlice];
+        writer.mData.reserve((e - b) * 4);
 
-        M6BufferEntry* entries = run->mEntries;
-        uint32 count = run->mCount;
+        for (auto i = b; i != e; ++i)
+        {
+            writer.Add(i->term, i->doc, i->ix, i->weight);
+
+            if (mDocLocationIxMap[i->ix])
+            {
+                assert(i->idl > 0);
 
-        uint32 t = 1;
-//        uint32 firstDoc = entries[0].doc;    // the first doc in this run
-        uint32 firstDoc = accumulate(entries, entries + count, entries[0].doc,
-                            [](uint32 minDocNr, const M6BufferEntry& e) -> uint32
-                                {
-                                    if (minDocNr > e.doc)
-                                        minDocNr = e.doc;
-                                    return minDocNr;
-                                });
-        uint32 d = firstDoc;
-        int32 ix = -1;
+                uint32 bitCount;
+                memcpy(&bitCount, idl + i->idl - 1, sizeof(bitCount));
+                writer.AddIDL(idl + i->idl - 1 + sizeof(bitCount), bitCount);
+            }
+        }
+    };
 
-        stable_sort(entries, entries + count);
+    if (mSliceCount == 1)
+        encode(0);
+    else
+    {
+        exception_ptr ex;
+        boost::mutex m;
 
-        for (uint32 i = 0; i < count; ++i)
+        boost::thread_group threads;
+        for (uint32 slice = 0; slice < mSliceCount; ++slice)
         {
-            assert(entries[i].term > t or entries[i].doc > d or entries[i].ix > ix);
+            threads.create_thread([&encode, &ex, &m, slice]()
+            {
+                try
+                {
+                    encode(slice);
+                }
+                catch (...)
+                {
+                    boost::mutex::scoped_lock lock(m);
+                    ex = current_exception();
+                }
+            });
+        }
+        threads.join_all();
 
-            if (entries[i].term > t)
-                d = firstDoc;
+        if (not (ex == exception_ptr()))
+            rethrow_exception(ex);
+    }
 
-            WriteGamma(bits, entries[i].term - t + 1);
-            WriteGamma(bits, entries[i].doc - d + 1);
-            WriteGamma(bits, entries[i].ix + 1);
-            WriteBinary(bits, kM6WeightBitCount, entries[i].weight);
+    inRun.reset();
 
-            if (mDocLocationIxMap[entries[i].ix])
-                WriteBits(bits, entries[i].idl);
+    // and write them out, an iterator is created for each
+    for (uint32 slice = 0; slice < mSliceCount; ++slice)
+    {
+        M6RunWriter& writer = writers[slice];
+        if (writer.mCount == 0)
+            continue;
+
+        int64 offset = mEntryBuffer.Size();
+        mEntryBuffer.PWrite(&writer.mData[0], writer.mData.size(), offset);
 
-            t = entries[i].term;
-            d = entries[i].doc;
-            ix = entries[i].ix;
+        mEntryQueues[slice].push_back(new M6BufferEntryIterator(mEntryBuffer, offset,
+            writer.mData.size(), writer.mCount, firstDoc, mDocLocationIxMap));
+    }
+}
+
+// Merge the oldest runs of a slice into a new run until the number of
+// runs is below the fan-in limit. Only one run is written at a time and
+// so each merged run is stored contiguously at the end of the file.
+void M6FullTextIx::MergeRuns(M6EntryQueue& ioRuns)
+{
+    while (ioRuns.size() > kM6MaxMergeFanIn)
+    {
+        M6EntryQueue queue;
+        uint32 firstDoc = numeric_limits<uint32>::max();
+
+        for (uint32 i = 0; i < kM6MaxMergeFanIn; ++i)
+        {
+            M6BufferEntryIterator* iter = ioRuns[i];
+
+            if (firstDoc > iter->mFirstDoc)
+                firstDoc = iter->mFirstDoc;
+
+            if (iter->Next())
+            {
+                queue.push_back(iter);
+                push_heap(queue.begin(), queue.end(), CompareEntryIterator());
+            }
+            else
+                delete iter;
         }
 
-        bits.Sync();
+        ioRuns.erase(ioRuns.begin(), ioRuns.begin() + kM6MaxMergeFanIn);
 
-        // create an iterator now that we have all the info
-        mEntryQueue.push_back(new M6BufferEntryIterator(mEntryBuffer, offset,
-            count, firstDoc, mDocLocationIxMap));
+        M6RunWriter writer(firstDoc);
+        int64 offset = mEntryBuffer.Size(), size = 0;
 
-        delete run;
+        while (not queue.empty())
+        {
+            pop_heap(queue.begin(), queue.end(), CompareEntryIterator());
+            M6BufferEntryIterator* iter = queue.back();
+
+            writer.Add(iter->mTerm, iter->mDoc, iter->mIndex, iter->mWeight);
+            if (mDocLocationIxMap[iter->mIndex])
+                writer.AddIDL(iter->mIDL.data(), iter->mIDLBitCount);
+
+            if (writer.mData.size() >= kM6RunFlushSize)
+            {
+                mEntryBuffer.PWrite(&writer.mData[0], writer.mData.size(), offset + size);
+                size += writer.mData.size();
+                writer.mData.clear();
+            }
+
+            if (iter->Next())
+                push_heap(queue.begin(), queue.end(), CompareEntryIterator());
+            else
+            {
+                queue.pop_back();
+                delete iter;
+            }
+        }
+
+        if (not writer.mData.empty())
+        {
+            mEntryBuffer.PWrite(&writer.mData[0], writer.mData.size(), offset + size);
+            size += writer.mData.size();
+        }
+
+        if (writer.mCount > 0)
+            ioRuns.push_back(new M6BufferEntryIterator(mEntryBuffer, offset, size,
+                writer.mCount, firstDoc, mDocLocationIxMap));
     }
 }
 
@@ -504,40 +1046,57 @@ int64 M6FullTextIx::Finish()
     mEntryRunQueue.Put(nullptr);
     mEntryRunThread.join();
 
-    // setup the input queue
-    vector<M6BufferEntryIterator*> iterators;
-    swap(mEntryQueue, iterators);
-    mEntryQueue.reserve(iterators.size());
+    if (not (mEntryRunException == exception_ptr()))
+        rethrow_exception(mEntryRunException);
 
-    for (M6BufferEntryIterator* iter : iterators)
+    // setup the input queues, one for each slice
+    for (M6EntryQueue& queue : mEntryQueues)
     {
-        if (iter->Next())
+        MergeRuns(queue);
+
+        vector<M6BufferEntryIterator*> iterators;
+        swap(queue, iterators);
+        queue.reserve(iterators.size());
+
+        for (M6BufferEntryIterator* iter : iterators)
         {
-            mEntryQueue.push_back(iter);
-            push_heap(mEntryQueue.begin(), mEntryQueue.end(), CompareEntryIterator());
+            if (iter->Next())
+            {
+                queue.push_back(iter);
+                push_heap(queue.begin(), queue.end(), CompareEntryIterator());
+            }
+            else
+                delete iter;
         }
-        else
-            delete iter;
     }
+
     return mEntryCount;
 }
 
-bool M6FullTextIx::NextEntry(M6BufferEntry& outEntry)
+bool M6FullTextIx::NextEntry(uint32 inSlice, M6BufferEntry& outEntry)
 {
     bool result = false;
+    M6EntryQueue& queue = mEntryQueues[inSlice];
 
-    if (not mEntryQueue.empty())
+    if (not queue.empty())
     {
-        pop_heap(mEntryQueue.begin(), mEntryQueue.end(), CompareEntryIterator());
-        M6BufferEntryIterator* iter = mEntryQueue.back();
+        pop_heap(queue.begin(), queue.end(), CompareEntryIterator());
+        M6BufferEntryIterator* iter = queue.back();
+
+        outEntry.term = iter->mTerm;
+        outEntry.doc = iter->mDoc;
+        outEntry.ix = iter->mIndex;
+        outEntry.weight = iter->mWeight;
 
-        outEntry = move(iter->mEntry);
+        outEntry.idl.Clear();
+        if (mDocLocationIxMap[iter->mIndex])
+            CopyBits(outEntry.idl, iter->mIDL.data(), iter->mIDLBitCount);
 
         if (iter->Next())
-            push_heap(mEntryQueue.begin(), mEntryQueue.end(), CompareEntryIterator());
+            push_heap(queue.begin(), queue.end(), CompareEntryIterator());
         else
         {
-            mEntryQueue.erase(mEntryQueue.end() - 1);
+            queue.erase(queue.end() - 1);
             delete iter;
         }
 
@@ -547,32 +1106,89 @@ bool M6FullTextIx::NextEntry(M6BufferEntry& outEntry)
     return result;
 }
 
+void M6FullTextIx::M6RunWriter::Add(uint32 inTerm, uint32 inDoc, uint8 inIndex, uint8 inWeight)
+{
+    assert(inTerm > mTerm or (inTerm == mTerm and inDoc >= mDoc));
+
+    if (inTerm != mTerm)
+        mDoc = mFirstDoc;
+
+    AddVarInt(inTerm - mTerm);
+    AddVarInt(inDoc - mDoc);
+    mData.push_back(inIndex);
+    mData.push_back(inWeight);
+
+    mTerm = inTerm;
+    mDoc = inDoc;
+    ++mCount;
+}
+
+void M6FullTextIx::M6RunWriter::AddIDL(const uint8* inIDL, uint32 inBitCount)
+{
+    AddVarInt(inBitCount);
+    mData.insert(mData.end(), inIDL, inIDL + (inBitCount + 7) / 8);
+}
+
+void M6FullTextIx::M6BufferEntryIterator::FillBuffer()
+{
+    if (mOffset >= mEnd)
+        THROW(("Unexpected end of run in full-text buffer"));
+
+    // buffers are allocated only when needed, many runs may be pending
+    if (mBuffer.empty())
+        mBuffer.resize(kM6RunBufferSize);
+
+    uint32 size = kM6RunBufferSize;
+    if (size > mEnd - mOffset)
+        size = static_cast<uint32>(mEnd - mOffset);
+
+    mFile.PRead(&mBuffer[0], size, mOffset);
+
+    mOffset += size;
+    mBufferPtr = 0;
+    mBufferEnd = size;
+}
+
+void M6FullTextIx::M6BufferEntryIterator::Read(uint8* outData, uint32 inSize)
+{
+    while (inSize > 0)
+    {
+        if (mBufferPtr == mBufferEnd)
+            FillBuffer();
+
+        uint32 n = mBufferEnd - mBufferPtr;
+        if (n > inSize)
+            n = inSize;
+
+        memcpy(outData, &mBuffer[mBufferPtr], n);
+        mBufferPtr += n;
+        outData += n;
+        inSize -= n;
+    }
+}
+
 bool M6FullTextIx::M6BufferEntryIterator::Next()
 {
     bool result = false;
     if (mCount > 0)
     {
-        uint32 delta;
-        ReadGamma(mBits, delta);
-        delta -= 1;
-
+        uint32 delta = ReadVarInt();
         if (delta != 0)
         {
             mTerm += delta;
             mDoc = mFirstDoc;
         }
 
-        mEntry.term = mTerm;
-        ReadGamma(mBits, delta);
-        delta -= 1;
-        mDoc += delta;
-        mEntry.doc = mDoc;
-        ReadGamma(mBits, mEntry.ix);
-        mEntry.ix -= 1;
-        ReadBinary(mBits, kM6WeightBitCount, mEntry.weight);
+        mDoc += ReadVarInt();
+        mIndex = ReadByte();
+        mWeight = ReadByte();
 
-        if (mIDLIxMap[mEntry.ix])
-            ReadBits(mBits, mEntry.idl);
+        if (mIDLIxMap[mIndex])
+        {
+            mIDLBitCount = ReadVarInt();
+            mIDL.resize((mIDLBitCount + 7) / 8);
+            Read(mIDL.data(), static_cast<uint32>(mIDL.size()));
+        }
 
         --mCount;
         result = true;
@@ -851,7 +1467,12 @@ class M6BasicIx
                         const string& inName, uint8 inIndexNr);
     virtual         ~M6BasicIx();
 
-    void            AddWord(uint32 inWord);
+    // Create a new M6BasicIx writing to the same index. Used to assemble
+    // the slices of the full text buffer in parallel.
+    virtual M6BasicIx*
+                    CreateSlice(uint32 inSlice) = 0;
+
+    void            AddWord(M6FullTextIx::M6DocWordBuffer& ioBuffer, uint32 inWord);
     void            AddDocTerm(uint32 inDoc, uint32 inTerm, uint8 inFrequency, M6OBitStream& inIDL);
 
     void            SetDbDocCount(uint32 inDBDocCount);
@@ -860,18 +1481,27 @@ class M6BasicIx
 
   protected:
 
+                    M6BasicIx(const M6BasicIx& inMain);
+
     virtual void    AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL);
     virtual void    FlushTerm(uint32 inTerm, uint32 inDocCount);
 
     virtual void    FlushTerm(FlushedTerm* inTermData) = 0;
     void            FlushThread();
 
+    // stop a flush thread that was left running, e.g. after an exception
+    void            StopFlushThread();
+
     uint8            mIndexNr;
     uint32            mDbDocCount;
 
     M6FullTextIx&    mFullTextIndex;
     M6Lexicon&        mLexicon;
 
+    // slices share the index, writing to it is serialized
+    shared_ptr<boost::mutex>
+                    mIndexMutex;
+
     // data for the second pass
     uint32            mLastDoc;
     uint32            mLastTerm;
@@ -889,6 +1519,7 @@ M6BasicIx::M6BasicIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
     : mIndexNr(inIndexNr)
     , mFullTextIndex(inFullTextIndex)
     , mLexicon(inLexicon)
+    , mIndexMutex(new boost::mutex)
     , mLastDoc(0)
     , mDocCount(0)
     , mDbDocCount(0)
@@ -896,7 +1527,25 @@ M6BasicIx::M6BasicIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
 {
 }
 
+M6BasicIx::M6BasicIx(const M6BasicIx& inMain)
+    : mIndexNr(inMain.mIndexNr)
+    , mDbDocCount(inMain.mDbDocCount)
+    , mFullTextIndex(inMain.mFullTextIndex)
+    , mLexicon(inMain.mLexicon)
+    , mIndexMutex(inMain.mIndexMutex)
+    , mLastDoc(0)
+    , mLastTerm(0)
+    , mDocCount(0)
+    , mFlushThread(boost::bind(&M6BasicIx::FlushThread, this))
+{
+}
+
 M6BasicIx::~M6BasicIx()
+{
+    StopFlushThread();
+}
+
+void M6BasicIx::StopFlushThread()
 {
     if (mFlushThread.joinable())    // left over?
     {
@@ -905,9 +1554,9 @@ M6BasicIx::~M6BasicIx()
     }
 }
 
-void M6BasicIx::AddWord(uint32 inWord)
+void M6BasicIx::AddWord(M6FullTextIx::M6DocWordBuffer& ioBuffer, uint32 inWord)
 {
-    mFullTextIndex.AddWord(mIndexNr, inWord);
+    mFullTextIndex.AddWord(ioBuffer, mIndexNr, inWord);
 }
 
 void M6BasicIx::SetDbDocCount(uint32 inDBDocCount)
@@ -992,6 +1641,8 @@ void M6BasicIx::FlushThread()
         FlushedTerm* term = mFlushQueue.Get();
         if (term == nullptr)
             break;
+
+        boost::mutex::scoped_lock lock(*mIndexMutex);
         FlushTerm(term);
     }
 }
@@ -1005,10 +1656,15 @@ class M6StringIx : public M6BasicIx
                     M6StringIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
                         const string& inName, uint8 inIndexNr, M6BasicIndexPtr inIndex);
 
+    virtual M6BasicIx*
+                    CreateSlice(uint32 inSlice)                { return new M6StringIx(*this); }
+
     virtual void    AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL);
     virtual void    FlushTerm(uint32 inTerm, uint32 inDocCount);
 
   private:
+                    M6StringIx(const M6StringIx& inMain)
+                        : M6BasicIx(inMain), mIndex(inMain.mIndex) {}
 
     virtual void    FlushTerm(FlushedTerm* inTermData);
 
@@ -1049,6 +1705,7 @@ void M6StringIx::FlushTerm(uint32 inTerm, uint32 inDocCount)
 void M6StringIx::FlushTerm(FlushedTerm* inTermData)
 {
     mIndex->Insert(inTermData->mTerm, inTermData->mDocs);
+    delete inTermData;
 }
 
 // --------------------------------------------------------------------
@@ -1060,19 +1717,30 @@ class M6TextIx : public M6BasicIx
     struct FlushedIDLTerm : public FlushedTerm
     {
         int64        mIDLOffset;
+        int64        mIDLSize;
     };
 
                     M6TextIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
                         const string& inName, uint8 inIndexNr, M6BasicIndexPtr inIndex);
     virtual            ~M6TextIx();
 
+    virtual M6BasicIx*
+                    CreateSlice(uint32 inSlice)                { return new M6TextIx(*this, inSlice); }
+
   private:
+                    M6TextIx(const M6TextIx& inMain, uint32 inSlice);
+
     void            AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL);
     virtual void    FlushTerm(uint32 inTerm, uint32 inDocCount);
 
     virtual void    FlushTerm(FlushedTerm* inTermData);
 
-    M6File*            mIDLFile;
+    // The in document locations are written to a scratch file, one for
+    // each slice, and copied to the idl file by the flush thread.
+    string            mName;
+    M6File            mIDLFile;
+    fs::path        mScratchFile;
+    M6File            mScratch;
     M6OBitStream*    mIDLBits;
     int64            mIDLOffset;
     M6MultiIDLBasicIndex*
@@ -1082,7 +1750,10 @@ class M6TextIx : public M6BasicIx
 M6TextIx::M6TextIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
         const string& inName, uint8 inIndexNr, M6BasicIndexPtr inIndex)
     : M6BasicIx(inFullTextIndex, inLexicon, inName, inIndexNr)
-    , mIDLFile(nullptr)
+    , mName(inName)
+    , mIDLFile(inFullTextIndex.GetDbDirectory() / (inName + ".idl"), eReadWrite)
+    , mScratchFile(inFullTextIndex.GetDbDirectory() / (inName + "-0.idl.tmp"))
+    , mScratch(mScratchFile, eReadWrite)
     , mIDLBits(nullptr)
     , mIDLOffset(0)
     , mIndex(dynamic_cast<M6MultiIDLBasicIndex*>(inIndex.get()))
@@ -1091,14 +1762,30 @@ M6TextIx::M6TextIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
     mIndex->SetAutoCommit(false);
     mIndex->SetBatchMode(inLexicon);
     mFullTextIndex.SetUsesInDocLocation(mIndexNr);
-    mIDLFile = new M6File(
-        mFullTextIndex.GetDbDirectory() / (inName + ".idl"), eReadWrite);
+}
+
+M6TextIx::M6TextIx(const M6TextIx& inMain, uint32 inSlice)
+    : M6BasicIx(inMain)
+    , mName(inMain.mName)
+    , mIDLFile(inMain.mIDLFile)
+    , mScratchFile(mFullTextIndex.GetDbDirectory() /
+        (mName + '-' + boost::lexical_cast<string>(inSlice) + ".idl.tmp"))
+    , mScratch(mScratchFile, eReadWrite)
+    , mIDLBits(nullptr)
+    , mIDLOffset(0)
+    , mIndex(inMain.mIndex)
+{
 }
 
 M6TextIx::~M6TextIx()
 {
+    // the flush thread reads the scratch file
+    StopFlushThread();
+
     delete mIDLBits;
-    delete mIDLFile;
+
+    mScratch.Close();
+    fs::remove(mScratchFile);
 }
 
 void M6TextIx::AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL)
@@ -1107,8 +1794,8 @@ void M6TextIx::AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL)
 
     if (mIDLBits == nullptr)
     {
-        mIDLOffset = mIDLFile->Seek(0, SEEK_END);
-        mIDLBits = new M6OBitStream(*mIDLFile);
+        mIDLOffset = mScratch.Seek(0, SEEK_END);
+        mIDLBits = new M6OBitStream(mScratch);
     }
 
     CopyBits(*mIDLBits, inIDL);
@@ -1116,17 +1803,22 @@ void M6TextIx::AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL)
 
 void M6TextIx::FlushTerm(uint32 inTerm, uint32 inDocCount)
 {
+    if (mIDLBits != nullptr)
+    {
+        mIDLBits->Sync();
+        delete mIDLBits;
+        mIDLBits = nullptr;
+    }
+
     if (mDocCount > 0 and not mBits.Empty())
     {
         // flush the raw index bits
         mBits.Sync();
 
-        if (mIDLBits != nullptr)
-            mIDLBits->Sync();
-
         FlushedIDLTerm* termData = new FlushedIDLTerm;
         termData->mTerm = inTerm;
         termData->mIDLOffset = mIDLOffset;
+        termData->mIDLSize = mScratch.Size() - mIDLOffset;
 
         M6IBitStream bits(mBits);
 
@@ -1145,12 +1837,6 @@ void M6TextIx::FlushTerm(uint32 inTerm, uint32 inDocCount)
 
     mBits.Clear();
 
-    if (mIDLBits != nullptr)
-        mIDLBits->Sync();
-
-    delete mIDLBits;
-    mIDLBits = nullptr;
-
     mDocCount = 0;
     mLastDoc = 0;
 }
@@ -1159,7 +1845,25 @@ void M6TextIx::FlushTerm(FlushedTerm* inTermData)
 {
     FlushedIDLTerm* idlTerm = static_cast<FlushedIDLTerm*>(inTermData);
 
-    mIndex->Insert(idlTerm->mTerm, idlTerm->mIDLOffset, idlTerm->mDocs);
+    // copy the locations from the scratch file, the flush thread only
+    // reads the part that was synced before the term was queued
+    int64 idlOffset = mIDLFile.Seek(0, SEEK_END);
+
+    char buffer[65536];
+    for (int64 offset = idlTerm->mIDLOffset, size = idlTerm->mIDLSize; size > 0; )
+    {
+        int64 n = size;
+        if (n > static_cast<int64>(sizeof(buffer)))
+            n = sizeof(buffer);
+
+        mScratch.PRead(buffer, n, offset);
+        mIDLFile.Write(buffer, n);
+
+        offset += n;
+        size -= n;
+    }
+
+    mIndex->Insert(idlTerm->mTerm, idlOffset, idlTerm->mDocs);
     delete idlTerm;
 }
 
@@ -1177,10 +1881,15 @@ class M6WeightedWordIx : public M6BasicIx
                     M6WeightedWordIx(M6FullTextIx& inFullTextIndex, M6Lexicon& inLexicon,
                         const string& inName, uint8 inIndexNr, M6BasicIndexPtr inIndex);
 
+    virtual M6BasicIx*
+                    CreateSlice(uint32 inSlice)                { return new M6WeightedWordIx(*this); }
+
     virtual void    AddDocTerm(uint32 inDoc, uint8 inFrequency, M6OBitStream& inIDL);
     virtual void    FlushTerm(uint32 inTerm, uint32 inDocCount);
 
   private:
+                    M6WeightedWordIx(const M6WeightedWordIx& inMain)
+                        : M6BasicIx(inMain), mIndex(inMain.mIndex) {}
 
     virtual void    FlushTerm(FlushedTerm* inTermData);
 
@@ -1272,29 +1981,69 @@ void M6WeightedWordIx::FlushTerm(FlushedTerm* inTermData)
 class M6BatchIndexProcessor
 {
   public:
-                M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon);
+                M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon,
+                    uint32 inMemoryBudget);
                 ~M6BatchIndexProcessor();
 
-    void        IndexTokens(const string& inIndexName, M6DataType inDataType,
-                    const M6InputDocument::M6TokenList& inTokens);
-    void        IndexValue(const string& inIndexName, M6DataType inDataType,
-                    const string& inValue, bool inUnique, uint32 inDocNr);
-    void        IndexValue(const string& inIndexName, double inValue, bool inUnique, uint32 inDocNr);
-    void        IndexLink(uint32 inDocNr, const string& inDB, const string& inID);
-    void        FlushDoc(uint32 inDocNr);
+    // These may be called from several indexing threads at once, each
+    // thread passing in its own shard. A shard holds the words of the
+    // current document, the indices looked up so far and the values that
+    // still have to be added to the value and unique indices. Those are
+    // added in batches of kM6ShardValueCount, so the mutex is taken once
+    // per batch instead of once per value. FlushValues adds the remaining
+    // values, each thread calls it before it stops.
+    typedef M6FullTextIx::M6DocWordBuffer    M6DocWordBuffer;
+
+    struct M6PendingValue
+    {
+        string            mIndexName;
+        M6DataType        mDataType;
+        bool            mUnique;
+        bool            mIsDouble;        // the value is mFloatValue, not mValue
+        string            mValue;
+        double            mFloatValue;
+        uint32            mDocNr;
+    };
+
+    static const uint32 kM6ShardValueCount = 4096;
+
+    struct M6IndexShard
+    {
+        M6DocWordBuffer    mWords;
+        map<pair<string,M6IndexType>,M6BasicIx*>
+                        mIndices;
+        vector<M6PendingValue>
+                        mValues;
+    };
+
+    void        IndexTokens(M6IndexShard& ioShard, const string& inIndexName,
+                    M6DataType inDataType, const M6InputDocument::M6TokenList& inTokens);
+    void        IndexValue(M6IndexShard& ioShard, const string& inIndexName,
+                    M6DataType inDataType, const string& inValue, bool inUnique, uint32 inDocNr);
+    void        IndexValue(M6IndexShard& ioShard, const string& inIndexName,
+                    double inValue, bool inUnique, uint32 inDocNr);
+    void        IndexLink(M6IndexShard& ioShard, uint32 inDocNr, const string& inDB, const string& inID);
+    void        FlushDoc(M6IndexShard& ioShard, uint32 inDocNr);
+    void        FlushValues(M6IndexShard& ioShard);
     void        Finish(uint32 inDocCount);
 
   private:
 
     template<class T>
-    M6BasicIx*    GetIndexBase(const string& inName, M6IndexType inType);
+    M6BasicIx*    GetIndexBase(M6IndexShard& ioShard, const string& inName, M6IndexType inType);
+
+    void        AddPendingValue(M6IndexShard& ioShard, const M6PendingValue& inValue);
 
     template<M6IndexType Ix, class Vx>
     M6BasicValueIx* GetValueIndex(const string& inName);
 
+    void        AssembleSlice(uint32 inSlice, vector<M6BasicIx*>& inIndices,
+                    uint32 inDocCount, M6Progress& inProgress);
+
     M6FullTextIx        mFullTextIndex;
     M6DatabankImpl&        mDatabank;
     M6Lexicon&            mLexicon;
+    boost::mutex        mMutex;
 
     struct M6BasicIxDesc
     {
@@ -1318,8 +2067,9 @@ class M6BatchIndexProcessor
     M6ValueIxDescList    mValueIndices;
 };
 
-M6BatchIndexProcessor::M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon)
-    : mFullTextIndex(inDatabank.GetDbDirectory(), "full-text.tmp")
+M6BatchIndexProcessor::M6BatchIndexProcessor(M6DatabankImpl& inDatabank, M6Lexicon& inLexicon,
+        uint32 inMemoryBudget)
+    : mFullTextIndex(inDatabank.GetDbDirectory(), "full-text.tmp", inMemoryBudget * 1024LL * 1024)
     , mDatabank(inDatabank)
     , mLexicon(inLexicon)
 {
@@ -1335,8 +2085,15 @@ M6BatchIndexProcessor::~M6BatchIndexProcessor()
 }
 
 template<class T>
-M6BasicIx* M6BatchIndexProcessor::GetIndexBase(const string& inName, M6IndexType inType)
+M6BasicIx* M6BatchIndexProcessor::GetIndexBase(M6IndexShard& ioShard, const string& inName,
+    M6IndexType inType)
 {
+    auto cached = ioShard.mIndices.find(make_pair(inName, inType));
+    if (cached != ioShard.mIndices.end())
+        return cached->second;
+
+    boost::mutex::scoped_lock lock(mMutex);
+
     T* result = nullptr;
     for (M6BasicIxDesc& ix : mIndices)
     {
@@ -1360,6 +2117,8 @@ M6BasicIx* M6BatchIndexProcessor::GetIndexBase(const string& inName, M6IndexType
         mIndices.push_back(desc);
     }
 
+    ioShard.mIndices[make_pair(inName, inType)] = result;
+
     return result;
 }
 
@@ -1390,7 +2149,7 @@ M6BasicValueIx* M6BatchIndexProcessor::GetValueIndex(const string& inName)
     return result;
 }
 
-void M6BatchIndexProcessor::IndexTokens(const string& inIndexName,
+void M6BatchIndexProcessor::IndexTokens(M6IndexShard& ioShard, const string& inIndexName,
     M6DataType inDataType, const M6InputDocument::M6TokenList& inTokens)
 {
     if (not inTokens.empty())
@@ -1398,122 +2157,125 @@ void M6BatchIndexProcessor::IndexTokens(const string& inIndexName,
         if (inDataType == eM6StringData)
         {
             for (uint32 t : inTokens)
-                mFullTextIndex.AddWord(0, t);
+                mFullTextIndex.AddWord(ioShard.mWords, 0, t);
         }
         else
         {
-            M6BasicIx* index = GetIndexBase<M6TextIx>(inIndexName, eM6CharMultiIDLIndex);
+            M6BasicIx* index = GetIndexBase<M6TextIx>(ioShard, inIndexName, eM6CharMultiIDLIndex);
             for (uint32 t : inTokens)
-                index->AddWord(t);
+                index->AddWord(ioShard.mWords, t);
         }
     }
 }
 
-void M6BatchIndexProcessor::IndexValue(const string& inIndexName,
+void M6BatchIndexProcessor::IndexValue(M6IndexShard& ioShard, const string& inIndexName,
     M6DataType inDataType, const string& inValue, bool inUnique, uint32 inDocNr)
 {
-    if (inUnique)
-    {
-        M6BasicIndexPtr index;
-
-        switch (inDataType)
-        {
-            case eM6StringData:    index = mDatabank.CreateIndex(inIndexName, eM6CharIndex); break;
-            case eM6NumberData:    index = mDatabank.CreateIndex(inIndexName, eM6NumberIndex); break;
-            case eM6FloatData:    index = mDatabank.CreateIndex(inIndexName, eM6FloatIndex); break;
-//            case eM6DateData:    index = mDatabank.CreateIndex(inIndexName, eM6DateIndex); break;
-            default:            THROW(("Runtime error, unexpected index type"));
-        }
-
-        try
-        {
-            index->Insert(inValue, inDocNr);
-        }
-        catch (M6DuplicateKeyException& e)
-        {
-            cerr << endl << inValue << ": " << e.what() << endl;
-        }
-    }
-    else if (inDataType == eM6FloatData)
-    {
-        M6BasicValueIx* index = GetValueIndex<eM6FloatMultiIndex,M6FloatIx>(inIndexName);
-        index->AddValue(inValue, inDocNr);
-    }
-    else if (inDataType == eM6NumberData)
+    if (inUnique or inDataType == eM6FloatData or inDataType == eM6NumberData)
     {
-        M6BasicValueIx* index = GetValueIndex<eM6NumberMultiIndex,M6NumberIx>(inIndexName);
-        index->AddValue(inValue, inDocNr);
+        M6PendingValue value = { inIndexName, inDataType, inUnique, false, inValue, 0, inDocNr };
+        AddPendingValue(ioShard, value);
     }
     else if (inValue.length() <= kM6MaxKeyLength and inDataType == eM6StringData)
     {
         // too bad, we still have to go through the old route
-        M6BasicIx* index = GetIndexBase<M6StringIx>(inIndexName, eM6CharMultiIndex);
+        M6BasicIx* index = GetIndexBase<M6StringIx>(ioShard, inIndexName, eM6CharMultiIndex);
 
-        uint32 t = 0;
+        index->AddWord(ioShard.mWords, mLexicon.Store(inValue));
+    }
+}
 
-        {
-            M6Lexicon::M6SharedLock lock(mLexicon);
-            t = mLexicon.Lookup(inValue);
-        }
+void M6BatchIndexProcessor::IndexValue(M6IndexShard& ioShard, const string& inIndexName,
+    double inValue, bool inUnique, uint32 inDocNr)
+{
+    M6PendingValue value = { inIndexName, eM6FloatData, inUnique, true, string(), inValue, inDocNr };
+    AddPendingValue(ioShard, value);
+}
 
-        if (t == 0)
-        {
-            M6Lexicon::M6UniqueLock lock(mLexicon);
-            t = mLexicon.Store(inValue);
-        }
+void M6BatchIndexProcessor::AddPendingValue(M6IndexShard& ioShard, const M6PendingValue& inValue)
+{
+    ioShard.mValues.push_back(inValue);
 
-        index->AddWord(t);
-    }
+    if (ioShard.mValues.size() >= kM6ShardValueCount)
+        FlushValues(ioShard);
 }
 
-void M6BatchIndexProcessor::IndexValue(const string& inIndexName,
-    double inValue, bool inUnique, uint32 inDocNr)
+void M6BatchIndexProcessor::FlushValues(M6IndexShard& ioShard)
 {
-    if (inUnique)
+    boost::mutex::scoped_lock lock(mMutex);
+
+    for (const M6PendingValue& v : ioShard.mValues)
     {
-        M6BasicIndexPtr index = mDatabank.CreateIndex(inIndexName, eM6FloatIndex);
-        try
+        if (v.mUnique)
+        {
+            M6BasicIndexPtr index;
+
+            switch (v.mDataType)
+            {
+                case eM6StringData:    index = mDatabank.CreateIndex(v.mIndexName, eM6CharIndex); break;
+                case eM6NumberData:    index = mDatabank.CreateIndex(v.mIndexName, eM6NumberIndex); break;
+                case eM6FloatData:    index = mDatabank.CreateIndex(v.mIndexName, eM6FloatIndex); break;
+//                case eM6DateData:    index = mDatabank.CreateIndex(v.mIndexName, eM6DateIndex); break;
+                default:            THROW(("Runtime error, unexpected index type"));
+            }
+
+            // Insert converts the value to a key, a double is passed as text
+            // that converts back to exactly the same value
+            string value = v.mIsDouble ? (boost::format("%.17g") % v.mFloatValue).str() : v.mValue;
+
+            try
+            {
+                index->Insert(value, v.mDocNr);
+            }
+            catch (M6DuplicateKeyException& e)
+            {
+                cerr << endl << value << ": " << e.what() << endl;
+
+                // shards are flushed in no particular order, make sure
+                // the first document with this key wins, as it would
+                // in a sequential build
+                string key = index->StringToKey(value);
+
+                uint32 docNr;
+                if (index->Find(key, docNr) and docNr > v.mDocNr)
+                {
+                    index->Erase(key);
+                    index->Insert(value, v.mDocNr);
+                }
+            }
+        }
+        else if (v.mDataType == eM6FloatData)
         {
-            index->Insert(inValue, inDocNr);
+            M6BasicValueIx* index = GetValueIndex<eM6FloatMultiIndex,M6FloatIx>(v.mIndexName);
+            if (v.mIsDouble)
+                index->AddValue(v.mFloatValue, v.mDocNr);
+            else
+                index->AddValue(v.mValue, v.mDocNr);
         }
-        catch (M6DuplicateKeyException& e)
+        else
         {
-            cerr << endl << inValue << ": " << e.what() << endl;
+            M6BasicValueIx* index = GetValueIndex<eM6NumberMultiIndex,M6NumberIx>(v.mIndexName);
+            index->AddValue(v.mValue, v.mDocNr);
         }
     }
-    else
-    {
-        M6BasicValueIx* index = GetValueIndex<eM6FloatMultiIndex,M6FloatIx>(inIndexName);
-        index->AddValue(inValue, inDocNr);
-    }
+
+    ioShard.mValues.clear();
 }
 
-void M6BatchIndexProcessor::IndexLink(uint32 inDocNr, const string& inDB, const string& inID)
+void M6BatchIndexProcessor::IndexLink(M6IndexShard& ioShard, uint32 inDocNr,
+    const string& inDB, const string& inID)
 {
     string db = zeep::http::encode_url(inDB);
     ba::replace_all(db, "/", "%2F");
 
-    M6BasicIx* index = GetIndexBase<M6StringIx>(db, eM6LinkIndex);
-
-    uint32 t = 0;
-
-    {
-        M6Lexicon::M6SharedLock lock(mLexicon);
-        t = mLexicon.Lookup(inID);
-    }
-
-    if (t == 0)
-    {
-        M6Lexicon::M6UniqueLock lock(mLexicon);
-        t = mLexicon.Store(inID);
-    }
+    M6BasicIx* index = GetIndexBase<M6StringIx>(ioShard, db, eM6LinkIndex);
 
-    index->AddWord(t);
+    index->AddWord(ioShard.mWords, mLexicon.Store(inID));
 }
 
-void M6BatchIndexProcessor::FlushDoc(uint32 inDocNr)
+void M6BatchIndexProcessor::FlushDoc(M6IndexShard& ioShard, uint32 inDocNr)
 {
-    mFullTextIndex.FlushDoc(inDocNr);
+    mFullTextIndex.FlushDoc(ioShard.mWords, inDocNr);
 }
 
 void M6BatchIndexProcessor::Finish(uint32 inDocCount)
@@ -1527,58 +2289,59 @@ void M6BatchIndexProcessor::Finish(uint32 inDocCount)
     for_each(mIndices.begin(), mIndices.end(), [&inDocCount](M6BasicIxDesc& ix) { ix.mBasicIx->SetDbDocCount(inDocCount); });
 
     // Flush the entry buffer and set up for reading back in the sorted entries
-    int64 entryCount = mFullTextIndex.Finish(), entriesRead = 0;
-
-    // the next loop is very *hot*, make sure it is optimized as much as possible.
-    //
-    M6FullTextIx::M6BufferEntry ie;
-    if (not mFullTextIndex.NextEntry(ie))
+    int64 entryCount = mFullTextIndex.Finish();
+    if (entryCount == 0)
         THROW(("Nothing was indexed..."));
 
-    // now create the progress indicator
-    M6Progress progress(mDatabank.GetID(), entryCount, "assembling index");
+    // Each slice of the entry buffer is assembled by its own thread, using
+    // its own set of M6BasicIx objects. The first slice uses the original ones.
+    uint32 sliceCount = mFullTextIndex.GetSliceCount();
+    vector<vector<M6BasicIx*>> slices(sliceCount);
 
-    uint32 lastTerm = ie.term;
-    uint32 lastDoc = ie.doc;
-    uint32 termFrequency = ie.weight;
-
-    M6IndexMap exclude = mFullTextIndex.GetFullTextIxMap();
+    for (M6BasicIxDesc& ix : mIndices)
+        slices[0].push_back(ix.mBasicIx);
 
-    do
+    for (uint32 slice = 1; slice < sliceCount; ++slice)
     {
-        assert(ie.doc <= inDocCount);
-        assert(ie.term > lastTerm or (ie.term == lastTerm and ie.doc >= lastDoc));
+        for (M6BasicIxDesc& ix : mIndices)
+            slices[slice].push_back(ix.mBasicIx->CreateSlice(slice));
+    }
+
+    exception_ptr ex;
 
-        ++entriesRead;
+    {    // scope to force destruction of progress bar
+        M6Progress progress(mDatabank.GetID(), entryCount, "assembling index");
 
-        if ((entriesRead % 10000) == 0)
-            progress.Progress(entriesRead);
+        boost::thread_group g;
+        boost::mutex m;
 
-        if (lastDoc != ie.doc or lastTerm != ie.term)
+        for (uint32 slice = 0; slice < sliceCount; ++slice)
         {
-            if (termFrequency > 0)
-                mIndices.back().mBasicIx->AddDocTerm(lastDoc, lastTerm, termFrequency, ie.idl);
-
-            lastDoc = ie.doc;
-            lastTerm = ie.term;
-            termFrequency = 0;
+            g.create_thread([&, slice]()
+            {
+                try
+                {
+                    AssembleSlice(slice, slices[slice], inDocCount, progress);
+                }
+                catch (...)
+                {
+                    boost::mutex::scoped_lock lock(m);
+                    ex = current_exception();
+                }
+            });
         }
 
-        if (ie.ix > 0)
-            mIndices[ie.ix - 1].mBasicIx->AddDocTerm(ie.doc, ie.term, ie.weight, ie.idl);
-
-        if (not exclude[ie.ix])
-            termFrequency += ie.weight;
-
-        if (termFrequency > numeric_limits<uint8>::max())
-            termFrequency = numeric_limits<uint8>::max();
+        g.join_all();
     }
-    while (mFullTextIndex.NextEntry(ie));
 
-    // flush
-    for_each(mIndices.begin(), mIndices.end(), [&ie](M6BasicIxDesc& ix) { ix.mBasicIx->AddDocTerm(0, 0, 0, ie.idl); });
+    for (uint32 slice = 1; slice < sliceCount; ++slice)
+    {
+        for (M6BasicIx* ix : slices[slice])
+            delete ix;
+    }
 
-    progress.Progress(entriesRead);
+    if (not (ex == exception_ptr()))
+        rethrow_exception(ex);
 
     // write float indices
     if (not mValueIndices.empty())
@@ -1594,6 +2357,64 @@ void M6BatchIndexProcessor::Finish(uint32 inDocCount)
     }
 }
 
+void M6BatchIndexProcessor::AssembleSlice(uint32 inSlice, vector<M6BasicIx*>& inIndices,
+    uint32 inDocCount, M6Progress& inProgress)
+{
+    M6OBitStream noIDL;
+
+    // the next loop is very *hot*, make sure it is optimized as much as possible.
+    //
+    M6FullTextIx::M6BufferEntry ie;
+    if (mFullTextIndex.NextEntry(inSlice, ie))
+    {
+        M6BasicIx* allText = inIndices.back();
+        M6IndexMap exclude = mFullTextIndex.GetFullTextIxMap();
+
+        uint32 lastTerm = ie.term;
+        uint32 lastDoc = ie.doc;
+        uint32 termFrequency = 0;
+        int64 entriesRead = 0;
+
+        do
+        {
+            assert(ie.doc <= inDocCount);
+            assert(ie.term > lastTerm or (ie.term == lastTerm and ie.doc >= lastDoc));
+
+            if ((++entriesRead % 10000) == 0)
+                inProgress.Consumed(10000);
+
+            if (lastDoc != ie.doc or lastTerm != ie.term)
+            {
+                if (termFrequency > 0)
+                    allText->AddDocTerm(lastDoc, lastTerm, termFrequency, noIDL);
+
+                lastDoc = ie.doc;
+                lastTerm = ie.term;
+                termFrequency = 0;
+            }
+
+            if (ie.ix > 0)
+                inIndices[ie.ix - 1]->AddDocTerm(ie.doc, ie.term, ie.weight, ie.idl);
+
+            if (not exclude[ie.ix])
+                termFrequency += ie.weight;
+
+            if (termFrequency > numeric_limits<uint8>::max())
+                termFrequency = numeric_limits<uint8>::max();
+        }
+        while (mFullTextIndex.NextEntry(inSlice, ie));
+
+        if (termFrequency > 0)
+            allText->AddDocTerm(lastDoc, lastTerm, termFrequency, noIDL);
+
+        inProgress.Consumed(entriesRead % 10000);
+    }
+
+    // flush
+    for (M6BasicIx* ix : inIndices)
+        ix->AddDocTerm(0, 0, 0, noIDL);
+}
+
 // --------------------------------------------------------------------
 
 string determineDatabankVersion(fs::path dbDirectory)
@@ -1623,10 +2444,14 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const fs::path& inPath, M
     : mDatabank(inDatabank)
     , mDbDirectory(inPath)
     , mFastaFile(nullptr)
+    , mFastaSize(0)
+    , mFastaData(nullptr)
+    , mFastaOffsets(nullptr)
     , mMode(inMode)
     , mStore(nullptr)
     , mDictionary(nullptr)
     , mBatch(nullptr)
+    , mDeletedCount(0)
 {
     if (not fs::is_directory(mDbDirectory))
         THROW(("databank path is invalid (%s)", inPath.string().c_str()));
@@ -1687,13 +2512,19 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const fs::path& inPath, M
         if (name == "full-text")
             continue;
 
-        M6BasicIndexPtr index(M6BasicIndex::Load(ix->path()));
+        M6BasicIndexPtr index(M6BasicIndex::Load(ix->path(), mMode));
         mIndices.push_back(M6IndexDesc(name, indexNames[name], index->GetIndexType(), index));
     }
 
     if (mDocWeights.empty())
         RecalculateDocumentWeights();
 
+    if (fs::exists(mDbDirectory / "fasta") and fs::exists(mDbDirectory / "fasta.offsets"))
+    {
+        mFastaData = new M6File(mDbDirectory / "fasta", eReadOnly);
+        mFastaOffsets = new M6File(mDbDirectory / "fasta.offsets", eReadOnly);
+    }
+
     fs::path dict(mDbDirectory / "full-text.dict");
 
 //    if (not fs::exists(dict) or fs::file_size(dict) == 0)
@@ -1724,6 +2555,8 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const fs::path& inPath, M
         ptime t = from_time_t(fs::last_write_time(mDbDirectory));
         mVersion = to_iso_extended_string(t.date());
     }
+
+    LoadSegments();
 }
 
 M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const string& inDatabankID,
@@ -1733,10 +2566,14 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const string& inDatabankI
     , mDbDirectory(inPath)
     , mVersion(inVersion)
     , mFastaFile(nullptr)
+    , mFastaSize(0)
+    , mFastaData(nullptr)
+    , mFastaOffsets(nullptr)
     , mMode(eReadWrite)
     , mStore(nullptr)
     , mDictionary(nullptr)
     , mBatch(nullptr)
+    , mDeletedCount(0)
 {
     if (fs::exists(inPath))
         fs::remove_all(inPath);
@@ -1757,6 +2594,9 @@ M6DatabankImpl::M6DatabankImpl(M6Databank& inDatabank, const string& inDatabankI
         versionFile << mVersion << endl;
     }
 
+    fs::ofstream tokenizerFile(mDbDirectory / "tokenizer.txt");
+    tokenizerFile << M6Tokenizer::kVersion << endl;
+
     if (not inIndexNames.empty())
     {
         fs::ofstream nameFile(mDbDirectory / "index-names.txt");
@@ -1771,9 +2611,7 @@ M6DatabankImpl::~M6DatabankImpl()
         When an exception occurs, make the threads stop before
         deleting the data structures that they are using.
      */
-    mStoreQueue.Put(nullptr);
-    mStoreThread.join();
-    mIndexThread.join();
+    StopBatchThreads();
 
     boost::unique_lock<boost::mutex> lock(mMutex);
 
@@ -1784,12 +2622,207 @@ M6DatabankImpl::~M6DatabankImpl()
     delete mStore;
 
     delete mFastaFile;
+    delete mFastaData;
+    delete mFastaOffsets;
     delete mDictionary;
+
+    for (M6Segment& segment : mSegments)
+        delete segment.mDatabank;
+}
+
+// --------------------------------------------------------------------
+//    The segment manifest and the list of deleted documents are replaced
+//    as a whole, new versions are written to a temporary file first.
+//    Deleted documents in the base that were removed from the document
+//    store by a Vacuum are listed in the file erased. The indices still
+//    refer to them, so they are filtered out like the deleted documents.
+
+namespace
+{
+
+void ReadDeletedDocs(const fs::path& inDbDirectory, vector<uint32>& outDocs,
+    const string& inName = "deleted")
+{
+    if (fs::exists(inDbDirectory / inName))
+    {
+        fs::ifstream file(inDbDirectory / inName, ios::binary);
+
+        uint32 docNr;
+        while (file.read(reinterpret_cast<char*>(&docNr), sizeof(docNr)))
+            outDocs.push_back(docNr);
+    }
+}
+
+void WriteDeletedDocs(const fs::path& inDbDirectory, vector<uint32>& inDocs,
+    const string& inName = "deleted")
+{
+    // the list of deleted documents is kept sorted
+    sort(inDocs.begin(), inDocs.end());
+    inDocs.erase(unique(inDocs.begin(), inDocs.end()), inDocs.end());
+
+    {
+        fs::ofstream file(inDbDirectory / (inName + ".tmp"), ios::binary|ios::trunc);
+        if (not inDocs.empty())
+            file.write(reinterpret_cast<const char*>(&inDocs[0]), inDocs.size() * sizeof(uint32));
+        if (not file)
+            THROW(("Error writing deleted documents"));
+    }
+
+    fs::rename(inDbDirectory / (inName + ".tmp"), inDbDirectory / inName);
+}
+
+// The directories of merged segments are listed in garbage.txt, they
+// are removed by CollectGarbage.
+
+void ReadGarbage(const fs::path& inDbDirectory, vector<string>& outSegments)
+{
+    if (fs::exists(inDbDirectory / "garbage.txt"))
+    {
+        fs::ifstream file(inDbDirectory / "garbage.txt");
+
+        string line;
+        while (getline(file, line))
+        {
+            if (not line.empty())
+                outSegments.push_back(line);
+        }
+    }
+}
+
+void WriteGarbage(const fs::path& inDbDirectory, const vector<string>& inSegments)
+{
+    {
+        fs::ofstream file(inDbDirectory / "garbage.tmp", ios::trunc);
+
+        for (const string& segment : inSegments)
+            file << segment << endl;
+
+        if (not file)
+            THROW(("Error writing garbage list"));
+    }
+
+    fs::rename(inDbDirectory / "garbage.tmp", inDbDirectory / "garbage.txt");
+}
+
+void WriteManifest(const fs::path& inDbDirectory, const M6SegmentInfoList& inSegments)
+{
+    {
+        fs::ofstream file(inDbDirectory / "segments.tmp", ios::trunc);
+
+        for (const M6SegmentInfo& segment : inSegments)
+            file << segment.mName << '\t' << segment.mDocBase << '\t' << segment.mDocCount << endl;
+
+        if (not file)
+            THROW(("Error writing segment list"));
+    }
+
+    // the contents changed, so does the uuid
+    {
+        fs::ofstream file(inDbDirectory / "uuid.tmp", ios::trunc);
+        file << to_string(boost::uuids::random_generator()()) << endl;
+
+        if (not file)
+            THROW(("Error writing uuid"));
+    }
+
+    // the uuid is replaced first, a crash in between leaves a new uuid
+    // with the old segments, which only costs a reload of cached pages
+    fs::rename(inDbDirectory / "uuid.tmp", inDbDirectory / "uuid");
+    fs::rename(inDbDirectory / "segments.tmp", inDbDirectory / "segments.txt");
+}
+
+}
+
+void M6DatabankImpl::LoadSegments()
+{
+    M6SegmentInfoList segments;
+    M6Databank::GetSegments(mDbDirectory, segments);
+
+    for (const M6SegmentInfo& info : segments)
+    {
+        M6Segment segment = {
+            new M6Databank(mDbDirectory / "segments" / info.mName, eReadOnly),
+            info.mDocBase
+        };
+
+        mSegments.push_back(segment);
+    }
+
+    vector<uint32> deleted, erased;
+    ReadDeletedDocs(mDbDirectory, deleted);
+    ReadDeletedDocs(mDbDirectory, erased, "erased");
+
+    if (not (deleted.empty() and erased.empty()))
+    {
+        mDeleted.assign(GetLastDocNr() + 1, false);
+
+        // erased documents are not in the document store, nor in its size
+        for (uint32 docNr : erased)
+        {
+            if (docNr < mDeleted.size())
+                mDeleted[docNr] = true;
+        }
+
+        for (uint32 docNr : deleted)
+        {
+            if (docNr < mDeleted.size() and not mDeleted[docNr])
+            {
+                mDeleted[docNr] = true;
+                ++mDeletedCount;
+            }
+        }
+    }
+}
+
+uint32 M6DatabankImpl::size() const
+{
+    uint32 result = mStore->size();
+    for (const M6Segment& segment : mSegments)
+        result += segment.mDatabank->size();
+    return result - mDeletedCount;
+}
+
+uint32 M6DatabankImpl::GetLastDocNr() const
+{
+    uint32 result = GetMaxDocNr();
+    if (not mSegments.empty())
+        result = mSegments.back().mDocBase + mSegments.back().mDatabank->GetMaxDocNr();
+    return result;
+}
+
+M6Iterator* M6DatabankImpl::CombineSegments(M6Iterator* inIter,
+    function<M6Iterator*(M6Databank&)> inFind)
+{
+    if (not HasSegments())
+        return inIter;
+
+    unique_ptr<M6UnionIterator> result(new M6UnionIterator);
+
+    if (inIter != nullptr)
+        result->AddIterator(new M6SegmentIterator(inIter, 0, mDeleted));
+
+    for (M6Segment& segment : mSegments)
+    {
+        M6Iterator* iter = inFind(*segment.mDatabank);
+        if (iter != nullptr)
+            result->AddIterator(new M6SegmentIterator(iter, segment.mDocBase, mDeleted));
+    }
+
+    return result.release();
+}
+
+M6Iterator* M6DatabankImpl::FilterDeleted(M6Iterator* inIter)
+{
+    M6Iterator* result = inIter;
+    if (inIter != nullptr and mDeletedCount > 0)
+        result = new M6SegmentIterator(inIter, 0, mDeleted);
+    return result;
 }
 
 void M6DatabankImpl::GetInfo(M6DatabankInfo& outInfo)
 {
     mStore->GetInfo(outInfo.mDocCount, outInfo.mDataStoreSize, outInfo.mRawTextSize);
+    outInfo.mDocCount = size();
 
     for (const M6IndexDesc& desc : mIndices)
     {
@@ -1816,6 +2849,16 @@ void M6DatabankImpl::GetInfo(M6DatabankInfo& outInfo)
             });
     }
 
+    for (M6Segment& segment : mSegments)
+    {
+        M6DatabankInfo info;
+        segment.mDatabank->GetInfo(info);
+
+        outInfo.mDataStoreSize += info.mDataStoreSize;
+        outInfo.mRawTextSize += info.mRawTextSize;
+        outInfo.mTotalSize += info.mTotalSize;
+    }
+
     outInfo.mUUID = mUUID;
     outInfo.mVersion = mVersion;
 
@@ -1909,83 +2952,165 @@ M6BasicIndexPtr M6DatabankImpl::CreateIndex(const string& inName, M6IndexType in
 
 void M6DatabankImpl::StoreThread()
 {
+    using namespace boost::posix_time;
+
     try
     {
+        ptime start = microsec_clock::universal_time();
+
         for (;;)
         {
             M6InputDocument* doc = mStoreQueue.Get();
+            mStoreCounter.mStarved += M6StageCounter::Elapsed(start);
+
             if (doc == nullptr)
                 break;
 
+            // the document store serializes the actual appends
             doc->Store();
 
             const string& fasta = doc->GetFasta();
             if (not fasta.empty())
-            {
-                if (mFastaFile == nullptr)
-                {
-                    mFastaFile = new fs::ofstream(mDbDirectory / "fasta", ios_base::out|ios_base::trunc|ios_base::binary);
-                    if (not mFastaFile->is_open())
-                        throw runtime_error("could not create fasta file");
-                }
-                *mFastaFile << fasta;
-            }
+                StoreFasta(doc->GetDocNr(), fasta);
+
+            mStoreCounter.mDocuments += 1;
+            mStoreCounter.mBytes += doc->Peek().length();
+            mStoreCounter.mBusy += M6StageCounter::Elapsed(start);
 
             mIndexQueue.Put(doc);
+            mStoreCounter.mBlocked += M6StageCounter::Elapsed(start);
         }
-
-        mIndexQueue.Put(nullptr);
     }
     catch (exception& e)
     {
         cerr << "exception in thread: " << e.what() << endl;
-        mException = current_exception();
+        SetException(current_exception());
+    }
+}
+
+void M6DatabankImpl::StoreFasta(uint32 inDocNr, const string& inFasta)
+{
+    boost::mutex::scoped_lock lock(mFastaMutex);
+
+    if (mFastaFile == nullptr)
+    {
+        mFastaFile = new fs::ofstream(mDbDirectory / "fasta", ios_base::out|ios_base::trunc|ios_base::binary);
+        if (not mFastaFile->is_open())
+            throw runtime_error("could not create fasta file");
+
+        // the old fasta, if any, is replaced
+        delete mFastaData;
+        mFastaData = nullptr;
+        delete mFastaOffsets;
+
+        if (fs::exists(mDbDirectory / "fasta.offsets"))
+            fs::remove(mDbDirectory / "fasta.offsets");
+        mFastaOffsets = new M6File(mDbDirectory / "fasta.offsets", eReadWrite);
+    }
+    *mFastaFile << inFasta;
+
+    M6FastaOffset offset = { mFastaSize, static_cast<int64>(inFasta.length()) };
+    mPendingFastaOffsets.push_back(make_pair(inDocNr, offset));
+    mFastaSize += inFasta.length();
+
+    if (mPendingFastaOffsets.size() >= kFastaOffsetBlockSize)
+        FlushFastaOffsets();
+}
+
+void M6DatabankImpl::FlushFastaOffsets()
+{
+    // The store threads hand in documents slightly out of order, the offsets
+    // are sorted and written in runs of consecutive document numbers.
+    sort(mPendingFastaOffsets.begin(), mPendingFastaOffsets.end(),
+        [](const pair<uint32,M6FastaOffset>& a, const pair<uint32,M6FastaOffset>& b) -> bool
+            { return a.first < b.first; });
+
+    vector<M6FastaOffset> run;
+    uint32 first = 0;
+
+    for (auto& pending : mPendingFastaOffsets)
+    {
+        if (not run.empty() and pending.first != first + run.size())
+        {
+            mFastaOffsets->PWrite(&run[0], run.size() * sizeof(M6FastaOffset), first * sizeof(M6FastaOffset));
+            run.clear();
+        }
+
+        if (run.empty())
+            first = pending.first;
+        run.push_back(pending.second);
     }
+
+    if (not run.empty())
+        mFastaOffsets->PWrite(&run[0], run.size() * sizeof(M6FastaOffset), first * sizeof(M6FastaOffset));
+
+    mPendingFastaOffsets.clear();
 }
 
 void M6DatabankImpl::IndexThread()
 {
+    using namespace boost::posix_time;
+
     try
     {
+        M6BatchIndexProcessor::M6IndexShard shard;
+        ptime start = microsec_clock::universal_time();
+
         for (;;)
         {
             M6InputDocument* doc = mIndexQueue.Get();
+            mIndexCounter.mStarved += M6StageCounter::Elapsed(start);
+
             if (doc == nullptr)
+            {
+                mBatch->FlushValues(shard);
                 break;
+            }
 
             uint32 docNr = doc->GetDocNr();
             assert(docNr > 0);
 
             for (const M6InputDocument::M6IndexTokens& d : doc->GetIndexTokens())
-                mBatch->IndexTokens(d.mIndexName, d.mDataType, d.mTokens);
+                mBatch->IndexTokens(shard, d.mIndexName, d.mDataType, d.mTokens);
 
             for (const M6InputDocument::M6IndexValue& v : doc->GetIndexValues())
             {
                 switch (v.mDataType)
                 {
-                    case eM6FloatData:    mBatch->IndexValue(v.mIndexName, v.mIndexFloatValue, v.mUnique, docNr); break;
-                    default:            mBatch->IndexValue(v.mIndexName, v.mDataType, v.mIndexValue, v.mUnique, docNr); break;
+                    case eM6FloatData:    mBatch->IndexValue(shard, v.mIndexName, v.mIndexFloatValue, v.mUnique, docNr); break;
+                    default:            mBatch->IndexValue(shard, v.mIndexName, v.mDataType, v.mIndexValue, v.mUnique, docNr); break;
                 }
             }
 
             for (const auto& lDb : doc->GetLinks())
             {
                 for (const string& lId : lDb.second)
-                    mBatch->IndexLink(docNr, lDb.first, lId);
+                    mBatch->IndexLink(shard, docNr, lDb.first, lId);
             }
 
-            mBatch->FlushDoc(docNr);
+            mBatch->FlushDoc(shard, docNr);
+
+            mIndexCounter.mDocuments += 1;
+            mIndexCounter.mBytes += doc->Peek().length();
 
             delete doc;
+
+            mIndexCounter.mBusy += M6StageCounter::Elapsed(start);
         }
     }
     catch (exception& e)
     {
         cerr << "exception in thread: " << e.what() << endl;
-        mException = current_exception();
+        SetException(current_exception());
     }
 }
 
+void M6DatabankImpl::SetException(exception_ptr inException)
+{
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mException = inException;
+}
+
 void M6DatabankImpl::Store(M6Document* inDocument)
 {
     if (not (mException == exception_ptr()))
@@ -2002,13 +3127,84 @@ void M6DatabankImpl::Store(M6Document* inDocument)
         mStoreQueue.Put(doc);
 }
 
-M6Document* M6DatabankImpl::Fetch(uint32 inDocNr)
-{
-    M6Document* result = nullptr;
+M6Document* M6DatabankImpl::Fetch(uint32 inDocNr)
+{
+    M6Document* result = nullptr;
+
+    if (inDocNr < mDeleted.size() and mDeleted[inDocNr])
+        return result;
+
+    for (auto segment = mSegments.rbegin(); segment != mSegments.rend(); ++segment)
+    {
+        if (inDocNr > segment->mDocBase)
+        {
+            // document numbers of merged segments are not reused
+            if (inDocNr - segment->mDocBase > segment->mDatabank->GetMaxDocNr())
+                return result;
+            return segment->mDatabank->Fetch(inDocNr - segment->mDocBase);
+        }
+    }
+
+    uint32 docPage, docSize;
+    bool pageAligned;
+    if (mStore->FetchDocument(inDocNr, docPage, docSize, pageAligned))
+        result = new M6OutputDocument(mDatabank, inDocNr, docPage, docSize, pageAligned);
+
+    return result;
+}
+
+bool M6DatabankImpl::Exists(uint32 inDocNr)
+{
+    if (inDocNr < mDeleted.size() and mDeleted[inDocNr])
+        return false;
+
+    for (auto segment = mSegments.rbegin(); segment != mSegments.rend(); ++segment)
+    {
+        if (inDocNr > segment->mDocBase)
+        {
+            // document numbers of merged segments are not reused
+            if (inDocNr - segment->mDocBase > segment->mDatabank->GetMaxDocNr())
+                return false;
+            return segment->mDatabank->Exists(inDocNr - segment->mDocBase);
+        }
+    }
+
+    uint32 docPage, docSize;
+    bool pageAligned;
+    return mStore->FetchDocument(inDocNr, docPage, docSize, pageAligned);
+}
+
+bool M6DatabankImpl::GetFasta(uint32 inDocNr, string& outFasta)
+{
+    bool result = false;
+
+    if (inDocNr < mDeleted.size() and mDeleted[inDocNr])
+        return result;
+
+    for (auto segment = mSegments.rbegin(); segment != mSegments.rend(); ++segment)
+    {
+        if (inDocNr > segment->mDocBase)
+        {
+            // document numbers of merged segments are not reused
+            if (inDocNr - segment->mDocBase > segment->mDatabank->GetMaxDocNr())
+                return result;
+            return segment->mDatabank->GetFasta(inDocNr - segment->mDocBase, outFasta);
+        }
+    }
+
+    if (mFastaData != nullptr and mFastaOffsets != nullptr and
+        static_cast<int64>((inDocNr + 1) * sizeof(M6FastaOffset)) <= mFastaOffsets->Size())
+    {
+        M6FastaOffset offset;
+        mFastaOffsets->PRead(offset, inDocNr * sizeof(M6FastaOffset));
 
-    uint32 docPage, docSize;
-    if (mStore->FetchDocument(inDocNr, docPage, docSize))
-        result = new M6OutputDocument(mDatabank, inDocNr, docPage, docSize);
+        if (offset.mSize > 0 and offset.mOffset + offset.mSize <= mFastaData->Size())
+        {
+            outFasta.resize(offset.mSize);
+            mFastaData->PRead(&outFasta[0], offset.mSize, offset.mOffset);
+            result = true;
+        }
+    }
 
     return result;
 }
@@ -2090,7 +3286,7 @@ M6Iterator* M6DatabankImpl::Find(const string& inQuery, bool inAllTermsRequired,
         inAllTermsRequired = false;
 
     if (terms.empty())
-        result = filter;
+        result = FilterDeleted(filter);
     else
         result = Find(terms, filter, inAllTermsRequired, inReportLimit);
 
@@ -2109,13 +3305,113 @@ M6Iterator* M6DatabankImpl::FindBoolean(const string& inQuery, uint32 inReportLi
     if (not isBooleanQuery)
         THROW(("Not a valid boolean query"));
 
-    return result;
+    return FilterDeleted(result);
 }
 
 extern double system_time();
 
 M6Iterator* M6DatabankImpl::Find(const vector<string>& inQueryTerms,
     M6Iterator* inFilter, bool inAllTermsRequired, uint32 inReportLimit)
+{
+    if (not HasSegments())
+        return FindInSegment(inQueryTerms, inFilter, inAllTermsRequired, inReportLimit);
+
+    // take ownership
+    unique_ptr<M6Iterator> filter(inFilter);
+
+    if (inReportLimit == 0 or inQueryTerms.empty())
+        return nullptr;
+
+    // the filter uses global document numbers, it is split over the segments
+    vector<uint32> filterDocs;
+    if (filter)
+    {
+        uint32 docNr;
+        float rank;
+        while (filter->Next(docNr, rank))
+            filterDocs.push_back(docNr);
+        sort(filterDocs.begin(), filterDocs.end());
+    }
+
+    // The IDF of each term is calculated over the base and all segments,
+    // as if they were one databank, deleted documents included. This keeps
+    // the ranks of the segments comparable.
+    vector<M6DatabankImpl*> parts(1, this);
+    for (M6Segment& segment : mSegments)
+        parts.push_back(segment.mDatabank->mImpl);
+
+    float maxD = static_cast<float>(GetLastDocNr());
+    map<string,float> idf;
+
+    for (const string& term : inQueryTerms)
+    {
+        if (idf.count(term))
+            continue;
+
+        uint32 docFrequency = 0;
+        for (M6DatabankImpl* part : parts)
+        {
+            M6WeightedBasicIndex::M6WeightedIterator iter;
+            if (static_cast<M6WeightedBasicIndex*>(part->mAllTextIndex.get())->Find(term, iter))
+                docFrequency += iter.GetCount();
+        }
+
+        if (docFrequency > 0)
+            idf[term] = log(1.f + maxD / docFrequency);
+    }
+
+    // Each segment is ranked on its own and the results are merged. The
+    // segments leave out their deleted documents, from the count as well.
+    vector<pair<uint32,float>> best;
+    uint32 count = 0;
+
+    for (uint32 s = 0; s < parts.size(); ++s)
+    {
+        uint32 docBase = s > 0 ? mSegments[s - 1].mDocBase : 0;
+        uint32 lastDocNr = s < mSegments.size() ? mSegments[s].mDocBase : GetLastDocNr();
+
+        M6Iterator* segmentFilter = nullptr;
+        if (filter)
+        {
+            vector<uint32> docs;
+            for (auto d = upper_bound(filterDocs.begin(), filterDocs.end(), docBase);
+                    d != filterDocs.end() and *d <= lastDocNr; ++d)
+                docs.push_back(*d - docBase);
+
+            if (docs.empty())
+                continue;
+
+            segmentFilter = new M6VectorIterator(docs);
+        }
+
+        unique_ptr<M6Iterator> iter(parts[s]->FindInSegment(inQueryTerms, segmentFilter,
+            inAllTermsRequired, inReportLimit, &idf, docBase, &mDeleted));
+
+        if (not iter)
+            continue;
+
+        count += iter->GetCount();
+
+        uint32 docNr;
+        float rank;
+        while (iter->Next(docNr, rank))
+            best.push_back(make_pair(docNr + docBase, rank));
+    }
+
+    stable_sort(best.begin(), best.end(), [](const pair<uint32,float>& a, const pair<uint32,float>& b) -> bool
+        { return a.second > b.second; });
+
+    if (best.size() > inReportLimit)
+        best.erase(best.begin() + inReportLimit, best.end());
+
+    M6Iterator* result = new M6VectorIterator(best);
+    result->SetCount(count);
+    return result;
+}
+
+M6Iterator* M6DatabankImpl::FindInSegment(const vector<string>& inQueryTerms,
+    M6Iterator* inFilter, bool inAllTermsRequired, uint32 inReportLimit,
+    const map<string,float>* inIDF, uint32 inDocBase, const vector<bool>* inDeleted)
 {
     // take ownership
     unique_ptr<M6Iterator> filter(inFilter);
@@ -2151,7 +3447,7 @@ M6Iterator* M6DatabankImpl::Find(const vector<string>& inQueryTerms,
         iter_ptr iter(new M6WeightedBasicIndex::M6WeightedIterator);
         if (static_cast<M6WeightedBasicIndex*>(mAllTextIndex.get())->Find(term, *iter))
         {
-            float idf = log(1.f + maxD / iter->GetCount());
+            float idf = inIDF ? inIDF->at(term) : log(1.f + maxD / iter->GetCount());
             terms.push_back(make_tuple(term, iter, 1, kM6MaxWeight * idf, idf));
         }
         else
@@ -2223,6 +3519,16 @@ M6Iterator* M6DatabankImpl::Find(const vector<string>& inQueryTerms,
         termCount = 0;
     A.Collect(docs, termCount);
 
+    uint32 count = A.GetHitCount();
+
+    if (inDeleted != nullptr)
+    {
+        const vector<bool>& deleted = *inDeleted;
+        docs.erase(remove_if(docs.begin(), docs.end(), [&deleted, inDocBase](uint32 inDocNr) -> bool
+            { return inDocNr + inDocBase < deleted.size() and deleted[inDocNr + inDocBase]; }), docs.end());
+        count = static_cast<uint32>(docs.size());
+    }
+
     if (inFilter != nullptr)
     {
         sort(docs.begin(), docs.end());
@@ -2234,7 +3540,6 @@ M6Iterator* M6DatabankImpl::Find(const vector<string>& inQueryTerms,
 
     vector<pair<uint32,float>> best;
 
-    uint32 count = A.GetHitCount();
     if (count > inReportLimit)
         best.reserve(inReportLimit);
     else
@@ -2307,7 +3612,8 @@ M6Iterator* M6DatabankImpl::Find(const string& inIndex, const string& inTerm, M6
     else if (not iters.empty())
         result = new M6UnionIterator(iters);
 
-    return result;
+    return CombineSegments(result, [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.Find(inIndex, inTerm, inOperator); });
 }
 
 M6Iterator* M6DatabankImpl::Find(const string& inIndex, const string& inLowerBound, const string& inUpperBound)
@@ -2323,7 +3629,16 @@ M6Iterator* M6DatabankImpl::Find(const string& inIndex, const string& inLowerBou
         desc.mIndex->Find(inLowerBound, inUpperBound, hits, count);
     }
 
-    return new M6BitmapIterator(hits, count);
+    return CombineSegments(new M6BitmapIterator(hits, count), [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.Find(inIndex, inLowerBound, inUpperBound); });
+}
+
+M6Iterator* M6DatabankImpl::FindAll()
+{
+    // each segment numbers its documents from one, without gaps
+    return CombineSegments(new M6AllDocIterator(mStore->GetMaxDocNr()),
+        [](M6Databank& inSegment) -> M6Iterator*
+        { return new M6AllDocIterator(inSegment.GetMaxDocNr()); });
 }
 
 M6Iterator* M6DatabankImpl::FindPattern(const string& inIndex, const string& inPattern)
@@ -2347,7 +3662,8 @@ M6Iterator* M6DatabankImpl::FindPattern(const string& inIndex, const string& inP
         }
     }
 
-    return new M6BitmapIterator(hits, count);
+    return CombineSegments(new M6BitmapIterator(hits, count), [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.FindPattern(inIndex, inPattern); });
 }
 
 M6Iterator* M6DatabankImpl::FindString(const string& inIndex, const string& inString)
@@ -2367,12 +3683,13 @@ M6Iterator* M6DatabankImpl::FindString(const string& inIndex, const string& inSt
             result->AddIterator(iter);
     }
 
-    return result.release();
+    return CombineSegments(result.release(), [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.FindString(inIndex, inString); });
 }
 
 tuple<bool,uint32> M6DatabankImpl::Exists(const string& inIndex, const string& inValue)
 {
-    unique_ptr<M6UnionIterator> iter(new M6UnionIterator);
+    unique_ptr<M6UnionIterator> local(new M6UnionIterator);
 
     string value(inValue);
     M6Tokenizer::CaseFold(value);
@@ -2384,9 +3701,12 @@ tuple<bool,uint32> M6DatabankImpl::Exists(const string& inIndex, const string& i
 
         M6Iterator* sub = desc.mIndex->Find(value);
         if (sub != nullptr)
-            iter->AddIterator(sub);
+            local->AddIterator(sub);
     }
 
+    unique_ptr<M6Iterator> iter(CombineSegments(local.release(), [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.Find(inIndex, inValue, eM6Equals); }));
+
     tuple<bool,uint32> result = make_tuple(false, 0);
 
     uint32 docNr, dummy;
@@ -2420,6 +3740,9 @@ void M6DatabankImpl::InitLinkMap(const M6LinkMap& inLinkMap)
             mLinkIndices.push_back(M6IndexDesc(l.first, eM6LinkIndex, index));
         }
     }
+
+    for (M6Segment& segment : mSegments)
+        segment.mDatabank->InitLinkMap(inLinkMap);
 }
 
 bool M6DatabankImpl::IsLinked(const string& inDB, const string& inID)
@@ -2438,6 +3761,9 @@ bool M6DatabankImpl::IsLinked(const string& inDB, const string& inID)
         break;
     }
 
+    for (auto segment = mSegments.begin(); result == false and segment != mSegments.end(); ++segment)
+        result = segment->mDatabank->IsLinked(inDB, inID);
+
     return result;
 }
 
@@ -2486,7 +3812,8 @@ M6Iterator* M6DatabankImpl::GetLinkedDocuments(const string& inDB, const string&
         }
     }
 
-    return result.release();
+    return CombineSegments(result.release(), [&](M6Databank& inSegment) -> M6Iterator*
+        { return inSegment.GetLinkedDocuments(inDB, inID); });
 }
 
 void M6DatabankImpl::SuggestCorrection(const string& inWord, vector<pair<string,uint16>>& outCorrections)
@@ -2545,19 +3872,52 @@ void M6DatabankImpl::ListIndexEntries(const string& inIndex, const string& inFir
     }
 }
 
-void M6DatabankImpl::StartBatchImport(M6Lexicon& inLexicon)
+void M6DatabankImpl::StartBatchImport(M6Lexicon& inLexicon, uint32 inNrOfThreads,
+    uint32 inIndexMemory)
+{
+    mBatch = new M6BatchIndexProcessor(*this, inLexicon, inIndexMemory);
+
+    // Storing is mostly copying data into the document store, a few
+    // threads suffice. Indexing scales with the number of threads.
+    uint32 storeThreads = min(inNrOfThreads, 2U), indexThreads = inNrOfThreads;
+    if (storeThreads < 1)
+        storeThreads = 1;
+    if (indexThreads < 1)
+        indexThreads = 1;
+
+    mStoreCounter.Reset(storeThreads);
+    mIndexCounter.Reset(indexThreads);
+
+    for (uint32 i = 0; i < storeThreads; ++i)
+        mStoreThreads.create_thread(boost::bind(&M6DatabankImpl::StoreThread, this));
+
+    for (uint32 i = 0; i < indexThreads; ++i)
+        mIndexThreads.create_thread(boost::bind(&M6DatabankImpl::IndexThread, this));
+}
+
+void M6DatabankImpl::StopBatchThreads()
 {
-    mBatch = new M6BatchIndexProcessor(*this, inLexicon);
+    // each thread stops at the first nullptr it receives
+    vector<M6InputDocument*> stop(max(mStoreThreads.size(), mIndexThreads.size()), nullptr);
 
-    mStoreThread = boost::thread(boost::bind(&M6DatabankImpl::StoreThread, this));
-    mIndexThread = boost::thread(boost::bind(&M6DatabankImpl::IndexThread, this));
+    mStoreQueue.Put(stop.data(), static_cast<uint32>(mStoreThreads.size()));
+    mStoreThreads.join_all();
+
+    mIndexQueue.Put(stop.data(), static_cast<uint32>(mIndexThreads.size()));
+    mIndexThreads.join_all();
 }
 
 void M6DatabankImpl::EndBatchImport()
 {
-    mStoreQueue.Put(nullptr);
-    mStoreThread.join();
-    mIndexThread.join();
+    StopBatchThreads();
+
+    if (not mPendingFastaOffsets.empty())
+        FlushFastaOffsets();
+
+    mStoreCounter.Report(mID, "store");
+    mIndexCounter.Report(mID, "index");
+    ReportQueue(mID, "store", mStoreQueue.GetStats());
+    ReportQueue(mID, "index", mIndexQueue.GetStats());
 
     if (not (mException == exception_ptr()))
         rethrow_exception(mException);
@@ -2628,19 +3988,203 @@ void M6DatabankImpl::CreateDictionary()
     M6Dictionary::Create(*mAllTextIndex, docCount, dictFile, progress);
 }
 
-void M6DatabankImpl::Vacuum()
+void M6DatabankImpl::Merge(const vector<M6Databank*>& inSegments,
+    const vector<vector<uint32>>& inDocMaps)
 {
-    int64 size = mAllTextIndex->size();
+    // The documents are copied in the order of their new numbers. They are
+    // decoded and compressed again, the attribute numbers in the document
+    // header differ between document stores.
+    uint32 docCount = 0;
+    for (auto& docMap : inDocMaps)
+    {
+        docCount += static_cast<uint32>(count_if(docMap.begin(), docMap.end(),
+            [](uint32 inDocNr) -> bool { return inDocNr != 0; }));
+    }
+
+    {
+        M6Progress progress(mID, docCount + 1, "copying documents");
+
+        for (uint32 s = 0; s < inSegments.size(); ++s)
+        {
+            M6Databank& segment = *inSegments[s];
+
+            for (uint32 docNr = 1; docNr < inDocMaps[s].size(); ++docNr)
+            {
+                if (inDocMaps[s][docNr] == 0)
+                    continue;
+
+                unique_ptr<M6Document> doc(segment.Fetch(docNr));
+                M6OutputDocument* source = dynamic_cast<M6OutputDocument*>(doc.get());
+                if (source == nullptr)
+                    THROW(("Document %d is missing from segment %s", docNr,
+                        segment.GetDbDirectory().string().c_str()));
+
+                M6InputDocument copy(mDatabank, source->GetText());
+                if (copy.GetDocNr() != inDocMaps[s][docNr])
+                    THROW(("Inconsistent document numbers in merge"));
+
+                map<string,string> attributes;
+                source->GetAttributes(attributes);
+                for (auto& attr : attributes)
+                    copy.SetAttribute(attr.first, attr.second.c_str(), attr.second.length());
+
+                for (auto& link : source->GetLinks())
+                {
+                    for (auto& id : link.second)
+                        copy.AddLink(link.first, id);
+                }
+
+                copy.Compress();
+                copy.Store();
+
+                string fasta;
+                if (segment.GetFasta(docNr, fasta))
+                    StoreFasta(copy.GetDocNr(), fasta);
+
+                progress.Consumed(1);
+            }
+        }
+
+        if (not mPendingFastaOffsets.empty())
+            FlushFastaOffsets();
+
+        if (mFastaFile != nullptr)
+            mFastaFile->flush();
+
+        progress.Consumed(1);
+    }
+
+    // The indices are merged by name, a segment may lack some of them.
+    // Link indices are not loaded by the constructor, they are read from
+    // the links directory of each segment.
+    struct M6MergedIndex
+    {
+        M6IndexType                mType;
+        vector<M6BasicIndex*>    mIndices;
+    };
+
+    map<string,M6MergedIndex> indices, links;
+    vector<M6BasicIndexPtr> linkIndices;
+    vector<M6BasicIndex*> fullText;
+    int64 size = 0;
+
+    auto add = [&](map<string,M6MergedIndex>& ioIndices, const string& inName,
+        M6IndexType inType, M6BasicIndex* inIndex, uint32 inSegmentNr)
+    {
+        if (ioIndices.count(inName) == 0)
+        {
+            M6MergedIndex& merged = ioIndices[inName];
+            merged.mType = inType;
+            merged.mIndices.assign(inSegments.size(), nullptr);
+        }
+        else if (ioIndices[inName].mType != inType)
+            THROW(("Inconsistent use of indices (%s)", inName.c_str()));
+
+        ioIndices[inName].mIndices[inSegmentNr] = inIndex;
+        size += inIndex->size();
+    };
+
+    for (uint32 s = 0; s < inSegments.size(); ++s)
+    {
+        M6DatabankImpl& segment = *inSegments[s]->mImpl;
+
+        fullText.push_back(segment.mAllTextIndex.get());
+        size += segment.mAllTextIndex->size();
+
+        for (M6IndexDesc& desc : segment.mIndices)
+            add(indices, desc.mName, desc.mType, desc.mIndex.get(), s);
+
+        fs::path linkDir = segment.mDbDirectory / "links";
+        if (not fs::is_directory(linkDir))
+            continue;
+
+        fs::directory_iterator end;
+        for (fs::directory_iterator ix(linkDir); ix != end; ++ix)
+        {
+            if (ix->path().extension().string() != ".index")
+                continue;
+
+            M6BasicIndexPtr index(M6BasicIndex::Load(ix->path()));
+            linkIndices.push_back(index);
+            add(links, ix->path().stem().string(), eM6LinkIndex, index.get(), s);
+        }
+    }
+
+    {
+        M6Progress progress(mID, size + 1, "merging indices");
+
+        mAllTextIndex->Merge(fullText, inDocMaps, progress);
+
+        for (auto& ix : indices)
+            CreateIndex(ix.first, ix.second.mType)->Merge(ix.second.mIndices, inDocMaps, progress);
+
+        for (auto& ix : links)
+            CreateIndex(ix.first, eM6LinkIndex)->Merge(ix.second.mIndices, inDocMaps, progress);
+
+        progress.Consumed(1);
+    }
+
+    RecalculateDocumentWeights();
+    CreateDictionary();
+}
+
+int64 M6DatabankImpl::Vacuum()
+{
+    // deleted documents in the base are erased from the document store,
+    // those in a segment stay until the segment is merged
+    vector<uint32> deleted, erased;
+    ReadDeletedDocs(mDbDirectory, deleted);
+    ReadDeletedDocs(mDbDirectory, erased, "erased");
+
+    uint32 maxDocNr = GetMaxDocNr();
+    auto inBase = partition(deleted.begin(), deleted.end(),
+        [maxDocNr](uint32 inDocNr) -> bool { return inDocNr > maxDocNr; });
+
+    int64 size = mAllTextIndex->size() + (deleted.end() - inBase);
 
     for (M6IndexDesc& desc : mIndices)
         size += desc.mIndex->size();
 
+    // the document store reports progress per document number
+    size += mStore->GetMaxDocNr() - 1;
+
     M6Progress progress(mID, size + 1, "vacuuming");
 
+    for (auto docNr = inBase; docNr != deleted.end(); ++docNr)
+    {
+        uint32 docPage, docSize;
+        bool pageAligned;
+        if (mStore->FetchDocument(*docNr, docPage, docSize, pageAligned))
+        {
+            // the raw text size is needed to keep the store info correct
+            M6OutputDocument doc(mDatabank, *docNr, docPage, docSize, pageAligned);
+            mStore->EraseDocument(*docNr, doc.GetText().length());
+        }
+
+        erased.push_back(*docNr);
+        progress.Consumed(1);
+    }
+
+    int64 reclaimed = mStore->Vacuum(progress);
+
+    // the erased documents must be listed before they leave the deleted list
+    deleted.erase(inBase, deleted.end());
+    WriteDeletedDocs(mDbDirectory, erased, "erased");
+    WriteDeletedDocs(mDbDirectory, deleted);
+
+    mDeletedCount = 0;
+    for (uint32 docNr : deleted)
+    {
+        if (docNr < mDeleted.size() and mDeleted[docNr])
+            ++mDeletedCount;
+    }
+
     mAllTextIndex->Vacuum(progress);
     for (M6IndexDesc& desc : mIndices)
         desc.mIndex->Vacuum(progress);
     progress.Consumed(1);
+
+    return reclaimed;
 }
 
 void M6DatabankImpl::Validate()
@@ -2730,9 +4274,225 @@ M6Databank* M6Databank::CreateNew(const string& inDatabankID, const fs::path& in
     return new M6Databank(inDatabankID, inPath, inVersion, inIndexNames);
 }
 
-void M6Databank::StartBatchImport(M6Lexicon& inLexicon)
+void M6Databank::GetSegments(const fs::path& inDbDirectory, M6SegmentInfoList& outSegments)
+{
+    if (not fs::exists(inDbDirectory / "segments.txt"))
+        return;
+
+    fs::ifstream file(inDbDirectory / "segments.txt");
+
+    string line;
+    while (getline(file, line))
+    {
+        vector<string> fields;
+        ba::split(fields, line, ba::is_any_of("\t"));
+        if (fields.size() < 2)
+            continue;
+
+        M6SegmentInfo segment = {
+            fields[0],
+            boost::lexical_cast<uint32>(fields[1]),
+            fields.size() > 2 ? boost::lexical_cast<uint32>(fields[2]) : 0
+        };
+
+        // manifests written before the document count was recorded
+        if (fields.size() == 2)
+            segment.mDocCount = M6Databank(inDbDirectory / "segments" / segment.mName, eReadOnly).GetMaxDocNr();
+
+        outSegments.push_back(segment);
+    }
+}
+
+uint32 M6Databank::GetTokenizerVersion(const fs::path& inDbDirectory)
+{
+    uint32 result = 1;
+
+    if (fs::exists(inDbDirectory / "tokenizer.txt"))
+    {
+        fs::ifstream file(inDbDirectory / "tokenizer.txt");
+        file >> result;
+    }
+
+    return result;
+}
+
+void M6Databank::AddSegment(const fs::path& inDbDirectory, const string& inSegment,
+    uint32 inDocBase, const vector<uint32>& inDeletedDocs)
+{
+    if (not fs::is_directory(inDbDirectory / "segments" / inSegment))
+        THROW(("Segment %s does not exist", inSegment.c_str()));
+
+    M6SegmentInfo segment = {
+        inSegment,
+        inDocBase,
+        M6Databank(inDbDirectory / "segments" / inSegment, eReadOnly).GetMaxDocNr()
+    };
+
+    M6SegmentInfoList segments;
+    GetSegments(inDbDirectory, segments);
+    segments.push_back(segment);
+
+    vector<uint32> deleted(inDeletedDocs);
+    ReadDeletedDocs(inDbDirectory, deleted);
+
+    // the deleted documents must be there before the segment appears.
+    WriteDeletedDocs(inDbDirectory, deleted);
+    WriteManifest(inDbDirectory, segments);
+}
+
+void M6Databank::MergeSegments(const fs::path& inDbDirectory, const vector<string>& inMerged,
+    const string& inSegment, uint32 inDocBase)
 {
-    mImpl->StartBatchImport(inLexicon);
+    if (not fs::is_directory(inDbDirectory / "segments" / inSegment))
+        THROW(("Segment %s does not exist", inSegment.c_str()));
+
+    M6SegmentInfoList segments;
+    GetSegments(inDbDirectory, segments);
+
+    vector<uint32> deleted;
+    ReadDeletedDocs(inDbDirectory, deleted);
+
+    M6SegmentInfoList::iterator segment = segments.begin();
+    while (segment != segments.end())
+    {
+        if (find(inMerged.begin(), inMerged.end(), segment->mName) == inMerged.end())
+        {
+            ++segment;
+            continue;
+        }
+
+        // the document numbers of this segment are no longer used
+        uint32 first = segment->mDocBase, last = segment->mDocBase + segment->mDocCount;
+        deleted.erase(remove_if(deleted.begin(), deleted.end(),
+            [first, last](uint32 docNr) -> bool { return docNr > first and docNr <= last; }),
+            deleted.end());
+
+        segment = segments.erase(segment);
+    }
+
+    M6SegmentInfo merged = {
+        inSegment,
+        inDocBase,
+        M6Databank(inDbDirectory / "segments" / inSegment, eReadOnly).GetMaxDocNr()
+    };
+    segments.push_back(merged);
+
+    // The merged segments are listed as garbage before the manifest is
+    // written, a crash in between leaves them in both and CollectGarbage
+    // keeps them.
+    vector<string> garbage;
+    ReadGarbage(inDbDirectory, garbage);
+    garbage.insert(garbage.end(), inMerged.begin(), inMerged.end());
+    WriteGarbage(inDbDirectory, garbage);
+
+    // the manifest goes first, otherwise the deleted documents
+    // of the merged segments would reappear for a moment.
+    WriteManifest(inDbDirectory, segments);
+    WriteDeletedDocs(inDbDirectory, deleted);
+}
+
+void M6Databank::CollectGarbage(const fs::path& inDbDirectory)
+{
+    vector<string> garbage, kept;
+    ReadGarbage(inDbDirectory, garbage);
+
+    if (garbage.empty())
+        return;
+
+    M6SegmentInfoList segments;
+    GetSegments(inDbDirectory, segments);
+
+    for (const string& name : garbage)
+    {
+        if (find_if(segments.begin(), segments.end(),
+                [&name](const M6SegmentInfo& segment) -> bool { return segment.mName == name; }) != segments.end())
+            continue;
+
+        // files that are still open cannot be removed on some systems,
+        // these are tried again the next time
+        boost::system::error_code ec;
+        fs::remove_all(inDbDirectory / "segments" / name, ec);
+
+        if (ec)
+        {
+            LOG(WARN, "Could not remove merged segment %s: %s", name.c_str(), ec.message().c_str());
+            kept.push_back(name);
+        }
+    }
+
+    WriteGarbage(inDbDirectory, kept);
+}
+
+void M6Databank::CreateMergedSegment(const fs::path& inDbDirectory, const string& inDatabankID,
+    const vector<string>& inMerged, const string& inSegment, vector<uint32>& outDocMap)
+{
+    M6SegmentInfoList segments;
+    GetSegments(inDbDirectory, segments);
+
+    vector<uint32> deleted;
+    ReadDeletedDocs(inDbDirectory, deleted);
+    sort(deleted.begin(), deleted.end());
+
+    // the documents that are kept are numbered from one, in order
+    vector<unique_ptr<M6Databank>> databanks;
+    vector<vector<uint32>> docMaps;
+    uint32 docNr = 0;
+
+    string version;
+    map<string,string> indexNames;
+
+    for (const M6SegmentInfo& segment : segments)
+    {
+        if (find(inMerged.begin(), inMerged.end(), segment.mName) == inMerged.end())
+            continue;
+
+        databanks.emplace_back(new M6Databank(inDbDirectory / "segments" / segment.mName, eReadOnly));
+
+        M6DatabankInfo info;
+        databanks.back()->GetInfo(info);
+
+        version = info.mVersion;
+        for (const M6IndexInfo& index : info.mIndexInfo)
+        {
+            if (not index.mDesc.empty())
+                indexNames[index.mName] = index.mDesc;
+        }
+
+        uint32 last = segment.mDocBase + segment.mDocCount;
+        if (outDocMap.size() <= last)
+            outDocMap.resize(last + 1, 0);
+
+        // the documents of a segment are numbered up to, not including,
+        // its maximum document number
+        uint32 maxDocNr = databanks.back()->GetMaxDocNr();
+
+        docMaps.push_back(vector<uint32>(maxDocNr, 0));
+        for (uint32 d = 1; d < maxDocNr; ++d)
+        {
+            if (binary_search(deleted.begin(), deleted.end(), segment.mDocBase + d))
+                continue;
+
+            docMaps.back()[d] = ++docNr;
+            outDocMap[segment.mDocBase + d] = docNr;
+        }
+    }
+
+    if (databanks.size() != inMerged.size())
+        THROW(("Not all segments to merge exist"));
+
+    vector<M6Databank*> sources;
+    for (auto& databank : databanks)
+        sources.push_back(databank.get());
+
+    unique_ptr<M6Databank> merged(CreateNew(inDatabankID, inDbDirectory / "segments" / inSegment,
+        version, vector<pair<string,string>>(indexNames.begin(), indexNames.end())));
+    merged->mImpl->Merge(sources, docMaps);
+}
+
+void M6Databank::StartBatchImport(M6Lexicon& inLexicon, uint32 inNrOfThreads,
+    uint32 inIndexMemory)
+{
+    mImpl->StartBatchImport(inLexicon, inNrOfThreads, inIndexMemory);
 }
 
 void M6Databank::EndBatchImport()
@@ -2760,6 +4520,16 @@ M6Document* M6Databank::Fetch(uint32 inDocNr)
     return mImpl->Fetch(inDocNr);
 }
 
+bool M6Databank::Exists(uint32 inDocNr)
+{
+    return mImpl->Exists(inDocNr);
+}
+
+bool M6Databank::GetFasta(uint32 inDocNr, string& outFasta)
+{
+    return mImpl->GetFasta(inDocNr, outFasta);
+}
+
 M6Document* M6Databank::Fetch(const string& inDocID)
 {
     M6Document* result = nullptr;
@@ -2823,6 +4593,11 @@ M6Iterator* M6Databank::FindPattern(const string& inIndex, const string& inPatte
     return mImpl->FindPattern(inIndex, inPattern);
 }
 
+M6Iterator* M6Databank::FindAll()
+{
+    return mImpl->FindAll();
+}
+
 M6Iterator* M6Databank::FindString(const string& inIndex, const string& inString)
 {
     return mImpl->FindString(inIndex, inString);
@@ -2863,9 +4638,9 @@ void M6Databank::RecalculateDocumentWeights()
     mImpl->RecalculateDocumentWeights();
 }
 
-void M6Databank::Vacuum()
+int64 M6Databank::Vacuum()
 {
-    mImpl->Vacuum();
+    return mImpl->Vacuum();
 }
 
 void M6Databank::Validate()
@@ -2880,12 +4655,12 @@ void M6Databank::DumpIndex(const string& inIndex, ostream& inStream)
 
 uint32 M6Databank::size() const
 {
-    return mImpl->GetDocStore().size();
+    return mImpl->size();
 }
 
 uint32 M6Databank::GetMaxDocNr() const
 {
-    return mImpl->GetMaxDocNr();
+    return mImpl->GetLastDocNr();
 }
 
 bool M6Databank::BrowseSectionsForIndex(const string& inIndex,
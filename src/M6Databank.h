@@ -50,6 +50,17 @@ struct M6DatabankInfo
     M6IndexInfoList    mIndexInfo;
 };
 
+// A segment is a complete databank stored in the segments directory of
+// another databank. The manifest, segments.txt, lists for each segment
+// the document number it starts after and the number of documents.
+struct M6SegmentInfo
+{
+    std::string        mName;
+    uint32            mDocBase;
+    uint32            mDocCount;
+};
+typedef std::vector<M6SegmentInfo>    M6SegmentInfoList;
+
 class M6Databank
 {
   public:
@@ -68,12 +79,56 @@ class M6Databank
     boost::filesystem::path
                     GetDbDirectory() const;
 
-    void            StartBatchImport(M6Lexicon& inLexicon);
+    // Add the databank in the directory segments/inSegment as a segment
+    // to the databank in inDbDirectory. The document numbers of the segment
+    // start after inDocBase, the documents in inDeletedDocs are superseded
+    // by the new segment. Open databank objects do not see the segment.
+    static void        AddSegment(const boost::filesystem::path& inDbDirectory,
+                        const std::string& inSegment, uint32 inDocBase,
+                        const std::vector<uint32>& inDeletedDocs);
+
+    // Create segments/inSegment from the segments in inMerged without
+    // parsing their documents again. The documents that are not deleted
+    // are copied in order and numbered from one, the keys of the indices
+    // are merged. outDocMap receives, for each document number of the
+    // merged segments in inDbDirectory, the number in the new segment or
+    // zero if the document was deleted.
+    static void        CreateMergedSegment(const boost::filesystem::path& inDbDirectory,
+                        const std::string& inDatabankID, const std::vector<std::string>& inMerged,
+                        const std::string& inSegment, std::vector<uint32>& outDocMap);
+
+    // Replace the segments in inMerged by segments/inSegment whose document
+    // numbers start after inDocBase. Only the manifest is updated, the new
+    // segment must already hold the documents of the replaced segments,
+    // see CreateMergedSegment. The deleted documents of the merged segments
+    // are forgotten. Their directories are not removed, a server may still
+    // use them until it reloads, they are listed in garbage.txt instead.
+    static void        MergeSegments(const boost::filesystem::path& inDbDirectory,
+                        const std::vector<std::string>& inMerged,
+                        const std::string& inSegment, uint32 inDocBase);
+
+    // Remove the directories of the segments listed in garbage.txt. Call
+    // this only when no process uses the manifest they were merged from.
+    static void        CollectGarbage(const boost::filesystem::path& inDbDirectory);
+
+    static void        GetSegments(const boost::filesystem::path& inDbDirectory,
+                        M6SegmentInfoList& outSegments);
+
+    // The M6Tokenizer::kVersion the databank was built with. Databanks
+    // without tokenizer.txt predate it and were built with version 1.
+    static uint32    GetTokenizerVersion(const boost::filesystem::path& inDbDirectory);
+
+    // inNrOfThreads is the number of threads used for storing and indexing,
+    // inIndexMemory is the memory budget in megabytes for sorting the
+    // full text entries.
+    void            StartBatchImport(M6Lexicon& inLexicon, uint32 inNrOfThreads = 1,
+                        uint32 inIndexMemory = 1024);
     void            EndBatchImport();
     void            FinishBatchImport();
 
     void            RecalculateDocumentWeights();
-    void            Vacuum();
+    // Returns the number of bytes reclaimed from the document store
+    int64            Vacuum();
 
     void            Validate();
     void            DumpIndex(const std::string& inIndex, std::ostream& inStream);
@@ -83,6 +138,14 @@ class M6Databank
     M6Document*        Fetch(uint32 inDocNr);
     M6Document*        Fetch(const std::string& inID);
 
+    // Exists returns true if inDocNr refers to a stored document that is
+    // not deleted, the document itself is not read.
+    bool            Exists(uint32 inDocNr);
+
+    // GetFasta returns the fasta for a document as written during the batch
+    // import, returns false if the databank has no fasta for this document.
+    bool            GetFasta(uint32 inDocNr, std::string& outFasta);
+
     // high-level interface
     M6Iterator*        Find(const std::string& inQuery, bool inAllTermsRequired,
                         uint32 inReportLimit);
@@ -98,6 +161,9 @@ class M6Databank
     M6Iterator*        FindPattern(const std::string& inIndex, const std::string& inPattern);
     M6Iterator*        FindString(const std::string& inIndex, const std::string& inString);
 
+    // All documents, merging segments leaves gaps in the document numbers
+    M6Iterator*        FindAll();
+
     // Very low level...
     M6BasicIndexPtr    GetIndex(const std::string& inIndex) const;
 
@@ -10,15 +10,18 @@
 #include "M6Lib.h"
 
 #include <cassert>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <atomic>
 
 #include <boost/iostreams/categories.hpp>
 #include <boost/thread.hpp>
+#include <boost/filesystem/operations.hpp>
 
 #include "M6DocStore.h"
 #include "M6Error.h"
+#include "M6Progress.h"
 
 using namespace std;
 namespace io = boost::iostreams;
@@ -36,8 +39,15 @@ const int64
 //    kM6DataPageSize            = 256,
     kM6DataPageTextSize        = kM6DataPageSize - 8,
     kM6DataPageIndexCount    = kM6DataPageTextSize / (3 * sizeof(uint32)),
+    kM6DataPageSegmentSize    = kM6DataPageTextSize - sizeof(uint32) - sizeof(uint16),
+                                // data capacity of a page holding a single document
     kM6DataPageTextCutOff    = 64;    // start a new data page if 'free' is less than this
 
+// Page numbers fit in 31 bits, the high bit of the page number in a leaf
+// index entry is set for documents that were stored page aligned.
+const uint32
+    kM6PageAlignedFlag        = 0x80000000;
+
 enum M6DataPageType
 {
     eM6DocStoreEmptyPage,
@@ -109,6 +119,7 @@ class M6DocStorePage
     uint32            GetLink() const                    { return mData->mLink; }
 
     void            SetDirty(bool inDirty)            { mDirty = inDirty; }
+    void            Clear()                            { memset(mData, 0, kM6DataPageSize); }
     bool            IsDirty() const                    { return mDirty; }
 
     uint32            GetPageNr() const                { return mPageNr; }
@@ -137,6 +148,9 @@ class M6DocStoreDataPage : public M6DocStorePage
 
     uint32            Store(uint32 inDocNr, const uint8* inData, uint32 inSize);
     uint32            Load(uint32 inDocNr, uint8* outData, uint32 inSize);
+    uint32            Erase(uint32 inDocNr);
+
+    bool            IsEmpty() const                    { return mData->mN == 0; }
 
   private:
 
@@ -196,8 +210,8 @@ class M6DocStoreIndexPage : public M6DocStorePage
     void            SetDocSize(uint32 inIndex, uint32 inValue)    { mData->mData[inIndex].mDocSize = swap_bytes(inValue); }
 
     bool            Insert(uint32& ioDocNr, uint32& ioPageNr, uint32 inDocSize);
-    void            Erase(uint32 inDocNr);
-    bool            Find(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize);
+    bool            Erase(uint32 inDocNr);
+    bool            Find(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize, bool& outPageAligned);
 
     void            InsertValues(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize, uint32 inIndex);
     static void        Move(M6DocStoreIndexPage& inSrc, M6DocStoreIndexPage& inDst,
@@ -257,17 +271,25 @@ class M6DocStoreImpl
     int64            GetRawSize() const                { return mHeader.mRawTextSize; }
     int64            GetFileSize() const                { return mFile.Size(); }
 
-    void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
-    void            EraseDocument(uint32 inDocNr);
-    bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize);
+    void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize,
+                        bool inPageAligned);
+    void            EraseDocument(uint32 inDocNr, size_t inRawSize);
+    bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize,
+                        bool& outPageAligned);
     void            OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
+                        bool inPageAligned, uint32 inOffset, uint32 inLength,
                         io::filtering_stream<io::input>& ioStream);
 
+    int64            Vacuum(M6Progress& inProgress);
+
     uint8            RegisterAttribute(const string& inName);
     string            GetAttributeName(uint8 inAttrNr) const;
 
+    // Allocate reuses free pages unless inAppend is true, page aligned
+    // documents need consecutive pages at the end of the file.
     template<class T>
-    M6DocStorePagePtr<T>    Allocate();
+    M6DocStorePagePtr<T>    Allocate(bool inAppend = false);
+    void            Free(M6DocStorePage* inPage);
 
     template<class T>
     M6DocStorePagePtr<T>    Load(uint32 inPageNr);
@@ -302,6 +324,11 @@ class M6DocStoreImpl
         M6CachedPagePtr        mPrev;
     };
 
+    M6DocStoreIndexPagePtr    GetRoot();
+    void            ReadDocument(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize, char* outData);
+    void            DiscardCachedPage(uint32 inPageNr);
+
+    fs::path                mPath;
     M6File                    mFile;
     MOpenMode                mMode;
     boost::mutex            mMutex;
@@ -448,6 +475,37 @@ uint32 M6DocStoreDataPage::Load(uint32 inDocNr, uint8* outData, uint32 inSize)
     return size;
 }
 
+uint32 M6DocStoreDataPage::Erase(uint32 inDocNr)
+{
+    uint32 docNr = 0;
+    uint16 size = 0;
+    uint8* src = mData->mText;
+
+    while (src < mData->mText + mData->mN)
+    {
+        docNr = Read32(src);
+        size = Read16(src);
+
+        if (docNr == inDocNr)
+            break;
+
+        src += size;
+    }
+
+    if (docNr != inDocNr)
+        THROW(("Document not found!"));
+
+    // remove the segment including its docNr and size fields
+    uint8* dst = src - sizeof(uint32) - sizeof(uint16);
+    src += size;
+    memmove(dst, src, mData->mText + mData->mN - src);
+    mData->mN -= static_cast<uint16>(src - dst);
+
+    mDirty = true;
+
+    return size;
+}
+
 // --------------------------------------------------------------------
 
 M6DocStoreIndexPage::M6DocStoreIndexPage(M6DocStoreImpl& inStore, M6DocStorePageData* inData, uint32 inPageNr)
@@ -608,11 +666,52 @@ bool M6DocStoreIndexPage::Insert(uint32& ioDocNr, uint32& ioPageNr, uint32 inDoc
     return result;
 }
 
-void M6DocStoreIndexPage::Erase(uint32 inDocNr)
+// Erase only removes the entry from its leaf page, pages are not merged
+// afterwards. A Vacuum of the store rebuilds a compact index.
+
+bool M6DocStoreIndexPage::Erase(uint32 inDocNr)
 {
+    bool result = false;
+
+    int32 L = 0, R = mData->mN - 1;
+    while (L <= R)
+    {
+        int32 i = (L + R) / 2;
+
+        if (inDocNr < GetKey(i))
+            R = i - 1;
+        else
+            L = i + 1;
+    }
+
+    if (mData->mType == eM6DocStoreIndexLeafPage)
+    {
+        if (R >= 0 and GetKey(R) == inDocNr)
+        {
+            memmove(mData->mData + R, mData->mData + R + 1, sizeof(M6DocStoreIndexEntry) * (mData->mN - R - 1));
+            --mData->mN;
+            mDirty = true;
+            result = true;
+        }
+    }
+    else    // branch page
+    {
+        uint32 pageNr;
+
+        if (R < 0)
+            pageNr = mData->mLink;
+        else
+            pageNr = GetDocPage(R);
+
+        M6DocStoreIndexPagePtr page(mStore.Load<M6DocStoreIndexPage>(pageNr));
+        result = page->Erase(inDocNr);
+    }
+
+    return result;
 }
 
-bool M6DocStoreIndexPage::Find(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize)
+bool M6DocStoreIndexPage::Find(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize,
+    bool& outPageAligned)
 {
     bool result = false;
 
@@ -631,7 +730,8 @@ bool M6DocStoreIndexPage::Find(uint32 inDocNr, uint32& outPageNr, uint32& outDoc
     {
         if (R >= 0 and GetKey(R) == inDocNr)
         {
-            outPageNr = GetDocPage(R);
+            outPageNr = GetDocPage(R) & ~kM6PageAlignedFlag;
+            outPageAligned = (GetDocPage(R) & kM6PageAlignedFlag) != 0;
             outDocSize = GetDocSize(R);
             result = true;
         }
@@ -646,7 +746,7 @@ bool M6DocStoreIndexPage::Find(uint32 inDocNr, uint32& outPageNr, uint32& outDoc
             pageNr = GetDocPage(R);
 
         M6DocStoreIndexPagePtr page(mStore.Load<M6DocStoreIndexPage>(pageNr));
-        result = page->Find(inDocNr, outPageNr, outDocSize);
+        result = page->Find(inDocNr, outPageNr, outDocSize, outPageAligned);
     }
 
     return result;
@@ -703,7 +803,7 @@ void M6DocStoreIndexPage::Dump(int inLevel)
     {
         cout << prefix << "leaf page at " << mPageNr << "; N = " << mData->mN << ": [";
         for (int i = 0; i < mData->mN; ++i)
-            cout << GetKey(i) << '(' << GetDocPage(i) << ')'
+            cout << GetKey(i) << '(' << (GetDocPage(i) & ~kM6PageAlignedFlag) << ')'
                  << (i + 1 < mData->mN ? ", " : "");
         cout << "]" << endl;
 
@@ -743,25 +843,26 @@ struct M6DocSource : public io::source
     typedef io::source_tag    category;
 
                     M6DocSource(M6DocStoreImpl& inStore, uint32 inDocNr,
-                        uint32 inPageNr, uint32 inDocSize);
+                        uint32 inPageNr, uint32 inDocSize, uint32 inSkip = 0);
                     M6DocSource(const M6DocSource& inSource);
     M6DocSource&    operator=(const M6DocSource& inSource);
 
     streamsize        read(char* s, streamsize n);
 
     M6DocStoreImpl*    mStore;
-    uint32            mDocNr, mPageNr, mDocSize;
+    uint32            mDocNr, mPageNr, mDocSize, mSkip;
     char            mBuffer[kM6DataPageTextSize];
     char*            mBufferStart;
     char*            mBufferEnd;
 };
 
 M6DocSource::M6DocSource(M6DocStoreImpl& inStore,
-    uint32 inDocNr, uint32 inPageNr, uint32 inDocSize)
+    uint32 inDocNr, uint32 inPageNr, uint32 inDocSize, uint32 inSkip)
     : mStore(&inStore)
     , mDocNr(inDocNr)
     , mPageNr(inPageNr)
     , mDocSize(inDocSize)
+    , mSkip(inSkip)
     , mBufferStart(mBuffer)
     , mBufferEnd(mBuffer)
 {
@@ -772,6 +873,7 @@ M6DocSource::M6DocSource(const M6DocSource& inSource)
     , mDocNr(inSource.mDocNr)
     , mPageNr(inSource.mPageNr)
     , mDocSize(inSource.mDocSize)
+    , mSkip(inSource.mSkip)
     , mBufferStart(mBuffer)
     , mBufferEnd(mBuffer)
 {
@@ -788,6 +890,7 @@ M6DocSource& M6DocSource::operator=(const M6DocSource& inSource)
         mDocNr = inSource.mDocNr;
         mPageNr = inSource.mPageNr;
         mDocSize = inSource.mDocSize;
+        mSkip = inSource.mSkip;
 
         size_t n = inSource.mBufferEnd - inSource.mBufferStart;
         memcpy(mBuffer, inSource.mBufferStart, n);
@@ -815,10 +918,19 @@ streamsize M6DocSource::read(char* s, streamsize n)
 
             uint32 n = page->Load(mDocNr, reinterpret_cast<uint8*>(mBuffer), sizeof(mBuffer));
             mPageNr = page->GetLink();
+
+            if (mSkip > n)
+                THROW(("Invalid offset in document"));
+
+            // mDocSize is the number of bytes left to deliver
+            n -= mSkip;
+            if (n > mDocSize)
+                n = mDocSize;
             mDocSize -= n;
 
-            mBufferStart = mBuffer;
-            mBufferEnd = mBuffer + n;
+            mBufferStart = mBuffer + mSkip;
+            mBufferEnd = mBufferStart + n;
+            mSkip = 0;
         }
 
         streamsize k = mBufferEnd - mBufferStart;
@@ -841,7 +953,8 @@ streamsize M6DocSource::read(char* s, streamsize n)
 // --------------------------------------------------------------------
 
 M6DocStoreImpl::M6DocStoreImpl(const fs::path& inPath, MOpenMode inMode)
-    : mFile(inPath, inMode)
+    : mPath(inPath)
+    , mFile(inPath, inMode)
     , mMode(inMode)
     , mNextDocNumber(1)
     , mDirty(false)
@@ -948,7 +1061,8 @@ string M6DocStoreImpl::GetAttributeName(uint8 inAttrNr) const
     return result;
 }
 
-void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize)
+void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize,
+    bool inPageAligned)
 {
     if (inSize == 0 or inData == nullptr)
         THROW(("Empty document"));
@@ -966,9 +1080,9 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
     uint32 pageNr = mHeader.mLastDataPage;
 
     M6DocStoreDataPagePtr dataPage;
-    if (pageNr == 0)
+    if (pageNr == 0 or inPageAligned)
     {
-        dataPage = Allocate<M6DocStoreDataPage>();
+        dataPage = Allocate<M6DocStoreDataPage>(inPageAligned);
         dataPage->SetPageType(eM6DocStoreDataPage);
         pageNr = dataPage->GetPageNr();
         mHeader.mLastDataPage = pageNr;
@@ -987,8 +1101,12 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
 
         if (size > 0)
         {
-            M6DocStoreDataPagePtr next(Allocate<M6DocStoreDataPage>());
+            M6DocStoreDataPagePtr next(Allocate<M6DocStoreDataPage>(inPageAligned));
             next->SetPageType(eM6DocStoreDataPage);
+
+            if (inPageAligned and next->GetPageNr() != pageNr + 1)
+                THROW(("Data pages for page aligned document are not consecutive"));
+
             pageNr = next->GetPageNr();
             dataPage->SetLink(pageNr);
             mHeader.mLastDataPage = pageNr;
@@ -1011,6 +1129,9 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
             mRoot = Load<M6DocStoreIndexPage>(mHeader.mIndexRoot);
     }
 
+    if (inPageAligned)
+        docPageNr |= kM6PageAlignedFlag;
+
     if (mRoot->Insert(inDocNr, docPageNr, docSize))
     {
         M6DocStoreIndexPagePtr newRoot(Allocate<M6DocStoreIndexPage>());
@@ -1028,12 +1149,44 @@ void M6DocStoreImpl::StoreDocument(uint32 inDocNr, const char* inData, size_t in
     mDirty = true;
 }
 
-void M6DocStoreImpl::EraseDocument(uint32 inDocNr)
+void M6DocStoreImpl::EraseDocument(uint32 inDocNr, size_t inRawSize)
 {
-    THROW(("unimplemented"));
+    if (mMode != eReadWrite)
+        THROW(("Document store is read only"));
+
+    uint32 pageNr, docSize;
+    bool pageAligned;
+    if (not FetchDocument(inDocNr, pageNr, docSize, pageAligned))
+        THROW(("Document %d not found", inDocNr));
+
+    // remove the data segments, pages that end up empty go to the free list
+
+    while (docSize > 0)
+    {
+        M6DocStoreDataPagePtr page(Load<M6DocStoreDataPage>(pageNr));
+
+        uint32 n = page->Erase(inDocNr);
+        if (n == 0 or n > docSize)
+            THROW(("Inconsistent document data for document %d", inDocNr));
+        docSize -= n;
+
+        uint32 next = page->GetLink();
+
+        if (page->IsEmpty() and pageNr != mHeader.mLastDataPage)
+            Free(&*page);
+
+        pageNr = next;
+    }
+
+    if (not GetRoot()->Erase(inDocNr))
+        THROW(("Document %d not found", inDocNr));
+
+    --mHeader.mDocCount;
+    mHeader.mRawTextSize -= inRawSize;
+    mDirty = true;
 }
 
-bool M6DocStoreImpl::FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize)
+M6DocStoreIndexPagePtr M6DocStoreImpl::GetRoot()
 {
     if (not mRoot)
     {
@@ -1047,28 +1200,172 @@ bool M6DocStoreImpl::FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& ou
             mRoot = Load<M6DocStoreIndexPage>(mHeader.mIndexRoot);
     }
 
-    return mRoot->Find(inDocNr, outPageNr, outDocSize);
+    return mRoot;
+}
+
+bool M6DocStoreImpl::FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize,
+    bool& outPageAligned)
+{
+    return GetRoot()->Find(inDocNr, outPageNr, outDocSize, outPageAligned);
+}
+
+void M6DocStoreImpl::ReadDocument(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize, char* outData)
+{
+    while (inDocSize > 0)
+    {
+        M6DocStoreDataPagePtr page(Load<M6DocStoreDataPage>(inPageNr));
+
+        char buffer[kM6DataPageTextSize];
+        uint32 n = page->Load(inDocNr, reinterpret_cast<uint8*>(buffer), sizeof(buffer));
+        if (n == 0 or n > inDocSize)
+            THROW(("Inconsistent document data for document %d", inDocNr));
+
+        memcpy(outData, buffer, n);
+        outData += n;
+        inDocSize -= n;
+
+        inPageNr = page->GetLink();
+    }
+}
+
+// --------------------------------------------------------------------
+//    Vacuum rewrites all live documents, ordered by document number, into
+//    a new file that replaces the current one. This leaves no free pages
+//    and documents with adjacent numbers end up in adjacent pages.
+//    Document page numbers obtained before a Vacuum are no longer valid.
+
+int64 M6DocStoreImpl::Vacuum(M6Progress& inProgress)
+{
+    if (mMode != eReadWrite)
+        THROW(("Document store is read only"));
+
+    fs::path path(mPath.parent_path() / (mPath.filename().string() + ".vacuum"));
+    if (fs::exists(path))
+        fs::remove(path);
+
+    Commit();
+
+    int64 oldSize = mFile.Size();
+
+    {
+        M6DocStoreImpl store(path, eReadWrite);
+
+        store.mHeader.mAttributeOffset = mHeader.mAttributeOffset;
+        memcpy(store.mHeader.mText, mHeader.mText, M6DocStoreHdr::kTextSize);
+        store.mNextDocNumber = static_cast<uint32>(mNextDocNumber);
+
+        vector<char> data;
+
+        uint32 maxDocNr = mNextDocNumber;
+        for (uint32 docNr = 1; docNr < maxDocNr; ++docNr)
+        {
+            uint32 pageNr, docSize;
+            bool aligned;
+            if (FetchDocument(docNr, pageNr, docSize, aligned))
+            {
+                data.resize(docSize);
+                ReadDocument(docNr, pageNr, docSize, &data[0]);
+
+                // page aligned documents stay page aligned
+                store.StoreDocument(docNr, &data[0], docSize, 0, aligned);
+            }
+
+            inProgress.Consumed(1);
+        }
+
+        store.mHeader.mRawTextSize = mHeader.mRawTextSize;
+        store.Commit();
+    }
+
+    // replace the current file with the new one
+
+    mRoot = M6DocStoreIndexPagePtr();
+
+    for (uint32 ix = 0; ix < mCacheCount; ++ix)
+    {
+        assert(mCache[ix].mRefCount == 0);
+
+        delete mCache[ix].mPage;
+        mCache[ix].mPage = nullptr;
+        mCache[ix].mPageNr = 0;
+        mCache[ix].mRefCount = 0;
+    }
+
+    // an open file cannot be replaced on Windows
+    mFile.Close();
+    fs::rename(path, mPath);
+
+    mFile = M6File(mPath, mMode);
+    mFile.PRead(mHeader, 0);
+    mNextDocNumber = mHeader.mNextDocNumber;
+    mDirty = false;
+
+    int64 reclaimed = max(oldSize - mFile.Size(), int64(0));
+    inProgress.Message("document store: reclaimed " + to_string(reclaimed) + " bytes");
+
+    return reclaimed;
 }
 
-void M6DocStoreImpl::OpenDataStream(uint32 inDocNr,
-    uint32 inPageNr, uint32 inDocSize, io::filtering_stream<io::input>& ioStream)
+void M6DocStoreImpl::OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
+    bool inPageAligned, uint32 inOffset, uint32 inLength, io::filtering_stream<io::input>& ioStream)
 {
-    ioStream.push(M6DocSource(*this, inDocNr, inPageNr, inDocSize));
+    if (inOffset > inDocSize or inLength > inDocSize - inOffset)
+        THROW(("Requested range exceeds document size"));
+
+    if (inOffset > 0 and not inPageAligned)
+        THROW(("Document %d is not page aligned, cannot read from offset %d", inDocNr, inOffset));
+
+    // page aligned documents fill each page completely, so the page
+    // containing inOffset can be calculated directly
+    uint32 pageNr = inPageNr + inOffset / kM6DataPageSegmentSize;
+    uint32 skip = inOffset % kM6DataPageSegmentSize;
+
+    ioStream.push(M6DocSource(*this, inDocNr, pageNr, inLength, skip));
 }
 
 template<class T>
-M6DocStorePagePtr<T> M6DocStoreImpl::Allocate()
+M6DocStorePagePtr<T> M6DocStoreImpl::Allocate(bool inAppend)
 {
-    int64 fileSize = mFile.Size();
-    uint32 pageNr = static_cast<uint32>((fileSize - 1) / kM6DataPageSize + 1ULL);
-    int64 offset = pageNr * kM6DataPageSize;
-    mFile.Truncate(offset + kM6DataPageSize);
+    uint32 pageNr, nextFreePage = 0;
+    bool reuse = not inAppend and mHeader.mFirstFreeDataPage != 0;
+    unique_ptr<M6DocStorePageData> data(new M6DocStorePageData);
+
+    if (reuse)
+    {
+        // free pages are flushed when freed, so the link can be read from disk.
+        // The free list is only advanced once nothing below can throw anymore,
+        // otherwise a failure would drop the page from the list.
+        pageNr = mHeader.mFirstFreeDataPage;
+        DiscardCachedPage(pageNr);
+        mFile.PRead(*data, pageNr * kM6DataPageSize);
+
+        if (data->mType != eM6DocStoreEmptyPage)
+            THROW(("Invalid page in free list (page = %d)", pageNr));
+
+        nextFreePage = data->mLink;
+    }
+    else
+    {
+        int64 fileSize = mFile.Size();
+        if ((fileSize - 1) / kM6DataPageSize + 1 >= kM6PageAlignedFlag)
+            THROW(("Document store is full"));
+
+        pageNr = static_cast<uint32>((fileSize - 1) / kM6DataPageSize + 1ULL);
+        int64 offset = pageNr * kM6DataPageSize;
+        mFile.Truncate(offset + kM6DataPageSize);
+    }
 
-    M6DocStorePageData* data = new M6DocStorePageData;
-    memset(data, 0, kM6DataPageSize);
+    memset(data.get(), 0, kM6DataPageSize);
 
     M6CachedPagePtr cp = GetCachePage(pageNr);
-    cp->mPage = new T(*this, data, pageNr);
+    cp->mPage = new T(*this, data.get(), pageNr);
+    data.release();
+
+    if (reuse)
+    {
+        mHeader.mFirstFreeDataPage = nextFreePage;
+        mDirty = true;
+    }
 
     return M6DocStorePagePtr<T>(*this, static_cast<T*>(cp->mPage));
 }
@@ -1112,6 +1409,34 @@ M6DocStorePagePtr<T> M6DocStoreImpl::Load(uint32 inPageNr)
     return M6DocStorePagePtr<T>(*this, static_cast<T*>(cp->mPage));
 }
 
+void M6DocStoreImpl::Free(M6DocStorePage* inPage)
+{
+    inPage->Clear();
+    inPage->SetPageType(eM6DocStoreEmptyPage);
+    inPage->SetLink(mHeader.mFirstFreeDataPage);
+    inPage->SetDirty(true);
+    inPage->Flush(mFile);
+
+    mHeader.mFirstFreeDataPage = inPage->GetPageNr();
+    mDirty = true;
+}
+
+void M6DocStoreImpl::DiscardCachedPage(uint32 inPageNr)
+{
+    for (M6CachedPagePtr cp = mLRUHead; cp != nullptr; cp = cp->mNext)
+    {
+        if (cp->mPageNr == inPageNr and cp->mPage != nullptr)
+        {
+            if (cp->mRefCount > 0)
+                THROW(("Reusing a page that is still in use (page = %d)", inPageNr));
+
+            delete cp->mPage;
+            cp->mPage = nullptr;
+            cp->mPageNr = 0;
+        }
+    }
+}
+
 void M6DocStoreImpl::InitCache()
 {
     const uint32 kM6CacheCount = 32;
@@ -1340,29 +1665,55 @@ string M6DocStore::GetAttributeName(uint8 inAttrNr) const
     return mImpl->GetAttributeName(inAttrNr);
 }
 
-void M6DocStore::StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize)
+void M6DocStore::StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize,
+    bool inPageAligned)
 {
     M6DocStoreImpl::Lock lock(mImpl);
-    mImpl->StoreDocument(inDocNr, inData, inSize, inRawSize);
+    mImpl->StoreDocument(inDocNr, inData, inSize, inRawSize, inPageAligned);
 }
 
-void M6DocStore::EraseDocument(uint32 inDocNr)
+void M6DocStore::EraseDocument(uint32 inDocNr, size_t inRawSize)
 {
     M6DocStoreImpl::Lock lock(mImpl);
-    mImpl->EraseDocument(inDocNr);
+    mImpl->EraseDocument(inDocNr, inRawSize);
 }
 
 bool M6DocStore::FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize)
+{
+    bool pageAligned;
+    return FetchDocument(inDocNr, outPageNr, outDocSize, pageAligned);
+}
+
+bool M6DocStore::FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize,
+    bool& outPageAligned)
 {
     M6DocStoreImpl::Lock lock(mImpl);
-    return mImpl->FetchDocument(inDocNr, outPageNr, outDocSize);
+    return mImpl->FetchDocument(inDocNr, outPageNr, outDocSize, outPageAligned);
 }
 
 void M6DocStore::OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
     io::filtering_stream<io::input>& ioStream)
 {
     M6DocStoreImpl::Lock lock(mImpl);
-    mImpl->OpenDataStream(inDocNr, inPageNr, inDocSize, ioStream);
+    mImpl->OpenDataStream(inDocNr, inPageNr, inDocSize, false, 0, inDocSize, ioStream);
+}
+
+void M6DocStore::OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
+    bool inPageAligned, uint32 inOffset, uint32 inLength, io::filtering_stream<io::input>& ioStream)
+{
+    M6DocStoreImpl::Lock lock(mImpl);
+    mImpl->OpenDataStream(inDocNr, inPageNr, inDocSize, inPageAligned, inOffset, inLength, ioStream);
+}
+
+int64 M6DocStore::Vacuum(M6Progress& inProgress)
+{
+    M6DocStoreImpl::Lock lock(mImpl);
+    return mImpl->Vacuum(inProgress);
+}
+
+uint32 M6DocStore::GetPageDataSize()
+{
+    return kM6DataPageSegmentSize;
 }
 
 uint32 M6DocStore::size() const
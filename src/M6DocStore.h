@@ -11,6 +11,7 @@
 #include "M6File.h"
 
 class M6DocStoreImpl;
+class M6Progress;
 
 class M6DocStore
 {
@@ -20,11 +21,31 @@ class M6DocStore
 
     void            GetInfo(uint32& outDocCount, int64& outFileSize, int64& outRawSize);
 
-    void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize);
+    // Documents stored with inPageAligned start at a fresh data page and
+    // occupy consecutive pages, which allows random access to their data
+    // using the OpenDataStream variant that takes an offset.
+    void            StoreDocument(uint32 inDocNr, const char* inData, size_t inSize, size_t inRawSize,
+                        bool inPageAligned = false);
     bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize);
+    bool            FetchDocument(uint32 inDocNr, uint32& outPageNr, uint32& outDocSize,
+                        bool& outPageAligned);
     void            OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
                         boost::iostreams::filtering_stream<boost::iostreams::input>& ioStream);
-    void            EraseDocument(uint32 inDocNr);
+    // Open a stream on inLength bytes of the document data starting at inOffset,
+    // inOffset may only be non-zero for documents that were stored page aligned.
+    // Pass the outPageAligned value returned by FetchDocument in inPageAligned.
+    void            OpenDataStream(uint32 inDocNr, uint32 inPageNr, uint32 inDocSize,
+                        bool inPageAligned, uint32 inOffset, uint32 inLength,
+                        boost::iostreams::filtering_stream<boost::iostreams::input>& ioStream);
+    // The number of data bytes a single page of a page aligned document holds
+    static uint32    GetPageDataSize();
+
+    // inRawSize is the raw size that was passed to StoreDocument
+    void            EraseDocument(uint32 inDocNr, size_t inRawSize);
+
+    // Rewrite the store compactly, reclaiming the space of erased documents.
+    // Returns the number of bytes the store file shrunk.
+    int64            Vacuum(M6Progress& inProgress);
 
     uint8            RegisterAttribute(const std::string& inName);
     std::string        GetAttributeName(uint8 inAttrNr) const;
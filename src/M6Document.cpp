@@ -34,11 +34,91 @@ namespace ba = boost::algorithm;
 namespace
 {
 
+// Large documents are compressed in independent blocks, so that a part of
+// the document can be read without inflating everything in front of it.
+// The stored data then starts with a M6DocBlockHeader followed by the
+// end offsets of the compressed blocks and then the blocks themselves.
+// The signature's first byte is not a valid start of a deflate stream.
+// All numbers are stored big-endian, like the rest of the document store.
+//
+// A block holds as many uncompressed bytes as a data page of a page aligned
+// document, so reading a block inflates at most a page worth of text and
+// for any compressible text reads no more than two data pages.
+
+const uint32
+    kM6DocBlockThreshold = 256 * 1024;
+
+const uint8
+    kM6DocBlockSignature[4] = { 0xff, 'M', '6', 'B' };
+
+struct M6DocBlockHeader
+{
+    uint8            mSignature[4];
+    uint32            mBlockSize;
+    uint32            mTextOffset;
+    uint32            mBlockCount;
+};
+
 const uint32
-    kUndefinedTokenValue = ~0;
+    kM6DocBlockHeaderSize = 16;
+
+void Write32(uint8*& ioPtr, uint32 inValue)
+{
+    *ioPtr++ = static_cast<uint8>(inValue >> 24);
+    *ioPtr++ = static_cast<uint8>(inValue >> 16);
+    *ioPtr++ = static_cast<uint8>(inValue >>  8);
+    *ioPtr++ = static_cast<uint8>(inValue >>  0);
+}
+
+uint32 Read32(const uint8*& ioPtr)
+{
+    uint32 result = *ioPtr++;
+    result = result << 8 | *ioPtr++;
+    result = result << 8 | *ioPtr++;
+    result = result << 8 | *ioPtr++;
+    return result;
+}
 
+void WriteBlockHeader(uint8* inData, const M6DocBlockHeader& inHeader)
+{
+    memcpy(inData, inHeader.mSignature, sizeof(inHeader.mSignature));
+    inData += sizeof(inHeader.mSignature);
+    Write32(inData, inHeader.mBlockSize);
+    Write32(inData, inHeader.mTextOffset);
+    Write32(inData, inHeader.mBlockCount);
 }
 
+void ReadBlockHeader(const uint8* inData, M6DocBlockHeader& outHeader)
+{
+    memcpy(outHeader.mSignature, inData, sizeof(outHeader.mSignature));
+    inData += sizeof(outHeader.mSignature);
+    outHeader.mBlockSize = Read32(inData);
+    outHeader.mTextOffset = Read32(inData);
+    outHeader.mBlockCount = Read32(inData);
+}
+
+}
+
+// M6DocBlockIndex is the in memory version of the block index of a document
+
+struct M6DocBlockIndex
+{
+    uint32            mBlockSize;
+    uint32            mTextOffset;
+    uint32            mDataOffset;
+    vector<uint32>    mBlockEnd;
+
+    uint32            GetBlockOffset(uint32 inBlockNr) const
+                    {
+                        return mDataOffset + (inBlockNr > 0 ? mBlockEnd[inBlockNr - 1] : 0);
+                    }
+
+    uint32            GetBlockLength(uint32 inBlockNr) const
+                    {
+                        return mDataOffset + mBlockEnd[inBlockNr] - GetBlockOffset(inBlockNr);
+                    }
+};
+
 // --------------------------------------------------------------------
 
 M6Document::M6Document(M6Databank& inDatabank)
@@ -50,11 +130,17 @@ M6Document::~M6Document()
 {
 }
 
+istream* M6Document::GetTextStream()
+{
+    return new istringstream(GetText());
+}
+
 // --------------------------------------------------------------------
 
 M6InputDocument::M6InputDocument(M6Databank& inDatabank)
     : M6Document(inDatabank)
     , mDocNr(inDatabank.GetDocStore().GetNextDocumentNumber())
+    , mBlocked(false)
 {
 }
 
@@ -62,11 +148,13 @@ M6InputDocument::M6InputDocument(M6Databank& inDatabank, const string& inText)
     : M6Document(inDatabank)
     , mText(inText)
     , mDocNr(inDatabank.GetDocStore().GetNextDocumentNumber())
+    , mBlocked(false)
 {
 }
 
 void M6InputDocument::SetText(const string& inText)
 {
+    DetachWords();
     mText = inText;
 }
 
@@ -102,58 +190,118 @@ void M6InputDocument::Compress()
 {
     M6DocStore& store(mDatabank.GetDocStore());
 
-    mBuffer.reserve(mText.length() + mText.length() / 20);
+    // the attributes and links are written first, as the document header
 
-    // set-up the compression machine
-    io::zlib_params params(io::zlib::best_speed);
-    params.noheader = true;
-    params.calculate_crc = true;
-
-    io::zlib_compressor z_stream(params);
-
-    io::filtering_stream<io::output> out;
-    out.push(z_stream);
-    out.push(io::back_inserter(mBuffer));
+    string header;
 
     for (auto attr : mAttributes)
     {
         uint8 attrNr = store.RegisterAttribute(attr.first);
-        out.write(reinterpret_cast<char*>(&attrNr), 1);
+        header += static_cast<char>(attrNr);
 
         uint8 size = static_cast<uint8>(attr.second.length());
-        out.write(reinterpret_cast<char*>(&size), 1);
+        header += static_cast<char>(size);
 
-        out.write(attr.second.c_str(), size);
+        header.append(attr.second.c_str(), size);
     }
 
-    char mark = 0;
-    out.write(&mark, 1);
+    header += '\0';
 
     // write links
 
     if (not mLinks.empty() or ba::starts_with(mText, "[[\n"))
     {
-        out << "[[" << endl;
-        stringstream ls;
+        header += "[[\n";
 
         for (auto& l : mLinks)
         {
-            out << l.first << '\t';
+            header += l.first;
+            header += '\t';
             for (auto id : l.second)
-                out << id << ';';
-            out << endl;
+            {
+                header += id;
+                header += ';';
+            }
+            header += '\n';
         }
 
-        out << "]]" << endl;
+        header += "]]\n";
+    }
+
+    // set-up the compression machine
+    io::zlib_params params(io::zlib::best_speed);
+    params.noheader = true;
+    params.calculate_crc = true;
+
+    mBuffer.clear();
+    mBuffer.reserve(mText.length() + mText.length() / 20);
+
+    mBlocked = header.length() + mText.length() >= kM6DocBlockThreshold;
+
+    if (not mBlocked)
+    {
+        io::filtering_stream<io::output> out;
+        out.push(io::zlib_compressor(params));
+        out.push(io::back_inserter(mBuffer));
+
+        out.write(header.c_str(), header.length());
+        out.write(mText.c_str(), mText.length());
     }
+    else
+    {
+        size_t size = header.length() + mText.length();
+        uint32 blockSize = M6DocStore::GetPageDataSize();
+        uint32 blockCount = static_cast<uint32>((size - 1) / blockSize + 1);
+
+        M6DocBlockHeader blockHeader;
+        memcpy(blockHeader.mSignature, kM6DocBlockSignature, sizeof(kM6DocBlockSignature));
+        blockHeader.mBlockSize = blockSize;
+        blockHeader.mTextOffset = static_cast<uint32>(header.length());
+        blockHeader.mBlockCount = blockCount;
+
+        size_t dataOffset = kM6DocBlockHeaderSize + blockCount * sizeof(uint32);
+        mBuffer.resize(dataOffset);
+        WriteBlockHeader(reinterpret_cast<uint8*>(&mBuffer[0]), blockHeader);
+
+        vector<uint32> blockEnd;
+
+        for (size_t offset = 0; offset < size; offset += blockSize)
+        {
+            size_t n = blockSize;
+            if (n > size - offset)
+                n = size - offset;
 
-    out.write(mText.c_str(), mText.length());
+            {
+                io::filtering_stream<io::output> out;
+                out.push(io::zlib_compressor(params));
+                out.push(io::back_inserter(mBuffer));
+
+                // a block may span the header and the text
+                size_t o = offset, e = offset + n;
+                if (o < header.length())
+                {
+                    size_t k = min(e, header.length());
+                    out.write(header.c_str() + o, k - o);
+                    o = k;
+                }
+
+                if (o < e)
+                    out.write(mText.c_str() + o - header.length(), e - o);
+            }
+
+            blockEnd.push_back(static_cast<uint32>(mBuffer.size() - dataOffset));
+        }
+
+        uint8* p = reinterpret_cast<uint8*>(&mBuffer[kM6DocBlockHeaderSize]);
+        for (uint32 end : blockEnd)
+            Write32(p, end);
+    }
 }
 
 void M6InputDocument::Store()
 {
     assert(not mBuffer.empty());
-    mDatabank.GetDocStore().StoreDocument(mDocNr, &mBuffer[0], mBuffer.size(), mText.length());
+    mDatabank.GetDocStore().StoreDocument(mDocNr, &mBuffer[0], mBuffer.size(), mText.length(), mBlocked);
 }
 
 M6InputDocument::M6IndexTokenList::iterator M6InputDocument::GetIndexTokens(
@@ -211,7 +359,7 @@ void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
             {
                 cerr << endl
                      << "l == 0, text = '" << string(inText, inSize) << '\'' << endl
-                     << " tokentext = '" << tokenizer.GetTokenValue() << '\'' << endl
+                     << " tokentext = '" << tokenizer.GetTokenString() << '\'' << endl
                      << " token = " << token << endl;
 
             }
@@ -230,8 +378,8 @@ void M6InputDocument::Index(const string& inIndex, M6DataType inDataType,
             if (token != eM6TokenNumber and token != eM6TokenWord)
                 continue;
 
-            uint32 t = mDocLexicon.Store(tokenizer.GetTokenValue(), l);
-            ix->mTokens.push_back(t);
+            auto word = tokenizer.GetTokenSpan();
+            ix->mTokens.push_back(StoreWord(word.first, word.second));
         }
     }
 }
@@ -248,10 +396,7 @@ void M6InputDocument::Index(const string& inIndex,
     auto ix = GetIndexTokens(inIndex, eM6StringData);
 
     for (auto word : inWords)
-    {
-        uint32 t = mDocLexicon.Store(word.first, word.second);
-        ix->mTokens.push_back(t);
-    }
+        ix->mTokens.push_back(StoreWord(word.first, word.second));
 }
 
 //void M6InputDocument::IndexSequence(const string& inIndex, uint32 inWordSize,
@@ -261,7 +406,7 @@ void M6InputDocument::Index(const string& inIndex,
 //
 //    for (uint32 i = 0; i + inWordSize <= inLength; ++i)
 //    {
-//        uint32 t = mDocLexicon.Store(inSequence++, inWordSize);
+//        uint32 t = StoreWord(inSequence++, inWordSize);
 //        ix->mTokens.push_back(t);
 //    }
 //}
@@ -277,48 +422,139 @@ void M6InputDocument::AddLink(const string& inDatabank, const string& inValue)
     mLinks[db].insert(id);
 }
 
-void M6InputDocument::Tokenize(M6Lexicon& inLexicon, uint32 inLastStopWord)
+// The words are kept in a hash table with linear probing, the slots
+// contain the word numbers. A slot of zero is empty.
+
+namespace
 {
-    uint32 docTokenCount = mDocLexicon.Count();
-    vector<uint32> tokenRemap(docTokenCount, kUndefinedTokenValue);
-    tokenRemap[0] = 0;
 
+// room for the words of most documents, growing the tables is what
+// causes most allocations
+const size_t kInitialWordCount = 256;
+
+inline uint32 HashWord(const char* inWord, size_t inWordLength)
+{
+    uint32 h = 2166136261U;
+    for (size_t i = 0; i < inWordLength; ++i)
+        h = (h ^ static_cast<uint8>(inWord[i])) * 16777619U;
+    return h;
+}
+
+}
+
+uint32 M6InputDocument::StoreWord(const char* inWord, size_t inWordLength)
+{
+    // keep the load factor below one half
+    if ((mWords.size() + 1) * 2 > mWordSlots.size())
     {
-        M6Lexicon::M6SharedLock sharedLock(inLexicon);
+        if (mWordSlots.empty())
+        {
+            mWords.reserve(kInitialWordCount);
+            mWordText.reserve(kInitialWordCount * 8);
+        }
+
+        vector<uint32> slots(max<size_t>(mWordSlots.size() * 2, 2 * kInitialWordCount), 0);
+        uint32 mask = static_cast<uint32>(slots.size() - 1);
 
-        for (uint32 t = 1; t < docTokenCount; ++t)
+        for (uint32 nr : mWordSlots)
         {
+            if (nr == 0)
+                continue;
+
             const char* w;
             size_t wl;
+            GetWord(nr, w, wl);
 
-            mDocLexicon.GetString(t, w, wl);
-            uint32 rt = inLexicon.Lookup(w, wl);
-
-            if (rt != 0)
-            {
-                if (rt <= inLastStopWord)
-                    tokenRemap[t] = 0;
-                else
-                    tokenRemap[t] = rt;
-            }
+            uint32 ix = HashWord(w, wl) & mask;
+            while (slots[ix] != 0)
+                ix = (ix + 1) & mask;
+            slots[ix] = nr;
         }
+
+        swap(mWordSlots, slots);
     }
 
+    uint32 mask = static_cast<uint32>(mWordSlots.size() - 1);
+    uint32 ix = HashWord(inWord, inWordLength) & mask;
+
+    for (;;)
+    {
+        uint32 nr = mWordSlots[ix];
+        if (nr == 0)
+            break;
+
+        const char* w;
+        size_t wl;
+        GetWord(nr, w, wl);
+
+        if (wl == inWordLength and memcmp(w, inWord, wl) == 0)
+            return nr;
+
+        ix = (ix + 1) & mask;
+    }
+
+    // a new word, words in the document text are not copied
+    M6DocWord word = { 0, static_cast<uint32>(inWordLength), false };
+
+    if (inWord >= mText.data() and inWord + inWordLength <= mText.data() + mText.length())
+    {
+        word.mOffset = static_cast<uint32>(inWord - mText.data());
+        word.mInText = true;
+    }
+    else
     {
-        M6Lexicon::M6UniqueLock uniqueLock(inLexicon);
+        word.mOffset = static_cast<uint32>(mWordText.length());
+        mWordText.append(inWord, inWordLength);
+    }
+
+    mWords.push_back(word);
+    mWordSlots[ix] = static_cast<uint32>(mWords.size());
+
+    return mWordSlots[ix];
+}
+
+inline void M6InputDocument::GetWord(uint32 inWordNr, const char*& outWord, size_t& outWordLength) const
+{
+    const M6DocWord& word = mWords[inWordNr - 1];
 
-        for (uint32 t = 1; t < docTokenCount; ++t)
+    outWord = (word.mInText ? mText.data() : mWordText.data()) + word.mOffset;
+    outWordLength = word.mLength;
+}
+
+// Words found in the text are copied, before the text is replaced
+
+void M6InputDocument::DetachWords()
+{
+    for (M6DocWord& word : mWords)
+    {
+        if (word.mInText)
         {
-            if (tokenRemap[t] == kUndefinedTokenValue)
-            {
-                const char* w;
-                size_t wl;
+            size_t offset = mWordText.length();
+            mWordText.append(mText, word.mOffset, word.mLength);
 
-                mDocLexicon.GetString(t, w, wl);
-                tokenRemap[t] = inLexicon.Store(w, wl);
-            }
+            word.mOffset = static_cast<uint32>(offset);
+            word.mInText = false;
         }
     }
+}
+
+void M6InputDocument::Tokenize(M6Lexicon& inLexicon, uint32 inLastStopWord)
+{
+    uint32 docTokenCount = static_cast<uint32>(mWords.size() + 1);
+    vector<uint32> tokenRemap(docTokenCount, 0);
+
+    // the lexicon takes care of its own locking
+    for (uint32 t = 1; t < docTokenCount; ++t)
+    {
+        const char* w;
+        size_t wl;
+
+        GetWord(t, w, wl);
+        uint32 rt = inLexicon.Store(w, wl);
+
+        if (rt > inLastStopWord)
+            tokenRemap[t] = rt;
+    }
 
     RemapTokens(&tokenRemap[0]);
 }
@@ -335,32 +571,167 @@ void M6InputDocument::RemapTokens(const uint32 inTokenMap[])
 // --------------------------------------------------------------------
 
 M6OutputDocument::M6OutputDocument(M6Databank& inDatabank,
-        uint32 inDocNr, uint32 inDocPage, uint32 inDocSize)
+        uint32 inDocNr, uint32 inDocPage, uint32 inDocSize, bool inPageAligned)
     : M6Document(inDatabank)
     , mDocNr(inDocNr)
     , mDocPage(inDocPage)
     , mDocSize(inDocSize)
+    , mPageAligned(inPageAligned)
     , mLinksRead(false)
+    , mBlockIndexRead(false)
 {
 }
 
-string M6OutputDocument::GetText()
+void M6OutputDocument::ReadBlockIndex()
+{
+    if (not mBlockIndexRead)
+    {
+        M6DocStore& store(mDatabank.GetDocStore());
+
+        M6DocBlockHeader header = {};
+
+        // blocked documents are always stored page aligned, no need to
+        // probe the others
+        if (mPageAligned and mDocSize >= kM6DocBlockHeaderSize)
+        {
+            uint8 data[kM6DocBlockHeaderSize];
+
+            io::filtering_stream<io::input> is;
+            store.OpenDataStream(mDocNr, mDocPage, mDocSize, mPageAligned, 0, kM6DocBlockHeaderSize, is);
+            if (is.read(reinterpret_cast<char*>(data), kM6DocBlockHeaderSize))
+                ReadBlockHeader(data, header);
+        }
+
+        if (memcmp(header.mSignature, kM6DocBlockSignature, sizeof(kM6DocBlockSignature)) == 0)
+        {
+            mBlockIndex.reset(new M6DocBlockIndex);
+            mBlockIndex->mBlockSize = header.mBlockSize;
+            mBlockIndex->mTextOffset = header.mTextOffset;
+            mBlockIndex->mDataOffset = kM6DocBlockHeaderSize + header.mBlockCount * sizeof(uint32);
+            mBlockIndex->mBlockEnd.resize(header.mBlockCount);
+
+            if (header.mBlockCount == 0 or mBlockIndex->mDataOffset > mDocSize)
+                THROW(("Invalid block index for document %d", mDocNr));
+
+            vector<uint8> data(header.mBlockCount * sizeof(uint32));
+
+            io::filtering_stream<io::input> is;
+            store.OpenDataStream(mDocNr, mDocPage, mDocSize, mPageAligned, kM6DocBlockHeaderSize,
+                static_cast<uint32>(data.size()), is);
+            if (not is.read(reinterpret_cast<char*>(&data[0]), data.size()))
+                THROW(("Invalid block index for document %d", mDocNr));
+
+            const uint8* p = &data[0];
+            for (uint32& end : mBlockIndex->mBlockEnd)
+                end = Read32(p);
+        }
+
+        mBlockIndexRead = true;
+    }
+}
+
+// --------------------------------------------------------------------
+//    M6DocBlockSource inflates the blocks of a document stored in blocked
+//    format one after the other, starting at an arbitrary offset in the
+//    uncompressed data. Only the blocks that are actually read are
+//    fetched from the document store.
+
+class M6DocBlockSource : public io::source
+{
+  public:
+    typedef char            char_type;
+    typedef io::source_tag    category;
+
+                    M6DocBlockSource(M6DocStore& inStore, uint32 inDocNr, uint32 inDocPage,
+                        uint32 inDocSize, bool inPageAligned, shared_ptr<M6DocBlockIndex> inIndex,
+                        uint32 inOffset)
+                        : mStore(&inStore), mDocNr(inDocNr), mDocPage(inDocPage), mDocSize(inDocSize)
+                        , mPageAligned(inPageAligned), mIndex(inIndex), mBlockNr(inOffset / inIndex->mBlockSize)
+                        , mSkip(inOffset % inIndex->mBlockSize) {}
+
+    streamsize        read(char* s, streamsize n);
+
+  private:
+    M6DocStore*        mStore;
+    uint32            mDocNr, mDocPage, mDocSize;
+    bool            mPageAligned;
+    shared_ptr<M6DocBlockIndex>
+                    mIndex;
+    uint32            mBlockNr, mSkip;
+    shared_ptr<io::filtering_stream<io::input>>
+                    mBlock;
+};
+
+streamsize M6DocBlockSource::read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    while (result == 0)
+    {
+        if (not mBlock)
+        {
+            if (mBlockNr >= mIndex->mBlockEnd.size())
+                break;
+
+            io::zlib_params params;
+            params.noheader = true;
+            params.calculate_crc = true;
+
+            mBlock.reset(new io::filtering_stream<io::input>);
+            mBlock->push(io::zlib_decompressor(params));
+            mStore->OpenDataStream(mDocNr, mDocPage, mDocSize, mPageAligned,
+                mIndex->GetBlockOffset(mBlockNr), mIndex->GetBlockLength(mBlockNr), *mBlock);
+
+            if (mSkip > 0)
+            {
+                mBlock->ignore(mSkip);
+                mSkip = 0;
+            }
+        }
+
+        mBlock->read(s, n);
+        result = mBlock->gcount();
+
+        if (result == 0)
+        {
+            mBlock.reset();
+            ++mBlockNr;
+        }
+    }
+
+    if (result == 0)
+        result = -1;
+
+    return result;
+}
+
+void M6OutputDocument::OpenDataStream(io::filtering_stream<io::input>& ioStream, uint32 inOffset)
 {
     M6DocStore& store(mDatabank.GetDocStore());
 
-    // set-up the decompression machine
-    io::zlib_params params;
-    params.noheader = true;
-    params.calculate_crc = true;
+    ReadBlockIndex();
 
-    io::zlib_decompressor z_stream(params);
+    if (mBlockIndex)
+        ioStream.push(M6DocBlockSource(store, mDocNr, mDocPage, mDocSize, mPageAligned, mBlockIndex, inOffset));
+    else
+    {
+        // set-up the decompression machine
+        io::zlib_params params;
+        params.noheader = true;
+        params.calculate_crc = true;
 
-    io::filtering_stream<io::input> is;
-    is.push(z_stream);
-    store.OpenDataStream(mDocNr, mDocPage, mDocSize, is);
+        ioStream.push(io::zlib_decompressor(params));
+        store.OpenDataStream(mDocNr, mDocPage, mDocSize, ioStream);
 
-    // skip over the attributes first
+        if (inOffset > 0)
+            ioStream.ignore(inOffset);
+    }
+}
 
+// skip over the attributes and the optional link block, returns the
+// first line of text that was read in the process, if any.
+static string SkipDocumentHeader(istream& is)
+{
     char c;
     is.read(&c, 1);
     while (c != 0 and not is.eof())
@@ -382,12 +753,116 @@ string M6OutputDocument::GetText()
     else
         text += '\n';
 
+    return text;
+}
+
+string M6OutputDocument::GetText()
+{
+    unique_ptr<istream> is(GetTextStream());
+
+    string text;
+
     io::filtering_ostream out(io::back_inserter(text));
-    io::copy(is, out);
+    io::copy(*is, out);
 
     return text;
 }
 
+string M6OutputDocument::GetText(uint32 inOffset, uint32 inLength)
+{
+    unique_ptr<istream> is(GetTextStream(inOffset));
+
+    string text(inLength, 0);
+    is->read(&text[0], inLength);
+    text.resize(is->gcount());
+
+    return text;
+}
+
+// --------------------------------------------------------------------
+//    M6DocTextSource is a device that returns the text of a stored document
+//    decompressing it on the fly. Only a single data page and the zlib
+//    buffers are kept in memory.
+
+class M6DocTextSource : public io::source
+{
+  public:
+    typedef char            char_type;
+    typedef io::source_tag    category;
+
+                    M6DocTextSource(shared_ptr<io::filtering_stream<io::input>> inStream,
+                        const string& inFirstLine)
+                        : mStream(inStream), mFirstLine(new string(inFirstLine)), mOffset(0) {}
+
+    streamsize        read(char* s, streamsize n);
+
+  private:
+    shared_ptr<io::filtering_stream<io::input>>
+                    mStream;
+    shared_ptr<string>
+                    mFirstLine;
+    size_t            mOffset;
+};
+
+streamsize M6DocTextSource::read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    if (mOffset < mFirstLine->length())
+    {
+        result = mFirstLine->length() - mOffset;
+        if (result > n)
+            result = n;
+
+        memcpy(s, mFirstLine->c_str() + mOffset, result);
+        mOffset += result;
+        s += result;
+        n -= result;
+    }
+
+    if (n > 0 and not mStream->eof())
+    {
+        mStream->read(s, n);
+        result += mStream->gcount();
+    }
+
+    if (result == 0)
+        result = -1;
+
+    return result;
+}
+
+istream* M6OutputDocument::GetTextStream()
+{
+    return GetTextStream(0);
+}
+
+istream* M6OutputDocument::GetTextStream(uint32 inOffset)
+{
+    shared_ptr<io::filtering_stream<io::input>> is(new io::filtering_stream<io::input>);
+    string firstLine;
+
+    ReadBlockIndex();
+
+    if (mBlockIndex)    // text starts at a known offset, no need to parse the header
+        OpenDataStream(*is, mBlockIndex->mTextOffset + inOffset);
+    else
+    {
+        OpenDataStream(*is);
+
+        firstLine = SkipDocumentHeader(*is);
+        if (inOffset < firstLine.length())
+            firstLine.erase(0, inOffset);
+        else
+        {
+            is->ignore(inOffset - firstLine.length());
+            firstLine.clear();
+        }
+    }
+
+    return new io::stream<M6DocTextSource>(M6DocTextSource(is, firstLine));
+}
+
 string M6OutputDocument::GetAttribute(const string& inName)
 {
     M6DocStore& store(mDatabank.GetDocStore());
@@ -399,16 +874,8 @@ string M6OutputDocument::GetAttribute(const string& inName)
         result = to_string(mDocNr);
     else
     {
-        // set-up the decompression machine
-        io::zlib_params params;
-        params.noheader = true;
-        params.calculate_crc = true;
-
-        io::zlib_decompressor z_stream(params);
-
         io::filtering_stream<io::input> is;
-        is.push(z_stream);
-        store.OpenDataStream(mDocNr, mDocPage, mDocSize, is);
+        OpenDataStream(is);
 
         for (;;)
         {
@@ -436,22 +903,36 @@ string M6OutputDocument::GetAttribute(const string& inName)
     return result;
 }
 
-M6DocLinks& M6OutputDocument::GetLinks()
+void M6OutputDocument::GetAttributes(map<string,string>& outAttributes)
 {
-    if (not mLinksRead)
+    M6DocStore& store(mDatabank.GetDocStore());
+
+    io::filtering_stream<io::input> is;
+    OpenDataStream(is);
+
+    for (;;)
     {
-        M6DocStore& store(mDatabank.GetDocStore());
+        char c;
+        if (not is.read(&c, 1) or c == 0)
+            break;
 
-        // set-up the decompression machine
-        io::zlib_params params;
-        params.noheader = true;
-        params.calculate_crc = true;
+        uint8 l;
+        is.read(reinterpret_cast<char*>(&l), 1);
 
-        io::zlib_decompressor z_stream(params);
+        string value(l, 0);
+        if (l > 0)
+            is.read(&value[0], l);
 
+        outAttributes[store.GetAttributeName(static_cast<uint8>(c))] = value;
+    }
+}
+
+M6DocLinks& M6OutputDocument::GetLinks()
+{
+    if (not mLinksRead)
+    {
         io::filtering_stream<io::input> is;
-        is.push(z_stream);
-        store.OpenDataStream(mDocNr, mDocPage, mDocSize, is);
+        OpenDataStream(is);
 
         // skip over the attributes first
         char c;
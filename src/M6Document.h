@@ -15,10 +15,15 @@
 #include <map>
 #include <set>
 #include <vector>
+#include <istream>
+#include <memory>
+
+#include <boost/iostreams/filtering_stream.hpp>
 
 #include "M6Lexicon.h"
 
 class M6Databank;
+struct M6DocBlockIndex;
 
 // Documents can have links:
 typedef std::map<std::string,std::set<std::string>> M6DocLinks;
@@ -34,6 +39,11 @@ class M6Document
     virtual std::string    GetText() = 0;
     virtual std::string    GetAttribute(const std::string& inName) = 0;
 
+    // GetTextStream returns a newly allocated stream on the text of
+    // this document. The caller owns the stream. The default implementation
+    // simply wraps GetText.
+    virtual std::istream*    GetTextStream();
+
     virtual M6DocLinks&    GetLinks() = 0;
 
   protected:
@@ -122,14 +132,32 @@ class M6InputDocument : public M6Document
                         GetIndexTokens(const std::string& inIndexName,
                             M6DataType inDataType);
 
+    // The distinct words of this document are numbered from 1 and stored
+    // in a small hash table. A word found unchanged in the document text is
+    // kept as a span of mText, other words are copied to mWordText.
+    struct M6DocWord
+    {
+        uint32            mOffset;
+        uint32            mLength;
+        bool            mInText;
+    };
+
+    uint32                StoreWord(const char* inWord, size_t inWordLength);
+    void                GetWord(uint32 inWordNr, const char*& outWord, size_t& outWordLength) const;
+    void                DetachWords();
+
     std::string            mText;
     std::string            mFasta;
     std::vector<char>    mBuffer;
     M6DocAttributes        mAttributes;
     M6IndexTokenList    mTokens;
     M6IndexValueList    mValues;
-    M6Lexicon            mDocLexicon;
+    std::vector<M6DocWord>
+                        mWords;
+    std::vector<uint32>    mWordSlots;
+    std::string            mWordText;
     uint32                mDocNr;
+    bool                mBlocked;
 };
 
 // Output document, this is returned by the M6Databank object
@@ -138,14 +166,37 @@ class M6OutputDocument : public M6Document
 {
   public:
                         M6OutputDocument(M6Databank& inDatabank,
-                            uint32 inDocNr, uint32 inDocPage, uint32 inDocSize);
+                            uint32 inDocNr, uint32 inDocPage, uint32 inDocSize,
+                            bool inPageAligned);
 
     virtual std::string    GetText();
     virtual std::string    GetAttribute(const std::string& inName);
 
+    // All attributes stored with this document, by name
+    void                GetAttributes(std::map<std::string,std::string>& outAttributes);
+
+    // Return at most inLength bytes of text starting at inOffset. For large
+    // documents, stored in independently compressed blocks, this only
+    // decompresses the blocks containing the requested range.
+    std::string            GetText(uint32 inOffset, uint32 inLength);
+
+    // Returns a stream that decompresses the document text straight
+    // from the document store, without creating a copy in memory.
+    // The stream remains valid as long as the databank is open.
+    virtual std::istream*    GetTextStream();
+    std::istream*        GetTextStream(uint32 inOffset);
+
     virtual M6DocLinks&    GetLinks();
 
   private:
+    void                ReadBlockIndex();
+    void                OpenDataStream(boost::iostreams::filtering_stream<boost::iostreams::input>& ioStream,
+                            uint32 inOffset = 0);
+
     uint32                mDocNr, mDocPage, mDocSize;
+    bool                mPageAligned;
     bool                mLinksRead;
+    bool                mBlockIndexRead;
+    std::shared_ptr<M6DocBlockIndex>
+                        mBlockIndex;
 };
@@ -208,6 +208,11 @@ void pread(M6Handle inHandle, void* inBuffer, int64 inSize, int64 inOffset)
 
 }
 
+void advise(M6Handle inHandle, int64 inOffset, int64 inSize, MAccessAdvice inAdvice)
+{
+    // there is no equivalent for an open file on Windows
+}
+
 #else
 
 #include <fcntl.h>
@@ -270,6 +275,16 @@ void pread(M6Handle inHandle, void* inBuffer, int64 inSize, int64 inOffset)
 //    cout << "pread(" << inSize << ", " << inOffset << ", " << int(byte) << ")" << endl;
 }
 
+void advise(M6Handle inHandle, int64 inOffset, int64 inSize, MAccessAdvice inAdvice)
+{
+#if defined(POSIX_FADV_SEQUENTIAL)
+    int advice = inAdvice == eSequentialAccess ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_DONTNEED;
+
+    // this is only a hint, errors are ignored
+    posix_fadvise(inHandle, inOffset, inSize, advice);
+#endif
+}
+
 #endif
 
 }
@@ -367,6 +382,11 @@ void M6File::PWrite(const void* inBuffer, int64 inSize, int64 inOffset)
         mImpl->mSize = inOffset + inSize;
 }
 
+void M6File::Advise(int64 inOffset, int64 inSize, MAccessAdvice inAdvice)
+{
+    M6IO::advise(mImpl->mHandle, inOffset, inSize, inAdvice);
+}
+
 void M6File::Truncate(int64 inSize)
 {
     M6IO::truncate(mImpl->mHandle, inSize);
@@ -20,6 +20,13 @@ enum MOpenMode
     eReadWrite
 };
 
+// hints for the page cache, these are ignored where not supported
+enum MAccessAdvice
+{
+    eSequentialAccess,        // the file will be read from start to end
+    eDontNeed                // the range will not be read again soon
+};
+
 typedef int64    M6Handle;
 
 namespace M6IO
@@ -32,6 +39,9 @@ namespace M6IO
 
     void pwrite(M6Handle inHandle, const void* inBuffer, int64 inSize, int64 inOffset);
     void pread(M6Handle inHandle, void* inBuffer, int64 inSize, int64 inOffset);
+
+    // a size of zero means up to the end of the file
+    void advise(M6Handle inHandle, int64 inOffset, int64 inSize, MAccessAdvice inAdvice);
 }
 
 class M6FileReader;
@@ -66,6 +76,8 @@ class M6File
     void            PWrite(S& outStruct, int64 inOffset)
                         { PWrite(&outStruct, sizeof(S), inOffset); }
 
+    void            Advise(int64 inOffset, int64 inSize, MAccessAdvice inAdvice);
+
     virtual void    Truncate(int64 inSize);
     int64            Size() const                        { return mImpl->mSize; }
     int64            Seek(int64 inOffset, int inMode);
@@ -18,6 +18,7 @@
 #include <cmath>
 #include <deque>
 #include <list>
+#include <memory>
 #include <vector>
 #include <numeric>
 #include <iostream>
@@ -959,6 +960,8 @@ struct M6IndexImpl
     virtual void    Commit() = 0;
     virtual void    Rollback() = 0;
     virtual void    Vacuum(M6Progress& inProgress) = 0;
+    virtual void    Merge(const vector<M6IndexImpl*>& inIndices,
+                        const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress) = 0;
 
     // basic cache routines
     template<class PageType>    PageType*    Allocate();
@@ -1057,6 +1060,9 @@ class M6IndexImplT : public M6IndexImpl
     virtual bool    IsInBatchMode()                 { return mBatchFile != nullptr; }
     void            CreateUpLevels(deque<pair<string,uint32>>& up);
 
+    virtual void    Merge(const vector<M6IndexImpl*>& inIndices,
+                        const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress);
+
     virtual void    Validate();
     virtual void    Dump();
 
@@ -1083,6 +1089,14 @@ class M6IndexImplT : public M6IndexImpl
     typedef function<bool(const char* inKey, uint32 inKeyLength, const M6DataType& inData)> Visitor;
     void            Visit(Visitor inVisitor, uint32 inPage = 0, uint32 inKey = 0);
 
+    // MergeKeys passes the values stored for a key in one or more of
+    // inIndices, paired with the number of their index, to inMerge which
+    // returns false if nothing is left to store for this key.
+    typedef vector<pair<uint32,M6DataType>>    M6MergeValues;
+    typedef function<bool(const M6MergeValues& inValues, M6DataType& outValue)> M6MergeFunc;
+    void            MergeKeys(const vector<M6IndexImpl*>& inIndices, M6MergeFunc inMerge,
+                        M6Progress& inProgress);
+
     BOOST_STATIC_ASSERT(sizeof(M6BatchEntry[2]) == (2 * sizeof(M6BatchEntry)));
 
     M6BatchEntry*    mBatch;
@@ -2927,6 +2941,7 @@ M6Iterator* M6IndexImplT<M6MultiIDLData>::FindString(const string& inString)
         vector<tuple<M6Iterator*,int64,uint32>> iterators;
         bool ok = true;
         uint32 index = 0;
+        string key;
 
         M6Tokenizer tokenizer(inString);
         for (;;)
@@ -2937,7 +2952,8 @@ M6Iterator* M6IndexImplT<M6MultiIDLData>::FindString(const string& inString)
 
             if (token == eM6TokenWord or token == eM6TokenNumber)
             {
-                if (not root->Find(tokenizer.GetTokenString(), data))
+                key.assign(tokenizer.GetTokenValue(), tokenizer.GetTokenLength());
+                if (not root->Find(key, data))
                 {
                     ok = false;
                     break;
@@ -3190,6 +3206,265 @@ M6BasicPage* M6IndexImplT<M6DataType>::GetFirstLeafPage()
     return result;
 }
 
+// --------------------------------------------------------------------
+//    Merging indices. The keys of the source indices are read in order
+//    from their leaf pages and the new index is built bottom-up like in
+//    FinishBatchMode. The document numbers are remapped using a table
+//    for each source index, documents mapped to zero are dropped.
+
+namespace
+{
+
+inline uint32 M6RemapDoc(const vector<uint32>& inDocMap, uint32 inDocNr)
+{
+    return inDocNr < inDocMap.size() ? inDocMap[inDocNr] : 0;
+}
+
+}
+
+template<class M6DataType>
+void M6IndexImplT<M6DataType>::MergeKeys(const vector<M6IndexImpl*>& inIndices,
+    M6MergeFunc inMerge, M6Progress& inProgress)
+{
+    if (mHeader.mRoot != 0)
+        THROW(("Merging into a non-empty index is not supported"));
+
+    struct M6MergeCursor
+    {
+        uint32        mIndexNr;
+        LeafPage*    mPage;
+        uint32        mKeyNr;
+        string        mKey;
+    };
+
+    // move to the next key, skipping empty pages
+    auto advance = [&inIndices](M6MergeCursor& c) -> bool
+    {
+        while (c.mPage != nullptr and c.mKeyNr >= c.mPage->GetN())
+        {
+            M6IndexImpl* index = inIndices[c.mIndexNr];
+            uint32 link = c.mPage->GetLink();
+
+            index->Release(c.mPage);
+            c.mPage = link != 0 ? index->Load<LeafPage>(link) : nullptr;
+            c.mKeyNr = 0;
+        }
+
+        if (c.mPage != nullptr)
+            c.mKey = c.mPage->GetKey(c.mKeyNr);
+
+        return c.mPage != nullptr;
+    };
+
+    // equal keys leave the heap in the order of their indices
+    auto greater = [this](const M6MergeCursor* a, const M6MergeCursor* b) -> bool
+    {
+        int d = CompareKeys(a->mKey, b->mKey);
+        return d > 0 or (d == 0 and a->mIndexNr > b->mIndexNr);
+    };
+
+    vector<M6MergeCursor> cursors(inIndices.size());
+    vector<M6MergeCursor*> heap;
+
+    for (uint32 i = 0; i < inIndices.size(); ++i)
+    {
+        M6MergeCursor& c = cursors[i];
+        c.mIndexNr = i;
+        c.mPage = inIndices[i] ? static_cast<LeafPage*>(inIndices[i]->GetFirstLeafPage()) : nullptr;
+        c.mKeyNr = 0;
+
+        if (advance(c))
+            heap.push_back(&c);
+    }
+
+    make_heap(heap.begin(), heap.end(), greater);
+
+    deque<pair<string,uint32>> up;
+    LeafPage* page = nullptr;
+    uint32 n = 0;
+
+    M6MergeValues values;
+
+    while (not heap.empty())
+    {
+        string key = heap.front()->mKey;
+
+        values.clear();
+        while (not heap.empty() and CompareKeys(heap.front()->mKey, key) == 0)
+        {
+            pop_heap(heap.begin(), heap.end(), greater);
+
+            M6MergeCursor* c = heap.back();
+            values.push_back(make_pair(c->mIndexNr, c->mPage->GetValue(c->mKeyNr)));
+
+            ++c->mKeyNr;
+            if (advance(*c))
+                push_heap(heap.begin(), heap.end(), greater);
+            else
+                heap.pop_back();
+        }
+
+        inProgress.Consumed(values.size());
+
+        M6DataType v;
+        if (not inMerge(values, v))
+            continue;
+
+        if (page == nullptr or not page->CanStore(key))
+        {
+            LeafPage* next = Allocate<LeafPage>();
+
+            if (page == nullptr)
+                mHeader.mFirstLeafPage = next->GetPageNr();
+            else
+            {
+                page->SetLink(next->GetPageNr());
+                Release(page);
+            }
+
+            page = next;
+            up.push_back(make_pair(key, page->GetPageNr()));
+        }
+
+        page->InsertKeyValue(key, v, page->GetN());
+        ++n;
+    }
+
+    mHeader.mSize = n;
+
+    if (page != nullptr)
+    {
+        Release(page);
+
+        FlushCache();
+        CreateUpLevels(up);
+    }
+
+    mDirty = true;
+    Commit();
+}
+
+template<>
+void M6IndexImplT<uint32>::Merge(const vector<M6IndexImpl*>& inIndices,
+    const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress)
+{
+    MergeKeys(inIndices, [&](const M6MergeValues& inValues, uint32& outValue) -> bool
+    {
+        // a key is unique, the document from the newest index is kept
+        outValue = 0;
+        for (auto& v : inValues)
+        {
+            uint32 docNr = M6RemapDoc(inDocMaps[v.first], v.second);
+            if (docNr != 0)
+                outValue = docNr;
+        }
+        return outValue != 0;
+    }, inProgress);
+}
+
+template<>
+void M6IndexImplT<M6MultiData>::Merge(const vector<M6IndexImpl*>& inIndices,
+    const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress)
+{
+    vector<uint32> docs;
+
+    MergeKeys(inIndices, [&](const M6MergeValues& inValues, M6MultiData& outValue) -> bool
+    {
+        docs.clear();
+
+        for (auto& v : inValues)
+        {
+            M6CompressedArrayIterator iter(
+                M6IBitStream(new M6IBitVectorImpl(*inIndices[v.first], v.second.mBitVector)),
+                v.second.mCount);
+
+            uint32 docNr;
+            while (iter.Next(docNr))
+            {
+                docNr = M6RemapDoc(inDocMaps[v.first], docNr);
+                if (docNr != 0)
+                    docs.push_back(docNr);
+            }
+        }
+
+        if (docs.empty())
+            return false;
+
+        outValue.mCount = static_cast<uint32>(docs.size());
+
+        M6OBitStream bits;
+        CompressSimpleArraySelector(bits, docs);
+        StoreBits(bits, outValue.mBitVector);
+
+        return true;
+    }, inProgress);
+}
+
+template<>
+void M6IndexImplT<M6MultiIDLData>::Merge(const vector<M6IndexImpl*>& inIndices,
+    const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress)
+{
+    // the in document locations are stored per key as one array for each
+    // document, only those of the documents that are kept are copied.
+    auto idlPath = [](const fs::path& inIndexPath) -> fs::path
+        { return inIndexPath.parent_path() / (inIndexPath.stem().string() + ".idl"); };
+
+    M6File idlFile(idlPath(mPath), eReadWrite);
+
+    vector<shared_ptr<M6File>> sourceIDLFiles;
+    for (M6IndexImpl* index : inIndices)
+    {
+        shared_ptr<M6File> file;
+        if (index != nullptr)
+            file.reset(new M6File(idlPath(static_cast<M6IndexImplT*>(index)->mPath), eReadOnly));
+        sourceIDLFiles.push_back(file);
+    }
+
+    vector<uint32> docs, locations;
+
+    MergeKeys(inIndices, [&](const M6MergeValues& inValues, M6MultiIDLData& outValue) -> bool
+    {
+        docs.clear();
+
+        outValue.mIDLOffset = idlFile.Seek(0, SEEK_END);
+        M6OBitStream idlBits(idlFile);
+
+        for (auto& v : inValues)
+        {
+            M6CompressedArrayIterator iter(
+                M6IBitStream(new M6IBitVectorImpl(*inIndices[v.first], v.second.mBitVector)),
+                v.second.mCount);
+            M6IBitStream idl(*sourceIDLFiles[v.first], v.second.mIDLOffset);
+
+            uint32 docNr;
+            while (iter.Next(docNr))
+            {
+                ReadArray(idl, locations);
+
+                docNr = M6RemapDoc(inDocMaps[v.first], docNr);
+                if (docNr != 0)
+                {
+                    docs.push_back(docNr);
+                    WriteArray(idlBits, locations);
+                }
+            }
+        }
+
+        if (docs.empty())
+            return false;
+
+        idlBits.Sync();
+
+        outValue.mCount = static_cast<uint32>(docs.size());
+
+        M6OBitStream bits;
+        CompressSimpleArraySelector(bits, docs);
+        StoreBits(bits, outValue.mBitVector);
+
+        return true;
+    }, inProgress);
+}
+
 template<class M6DataType>
 void M6IndexImplT<M6DataType>::CreateUpLevels(deque<pair<string,uint32>>& up)
 {
@@ -3804,6 +4079,25 @@ bool M6BasicIndex::IsInBatchMode()
 
 // --------------------------------------------------------------------
 
+void M6BasicIndex::Merge(const vector<M6BasicIndex*>& inIndices,
+    const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress)
+{
+    if (inIndices.size() != inDocMaps.size())
+        THROW(("Merge needs a document map for each index"));
+
+    vector<M6IndexImpl*> indices;
+    for (M6BasicIndex* index : inIndices)
+    {
+        if (index != nullptr and index->GetIndexType() != GetIndexType())
+            THROW(("Cannot merge indices of a different type"));
+        indices.push_back(index != nullptr ? index->mImpl : nullptr);
+    }
+
+    mImpl->Merge(indices, inDocMaps, inProgress);
+}
+
+// --------------------------------------------------------------------
+
 void M6BasicIndex::Dump() const
 {
     mImpl->Dump();
@@ -3913,6 +4207,9 @@ struct M6WeightedBasicIndexImpl : public M6IndexImplT<M6MultiData>
                     GetIterator(const M6MultiData& inValue);
 
     virtual uint32    AddHits(const M6MultiData& inValue, vector<bool>& outBitmap);
+
+    virtual void    Merge(const vector<M6IndexImpl*>& inIndices,
+                        const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress);
 };
 
 M6Iterator* M6WeightedBasicIndexImpl::GetIterator(const M6MultiData& inValue)
@@ -3953,6 +4250,48 @@ uint32 M6WeightedBasicIndexImpl::AddHits(const M6MultiData& inValue, vector<bool
     return result;
 }
 
+void M6WeightedBasicIndexImpl::Merge(const vector<M6IndexImpl*>& inIndices,
+    const vector<vector<uint32>>& inDocMaps, M6Progress& inProgress)
+{
+    // the weights are stored per document, they are copied unchanged
+    for (M6IndexImpl* index : inIndices)
+    {
+        if (index != nullptr and index->GetMaxWeight() != GetMaxWeight())
+            THROW(("Cannot merge weighted indices with a different max weight"));
+    }
+
+    M6WeightedBasicIndex& index = static_cast<M6WeightedBasicIndex&>(mIndex);
+    vector<pair<uint32,uint8>> docs;
+
+    MergeKeys(inIndices, [&](const M6MergeValues& inValues, M6MultiData& outValue) -> bool
+    {
+        docs.clear();
+
+        for (auto& v : inValues)
+        {
+            M6WeightedBasicIndex::M6WeightedIterator iter(*inIndices[v.first],
+                v.second.mBitVector, v.second.mCount, GetMaxWeight());
+
+            uint32 docNr;
+            uint8 weight;
+            while (iter.Next(docNr, weight))
+            {
+                docNr = M6RemapDoc(inDocMaps[v.first], docNr);
+                if (docNr != 0)
+                    docs.push_back(make_pair(docNr, weight));
+            }
+        }
+
+        if (docs.empty())
+            return false;
+
+        outValue.mCount = static_cast<uint32>(docs.size());
+        index.StoreDocumentBits(docs, outValue);
+
+        return true;
+    }, inProgress);
+}
+
 M6WeightedBasicIndex::M6WeightedBasicIndex(const fs::path& inPath, M6IndexType inIndexType, MOpenMode inMode)
     : M6BasicIndex(new M6WeightedBasicIndexImpl(*this, inPath, inIndexType, inMode))
 {
@@ -4193,7 +4532,7 @@ uint32 M6WeightedBasicIndex::GetMaxWeight() const
 
 // --------------------------------------------------------------------
 
-M6BasicIndex* M6BasicIndex::Load(const fs::path& inFile)
+M6BasicIndex* M6BasicIndex::Load(const fs::path& inFile, MOpenMode inMode)
 {
     // first read the signature
     M6IxFileHeader header;
@@ -4206,16 +4545,16 @@ M6BasicIndex* M6BasicIndex::Load(const fs::path& inFile)
 
     switch (header.mSignature)
     {
-        case eM6CharIndex:            index = new M6SimpleIndex(inFile, eReadOnly);        break;
-        case eM6NumberIndex:        index = new M6NumberIndex(inFile, eReadOnly);        break;
-        case eM6FloatIndex:         index = new M6FloatIndex(inFile, eReadOnly);        break;
-//        case eM6DateIndex:            index = new M6SimpleIndex(inFile, eReadOnly);        break;
-        case eM6CharMultiIndex:        index = new M6SimpleMultiIndex(inFile, eReadOnly);    break;
-        case eM6NumberMultiIndex:    index = new M6NumberMultiIndex(inFile, eReadOnly);     break;
-        case eM6FloatMultiIndex:    index = new M6FloatMultiIndex(inFile, eReadOnly);   break;
-//        case eM6DateMultiIndex:        index = new M6SimpleMultiIndex(inFile, eReadOnly);    break;
-        case eM6CharMultiIDLIndex:    index = new M6SimpleIDLMultiIndex(inFile, eReadOnly); break;
-        case eM6CharWeightedIndex:    index = new M6SimpleWeightedIndex(inFile, eReadOnly); break;
+        case eM6CharIndex:            index = new M6SimpleIndex(inFile, inMode);        break;
+        case eM6NumberIndex:        index = new M6NumberIndex(inFile, inMode);        break;
+        case eM6FloatIndex:         index = new M6FloatIndex(inFile, inMode);        break;
+//        case eM6DateIndex:            index = new M6SimpleIndex(inFile, inMode);        break;
+        case eM6CharMultiIndex:        index = new M6SimpleMultiIndex(inFile, inMode);    break;
+        case eM6NumberMultiIndex:    index = new M6NumberMultiIndex(inFile, inMode);     break;
+        case eM6FloatMultiIndex:    index = new M6FloatMultiIndex(inFile, inMode);   break;
+//        case eM6DateMultiIndex:        index = new M6SimpleMultiIndex(inFile, inMode);    break;
+        case eM6CharMultiIDLIndex:    index = new M6SimpleIDLMultiIndex(inFile, inMode); break;
+        case eM6CharWeightedIndex:    index = new M6SimpleWeightedIndex(inFile, inMode); break;
         default:                    THROW(("Unknown index type"));
     }
 
@@ -40,7 +40,7 @@ class M6BasicIndex
     virtual            ~M6BasicIndex();
 
     static M6BasicIndex*
-                    Load(const boost::filesystem::path& inPath);
+                    Load(const boost::filesystem::path& inPath, MOpenMode inMode = eReadOnly);
 
     virtual M6IndexType
                     GetIndexType() const;
@@ -56,6 +56,16 @@ class M6BasicIndex
 
     void            Vacuum(M6Progress& inProgress);
 
+    // Merge fills this new, empty index with the keys of inIndices, which
+    // are of the same type. inDocMaps[i] maps the document numbers used in
+    // inIndices[i] to those of this index, documents mapped to zero are
+    // left out and so are keys without documents. Document numbers must
+    // map to increasing numbers, in the order of inIndices. An index in
+    // inIndices may be null.
+    void            Merge(const std::vector<M6BasicIndex*>& inIndices,
+                        const std::vector<std::vector<uint32>>& inDocMaps,
+                        M6Progress& inProgress);
+
     virtual int        CompareKeys(const char* inKeyA, size_t inKeyLengthA,
                         const char* inKeyB, size_t inKeyLengthB) const = 0;
     virtual std::string
@@ -300,6 +310,8 @@ class M6WeightedBasicIndex : public M6BasicIndex
     void            Insert(uint32 inKey, std::vector<std::pair<uint32,uint8>>& inDocuments);
 
   private:
+    friend struct M6WeightedBasicIndexImpl;
+
     void            StoreDocumentBits(std::vector<std::pair<uint32,uint8>>& inDocuments, M6MultiData& data);
 
     uint32            mMaxWeight;
@@ -5,6 +5,8 @@
 
 #include "M6Lib.h"
 
+#include <atomic>
+
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/algorithm/string.hpp>
@@ -27,7 +29,7 @@ struct M6LexPage
     // pages are 8 MB each:
     static const uint32 kLexDataSize = 8 * 1024 * 1024 - 2 * sizeof(uint32);
 
-    uint32        N;
+    atomic<uint32>    N;
     uint32        first;
     union
     {
@@ -97,24 +99,6 @@ struct M6LexPage
                     return comp(inPage->s + e1[inPEntry + 1], l1, s + e2[inEntry + 1], l2);
                 }
 
-    bool        TestKeyBit(uint32 inEntry, uint32 inBit) const
-                {
-                    assert(static_cast<int32>(inEntry) < N);
-                    assert(e[inEntry + 1] < e[inEntry]);
-                    assert(e[inEntry] <= kLexDataSize);
-
-                    bool result = false;
-
-                    uint32 byte = inBit >> 3;
-                    if (byte < e[inEntry] - e[inEntry + 1])
-                    {
-                        uint32 bit = 7 - (inBit & 0x0007);
-                        result = (s[e[inEntry + 1] + byte] & (1 << bit)) != 0;
-                    }
-
-                    return result;
-                }
-
     uint32        Free() const
                 {
                     return e[N] - (N + 1) * sizeof(uint32);
@@ -125,114 +109,185 @@ struct M6LexPage
 
 struct M6LexiconImpl
 {
-    // M6Node is a node in a Patricia tree
-    // and we store kIxNodeCount node in a page
+    // room for 32 GB of strings, the array of pages is never reallocated
+    static const uint32 kMaxPageCount = 4096;
 
-    static const uint32 kIxNodeCount = 8 * 1024;
+    // the initial number of slots in a shard, a power of two
+    static const uint32 kInitialSlotCount = 1024;
 
-    struct M6Node
+    // A slot in the hash table contains the lower 32 bits of the hash of
+    // the word and the word number. Only when these hash bits match, the
+    // word itself needs to be compared. A value of 0 marks an empty slot.
+    struct M6Slot
     {
-        M6Node*            left;
-        M6Node*            right;
+        uint32            hash;
         uint32            value;
-        uint32            bit;
     };
 
-                    M6LexiconImpl();
+    // Each shard is an open addressing hash table with linear probing,
+    // for the words whose hash points to it
+    struct M6Shard
+    {
+        boost::mutex    mMutex;
+        M6Slot*            mSlots;
+        uint32            mMask;
+        uint32            mUsed;
+    };
+
+                    M6LexiconImpl(uint32 inShardCount);
                     ~M6LexiconImpl();
 
     uint32            Lookup(const char* inWord, size_t inWordLength) const;
     uint32            Store(const char* inWord, size_t inWordLength);
     void            GetString(uint32 inNr, const char*& outWord, size_t& outWordLength) const;
-    const M6Node*    Find(const M6Node* inNode, const char* inWord, size_t inWordLength) const;
-    bool            Find(const char* inWord, size_t inWordLength, uint32& outNr) const;
     int                Compare(const char* inWord, size_t inWordLength, uint32 inNr) const;
     int                Compare(uint32 inA, uint32 inB) const;
 
-    bool            TestKeyBit(const char* inWord, size_t inWordLength, uint32 inBit) const
-                    {
-                        bool result = false;
+    static uint64    Hash(const char* inWord, size_t inWordLength);
 
-                        uint32 byte = inBit >> 3;
-                        if (byte < inWordLength)
-                        {
-                            uint32 bit = 7 - (inBit & 0x0007);
-                            result = (inWord[byte] & (1 << bit)) != 0;
-                        }
+    M6Shard&        GetShard(uint64 inHash) const        { return mShards[(inHash >> 32) % mShardCount]; }
+    M6Slot*            Find(M6Shard& inShard, uint32 inHash,
+                        const char* inWord, size_t inWordLength) const;
+    void            Grow(M6Shard& inShard);
 
-                        return result;
-                    }
+    M6LexPage* const*
+                    GetPage(uint32& ioNr) const;
 
-    bool            CompareKeyBits(const char* inWordA, size_t inWordALength,
-                        const char* inWordB, size_t inWordBLength, uint32 inBit) const
-                    {
-                        return
-                            TestKeyBit(inWordA, inWordALength, inBit) ==
-                            TestKeyBit(inWordB, inWordBLength, inBit);
-                    }
+    uint32            AddString(const char* inWord, size_t inWordLength);
 
-    bool            CompareKeyBits(const char* inWord, size_t inWordLength, uint32 inNr, uint32 inBit) const;
+    M6LexPage**        mPages;
+    atomic<uint32>    mPageCount;
+    atomic<uint32>    mCount;
+    boost::mutex    mPageMutex;
+    M6Shard*        mShards;
+    uint32            mShardCount;
+};
 
+// --------------------------------------------------------------------
 
-    typedef vector<M6LexPage*> LexPageArray;
+M6LexiconImpl::M6LexiconImpl(uint32 inShardCount)
+    : mPages(new M6LexPage*[kMaxPageCount])
+    , mPageCount(1)
+    , mCount(1)
+    , mShards(new M6Shard[inShardCount])
+    , mShardCount(inShardCount)
+{
+    mPages[0] = new M6LexPage(0);
+    mPages[0]->Add(" ", 1);
 
-    LexPageArray::const_iterator
-                    GetPage(uint32& ioNr) const;
+    for (uint32 s = 0; s < mShardCount; ++s)
+    {
+        M6Shard& shard = mShards[s];
 
-    typedef vector<M6Node*> NodePageArray;
+        shard.mSlots = new M6Slot[kInitialSlotCount]();
+        shard.mMask = kInitialSlotCount - 1;
+        shard.mUsed = 0;
+    }
+}
 
-    M6Node*            AllocateNode();
+M6LexiconImpl::~M6LexiconImpl()
+{
+    for (uint32 p = 0; p < mPageCount; ++p)
+        delete mPages[p];
+    delete[] mPages;
 
-    LexPageArray    mPages;
-    NodePageArray    mNodes;
-    M6Node*            mRoot;
-    uint32            mCount;
-};
+    for (uint32 s = 0; s < mShardCount; ++s)
+        delete[] mShards[s].mSlots;
+    delete[] mShards;
+}
 
-// --------------------------------------------------------------------
+// FNV-1a followed by the murmur3 finalizer to spread the bits, the upper
+// half selects the shard and the lower half the slot.
 
-M6LexiconImpl::M6LexiconImpl()
-    : mCount(0)
+inline uint64 M6LexiconImpl::Hash(const char* inWord, size_t inWordLength)
 {
-    mPages.push_back(new M6LexPage(0));
+    uint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < inWordLength; ++i)
+        h = (h ^ static_cast<uint8>(inWord[i])) * 1099511628211ULL;
 
-    mRoot = AllocateNode();
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
 
-    mRoot->value = 0;
-    mRoot->bit = 0;
-    mRoot->left = mRoot;
-    mRoot->right = mRoot;
+    return h;
+}
+
+// Returns the slot containing the word, or the empty slot where it should go
+
+inline M6LexiconImpl::M6Slot* M6LexiconImpl::Find(M6Shard& inShard, uint32 inHash,
+    const char* inWord, size_t inWordLength) const
+{
+    uint32 ix = inHash & inShard.mMask;
+
+    for (;;)
+    {
+        M6Slot* slot = inShard.mSlots + ix;
 
-    mPages.front()->Add(" ", 1);
-    mCount = 1;
+        if (slot->value == 0 or
+            (slot->hash == inHash and Compare(inWord, inWordLength, slot->value) == 0))
+        {
+            return slot;
+        }
+
+        ix = (ix + 1) & inShard.mMask;
+    }
 }
 
-M6LexiconImpl::~M6LexiconImpl()
+// Double the size of the table, the stored hashes are used to place the
+// words in the new table, the words themselves are not touched.
+
+void M6LexiconImpl::Grow(M6Shard& inShard)
 {
-    for (LexPageArray::iterator p = mPages.begin(); p != mPages.end(); ++p)
-        delete *p;
+    uint32 size = (inShard.mMask + 1) * 2;
+    M6Slot* slots = new M6Slot[size]();
 
-    for (NodePageArray::iterator p = mNodes.begin(); p != mNodes.end(); ++p)
-        delete[] *p;
+    for (uint32 i = 0; i <= inShard.mMask; ++i)
+    {
+        const M6Slot& slot = inShard.mSlots[i];
+        if (slot.value == 0)
+            continue;
+
+        uint32 ix = slot.hash & (size - 1);
+        while (slots[ix].value != 0)
+            ix = (ix + 1) & (size - 1);
+
+        slots[ix] = slot;
+    }
+
+    delete[] inShard.mSlots;
+    inShard.mSlots = slots;
+    inShard.mMask = size - 1;
 }
 
-M6LexiconImpl::M6Node* M6LexiconImpl::AllocateNode()
+// The strings of all shards are appended to the same pages. A new page
+// is published by incrementing mPageCount after it has been stored.
+
+uint32 M6LexiconImpl::AddString(const char* inWord, size_t inWordLength)
 {
-    uint32 ix = mCount % kIxNodeCount;
+    boost::mutex::scoped_lock lock(mPageMutex);
 
-    if (ix == 0)    // time for a new node page
+    M6LexPage* page = mPages[mPageCount - 1];
+
+    if (page->Free() < inWordLength + sizeof(uint32))
     {
-        assert((mCount / kIxNodeCount) == mNodes.size());
-        mNodes.push_back(new M6Node[kIxNodeCount]);
+        if (mPageCount == kMaxPageCount)
+            THROW(("Lexicon is full"));
+
+        page = new M6LexPage(mCount);
+        mPages[mPageCount] = page;
+        ++mPageCount;
     }
 
-    return mNodes.back() + ix;
+    page->Add(inWord, inWordLength);
+
+    return mCount++;
 }
 
-inline M6LexiconImpl::LexPageArray::const_iterator
-M6LexiconImpl::GetPage(uint32& ioNr) const
+inline M6LexPage* const* M6LexiconImpl::GetPage(uint32& ioNr) const
 {
-    int32 L = 0, R = static_cast<int32>(mPages.size() - 1);
+    int32 L = 0, R = static_cast<int32>(mPageCount - 1);
     while (L <= R)
     {
         int32 i = (L + R) / 2;
@@ -243,10 +298,10 @@ M6LexiconImpl::GetPage(uint32& ioNr) const
             R = i - 1;
     }
 
-    LexPageArray::const_iterator p = mPages.begin() + L - 1;
+    M6LexPage* const* p = mPages + L - 1;
 
     assert(L > 0);
-    assert(uint32(L - 1) < mPages.size());
+    assert(uint32(L - 1) < mPageCount);
     assert((*p)->first <= ioNr);
     assert(ioNr < (*p)->first + (*p)->N);
 
@@ -255,118 +310,47 @@ M6LexiconImpl::GetPage(uint32& ioNr) const
     return p;
 }
 
-const M6LexiconImpl::M6Node* M6LexiconImpl::Find(const M6Node* inNode, const char* inWord, size_t inWordLength) const
-{
-    const M6Node* p;
-
-    do
-    {
-        p = inNode;
-
-        if (TestKeyBit(inWord, inWordLength, inNode->bit))
-            inNode = inNode->right;
-        else
-            inNode = inNode->left;
-    }
-    while (p->bit < inNode->bit);
-
-    return inNode;
-}
-
-bool M6LexiconImpl::Find(const char* inWord, size_t inWordLength, uint32& outNr) const
-{
-    bool result = false;
-
-    if (mCount > 0)
-    {
-        const M6Node* t = Find(mRoot, inWord, inWordLength);
-        if (t != nullptr and Compare(inWord, inWordLength, t->value) == 0)
-        {
-            result = true;
-            outNr = t->value;
-        }
-    }
-
-    return result;
-}
-
 uint32 M6LexiconImpl::Lookup(const char* inWord, size_t inWordLength) const
 {
-    uint32 result = 0;
+    uint64 hash = Hash(inWord, inWordLength);
 
-    const M6Node* t = Find(mRoot, inWord, inWordLength);
+    M6Shard& shard = GetShard(hash);
+    boost::mutex::scoped_lock lock(shard.mMutex);
 
-    if (t != mRoot and Compare(inWord, inWordLength, t->value) == 0)
-        result = t->value;
-
-    return result;
+    return Find(shard, static_cast<uint32>(hash), inWord, inWordLength)->value;
 }
 
 uint32 M6LexiconImpl::Store(const char* inWord, size_t inWordLength)
 {
-    // check first to see if something has been added to inNode
-    // while we were locked...
-
-    const M6Node* t = Find(mRoot, inWord, inWordLength);
+    uint64 hash = Hash(inWord, inWordLength);
 
-    if (t != mRoot and Compare(inWord, inWordLength, t->value) == 0)
-        return t->value;
+    M6Shard& shard = GetShard(hash);
+    boost::mutex::scoped_lock lock(shard.mMutex);
 
-    uint32 i = 0;
+    M6Slot* slot = Find(shard, static_cast<uint32>(hash), inWord, inWordLength);
 
-    while (CompareKeyBits(inWord, inWordLength, t->value, i))
-        ++i;
-
-    M6Node* p;
-    M6Node* x = mRoot;
-
-    do
+    if (slot->value == 0)
     {
-        p = x;
-        if (TestKeyBit(inWord, inWordLength, x->bit))
-            x = x->right;
-        else
-            x = x->left;
-    }
-    while (x->bit < i and p->bit < x->bit);
-
-    if (mPages.back()->Free() < inWordLength + sizeof(uint32))
-        mPages.push_back(new M6LexPage(mCount));
-
-    mPages.back()->Add(inWord, inWordLength);
-
-    M6Node* n = AllocateNode();
-    n->value = mCount;
-    n->bit = i;
+        // keep the load factor below one half
+        if ((shard.mUsed + 1) * 2 > shard.mMask + 1)
+        {
+            Grow(shard);
+            slot = Find(shard, static_cast<uint32>(hash), inWord, inWordLength);
+        }
 
-    if (TestKeyBit(inWord, inWordLength, n->bit))
-    {
-        n->right = n;
-        n->left = x;
+        slot->hash = static_cast<uint32>(hash);
+        slot->value = AddString(inWord, inWordLength);
+        ++shard.mUsed;
     }
-    else
-    {
-        n->right = x;
-        n->left = n;
-    }
-
-    if (TestKeyBit(inWord, inWordLength, p->bit))
-        p->right = n;
-    else
-        p->left = n;
 
-    uint32 result = mCount;
-
-    ++mCount;
-
-    return result;
+    return slot->value;
 }
 
 inline void M6LexiconImpl::GetString(uint32 inNr, const char*& outWord, size_t& outWordLength) const
 {
-    LexPageArray::const_iterator p = GetPage(inNr);
+    M6LexPage* const* p = GetPage(inNr);
 
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
+    if ((*p)->N == 0 or inNr >= (*p)->N)
         THROW(("Lexicon is invalid"));
 
     return (*p)->GetEntry(inNr, outWord, outWordLength);
@@ -374,9 +358,9 @@ inline void M6LexiconImpl::GetString(uint32 inNr, const char*& outWord, size_t&
 
 int M6LexiconImpl::Compare(const char* inWord, size_t inWordLength, uint32 inNr) const
 {
-    LexPageArray::const_iterator p = GetPage(inNr);
+    M6LexPage* const* p = GetPage(inNr);
 
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
+    if ((*p)->N == 0 or inNr >= (*p)->N)
         THROW(("Lexicon is invalid"));
 
     return (*p)->Compare(inWord, inWordLength, inNr);
@@ -388,17 +372,11 @@ int M6LexiconImpl::Compare(uint32 inA, uint32 inB) const
 
     if (inA != inB)
     {
-        LexPageArray::const_iterator a = GetPage(inA);
-        LexPageArray::const_iterator b = GetPage(inB);
+        M6LexPage* const* a = GetPage(inA);
+        M6LexPage* const* b = GetPage(inB);
 
-        assert(a != mPages.end());
-        assert(b != mPages.end());
-
-        if (a != mPages.end() and inA < (*a)->N and
-            b != mPages.end() and inB < (*b)->N)
-        {
+        if (inA < (*a)->N and inB < (*b)->N)
             result = (*b)->Compare(*a, inA, inB);
-        }
         else
             assert(false);
     }
@@ -406,21 +384,10 @@ int M6LexiconImpl::Compare(uint32 inA, uint32 inB) const
     return result;
 }
 
-bool M6LexiconImpl::CompareKeyBits(const char* inWord, size_t inWordLength, uint32 inNr, uint32 inBit) const
-{
-    LexPageArray::const_iterator p = GetPage(inNr);
-
-    if (p == mPages.end() or (*p)->N == 0 or inNr >= (*p)->N)
-        THROW(("Lexicon is invalid"));
-
-    return
-        TestKeyBit(inWord, inWordLength, inBit) == (*p)->TestKeyBit(inNr, inBit);
-}
-
 // --------------------------------------------------------------------
 
-M6Lexicon::M6Lexicon()
-    : mImpl(new M6LexiconImpl)
+M6Lexicon::M6Lexicon(uint32 inShardCount)
+    : mImpl(new M6LexiconImpl(inShardCount > 0 ? inShardCount : 1))
 {
 }
 
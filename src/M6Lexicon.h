@@ -10,10 +10,15 @@
 
 #include <boost/thread.hpp>
 
-// M6Lexicon stores text strings in an ordered way using the least
-// possible amount of memory. Each text string gets a unique number.
-// Strings can be accessed by this number and the number for a string
-// can be found very quickly since the storage is based on a Patricia tree.
+// M6Lexicon stores text strings using the least possible amount of
+// memory. Each text string gets a unique number. Strings can be accessed
+// by this number and the number for a string can be found very quickly
+// using a hash table that stores only the number and part of the hash.
+//
+// A lexicon can be used by several threads at the same time. The words
+// are divided over a number of hash tables, the shards, each with its
+// own lock. The strings themselves are appended to shared pages, pages
+// are never moved so GetString does not need a lock.
 
 class M6Lexicon
 {
@@ -21,62 +26,17 @@ class M6Lexicon
 
   public:
 
-    // since we now have several locations where a M6Lexicon class
-    // is used, we have the option to create a lightweight version.
-                    M6Lexicon();
-    virtual            ~M6Lexicon();
+    // A lexicon shared by many threads should use kConcurrentShardCount
+    // shards, a lexicon used by a single thread needs only one.
+    static const uint32    kConcurrentShardCount = 64;
 
-    // M6Lexicon is one of the most heavily used classes.
-    // To optimize, we now use separate threads but there
-    // can only be one lexicon. So we need locking.
-    // Profiling has shown that locking is taking a
-    // disproportionate amount of time, so we split the
-    // code into a part that looks up words first in a
-    // shared lock mode and then stores those unknown
-    // in a unique lock mode.
-
-    class M6SharedLock
-    {
-      public:
-                    M6SharedLock(M6Lexicon& inLexicon)
-                        : mMutex(inLexicon.mMutex)
-                    {
-                        mMutex.lock_shared();
-                    }
-
-                    ~M6SharedLock()
-                    {
-                        mMutex.unlock_shared();
-                    }
-
-      private:
-        boost::shared_mutex&    mMutex;
-    };
-
-    class M6UniqueLock
-    {
-      public:
-                    M6UniqueLock(M6Lexicon& inLexicon)
-                        : mMutex(inLexicon.mMutex)
-                    {
-                        mMutex.lock();
-                    }
-
-                    ~M6UniqueLock()
-                    {
-                        mMutex.unlock();
-                    }
-
-      private:
-        boost::shared_mutex&    mMutex;
-    };
-
-    friend class M6SharedLock;
-    friend class M6UniqueLock;
+    explicit        M6Lexicon(uint32 inShardCount = 1);
+    virtual            ~M6Lexicon();
 
     uint32            Lookup(const std::string& inWord) const;
     uint32            Lookup(const char* inWord, size_t inWordLength) const;
 
+    // Store returns the number of inWord, adding it if it is not known yet
     uint32            Store(const std::string& inWord);
     uint32            Store(const char* inWord, size_t inWordLength);
 
@@ -95,7 +55,6 @@ class M6Lexicon
     M6Lexicon&        operator=(const M6Lexicon&);
 
     struct M6LexiconImpl*    mImpl;
-    boost::shared_mutex        mMutex;
 };
 
 // --------------------------------------------------------------------
@@ -0,0 +1,193 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include "M6LineMatcher.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+
+M6LineMatcher::M6LineMatcher(const string& inMatch)
+    : mKind(eNone), mMinLength(0)
+{
+    if (ba::starts_with(inMatch, "(?^:") and ba::ends_with(inMatch, ")"))
+    {
+        string re = inMatch.substr(4, inMatch.length() - 5);
+        if (not CompileLiteral(re))
+        {
+            mKind = eRegex;
+            mRE.assign(re);
+        }
+    }
+    else if (not inMatch.empty())
+    {
+        mKind = eLiteral;
+        mStr = inMatch;
+    }
+}
+
+// An expression is matched as a literal if it consists of an optional ^,
+// characters that are not special or are escaped, and optionally .* or .+
+// followed by an optional $.
+
+bool M6LineMatcher::CompileLiteral(const string& inRE)
+{
+    const char kSpecial[] = ".[]{}()\\*+?|^$";
+
+    string literal;
+    string::const_iterator c = inRE.begin(), e = inRE.end();
+
+    if (c != e and *c == '^')
+        ++c;
+
+    while (c != e)
+    {
+        if (*c == '\\')
+        {
+            // only escaped punctuation is literal, \d, \s and the like are not
+            if (c + 1 == e or isalnum(static_cast<unsigned char>(*(c + 1))))
+                return false;
+            literal += *(c + 1);
+            c += 2;
+        }
+        else if (strchr(kSpecial, *c) == nullptr)
+            literal += *c++;
+        else
+            break;
+    }
+
+    size_t minLength = literal.length();
+    M6MatchKind kind = eLiteral;
+
+    if (c != e and *c == '.' and c + 1 != e and (*(c + 1) == '*' or *(c + 1) == '+'))
+    {
+        kind = ePrefix;
+        if (*(c + 1) == '+')
+            ++minLength;
+        c += 2;
+    }
+
+    if (c != e and *c == '$')
+        ++c;
+
+    if (c != e or (kind == eLiteral and literal.empty()))
+        return false;
+
+    mKind = kind;
+    mStr = literal;
+    mMinLength = minLength;
+
+    return true;
+}
+
+// --------------------------------------------------------------------
+
+// M6SplitRecords reads the input in large blocks and looks up the line ends
+// using memchr. The documents found are passed on as slices of the block,
+// only the unfinished document at the end of a block is copied into
+// the next block. A block holds at least as many new bytes as were copied,
+// so a document larger than a block doubles the block size each time and
+// each byte of it is copied only a few times. The states are the same as
+// those in M6Processor::ParseFile.
+
+void M6SplitRecords(istream& inStream, const M6LineMatcher& inFirstLine,
+    const M6LineMatcher& inLastLine, M6RecordHandler inHandler, size_t inBlockSize)
+{
+    string tail;            // the unfinished document or line of the previous block
+    size_t scanned = 0;        // the number of bytes in tail that were scanned already
+    bool inDoc = false;
+
+    for (;;)
+    {
+        size_t blockSize = max(inBlockSize, tail.length());
+
+        shared_ptr<string> block(new string);
+        block->reserve(tail.length() + blockSize + 1);
+        block->assign(tail);
+
+        size_t size = tail.length();
+        block->resize(size + blockSize);
+        inStream.read(&(*block)[size], blockSize);
+        size_t read = static_cast<size_t>(inStream.gcount());
+        block->resize(size + read);
+        size += read;
+
+        // an unterminated last line is handled as if it ended with a newline,
+        // unless it is empty, just like getline does in ParseFile
+        bool eof = read == 0;
+        if (eof and size > 0 and (*block)[size - 1] != '\n')
+        {
+            size_t last = block->rfind('\n');
+            last = last == string::npos ? 0 : last + 1;
+
+            if (size - last == 1 and (*block)[last] == '\r')
+                block->resize(--size);
+            else
+            {
+                block->push_back('\n');
+                ++size;
+            }
+        }
+
+        const char* data = block->data();
+        size_t docStart = 0, lineStart = scanned;
+
+        for (;;)
+        {
+            const char* nl = static_cast<const char*>(memchr(data + lineStart, '\n', size - lineStart));
+            if (nl == nullptr)
+                break;
+
+            size_t lineEnd = nl - data;
+            size_t length = lineEnd - lineStart;
+            if (length > 0 and data[lineEnd - 1] == '\r')
+                --length;
+
+            if (not inDoc)
+            {
+                if (not inFirstLine or inFirstLine.Match(data + lineStart, length))
+                {
+                    docStart = lineStart;
+                    inDoc = true;
+                }
+            }
+            else if (not inLastLine and inFirstLine.Match(data + lineStart, length))
+            {
+                inHandler(block, docStart, lineStart - docStart);
+                docStart = lineStart;
+            }
+            else if (inLastLine and inLastLine.Match(data + lineStart, length))
+            {
+                inHandler(block, docStart, lineEnd + 1 - docStart);
+                inDoc = false;
+            }
+
+            lineStart = lineEnd + 1;
+        }
+
+        if (eof)
+        {
+            if (inDoc and docStart < size)
+                inHandler(block, docStart, size - docStart);
+            break;
+        }
+
+        if (inDoc)
+        {
+            tail.assign(data + docStart, size - docStart);
+            scanned = lineStart - docStart;
+        }
+        else
+        {
+            tail.assign(data + lineStart, size - lineStart);
+            scanned = 0;
+        }
+    }
+}
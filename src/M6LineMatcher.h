@@ -0,0 +1,83 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <istream>
+#include <memory>
+#include <functional>
+
+#include <boost/regex.hpp>
+
+// M6LineMatcher matches the lines that start or end a document. The values
+// from the parser are either a literal line or a Perl regular expression.
+// Most expressions are a literal line or a literal prefix followed by .*
+// or .+, these are matched without using boost::regex.
+
+struct M6LineMatcher
+{
+  public:
+            M6LineMatcher(const std::string& inMatch);
+
+    bool    Match(const std::string& inStr) const
+            {
+                return Match(inStr.c_str(), inStr.length());
+            }
+
+    bool    Match(const char* inLine, size_t inLength) const
+            {
+                bool result = false;
+
+                switch (mKind)
+                {
+                    case eNone:
+                        break;
+
+                    case eLiteral:
+                        result = inLength == mStr.length() and
+                            memcmp(inLine, mStr.data(), inLength) == 0;
+                        break;
+
+                    case ePrefix:
+                        result = inLength >= mMinLength and
+                            memcmp(inLine, mStr.data(), mStr.length()) == 0;
+                        break;
+
+                    case eRegex:
+                        result = boost::regex_match(inLine, inLine + inLength, mRE);
+                        break;
+                }
+
+                return result;
+            }
+
+            operator bool() const { return mKind != eNone; }
+
+  private:
+    bool    CompileLiteral(const std::string& inRE);
+
+    enum M6MatchKind { eNone, eLiteral, ePrefix, eRegex };
+
+    M6MatchKind        mKind;
+    std::string        mStr;
+    size_t            mMinLength;
+    boost::regex    mRE;
+};
+
+// M6SplitRecords cuts a file that is a plain list of records, without a
+// header or trailer, into records. A record starts at a line matching
+// inFirstLine and ends at a line matching inLastLine or before the next
+// first line, when inLastLine is empty. The handler gets the block of
+// text containing a record and the offset and length of the record.
+// The input is read inBlockSize bytes at a time.
+
+typedef std::function<void(const std::shared_ptr<const std::string>& inBlock,
+    size_t inOffset, size_t inLength)>    M6RecordHandler;
+
+void M6SplitRecords(std::istream& inStream, const M6LineMatcher& inFirstLine,
+    const M6LineMatcher& inLastLine, M6RecordHandler inHandler,
+    size_t inBlockSize = 4 * 1024 * 1024);
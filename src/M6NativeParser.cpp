@@ -0,0 +1,1607 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+//    Native versions of the uniprot, embl, genbank and pdb parser scripts.
+//    These follow the Perl code in the parsers directory closely, including
+//    the less obvious parts of the regular expressions used there, so that
+//    the indices are the same whichever parser is used. When changing one,
+//    change the other as well.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <set>
+#include <cstring>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "M6Parser.h"
+#include "M6Error.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+
+M6NativeParser::M6NativeParser()
+    : mDocument(nullptr)
+{
+}
+
+M6NativeParser::~M6NativeParser()
+{
+}
+
+void M6NativeParser::ParseDocument(M6InputDocument* inDoc,
+    const string& inFileName, const string& inDbHeader)
+{
+    mDocument = inDoc;
+
+    try
+    {
+        Parse(mDocument->Peek(), inFileName, inDbHeader);
+        mDocument = nullptr;
+    }
+    catch (exception& e)
+    {
+        mDocument = nullptr;
+        THROW(("Error parsing document: %s", e.what()));
+    }
+}
+
+string M6NativeParser::GetVersion(const string& inSourceConfig)
+{
+    return "";
+}
+
+void M6NativeParser::ToFasta(const string& inDoc, const string& inDb,
+    const string& inID, const string& inTitle, string& outFasta)
+{
+    THROW(("to_fasta not implemented"));
+}
+
+string M6NativeParser::GetValue(const string& inName) const
+{
+    string result;
+
+    auto i = mValues.find(inName);
+    if (i != mValues.end())
+        result = i->second;
+
+    return result;
+}
+
+void M6NativeParser::GetIndexNames(vector<pair<string,string>>& outIndexNames) const
+{
+    outIndexNames.insert(outIndexNames.end(), mIndexNames.begin(), mIndexNames.end());
+}
+
+void M6NativeParser::IndexText(const string& inIndex, const char* inText, size_t inLength)
+{
+    if (inLength > 0)
+        mDocument->Index(inIndex, eM6TextData, false, inText, inLength);
+}
+
+void M6NativeParser::IndexString(const string& inIndex, const string& inText)
+{
+    if (not inText.empty())
+        mDocument->Index(inIndex, eM6StringData, false, inText.c_str(), inText.length());
+}
+
+void M6NativeParser::IndexUniqueString(const string& inIndex, const string& inText)
+{
+    if (not inText.empty())
+        mDocument->Index(inIndex, eM6StringData, true, inText.c_str(), inText.length());
+}
+
+void M6NativeParser::IndexNumber(const string& inIndex, const string& inValue)
+{
+    if (inValue.empty())
+        THROW(("Error, value is undefined in call to index_number"));
+    mDocument->Index(inIndex, eM6NumberData, false, inValue.c_str(), inValue.length());
+}
+
+void M6NativeParser::IndexDate(const string& inIndex, const string& inValue)
+{
+    if (inValue.empty())
+        THROW(("Error, value is undefined in call to index_date"));
+    mDocument->Index(inIndex, eM6DateData, false, inValue.c_str(), inValue.length());
+}
+
+void M6NativeParser::IndexFloat(const string& inIndex, double inValue)
+{
+    mDocument->Index(inIndex, false, inValue);
+}
+
+void M6NativeParser::SetAttribute(const string& inName, const string& inValue)
+{
+    mDocument->SetAttribute(inName, inValue.c_str(), inValue.length());
+}
+
+void M6NativeParser::AddLink(const string& inDatabank, const string& inValue)
+{
+    if (inDatabank.empty())
+        THROW(("Error, databank is undefined in call to add_link"));
+    if (inValue.empty())
+        THROW(("Error, value is undefined in call to add_link"));
+    mDocument->AddLink(inDatabank, inValue);
+}
+
+// --------------------------------------------------------------------
+// Helpers implementing the Perl character classes and idioms
+
+namespace
+{
+
+// \w and \s for byte strings
+inline bool IsWord(char inChar)
+{
+    return (inChar >= 'a' and inChar <= 'z') or (inChar >= 'A' and inChar <= 'Z') or
+        (inChar >= '0' and inChar <= '9') or inChar == '_';
+}
+
+inline bool IsSpace(char inChar)
+{
+    return inChar == ' ' or inChar == '\t' or inChar == '\n' or inChar == '\r' or
+        inChar == '\f' or inChar == '\v';
+}
+
+inline bool IsDigit(char inChar)
+{
+    return inChar >= '0' and inChar <= '9';
+}
+
+string ToLower(const string& inText)
+{
+    string result(inText);
+    for (char& ch : result)
+    {
+        if (ch >= 'A' and ch <= 'Z')
+            ch += 'a' - 'A';
+    }
+    return result;
+}
+
+// substr in Perl does not mind offsets past the end
+string SubStr(const string& inText, size_t inOffset, size_t inLength = string::npos)
+{
+    string result;
+    if (inOffset < inText.length())
+        result = inText.substr(inOffset, inLength);
+    return result;
+}
+
+// s/\s+$//
+void TrimRight(string& ioText)
+{
+    size_t n = ioText.length();
+    while (n > 0 and IsSpace(ioText[n - 1]))
+        --n;
+    ioText.erase(n);
+}
+
+// end of the line starting at inOffset, or the end of the text
+inline size_t LineEnd(const string& inText, size_t inOffset)
+{
+    size_t result = inText.find('\n', inOffset);
+    if (result == string::npos)
+        result = inText.length();
+    return result;
+}
+
+// split(m/;\s*/, $text), trailing empty fields are removed like in Perl
+vector<string> SplitOnSemicolon(const string& inText)
+{
+    vector<string> result;
+
+    size_t s = 0;
+    for (;;)
+    {
+        size_t e = inText.find(';', s);
+        if (e == string::npos)
+        {
+            result.push_back(inText.substr(s));
+            break;
+        }
+
+        result.push_back(inText.substr(s, e - s));
+
+        s = e + 1;
+        while (s < inText.length() and IsSpace(inText[s]))
+            ++s;
+    }
+
+    while (not result.empty() and result.back().empty())
+        result.pop_back();
+
+    return result;
+}
+
+// split(m/$inSeparator/, $text) for a literal separator
+vector<string> Split(const string& inText, const string& inSeparator)
+{
+    vector<string> result;
+
+    size_t s = 0;
+    for (;;)
+    {
+        size_t e = inText.find(inSeparator, s);
+        if (e == string::npos)
+        {
+            result.push_back(inText.substr(s));
+            break;
+        }
+
+        result.push_back(inText.substr(s, e - s));
+        s = e + inSeparator.length();
+    }
+
+    while (not result.empty() and result.back().empty())
+        result.pop_back();
+
+    return result;
+}
+
+// s/.{72}/$&\n/g
+string WrapSequence(const string& inSequence)
+{
+    string result;
+    result.reserve(inSequence.length() + inSequence.length() / 72 + 1);
+
+    for (size_t i = 0; i + 72 <= inSequence.length(); i += 72)
+    {
+        result.append(inSequence, i, 72);
+        result += '\n';
+    }
+
+    result.append(inSequence, inSequence.length() - inSequence.length() % 72, string::npos);
+
+    return result;
+}
+
+// The uniprot and embl records consist of lines starting with a two letter
+// key followed by three spaces. NextField does what this loop does:
+//
+//    while ($text =~ m/^(?:([A-Z]{2})   ).+\n(?:\1.+\n)*/gm)
+//    {
+//        my $key = $1;
+//        my $value = $&;
+//        $value =~ s/^$key   //mg;
+
+bool NextField(const string& inText, size_t& ioOffset, string& outKey, string& outValue)
+{
+    const size_t n = inText.length();
+
+    for (size_t s = ioOffset; s < n; )
+    {
+        size_t e = inText.find('\n', s);
+        if (e == string::npos)
+            break;
+
+        if (e > s + 5 and
+            inText[s] >= 'A' and inText[s] <= 'Z' and inText[s + 1] >= 'A' and inText[s + 1] <= 'Z' and
+            inText.compare(s + 2, 3, "   ") == 0)
+        {
+            outKey.assign(inText, s, 2);
+            outValue.assign(inText, s + 5, e + 1 - (s + 5));
+
+            for (s = e + 1; s < n; s = e + 1)
+            {
+                e = inText.find('\n', s);
+                if (e == string::npos or e <= s + 2 or inText.compare(s, 2, outKey) != 0)
+                    break;
+
+                if (inText.compare(s + 2, 3, "   ") == 0)
+                    outValue.append(inText, s + 5, e + 1 - (s + 5));
+                else
+                    outValue.append(inText, s, e + 1 - s);
+            }
+
+            ioOffset = s;
+            return true;
+        }
+
+        s = e + 1;
+    }
+
+    ioOffset = n;
+    return false;
+}
+
+// Match (?:\S.+)(?:\n\s{N,}.+)* at inOffset, the text at inOffset should
+// be a non space character. Returns the end of the match, or npos if
+// there is no match.
+
+size_t MatchContinuedLines(const string& inText, size_t inOffset, size_t inIndent)
+{
+    const size_t n = inText.length();
+
+    if (inOffset + 1 >= n or inText[inOffset + 1] == '\n')
+        return string::npos;
+
+    size_t result = LineEnd(inText, inOffset);
+
+    while (result < n)
+    {
+        size_t s = result + 1, e = s;
+        while (e < n and IsSpace(inText[e]))
+            ++e;
+
+        if (e == n)
+        {
+            // backtrack, .+ needs a character that is not a newline
+            while (e > s + inIndent and inText[e - 1] == '\n')
+                --e;
+            if (e <= s + inIndent)
+                break;
+            --e;
+        }
+        else if (e - s < inIndent)
+            break;
+
+        result = LineEnd(inText, e);
+    }
+
+    return result;
+}
+
+// Iterate over the qualifiers in a feature table entry:
+//
+//    while ($ft =~ m'/(\w+)=(?|([^"].+)|"((?:[^"]++|"")*)")\n?'gm)
+
+template<class Callback>
+void ForEachQualifier(const string& inText, Callback inCallback)
+{
+    const size_t n = inText.length();
+
+    size_t p = 0;
+    while ((p = inText.find('/', p)) != string::npos)
+    {
+        size_t k = p + 1, v = k;
+        while (v < n and IsWord(inText[v]))
+            ++v;
+
+        if (v == k or v + 1 >= n or inText[v] != '=')
+        {
+            ++p;
+            continue;
+        }
+
+        string key(inText, k, v - k);
+        ++v;
+
+        size_t end = string::npos;
+        string value;
+
+        if (inText[v] != '"')
+        {
+            size_t e = LineEnd(inText, v + 1);
+            if (e > v + 1)
+            {
+                value.assign(inText, v, e - v);
+                end = e;
+            }
+        }
+        else
+        {
+            size_t i = v + 1, lastPair = string::npos;
+            bool closed = false;
+
+            while (i < n)
+            {
+                if (inText[i] != '"')
+                    ++i;
+                else if (i + 1 < n and inText[i + 1] == '"')
+                {
+                    lastPair = i;
+                    i += 2;
+                }
+                else
+                {
+                    closed = true;
+                    break;
+                }
+            }
+
+            if (not closed and lastPair != string::npos)
+            {
+                i = lastPair;
+                closed = true;
+            }
+
+            if (closed)
+            {
+                value.assign(inText, v + 1, i - v - 1);
+                end = i + 1;
+            }
+        }
+
+        if (end == string::npos)
+        {
+            ++p;
+            continue;
+        }
+
+        if (end < n and inText[end] == '\n')
+            ++end;
+        p = end;
+
+        inCallback(key, value);
+    }
+}
+
+}
+
+// --------------------------------------------------------------------
+// parsers/uniprot.pm
+
+class M6UniProtParser : public M6NativeParser
+{
+  public:
+                    M6UniProtParser();
+
+    virtual void    ToFasta(const string& inDoc, const string& inDb,
+                        const string& inID, const string& inTitle, string& outFasta);
+
+  protected:
+    virtual void    Parse(const string& inText, const string& inFileName,
+                        const string& inDbHeader);
+
+    static bool        MatchSequenceLine(const string& inText, size_t inOffset,
+                        string& outLength, string& outMW, string& outCRC64, size_t& outEnd);
+};
+
+M6UniProtParser::M6UniProtParser()
+{
+    mValues["lastdocline"] = "//";
+
+    const char* kIndexNames[][2] = {
+        { "ac",        "Accession number" },
+        { "cc",        "Comments and Notes" },
+        { "crc64",    "The CRC64 checksum for the sequence" },
+        { "de",        "Description" },
+        { "doi",    "Digital Object Indentifier (reference)" },
+        { "dr",        "Database cross-reference" },
+        { "dt",        "Date" },
+        { "ft",        "Feature table data" },
+        { "gn",        "Gene name" },
+        { "id",        "Identification" },
+        { "kw",        "Keywords" },
+        { "length",    "The length of the sequence" },
+        { "medline",    "Medline reference" },
+        { "mw",        "Molecular weight" },
+        { "oc",        "Organism classification" },
+        { "og",        "Organelle" },
+        { "oh",        "Organism host" },
+        { "os",        "Organism species" },
+        { "ox",        "Taxonomy cross-reference" },
+        { "pe",        "Protein Existence (evidence)" },
+        { "pubmed",    "PubMed reference" }
+    };
+
+    for (auto& ix : kIndexNames)
+        mIndexNames.push_back(make_pair(ix[0], ix[1]));
+}
+
+// SEQUENCE\s+(\d+) AA;\s+(\d+) MW;\s+([0-9A-F]{16}) CRC64;
+
+bool M6UniProtParser::MatchSequenceLine(const string& inText, size_t inOffset,
+    string& outLength, string& outMW, string& outCRC64, size_t& outEnd)
+{
+    const size_t n = inText.length();
+
+    auto spaces = [&](size_t& p) -> bool
+    {
+        size_t s = p;
+        while (p < n and IsSpace(inText[p]))
+            ++p;
+        return p > s;
+    };
+
+    auto digits = [&](size_t& p, string& v) -> bool
+    {
+        size_t s = p;
+        while (p < n and IsDigit(inText[p]))
+            ++p;
+        v.assign(inText, s, p - s);
+        return p > s;
+    };
+
+    auto literal = [&](size_t& p, const char* s) -> bool
+    {
+        size_t l = strlen(s);
+        bool result = inText.compare(p, l, s) == 0;
+        if (result)
+            p += l;
+        return result;
+    };
+
+    size_t p = inOffset + 8;    // SEQUENCE
+
+    if (not spaces(p) or not digits(p, outLength) or not literal(p, " AA;") or
+        not spaces(p) or not digits(p, outMW) or not literal(p, " MW;") or not spaces(p))
+        return false;
+
+    size_t s = p;
+    while (p < n and p < s + 16 and (IsDigit(inText[p]) or (inText[p] >= 'A' and inText[p] <= 'F')))
+        ++p;
+    if (p != s + 16)
+        return false;
+    outCRC64.assign(inText, s, 16);
+
+    if (not literal(p, " CRC64;"))
+        return false;
+
+    outEnd = p;
+    return true;
+}
+
+void M6UniProtParser::Parse(const string& inText, const string& inFileName,
+    const string& inDbHeader)
+{
+    static const char* kMonths[] = {
+        "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+    };
+
+    string key, value;
+    size_t offset = 0;
+
+    while (NextField(inText, offset, key, value))
+    {
+        const size_t n = value.length();
+
+        if (key == "ID")
+        {
+            size_t e = 0;
+            while (e < n and IsWord(value[e]))
+                ++e;
+
+            if (e == 0)
+                THROW(("No ID in UniProt record?\n%s   %s", key.c_str(), value.c_str()));
+
+            string id = value.substr(0, e);
+            IndexUniqueString("id", id);
+            SetAttribute("id", id);
+        }
+        else if (key == "AC")
+        {
+            uint32 nr = 0;
+            for (const string& ac : SplitOnSemicolon(value))
+            {
+                IndexString("ac", ac);
+                if (++nr == 1)
+                    SetAttribute("ac", ac);
+            }
+        }
+        else if (key == "DE")
+        {
+            // m/Full=(.+?);/
+            for (size_t p = value.find("Full="); p != string::npos; p = value.find("Full=", p + 1))
+            {
+                size_t s = p + 5, e = value.find(';', s + 1);
+                if (e != string::npos and e < LineEnd(value, s))
+                {
+                    SetAttribute("title", value.substr(s, e - s));
+                    break;
+                }
+            }
+
+            IndexText("de", value);
+
+            // m/(EC=)(\d+\.\d+\.\d+\.\d+)/g
+            for (size_t p = value.find("EC="); p != string::npos; p = value.find("EC=", p + 1))
+            {
+                size_t s = p + 3, e = s;
+                uint32 part = 0;
+
+                for (; part < 4; ++part)
+                {
+                    size_t d = e;
+                    while (e < n and IsDigit(value[e]))
+                        ++e;
+                    if (e == d)
+                        break;
+                    if (part < 3)
+                    {
+                        if (e >= n or value[e] != '.')
+                            break;
+                        ++e;
+                    }
+                }
+
+                if (part == 4)
+                {
+                    AddLink("enzyme", value.substr(s, e - s));
+                    p = e - 1;
+                }
+            }
+        }
+        else if (key == "DT")
+        {
+            // m/(\d{2})-(JAN|...|DEC)-(\d{4})/g
+            for (size_t p = 0; p + 11 <= n; ++p)
+            {
+                if (not IsDigit(value[p]) or not IsDigit(value[p + 1]) or value[p + 2] != '-' or
+                    value[p + 6] != '-' or not IsDigit(value[p + 7]) or not IsDigit(value[p + 8]) or
+                    not IsDigit(value[p + 9]) or not IsDigit(value[p + 10]))
+                    continue;
+
+                uint32 month = 0;
+                while (month < 12 and value.compare(p + 3, 3, kMonths[month]) != 0)
+                    ++month;
+                if (month == 12)
+                    continue;
+
+                string date = value.substr(p + 7, 4) + '-' +
+                    (month < 9 ? "0" : "") + boost::lexical_cast<string>(month + 1) + '-' +
+                    value.substr(p, 2);
+
+                IndexString("dt", date);
+                p += 10;
+            }
+        }
+        else if (key == "GN")
+        {
+            // m/(?:\w+=)?(.+);/g
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t e = LineEnd(value, s);
+                size_t semi = value.rfind(';', e - 1);
+                if (semi == string::npos or semi < s + 1 or semi >= e)
+                    continue;
+
+                size_t w = s;
+                while (w < e and IsWord(value[w]))
+                    ++w;
+
+                if (w > s and value[w] == '=' and semi > w + 1)
+                    s = w + 1;
+
+                IndexText("gn", value.c_str() + s, semi - s);
+            }
+        }
+        else if (key == "OC" or key == "KW")
+        {
+            // m/(.+);/g
+            string index = ToLower(key);
+
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t e = LineEnd(value, s);
+                size_t semi = value.rfind(';', e - 1);
+                if (semi != string::npos and semi > s and semi < e)
+                    IndexString(index, value.substr(s, semi - s));
+            }
+        }
+        else if (key == "CC")
+        {
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t e = LineEnd(value, s);
+                if (e == s)
+                    continue;
+
+                string line = value.substr(s, e - s);
+                if (line != "-----------------------------------------------------------------------" and
+                    line != "Copyrighted by the UniProt Consortium, see http://www.uniprot.org/terms" and
+                    line != "Distributed under the Creative Commons Attribution-NoDerivs License")
+                {
+                    IndexText("cc", line);
+                }
+            }
+        }
+        else if (key == "RX")
+        {
+            // m/(MEDLINE|PubMed|DOI)=([^;]+);/g
+            static const char* kNames[] = { "MEDLINE", "PubMed", "DOI" };
+
+            for (size_t p = 0; p < n; ++p)
+            {
+                for (const char* name : kNames)
+                {
+                    size_t l = strlen(name);
+                    if (value.compare(p, l, name) != 0 or p + l >= n or value[p + l] != '=')
+                        continue;
+
+                    size_t s = p + l + 1, e = value.find(';', s);
+                    if (e == string::npos or e == s)
+                        continue;
+
+                    IndexString(ToLower(name), value.substr(s, e - s));
+                    p = e;
+                    break;
+                }
+            }
+        }
+        else if (key[0] == 'R')
+            IndexText("ref", value);
+        else if (key == "DR")
+        {
+            // m/^(.+?); (.+?);(?: (.+?);)?/mg
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t e = LineEnd(value, s);
+
+                size_t d = value.find("; ", s + 1);
+                if (d == string::npos or d >= e)
+                    continue;
+
+                size_t i = value.find(';', d + 3);
+                if (i == string::npos or i >= e)
+                    continue;
+
+                string db = value.substr(s, d - s);
+                string id = value.substr(d + 2, i - d - 2);
+                string ac;
+
+                if (i + 1 < e and value[i + 1] == ' ')
+                {
+                    size_t a = value.find(';', i + 3);
+                    if (a != string::npos and a < e)
+                        ac = value.substr(i + 2, a - i - 2);
+                }
+
+                string ldb = ToLower(db);
+
+                if (ldb == "prosite" or ldb == "pfam")
+                    id = ac;
+                else if (ldb == "refseq")
+                {
+                    // s/\.\d+$//
+                    size_t x = id.length();
+                    while (x > 0 and IsDigit(id[x - 1]))
+                        --x;
+                    if (x < id.length() and x > 0 and id[x - 1] == '.')
+                        id.erase(x - 1);
+                }
+                else if (ldb == "go")
+                    id = SubStr(id, 3);
+
+                AddLink(db, id);
+            }
+
+            IndexText("dr", value);
+        }
+        else if (key == "SQ")
+        {
+            for (size_t p = value.find("SEQUENCE"); p != string::npos; p = value.find("SEQUENCE", p + 1))
+            {
+                string length, mw, crc64;
+                size_t end;
+
+                if (MatchSequenceLine(value, p, length, mw, crc64, end))
+                {
+                    IndexNumber("length", length);
+                    IndexNumber("mw", mw);
+                    IndexString("crc64", crc64);
+                    break;
+                }
+            }
+
+            break;
+        }
+        else if (key != "XX")
+            IndexText(ToLower(key), value);
+    }
+}
+
+void M6UniProtParser::ToFasta(const string& inDoc, const string& inDb,
+    const string& inID, const string& inTitle, string& outFasta)
+{
+    // m/SEQUENCE\s+(\d+) AA;\s+\d+ MW;\s+[0-9A-F]{16} CRC64;\n((\s+.+\n)+)\/\//m
+
+    string length, mw, crc64, seq;
+    bool found = false;
+
+    for (size_t p = inDoc.find("SEQUENCE"); not found and p != string::npos; p = inDoc.find("SEQUENCE", p + 1))
+    {
+        size_t end;
+        if (not MatchSequenceLine(inDoc, p, length, mw, crc64, end) or
+            end >= inDoc.length() or inDoc[end] != '\n')
+            continue;
+
+        seq.clear();
+        size_t s = end + 1, lines = 0;
+        while (s < inDoc.length() and (inDoc[s] == ' ' or inDoc[s] == '\t'))
+        {
+            size_t e = LineEnd(inDoc, s);
+            if (e == inDoc.length())
+                break;
+
+            for (size_t i = s; i < e; ++i)
+            {
+                if (not IsSpace(inDoc[i]))
+                    seq += inDoc[i];
+            }
+
+            ++lines;
+            s = e + 1;
+        }
+
+        found = lines > 0 and inDoc.compare(s, 2, "//") == 0;
+    }
+
+    if (not found)
+        THROW(("no sequence"));
+
+    if (seq.length() != boost::lexical_cast<size_t>(length))
+        THROW(("invalid SEQUENCE record %d!=%s", static_cast<int>(seq.length()), length.c_str()));
+
+    outFasta = ">gnl|" + inDb + '|' + inID + ' ' + inTitle + '\n' + WrapSequence(seq) + '\n';
+}
+
+// --------------------------------------------------------------------
+// parsers/embl.pm
+
+class M6EmblParser : public M6NativeParser
+{
+  public:
+                    M6EmblParser();
+
+  protected:
+    virtual void    Parse(const string& inText, const string& inFileName,
+                        const string& inDbHeader);
+};
+
+M6EmblParser::M6EmblParser()
+{
+    mValues["lastdocline"] = "//";
+
+    const char* kIndexNames[][2] = {
+        { "id",        "Identification" },
+        { "ac",        "Accession number" },
+        { "co",        "Contigs" },
+        { "cc",        "Comments and Notes" },
+        { "dt",        "Date" },
+        { "pr",        "Project" },
+        { "de",        "Description" },
+        { "gn",        "Gene name" },
+        { "os",        "Organism species" },
+        { "og",        "Organelle" },
+        { "oc",        "Organism classification" },
+        { "ox",        "Taxonomy cross-reference" },
+        { "ref",    "Any reference field" },
+        { "dr",        "Database cross-reference" },
+        { "kw",        "Keywords" },
+        { "ft",        "Feature table data" },
+        { "sv",        "Sequence version" },
+        { "fh",        "Feature table header" },
+        { "topology",    "Topology (circular or linear)" },
+        { "mt",        "Molecule type" },
+        { "dc",        "Data class" },
+        { "td",        "Taxonomic division" },
+        { "length",    "Sequence length" }
+    };
+
+    for (auto& ix : kIndexNames)
+        mIndexNames.push_back(make_pair(ix[0], ix[1]));
+}
+
+void M6EmblParser::Parse(const string& inText, const string& inFileName,
+    const string& inDbHeader)
+{
+    string key, value;
+    size_t offset = 0;
+
+    while (NextField(inText, offset, key, value))
+    {
+        if (not value.empty() and value.back() == '\n')    // chomp
+            value.erase(value.length() - 1);
+
+        const size_t n = value.length();
+
+        if (key == "ID")
+        {
+            // s/(\w+);.*/$1/
+            for (size_t p = 0; p < n; ++p)
+            {
+                if (not IsWord(value[p]))
+                    continue;
+
+                size_t e = p;
+                while (e < n and IsWord(value[e]))
+                    ++e;
+
+                if (e < n and value[e] == ';')
+                {
+                    value.erase(e, LineEnd(value, e) - e);
+                    break;
+                }
+
+                p = e;
+            }
+
+            IndexUniqueString("id", value);
+            SetAttribute("id", value);
+        }
+        else if (key == "AC")
+        {
+            uint32 nr = 0;
+            for (const string& ac : SplitOnSemicolon(value))
+            {
+                IndexString("ac", ac);
+                if (++nr == 1)
+                    SetAttribute("ac", ac);
+            }
+        }
+        else if (key == "DE")
+        {
+            IndexText("de", value);
+
+            // s/;.+//
+            for (size_t p = value.find(';'); p != string::npos; p = value.find(';', p + 1))
+            {
+                if (p + 1 < value.length() and value[p + 1] != '\n')
+                {
+                    value.erase(p, LineEnd(value, p) - p);
+                    break;
+                }
+            }
+
+            SetAttribute("title", value.substr(0, 255));
+        }
+        else if (key == "DR")
+        {
+            // m/^(.+?); (.+?);/mg
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t e = LineEnd(value, s);
+
+                size_t d = value.find("; ", s + 1);
+                if (d == string::npos or d >= e)
+                    continue;
+
+                size_t i = value.find(';', d + 3);
+                if (i == string::npos or i >= e)
+                    continue;
+
+                AddLink(value.substr(s, d - s), value.substr(d + 2, i - d - 2));
+            }
+
+            IndexText("dr", value);
+        }
+        else if (key == "FT")
+        {
+            // m/^\w+\s+((?:\S.+)(?:\n\s{15,}.+)*)/gm
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                size_t w = s;
+                while (w < n and IsWord(value[w]))
+                    ++w;
+
+                size_t x = w;
+                while (x < n and IsSpace(value[x]))
+                    ++x;
+
+                if (w == s or x == w or x == n)
+                    continue;
+
+                size_t e = MatchContinuedLines(value, x, 15);
+                if (e == string::npos)
+                    continue;
+
+                ForEachQualifier(value.substr(x, e - x), [this](const string& fkey, const string& fval)
+                {
+                    if (fkey == "translation")
+                        return;
+
+                    IndexText("ft", fval);
+
+                    // m/^(.+?):(.+)$/
+                    if (fkey == "db_xref")
+                    {
+                        string v(fval);
+                        if (not v.empty() and v.back() == '\n')
+                            v.erase(v.length() - 1);
+
+                        size_t c = v.find(':', 1);
+                        if (v.find('\n') == string::npos and c != string::npos and c + 1 < v.length())
+                            AddLink(v.substr(0, c), v.substr(c + 1));
+                    }
+                });
+
+                s = e;
+                if (s == n)
+                    break;
+            }
+        }
+        else if (key == "SQ")
+            break;
+        else if (key != "XX" and key != "DT" and key != "RN" and key != "RP" and key != "FH")
+            IndexText(ToLower(key), value);
+    }
+}
+
+// --------------------------------------------------------------------
+// parsers/genbank.pm
+
+class M6GenBankParser : public M6NativeParser
+{
+  public:
+                    M6GenBankParser();
+
+  protected:
+    virtual void    Parse(const string& inText, const string& inFileName,
+                        const string& inDbHeader);
+};
+
+M6GenBankParser::M6GenBankParser()
+{
+    mValues["firstdocline"] = "(?^:^LOCUS.+)";
+    mValues["lastdocline"] = "//";
+}
+
+void M6GenBankParser::Parse(const string& inText, const string& inFileName,
+    const string& inDbHeader)
+{
+    // split(m/\n(?=\w)/, $text)
+    vector<string> parts;
+
+    for (size_t s = 0, p = 0; ; ++p)
+    {
+        p = inText.find('\n', p);
+        if (p == string::npos)
+        {
+            parts.push_back(inText.substr(s));
+            break;
+        }
+
+        if (p + 1 < inText.length() and IsWord(inText[p + 1]))
+        {
+            parts.push_back(inText.substr(s, p - s));
+            s = p + 1;
+        }
+    }
+
+    while (not parts.empty() and parts.back().empty())
+        parts.pop_back();
+
+    for (const string& part : parts)
+    {
+        // m/^(\w+)\s+/
+        size_t w = 0;
+        while (w < part.length() and IsWord(part[w]))
+            ++w;
+
+        size_t x = w;
+        while (x < part.length() and IsSpace(part[x]))
+            ++x;
+
+        if (w == 0 or x == w)
+            continue;
+
+        string key = ToLower(part.substr(0, w));
+        string value = part.substr(x);
+        const size_t n = value.length();
+
+        if (key == "locus")
+        {
+            string id = value.substr(0, 15);
+            TrimRight(id);
+            IndexUniqueString("id", id);
+            SetAttribute("id", id);
+
+            IndexString("division", SubStr(value, 52, 3));
+        }
+        else if (key == "definition")
+        {
+            // s/\s+/ /g
+            string title;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (IsSpace(value[i]))
+                {
+                    while (i + 1 < n and IsSpace(value[i + 1]))
+                        ++i;
+                    title += ' ';
+                }
+                else
+                    title += value[i];
+            }
+
+            // s/;.+//
+            size_t semi = title.find(';');
+            if (semi != string::npos and semi + 1 < title.length())
+                title.erase(semi);
+
+            IndexText("title", title);
+            SetAttribute("title", title.substr(0, 255));
+        }
+        else if (key == "accession")
+        {
+            for (size_t s = 0; s < n; )
+            {
+                while (s < n and IsSpace(value[s]))
+                    ++s;
+                size_t e = s;
+                while (e < n and not IsSpace(value[e]))
+                    ++e;
+                if (e > s)
+                    IndexString("accession", value.substr(s, e - s));
+                s = e;
+            }
+        }
+        else if (key == "version")
+        {
+            // m/(\S+)\s+GI:(\d+)/
+            for (size_t s = 0; s < n; )
+            {
+                while (s < n and IsSpace(value[s]))
+                    ++s;
+                size_t e = s;
+                while (e < n and not IsSpace(value[e]))
+                    ++e;
+
+                size_t g = e;
+                while (g < n and IsSpace(value[g]))
+                    ++g;
+
+                if (e > s and g > e and value.compare(g, 3, "GI:") == 0 and g + 3 < n and IsDigit(value[g + 3]))
+                {
+                    size_t d = g + 3;
+                    while (d < n and IsDigit(value[d]))
+                        ++d;
+
+                    IndexUniqueString("version", value.substr(s, e - s));
+                    IndexUniqueString("gi", value.substr(g + 3, d - g - 3));
+                    break;
+                }
+
+                s = e;
+            }
+        }
+        else if (key == "keywords")
+        {
+            // s/\.$//
+            string kws(value);
+            if (ba::ends_with(kws, ".\n"))
+                kws.erase(kws.length() - 2, 1);
+            else if (ba::ends_with(kws, "."))
+                kws.erase(kws.length() - 1);
+
+            for (const string& kw : SplitOnSemicolon(kws))
+                IndexString("keywords", kw);
+        }
+        else if (key == "reference")
+        {
+            // m/^  (\w+)\s+((?:\S.+)(?:\n\s{12,}.+)*)/mg
+            for (size_t s = 0; s < n; s = LineEnd(value, s) + 1)
+            {
+                if (value.compare(s, 2, "  ") != 0)
+                    continue;
+
+                size_t w = s + 2;
+                while (w < n and IsWord(value[w]))
+                    ++w;
+
+                size_t x = w;
+                while (x < n and IsSpace(value[x]))
+                    ++x;
+
+                if (w == s + 2 or x == w or x == n)
+                    continue;
+
+                size_t e = MatchContinuedLines(value, x, 12);
+                if (e == string::npos)
+                    continue;
+
+                IndexText(ToLower(value.substr(s + 2, w - s - 2)), value.c_str() + x, e - x);
+
+                s = e;
+                if (s == n)
+                    break;
+            }
+        }
+        else if (key == "features")
+        {
+            // split(m/\n {5}(?=\w)/, $part)
+            vector<string> features;
+
+            for (size_t s = 0, p = 0; ; ++p)
+            {
+                p = part.find("\n     ", p);
+                if (p == string::npos)
+                {
+                    features.push_back(part.substr(s));
+                    break;
+                }
+
+                if (p + 6 < part.length() and IsWord(part[p + 6]))
+                {
+                    features.push_back(part.substr(s, p - s));
+                    s = p + 6;
+                }
+            }
+
+            for (const string& feature : features)
+            {
+                ForEachQualifier(feature, [this](const string& fkey, const string& fval)
+                {
+                    if (fkey == "translation")
+                        return;
+
+                    IndexText("feature", fval);
+
+                    // m/(.+?):(.+)/
+                    if (fkey == "db_xref")
+                    {
+                        for (size_t s = 0; s < fval.length(); s = LineEnd(fval, s) + 1)
+                        {
+                            size_t e = LineEnd(fval, s), c = s + 1;
+                            while (c < e and not (fval[c] == ':' and c + 1 < e))
+                                ++c;
+
+                            if (c < e)
+                            {
+                                AddLink(fval.substr(s, c - s), fval.substr(c + 1, e - c - 1));
+                                break;
+                            }
+                        }
+                    }
+                });
+            }
+        }
+        else if (key == "origin")
+            break;
+        else
+            IndexText(key, value);
+    }
+}
+
+// --------------------------------------------------------------------
+// parsers/pdb.pm
+
+class M6PDBParser : public M6NativeParser
+{
+  public:
+    virtual void    ToFasta(const string& inDoc, const string& inDb,
+                        const string& inID, const string& inTitle, string& outFasta);
+
+  protected:
+    virtual void    Parse(const string& inText, const string& inFileName,
+                        const string& inDbHeader);
+
+    void            AddIDLinks(const string& inID);
+};
+
+void M6PDBParser::AddIDLinks(const string& inID)
+{
+    SetAttribute("id", inID);
+    IndexUniqueString("id", inID);
+    AddLink("dssp", inID);
+    AddLink("hssp", inID);
+    AddLink("pdbfinder2", inID);
+}
+
+void M6PDBParser::Parse(const string& inText, const string& inFileName,
+    const string& inDbHeader)
+{
+    // *_final.pdb files (from pdb_redo) don't have the id in the header
+    // m/(.+\/)?([a-z0-9]{4})_final\.pdb/
+    string filename = ToLower(inFileName);
+
+    auto isIDChar = [](char ch) { return (ch >= 'a' and ch <= 'z') or IsDigit(ch); };
+
+    size_t idOffset = string::npos, firstOffset = string::npos;
+    for (size_t p = filename.find("_final.pdb"); p != string::npos; p = filename.find("_final.pdb", p + 1))
+    {
+        if (p < 4 or not isIDChar(filename[p - 4]) or not isIDChar(filename[p - 3]) or
+            not isIDChar(filename[p - 2]) or not isIDChar(filename[p - 1]))
+            continue;
+
+        // the last one following a slash, otherwise the first one
+        size_t s = p - 4;
+        if (firstOffset == string::npos)
+            firstOffset = s;
+        if (s >= 2 and filename[s - 1] == '/')
+            idOffset = s;
+    }
+
+    if (idOffset == string::npos)
+        idOffset = firstOffset;
+
+    if (idOffset != string::npos)
+        AddIDLinks(filename.substr(idOffset, 4));
+
+    string header, title, compound;
+    bool hasHeader = false;
+    uint32 modelCount = 0;
+    set<string> ligands;
+
+    for (size_t s = 0; s < inText.length(); )
+    {
+        size_t e = inText.find('\n', s);
+        if (e == string::npos)
+            break;
+
+        string line = inText.substr(s, e + 1 - s);
+        s = e + 1;
+
+        // m/^(\S+)\s+(?:\d+\s+)?(.+)\n$/
+        const size_t n = line.length() - 1;
+
+        size_t a = 0;
+        while (a < n and not IsSpace(line[a]))
+            ++a;
+        size_t b = a;
+        while (b < n and IsSpace(line[b]))
+            ++b;
+
+        if (a == 0 or b == a)
+            continue;
+
+        size_t t;
+        if (b < n)
+        {
+            t = b;
+
+            size_t c = b;
+            while (c < n and IsDigit(line[c]))
+                ++c;
+            size_t d = c;
+            while (d < n and IsSpace(line[d]))
+                ++d;
+
+            if (c > b and d > c)
+            {
+                if (d < n)
+                    t = d;
+                else if (d > c + 1)
+                    t = d - 1;
+            }
+        }
+        else if (b > a + 1)
+            t = b - 1;
+        else
+            continue;
+
+        string fld = line.substr(0, a);
+        string text = line.substr(t, n - t);
+
+        if (fld == "HEADER")
+        {
+            header = text;
+            hasHeader = true;
+
+            // xxxx is used in the pdb_redo files
+            string id = SubStr(line, 62, 4);
+            if (ToLower(id) != "xxxx")
+                AddIDLinks(id);
+
+            IndexText("text", text);
+        }
+        else if (fld == "MODEL")
+            ++modelCount;
+        else if (fld == "TITLE")
+        {
+            title += ToLower(text);
+            IndexText("title", text);
+        }
+        else if (fld == "COMPND")
+        {
+            size_t m = text.find("MOLECULE: ");
+            size_t ec = text.find("EC: ");
+            size_t ece = ec == string::npos ? string::npos : text.find(';', ec + 5);
+
+            if (m != string::npos and m + 10 < text.length())
+                compound += ToLower(text.substr(m + 10)) + ' ';
+            else if (ece != string::npos)
+            {
+                string ecs = text.substr(ec + 4, ece - ec - 4);
+                for (const string& ecc : Split(ecs, ", "))
+                    AddLink("enzyme", ecc);
+                compound += "EC: " + ToLower(ecs) + ' ';
+            }
+
+            IndexText("compnd", text);
+        }
+        else if (fld == "KEYWDS")
+        {
+            for (const string& wrd : Split(text, " "))
+                IndexString("keyword", wrd);
+        }
+        else if (fld == "AUTHOR" or fld == "REMARK")
+        {
+            bool splitInitials = fld == "AUTHOR";
+
+            if (fld == "REMARK")
+            {
+                // /\s*(\d+\s+)?AUTH\s+(.+)/
+                for (size_t p = text.find("AUTH"); p != string::npos; p = text.find("AUTH", p + 1))
+                {
+                    size_t x = p + 4;
+                    while (x < text.length() and IsSpace(text[x]))
+                        ++x;
+
+                    if (x == p + 4)
+                        continue;
+
+                    if (x == text.length())
+                    {
+                        if (x < p + 6)
+                            continue;
+                        --x;
+                    }
+
+                    text.erase(0, x);
+                    splitInitials = true;
+                    break;
+                }
+            }
+
+            if (splitInitials)
+            {
+                // s/(\w)\.(?=\w)/$1. /g
+                string s;
+                for (size_t i = 0; i < text.length(); ++i)
+                {
+                    s += text[i];
+                    if (IsWord(text[i]) and i + 2 < text.length() and text[i + 1] == '.' and IsWord(text[i + 2]))
+                    {
+                        s += ". ";
+                        ++i;
+                    }
+                }
+                text.swap(s);
+            }
+
+            IndexText(fld == "AUTHOR" ? "ref" : "remark", text);
+        }
+        else if (fld == "JRNL")
+            IndexText("ref", text);
+        else if (fld == "DBREF")
+        {
+            // 0         1         2         3         4         5         6
+            // DBREF  2IGB A    1   179  UNP    P41007   PYRR_BACCL       1    179
+            string db = SubStr(line, 26, 7);    TrimRight(db);
+            string ac = SubStr(line, 33, 9);    TrimRight(ac);
+            string id = SubStr(line, 42, 12);    TrimRight(id);
+
+            static const char* kDbMap[][2] = {
+                { "embl",    "embl" },
+                { "gb",        "genbank" },
+                { "ndb",    "ndb" },
+                { "pdb",    "pdb" },
+                { "pir",    "pir" },
+                { "prf",    "profile" },
+                { "sws",    "uniprot" },
+                { "trembl",    "uniprot" },
+                { "unp",    "uniprot" }
+            };
+
+            string ldb = ToLower(db);
+            for (auto& m : kDbMap)
+            {
+                if (ldb == m[0])
+                {
+                    db = m[1];
+                    break;
+                }
+            }
+
+            if (not db.empty())
+            {
+                if (not id.empty())
+                    AddLink(db, id);
+                if (not ac.empty())
+                    AddLink(db, ac);
+            }
+        }
+        else if (fld == "HETATM")
+            ligands.insert(SubStr(line, 17, 3));
+    }
+
+    if (modelCount > 0)
+        IndexNumber("models", boost::lexical_cast<string>(modelCount));
+
+    if (hasHeader)
+    {
+        if (not title.empty())
+            header = title + " (" + header + ")";
+        if (not compound.empty())
+            header += "; " + compound;
+        if (header.length() > 255)
+            header.erase(255);
+
+        // s/ {2,}/ /g
+        string title;
+        for (size_t i = 0; i < header.length(); ++i)
+        {
+            if (header[i] != ' ' or i == 0 or header[i - 1] != ' ')
+                title += header[i];
+        }
+
+        SetAttribute("title", title);
+    }
+
+    for (string ligand : ligands)
+    {
+        // s/^\s*(\S+)\s*$/$1/
+        string trimmed = ba::trim_copy_if(ligand, IsSpace);
+        if (not trimmed.empty() and find_if(trimmed.begin(), trimmed.end(), IsSpace) == trimmed.end())
+            ligand = trimmed;
+
+        IndexString("ligand", ligand);
+    }
+}
+
+void M6PDBParser::ToFasta(const string& inDoc, const string& inDb,
+    const string& inID, const string& inTitle, string& outFasta)
+{
+    static const char* kAminoAcids[][2] = {
+        { "ALA", "A" }, { "ARG", "R" }, { "ASN", "N" }, { "ASP", "D" },
+        { "CYS", "C" }, { "GLN", "Q" }, { "GLU", "E" }, { "GLY", "G" },
+        { "HIS", "H" }, { "ILE", "I" }, { "LEU", "L" }, { "LYS", "K" },
+        { "MET", "M" }, { "PHE", "F" }, { "PRO", "P" }, { "SER", "S" },
+        { "THR", "T" }, { "TRP", "W" }, { "TYR", "Y" }, { "VAL", "V" },
+        { "GLX", "Z" }, { "ASX", "B" }
+    };
+
+    // the chains in order of appearance, Perl uses the random order of a hash here
+    vector<pair<string,string>> chains;
+
+    for (size_t s = 0; s < inDoc.length(); s = LineEnd(inDoc, s) + 1)
+    {
+        size_t e = LineEnd(inDoc, s);
+        if (inDoc.compare(s, 6, "SEQRES") != 0 or e == s + 6)
+            continue;
+
+        string line = inDoc.substr(s, e - s);
+        string chainID = SubStr(line, 11, 1);
+
+        auto chain = find_if(chains.begin(), chains.end(),
+            [&chainID](const pair<string,string>& c) { return c.first == chainID; });
+        if (chain == chains.end())
+            chain = chains.insert(chains.end(), make_pair(chainID, string()));
+
+        for (const string& res : Split(SubStr(line, 19), " "))
+        {
+            if (res.length() != 3)
+                continue;
+
+            char aa = 'X';
+            for (auto& m : kAminoAcids)
+            {
+                if (res == m[0])
+                {
+                    aa = m[1][0];
+                    break;
+                }
+            }
+
+            chain->second += aa;
+        }
+    }
+
+    outFasta.clear();
+
+    for (auto& chain : chains)
+    {
+        if (chain.second.empty())
+            continue;
+
+        outFasta += ">gnl|" + inDb + '|' + inID + '|' + chain.first + ' ' + inTitle + '\n' +
+            WrapSequence(chain.second) + '\n';
+    }
+}
+
+// --------------------------------------------------------------------
+
+M6NativeParser* M6NativeParser::Create(const string& inName)
+{
+    M6NativeParser* result = nullptr;
+
+    if (inName == "uniprot")
+        result = new M6UniProtParser();
+    else if (inName == "embl")
+        result = new M6EmblParser();
+    else if (inName == "genbank")
+        result = new M6GenBankParser();
+    else if (inName == "pdb")
+        result = new M6PDBParser();
+
+    return result;
+}
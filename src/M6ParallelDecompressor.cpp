@@ -0,0 +1,845 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <cstring>
+#include <atomic>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#include <boost/thread.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "M6ParallelDecompressor.h"
+#include "M6File.h"
+#include "M6Progress.h"
+#include "M6Queue.h"
+#include "M6Error.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const size_t
+    kReadSize = 1024 * 1024,        // compressed bytes read at a time
+    kJobSize = 1024 * 1024,            // compressed bytes per BGZF job
+    kOutputSize = 1024 * 1024;        // decompressed bytes per sequential job
+
+// a false block magic in a bzip2 stream results in a block that cannot be
+// decompressed, it is merged with the next block and tried again.
+const uint32 kMaxMerges = 4;
+
+const uint64
+    kBZip2BlockMagic = 0x314159265359ULL,
+    kBZip2EndMagic = 0x177245385090ULL;
+
+enum M6CompressionFormat
+{
+    eM6GZip,        // sequential, one thread
+    eM6BGZF,
+    eM6BZip2
+};
+
+struct M6DecompressJob
+{
+                    M6DecompressJob()
+                        : mStartBit(0), mEndBit(0), mLevel(0), mBlockCRC(0)
+                        , mStreamEnd(false), mStreamCRC(0), mFailed(false), mDone(false) {}
+
+    string            mInput, mOutput;
+
+    // bzip2 blocks occupy the bits [mStartBit, mEndBit) in mInput
+    uint64            mStartBit, mEndBit;
+    char            mLevel;
+    uint32            mBlockCRC;
+    bool            mStreamEnd;
+    uint32            mStreamCRC;
+
+    bool            mFailed;
+    bool            mDone;
+    exception_ptr    mError;
+};
+
+typedef shared_ptr<M6DecompressJob> M6DecompressJobPtr;
+
+// --------------------------------------------------------------------
+// bit level helpers for bzip2, bits are numbered from the most
+// significant bit of the first byte.
+
+inline uint64 GetBits(const string& inData, uint64 inBit, uint32 inCount)
+{
+    const uint8* p = reinterpret_cast<const uint8*>(inData.data()) + inBit / 8;
+
+    uint64 v = 0;
+    for (uint32 i = 0; i < 8 and inBit / 8 + i < inData.length(); ++i)
+        v |= static_cast<uint64>(p[i]) << (56 - 8 * i);
+
+    return (v << (inBit % 8)) >> (64 - inCount);
+}
+
+// Find the first block or end of stream magic starting at or after bit
+// inFromBit. Returns false if none was found, outScanned is then set to
+// the bit where the next search can start once more data is available.
+
+bool FindBZip2Magic(const string& inData, uint64 inFromBit,
+    uint64& outBit, bool& outEndOfStream, uint64& outScanned)
+{
+    const uint8* p = reinterpret_cast<const uint8*>(inData.data());
+    size_t size = inData.length();
+
+    // start positions in byte j are checked with the eight bytes j..j+7
+    size_t j = inFromBit / 8;
+    if (j + 8 > size)
+    {
+        outScanned = inFromBit;
+        return false;
+    }
+
+    uint64 v = 0;
+    for (size_t i = 0; i < 7; ++i)
+        v = v << 8 | p[j + i];
+
+    for (; j + 8 <= size; ++j)
+    {
+        v = v << 8 | p[j + 7];
+
+        for (uint32 k = 0; k < 8; ++k)
+        {
+            uint64 m = (v >> (16 - k)) & 0xffffffffffffULL;
+            if (m != kBZip2BlockMagic and m != kBZip2EndMagic)
+                continue;
+
+            uint64 bit = j * 8 + k;
+            if (bit < inFromBit)
+                continue;
+
+            outBit = bit;
+            outEndOfStream = m == kBZip2EndMagic;
+            return true;
+        }
+    }
+
+    outScanned = j * 8;
+    return false;
+}
+
+class M6BitWriter
+{
+  public:
+                M6BitWriter(string& inData) : mData(inData), mBits(0), mBitCount(0) {}
+
+    void        Put(uint64 inValue, uint32 inCount)
+                {
+                    while (inCount-- > 0)
+                    {
+                        mBits = mBits << 1 | ((inValue >> inCount) & 1);
+                        if (++mBitCount == 8)
+                        {
+                            mData += static_cast<char>(mBits);
+                            mBits = mBitCount = 0;
+                        }
+                    }
+                }
+
+                // copy the bits [inFrom, inTo) of inSource, the writer
+                // should be at a byte boundary
+    void        Copy(const string& inSource, uint64 inFrom, uint64 inTo)
+                {
+                    assert(mBitCount == 0);
+
+                    const uint8* s = reinterpret_cast<const uint8*>(inSource.data()) + inFrom / 8;
+                    uint32 shift = inFrom % 8;
+                    size_t n = (inTo - inFrom) / 8;
+
+                    size_t offset = mData.length();
+                    mData.resize(offset + n);
+                    char* d = &mData[offset];
+
+                    if (shift == 0)
+                        memcpy(d, s, n);
+                    else
+                    {
+                        for (size_t i = 0; i < n; ++i)
+                            d[i] = static_cast<char>(s[i] << shift | s[i + 1] >> (8 - shift));
+                    }
+
+                    uint32 rest = (inTo - inFrom) % 8;
+                    if (rest > 0)
+                        Put(GetBits(inSource, inFrom + n * 8, rest), rest);
+                }
+
+    void        Flush()
+                {
+                    if (mBitCount > 0)
+                        Put(0, 8 - mBitCount);
+                }
+
+  private:
+    string&        mData;
+    uint32        mBits, mBitCount;
+};
+
+// --------------------------------------------------------------------
+// BGZF members have an extra field BC with the size of the member
+
+bool GetBGZFBlockSize(const string& inData, size_t inOffset, size_t& outSize)
+{
+    const uint8* p = reinterpret_cast<const uint8*>(inData.data()) + inOffset;
+    size_t n = inData.length() - inOffset;
+
+    if (n < 18 or p[0] != 0x1f or p[1] != 0x8b or p[2] != 8 or (p[3] & 4) == 0)
+        return false;
+
+    size_t xlen = p[10] | p[11] << 8;
+    if (n < 12 + xlen)
+        return false;
+
+    for (size_t i = 12; i + 4 <= 12 + xlen; )
+    {
+        size_t slen = p[i + 2] | p[i + 3] << 8;
+        if (p[i] == 'B' and p[i + 1] == 'C' and slen == 2 and i + 6 <= 12 + xlen)
+        {
+            outSize = (p[i + 4] | p[i + 5] << 8) + 1;
+            return true;
+        }
+        i += 4 + slen;
+    }
+
+    return false;
+}
+
+// Inflate one or more complete gzip members
+
+void InflateMembers(M6DecompressJob& inJob)
+{
+    z_stream z = {};
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+        THROW(("Error initializing zlib"));
+
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(inJob.mInput.data()));
+    z.avail_in = static_cast<uInt>(inJob.mInput.length());
+
+    size_t total = 0;
+    int err = Z_OK;
+
+    while (z.avail_in > 0)
+    {
+        if (err == Z_STREAM_END)
+            inflateReset(&z);
+
+        if (total == inJob.mOutput.length())
+            inJob.mOutput.resize(total + max<size_t>(total, 256 * 1024));
+
+        z.next_out = reinterpret_cast<Bytef*>(&inJob.mOutput[total]);
+        z.avail_out = static_cast<uInt>(inJob.mOutput.length() - total);
+
+        err = inflate(&z, Z_NO_FLUSH);
+        total = inJob.mOutput.length() - z.avail_out;
+
+        if (err != Z_OK and err != Z_STREAM_END)
+            break;
+    }
+
+    inJob.mOutput.resize(total);
+    inflateEnd(&z);
+
+    if (err != Z_STREAM_END)
+        THROW(("Error decompressing gzip data%s%s", z.msg ? ": " : "", z.msg ? z.msg : ""));
+}
+
+// Decompress a single bzip2 block, the block is written as a stream
+// of its own. The CRC of a stream with one block is the block CRC.
+
+void DecompressBZip2Block(M6DecompressJob& inJob)
+{
+    string stream("BZh");
+    stream += inJob.mLevel;
+
+    M6BitWriter bits(stream);
+    bits.Copy(inJob.mInput, inJob.mStartBit, inJob.mEndBit);
+    bits.Put(kBZip2EndMagic, 48);
+    bits.Put(inJob.mBlockCRC, 32);
+    bits.Flush();
+
+    bz_stream bz = {};
+    if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK)
+        THROW(("Error initializing libbz2"));
+
+    bz.next_in = const_cast<char*>(stream.data());
+    bz.avail_in = static_cast<uint32>(stream.length());
+
+    inJob.mOutput.resize((inJob.mLevel - '0') * 100000 + 4096);
+
+    size_t total = 0;
+    int err;
+    for (;;)
+    {
+        if (total == inJob.mOutput.length())
+            inJob.mOutput.resize(2 * total);
+
+        bz.next_out = &inJob.mOutput[total];
+        bz.avail_out = static_cast<uint32>(inJob.mOutput.length() - total);
+
+        err = BZ2_bzDecompress(&bz);
+        total = inJob.mOutput.length() - bz.avail_out;
+
+        if (err != BZ_OK or (bz.avail_in == 0 and bz.avail_out > 0))
+            break;
+    }
+
+    BZ2_bzDecompressEnd(&bz);
+
+    inJob.mOutput.resize(total);
+    inJob.mFailed = err != BZ_STREAM_END or bz.avail_in != 0;
+}
+
+}
+
+// --------------------------------------------------------------------
+
+class M6ParallelDecompressorImpl
+{
+  public:
+                        M6ParallelDecompressorImpl(const fs::path& inFile,
+                            M6Progress& inProgress, uint32 inNrOfThreads);
+                        ~M6ParallelDecompressorImpl();
+
+    streamsize            Read(char* s, streamsize n);
+
+  private:
+                        M6ParallelDecompressorImpl(const M6ParallelDecompressorImpl&);
+    M6ParallelDecompressorImpl&
+                        operator=(const M6ParallelDecompressorImpl&);
+
+    // the splitter thread reads the input and creates the jobs
+    void                Split();
+    void                SplitBGZF();
+    void                SplitBZip2();
+    void                Inflate();
+
+    bool                Fill(string& ioBuffer, size_t inSize);
+    void                Submit(M6DecompressJobPtr inJob);
+    void                SubmitBZip2Block(const string& inBuffer, uint64 inStartBit,
+                            uint64 inEndBit, char inLevel, bool inStreamEnd, uint32 inStreamCRC);
+
+    void                Work();
+    static void            Decompress(M6DecompressJob& inJob);
+
+    M6DecompressJobPtr    NextJob();
+    void                Wait(M6DecompressJobPtr inJob);
+
+    M6File                mFile;
+    int64                mSize, mRead;
+    M6Progress&            mProgress;
+    M6CompressionFormat    mFormat;
+
+    M6Queue<M6DecompressJobPtr,16>
+                        mOrder;
+    M6Queue<M6DecompressJobPtr,64>
+                        mWork;
+    boost::thread        mSplitter;
+    boost::thread_group    mWorkers;
+    uint32                mNrOfThreads;
+    boost::mutex        mMutex;
+    boost::condition_variable
+                        mJobDone;
+    atomic<bool>        mStop;
+
+    // reader state
+    bool                mEOF;
+    M6DecompressJobPtr    mCurrent;
+    size_t                mOffset;
+    uint32                mCombinedCRC;
+};
+
+M6ParallelDecompressorImpl::M6ParallelDecompressorImpl(const fs::path& inFile,
+        M6Progress& inProgress, uint32 inNrOfThreads)
+    : mFile(inFile, eReadOnly), mSize(fs::file_size(inFile)), mRead(0)
+    , mProgress(inProgress), mNrOfThreads(0), mStop(false)
+    , mEOF(false), mOffset(0), mCombinedCRC(0)
+{
+    char header[3] = {};
+    if (mSize >= 3)
+        mFile.PRead(header, 3, 0);
+
+    size_t blockSize;
+    string data(header, 3);
+
+    if (data == "BZh")
+        mFormat = eM6BZip2;
+    else if (data[0] == '\x1f' and data[1] == '\x8b')
+    {
+        data.resize(static_cast<size_t>(min<int64>(mSize, 64 * 1024)));
+        mFile.PRead(&data[0], data.length(), 0);
+
+        mFormat = GetBGZFBlockSize(data, 0, blockSize) ? eM6BGZF : eM6GZip;
+    }
+    else
+        THROW(("%s is not a gzip or bzip2 compressed file", inFile.string().c_str()));
+
+    mFile.Advise(0, 0, eSequentialAccess);
+
+    // the work queue should be able to hold all jobs in the order queue
+    // plus a sentinel for each worker. More workers than cores only makes
+    // the decompressors compete for the cache.
+    if (mFormat != eM6GZip)
+    {
+        uint32 cores = max<uint32>(boost::thread::hardware_concurrency(), 1);
+        mNrOfThreads = min<uint32>(max<uint32>(inNrOfThreads, 1), min<uint32>(cores, 32));
+    }
+
+    for (uint32 i = 0; i < mNrOfThreads; ++i)
+        mWorkers.create_thread([this]() { this->Work(); });
+
+    mSplitter = boost::thread([this]() { this->Split(); });
+}
+
+M6ParallelDecompressorImpl::~M6ParallelDecompressorImpl()
+{
+    mStop = true;
+
+    // the splitter may be waiting for room in the order queue
+    if (not mEOF)
+    {
+        while (mOrder.Get())
+            ;
+    }
+
+    mSplitter.join();
+    mWorkers.join_all();
+}
+
+bool M6ParallelDecompressorImpl::Fill(string& ioBuffer, size_t inSize)
+{
+    while (ioBuffer.length() < inSize and mRead < mSize)
+    {
+        size_t n = static_cast<size_t>(min<int64>(kReadSize, mSize - mRead));
+
+        size_t offset = ioBuffer.length();
+        ioBuffer.resize(offset + n);
+        mFile.Read(&ioBuffer[offset], n);
+        mFile.Advise(mRead, n, eDontNeed);
+
+        mRead += n;
+        mProgress.Consumed(n);
+    }
+
+    return ioBuffer.length() >= inSize;
+}
+
+void M6ParallelDecompressorImpl::Submit(M6DecompressJobPtr inJob)
+{
+    mOrder.Put(inJob);
+    if (not inJob->mDone)
+        mWork.Put(inJob);
+}
+
+void M6ParallelDecompressorImpl::Split()
+{
+    try
+    {
+        mFile.Seek(0, SEEK_SET);
+
+        switch (mFormat)
+        {
+            case eM6GZip:    Inflate(); break;
+            case eM6BGZF:    SplitBGZF(); break;
+            case eM6BZip2:    SplitBZip2(); break;
+        }
+    }
+    catch (...)
+    {
+        M6DecompressJobPtr job(new M6DecompressJob);
+        job->mError = current_exception();
+        job->mDone = true;
+        mOrder.Put(job);
+    }
+
+    mOrder.Put(M6DecompressJobPtr());
+    for (uint32 i = 0; i < mNrOfThreads; ++i)
+        mWork.Put(M6DecompressJobPtr());
+}
+
+void M6ParallelDecompressorImpl::SplitBGZF()
+{
+    string buffer;
+    size_t offset = 0;
+
+    while (not mStop and Fill(buffer, offset + 1))
+    {
+        M6DecompressJobPtr job(new M6DecompressJob);
+        size_t start = offset;
+
+        while (offset - start < kJobSize and Fill(buffer, offset + 1))
+        {
+            size_t blockSize;
+
+            Fill(buffer, offset + 18);
+            if (not GetBGZFBlockSize(buffer, offset, blockSize) or
+                not Fill(buffer, offset + blockSize))
+            {
+                THROW(("Invalid or truncated BGZF block"));
+            }
+
+            offset += blockSize;
+        }
+
+        job->mInput.assign(buffer, start, offset - start);
+        Submit(job);
+
+        buffer.erase(0, offset);
+        offset = 0;
+    }
+}
+
+void M6ParallelDecompressorImpl::SplitBZip2()
+{
+    string buffer;
+    uint64 scan = 0;
+    bool firstStream = true;
+
+    // each pass of this loop handles one stream
+    while (not mStop and Fill(buffer, 1))
+    {
+        if (not Fill(buffer, 4) or buffer.compare(0, 3, "BZh") != 0 or
+            buffer[3] < '1' or buffer[3] > '9')
+        {
+            // bzip2 ignores trailing garbage as well
+            if (firstStream)
+                THROW(("Invalid bzip2 stream"));
+            break;
+        }
+
+        firstStream = false;
+
+        char level = buffer[3];
+        uint64 blockStart = 32;
+        bool first = true;
+
+        scan = blockStart;
+
+        for (;;)
+        {
+            if (mStop)
+                return;
+
+            uint64 bit;
+            bool endOfStream;
+
+            if (not FindBZip2Magic(buffer, scan, bit, endOfStream, scan))
+            {
+                if (mRead == mSize)
+                    THROW(("Truncated bzip2 stream"));
+
+                Fill(buffer, buffer.length() + kReadSize);
+                continue;
+            }
+
+            if (first)
+            {
+                if (bit != blockStart)
+                    THROW(("Invalid bzip2 stream"));
+
+                first = false;
+                scan = bit + 48;
+
+                if (not endOfStream)
+                    continue;
+
+                // an empty stream
+                buffer.erase(0, (bit + 80 + 7) / 8);
+                break;
+            }
+
+            uint32 streamCRC = 0;
+            size_t streamEnd = 0;
+
+            if (endOfStream)
+            {
+                // a real end of stream is followed by the next stream or
+                // the end of the file, or by trailing garbage without magic
+                streamEnd = (bit + 80 + 7) / 8;
+                Fill(buffer, streamEnd + 3);
+
+                bool real = buffer.length() >= streamEnd and
+                    (buffer.length() == streamEnd or buffer.compare(streamEnd, 3, "BZh") == 0);
+
+                if (not real and mRead == mSize and buffer.length() >= streamEnd)
+                {
+                    uint64 nextBit, scanned;
+                    bool nextEnd;
+                    real = not FindBZip2Magic(buffer, bit + 1, nextBit, nextEnd, scanned);
+                }
+
+                if (not real)
+                {
+                    scan = bit + 1;
+                    continue;
+                }
+
+                streamCRC = static_cast<uint32>(GetBits(buffer, bit + 48, 32));
+            }
+
+            // the tests can have a false block magic found inside the block
+            uint64 falseMagic = M6ParallelDecompressor::sTestFalseMagicOffset;
+            if (falseMagic > 0 and falseMagic < bit - blockStart)
+            {
+                SubmitBZip2Block(buffer, blockStart, blockStart + falseMagic, level, false, 0);
+                blockStart += falseMagic;
+            }
+
+            SubmitBZip2Block(buffer, blockStart, bit, level, endOfStream, streamCRC);
+
+            if (endOfStream)
+            {
+                buffer.erase(0, streamEnd);
+                break;
+            }
+
+            buffer.erase(0, bit / 8);
+            blockStart = bit % 8;
+            scan = blockStart + 48;
+        }
+    }
+}
+
+void M6ParallelDecompressorImpl::SubmitBZip2Block(const string& inBuffer,
+    uint64 inStartBit, uint64 inEndBit, char inLevel, bool inStreamEnd, uint32 inStreamCRC)
+{
+    M6DecompressJobPtr job(new M6DecompressJob);
+
+    size_t firstByte = inStartBit / 8;
+    job->mInput.assign(inBuffer, firstByte, (inEndBit + 7) / 8 - firstByte);
+    job->mStartBit = inStartBit % 8;
+    job->mEndBit = job->mStartBit + (inEndBit - inStartBit);
+    job->mLevel = inLevel;
+    job->mBlockCRC = static_cast<uint32>(GetBits(inBuffer, inStartBit + 48, 32));
+    job->mStreamEnd = inStreamEnd;
+    job->mStreamCRC = inStreamCRC;
+
+    Submit(job);
+}
+
+// gzip files that are not in BGZF format are decompressed here, running
+// ahead of the reader
+
+void M6ParallelDecompressorImpl::Inflate()
+{
+    z_stream z = {};
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+        THROW(("Error initializing zlib"));
+
+    string buffer;
+    M6DecompressJobPtr job;
+    size_t filled = 0;
+    int err = Z_OK;
+
+    try
+    {
+        while (not mStop)
+        {
+            if (z.avail_in == 0)
+            {
+                buffer.clear();
+                if (not Fill(buffer, kReadSize) and buffer.empty())
+                    break;
+
+                z.next_in = reinterpret_cast<Bytef*>(&buffer[0]);
+                z.avail_in = static_cast<uInt>(buffer.length());
+            }
+
+            if (err == Z_STREAM_END)
+            {
+                // another member may follow, other data is ignored
+                if (z.next_in[0] != 0x1f)
+                    break;
+
+                inflateReset(&z);
+                err = Z_OK;
+            }
+
+            if (not job)
+            {
+                job.reset(new M6DecompressJob);
+                job->mOutput.resize(kOutputSize);
+                job->mDone = true;
+                filled = 0;
+            }
+
+            z.next_out = reinterpret_cast<Bytef*>(&job->mOutput[filled]);
+            z.avail_out = static_cast<uInt>(kOutputSize - filled);
+
+            err = inflate(&z, Z_NO_FLUSH);
+            if (err != Z_OK and err != Z_STREAM_END)
+                THROW(("Error decompressing gzip data%s%s", z.msg ? ": " : "", z.msg ? z.msg : ""));
+
+            filled = kOutputSize - z.avail_out;
+            if (filled == kOutputSize)
+            {
+                Submit(job);
+                job.reset();
+            }
+        }
+
+        if (err != Z_STREAM_END and not mStop)
+            THROW(("Truncated gzip data"));
+    }
+    catch (...)
+    {
+        inflateEnd(&z);
+        throw;
+    }
+
+    inflateEnd(&z);
+
+    if (job and filled > 0)
+    {
+        job->mOutput.resize(filled);
+        Submit(job);
+    }
+}
+
+void M6ParallelDecompressorImpl::Work()
+{
+    for (;;)
+    {
+        M6DecompressJobPtr job = mWork.Get();
+        if (not job)
+            break;
+
+        try
+        {
+            Decompress(*job);
+        }
+        catch (...)
+        {
+            job->mError = current_exception();
+        }
+
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        job->mDone = true;
+        mJobDone.notify_all();
+    }
+}
+
+void M6ParallelDecompressorImpl::Decompress(M6DecompressJob& inJob)
+{
+    if (inJob.mLevel != 0)
+        DecompressBZip2Block(inJob);
+    else
+        InflateMembers(inJob);
+}
+
+void M6ParallelDecompressorImpl::Wait(M6DecompressJobPtr inJob)
+{
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while (not inJob->mDone)
+        mJobDone.wait(lock);
+}
+
+M6DecompressJobPtr M6ParallelDecompressorImpl::NextJob()
+{
+    M6DecompressJobPtr job = mOrder.Get();
+    if (not job)
+    {
+        mEOF = true;
+        return job;
+    }
+
+    Wait(job);
+
+    for (uint32 merges = 0; job->mFailed; ++merges)
+    {
+        M6DecompressJobPtr next = mOrder.Get();
+        if (not next)
+            mEOF = true;
+
+        if (not next or merges == kMaxMerges)
+            THROW(("Error decompressing bzip2 data"));
+
+        // a worker may still be decompressing the next job
+        Wait(next);
+
+        if (next->mError)
+            rethrow_exception(next->mError);
+
+        // the two jobs share the byte where the first one ends
+        M6DecompressJobPtr merged(new M6DecompressJob(*next));
+
+        merged->mInput = job->mInput.substr(0, job->mEndBit / 8) + next->mInput;
+        merged->mOutput.clear();
+        merged->mStartBit = job->mStartBit;
+        merged->mEndBit = (job->mEndBit / 8) * 8 + next->mEndBit;
+        merged->mLevel = job->mLevel;
+        merged->mBlockCRC = job->mBlockCRC;
+
+        DecompressBZip2Block(*merged);
+        job = merged;
+    }
+
+    if (job->mError)
+        rethrow_exception(job->mError);
+
+    if (job->mLevel != 0)
+    {
+        mCombinedCRC = (mCombinedCRC << 1 | mCombinedCRC >> 31) ^ job->mBlockCRC;
+
+        if (job->mStreamEnd)
+        {
+            if (mCombinedCRC != job->mStreamCRC)
+                THROW(("CRC error in bzip2 stream"));
+            mCombinedCRC = 0;
+        }
+    }
+
+    return job;
+}
+
+streamsize M6ParallelDecompressorImpl::Read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    while (result < n)
+    {
+        if (not mCurrent or mOffset == mCurrent->mOutput.length())
+        {
+            if (mEOF)
+                break;
+
+            mCurrent = NextJob();
+            mOffset = 0;
+            continue;
+        }
+
+        size_t k = min<size_t>(n - result, mCurrent->mOutput.length() - mOffset);
+        memcpy(s + result, mCurrent->mOutput.data() + mOffset, k);
+
+        mOffset += k;
+        result += k;
+    }
+
+    return result > 0 ? result : -1;
+}
+
+// --------------------------------------------------------------------
+
+uint32 M6ParallelDecompressor::sTestFalseMagicOffset = 0;
+
+M6ParallelDecompressor::M6ParallelDecompressor(const fs::path& inFile,
+        M6Progress& inProgress, uint32 inNrOfThreads)
+    : mImpl(new M6ParallelDecompressorImpl(inFile, inProgress, inNrOfThreads))
+{
+}
+
+streamsize M6ParallelDecompressor::read(char* s, streamsize n)
+{
+    return mImpl->Read(s, n);
+}
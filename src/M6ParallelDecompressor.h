@@ -0,0 +1,49 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+//    M6ParallelDecompressor is a boost::iostreams source that returns the
+//    decompressed contents of a gzip or bzip2 compressed file. The input
+//    is cut into pieces that can be decompressed independently, these are
+//    decompressed by a pool of threads and returned in the original order.
+//
+//    bzip2 files are cut at the block boundaries, each block is turned into
+//    a stream of its own and handed to libbz2. gzip files in the BGZF
+//    format (blocked gzip, as written by bgzip) are cut at the member
+//    boundaries. Other gzip files have a single member in most cases, their
+//    members cannot be found without decompressing. These are decompressed
+//    by one thread that runs ahead of the reader.
+//
+//    Progress is reported in compressed bytes, as they are read. Pages of
+//    the input that have been read are dropped from the page cache.
+
+#pragma once
+
+#include <memory>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/filesystem/path.hpp>
+
+class M6Progress;
+class M6ParallelDecompressorImpl;
+
+class M6ParallelDecompressor
+{
+  public:
+    typedef char                            char_type;
+    typedef boost::iostreams::source_tag    category;
+
+                        M6ParallelDecompressor(const boost::filesystem::path& inFile,
+                            M6Progress& inProgress, uint32 inNrOfThreads);
+
+    std::streamsize        read(char* s, std::streamsize n);
+
+    // For testing only: when not zero, each bzip2 block is also cut this
+    // many bits after its start, as if a false block magic was found there.
+    static uint32        sTestFalseMagicOffset;
+
+  private:
+    std::shared_ptr<M6ParallelDecompressorImpl>
+                        mImpl;
+};
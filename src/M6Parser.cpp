@@ -1055,9 +1055,14 @@ void xs_init(pTHX)
 //    sv_setiv(get_sv("M6::INDEX_STRING", true),        eIndexString);
 }
 
-M6Parser::M6Parser(const string& inName)
-    : mName(inName)
+M6Parser::M6Parser(const string& inName, bool inUseNative)
+    : mName(inName), mNative(false)
 {
+    if (inUseNative)
+    {
+        mNativeImpl.reset(M6NativeParser::Create(inName));
+        mNative = mNativeImpl.get() != nullptr;
+    }
 }
 
 M6Parser::~M6Parser()
@@ -1073,12 +1078,23 @@ M6ParserImpl* M6Parser::Impl()
     return mImpl.get();
 }
 
+M6NativeParser* M6Parser::Native()
+{
+    if (mNativeImpl.get() == nullptr)
+        mNativeImpl.reset(M6NativeParser::Create(mName));
+
+    return mNativeImpl.get();
+}
+
 string M6Parser::GetVersion(const string& inSourceConfig)
 {
     string result;
     try
     {
-        result = Impl()->GetVersion(inSourceConfig);
+        if (mNative)
+            result = Native()->GetVersion(inSourceConfig);
+        else
+            result = Impl()->GetVersion(inSourceConfig);
     }
     catch (exception& e)
     {
@@ -1091,21 +1107,33 @@ string M6Parser::GetVersion(const string& inSourceConfig)
 void M6Parser::ParseDocument(M6InputDocument* inDoc,
     const string& inFileName, const string& inDbHeader)
 {
-    Impl()->Parse(inDoc, inFileName, inDbHeader);
+    if (mNative)
+        Native()->ParseDocument(inDoc, inFileName, inDbHeader);
+    else
+        Impl()->Parse(inDoc, inFileName, inDbHeader);
 }
 
 string M6Parser::GetValue(const string& inName)
 {
-    return Impl()->operator[](inName.c_str());
+    if (mNative)
+        return Native()->GetValue(inName);
+    else
+        return Impl()->operator[](inName.c_str());
 }
 
 void M6Parser::ToFasta(const string& inDoc, const string& inDb, const string& inID,
     const string& inTitle, string& outFasta)
 {
-    Impl()->ToFasta(inDoc, inDb, inID, inTitle, outFasta);
+    if (mNative)
+        Native()->ToFasta(inDoc, inDb, inID, inTitle, outFasta);
+    else
+        Impl()->ToFasta(inDoc, inDb, inID, inTitle, outFasta);
 }
 
 void M6Parser::GetIndexNames(vector<pair<string,string>>& outIndexNames)
 {
-    Impl()->GetIndexNames(outIndexNames);
+    if (mNative)
+        Native()->GetIndexNames(outIndexNames);
+    else
+        Impl()->GetIndexNames(outIndexNames);
 }
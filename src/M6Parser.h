@@ -12,10 +12,17 @@
 struct M6ParserImpl;
 typedef boost::thread_specific_ptr<M6ParserImpl>    M6ParserImplPtr;
 
+class M6NativeParser;
+typedef boost::thread_specific_ptr<M6NativeParser>    M6NativeParserPtr;
+
 class M6Parser
 {
   public:
-                    M6Parser(const std::string& inName);
+                    // The Perl script with this name is used, unless
+                    // inUseNative is true and a native parser exists for
+                    // inName. Databanks ask for it with native-parser="true",
+                    // a native parser ignores local changes to the script.
+                    M6Parser(const std::string& inName, bool inUseNative = false);
                     ~M6Parser();
 
                     // return the version string of the current data set.
@@ -33,10 +40,76 @@ class M6Parser
                         const std::string& inDb, const std::string& inTitle,
                         std::string& outFasta);
 
+    bool            IsNative() const            { return mNative; }
+
   private:
 
     M6ParserImpl*    Impl();
+    M6NativeParser*    Native();
 
     std::string        mName;
+    bool            mNative;
     M6ParserImplPtr    mImpl;
+    M6NativeParserPtr
+                    mNativeImpl;
+};
+
+// --------------------------------------------------------------------
+// Native parsers are C++ versions of the Perl parser scripts for the
+// largest databanks. They produce the same output, using the same
+// callbacks as the M6::Script objects in Perl do. Like the Perl
+// parsers, one is created for each thread.
+
+class M6NativeParser
+{
+  public:
+                    M6NativeParser();
+    virtual            ~M6NativeParser();
+
+                    // returns nullptr if there is no native parser inName
+    static M6NativeParser*
+                    Create(const std::string& inName);
+
+    void            ParseDocument(M6InputDocument* inDoc,
+                        const std::string& inFileName, const std::string& inDbHeader);
+
+    virtual std::string
+                    GetVersion(const std::string& inSourceConfig);
+    virtual void    ToFasta(const std::string& inDoc, const std::string& inDb,
+                        const std::string& inID, const std::string& inTitle,
+                        std::string& outFasta);
+
+    std::string        GetValue(const std::string& inName) const;
+    void            GetIndexNames(
+                        std::vector<std::pair<std::string,std::string>>& outIndexNames) const;
+
+  protected:
+
+    virtual void    Parse(const std::string& inText, const std::string& inFileName,
+                        const std::string& inDbHeader) = 0;
+
+    // The M6::Script callbacks. Empty texts and strings are ignored,
+    // an empty number, date or link is an error.
+    void            IndexText(const std::string& inIndex, const char* inText, size_t inLength);
+    void            IndexText(const std::string& inIndex, const std::string& inText)
+                        { IndexText(inIndex, inText.c_str(), inText.length()); }
+    void            IndexString(const std::string& inIndex, const std::string& inText);
+    void            IndexUniqueString(const std::string& inIndex, const std::string& inText);
+    void            IndexNumber(const std::string& inIndex, const std::string& inValue);
+    void            IndexDate(const std::string& inIndex, const std::string& inValue);
+    void            IndexFloat(const std::string& inIndex, double inValue);
+    void            SetAttribute(const std::string& inName, const std::string& inValue);
+    void            AddLink(const std::string& inDatabank, const std::string& inValue);
+
+    // the values passed to new M6::Script in the Perl script
+    std::map<std::string,std::string>
+                    mValues;
+    std::vector<std::pair<std::string,std::string>>
+                    mIndexNames;
+
+  private:
+                    M6NativeParser(const M6NativeParser&);
+    M6NativeParser&    operator=(const M6NativeParser&);
+
+    M6InputDocument*    mDocument;
 };
@@ -197,7 +197,7 @@ M6Iterator* M6QueryParser::ParseTest()
             else if (mDatabank != nullptr)
             {
                 if (pat == "*")
-                    result.reset(new M6AllDocIterator(mDatabank->size()));
+                    result.reset(mDatabank->FindAll());
                 else
                     result.reset(mDatabank->FindPattern("full-text", pat));
             }
@@ -3,11 +3,46 @@
 //     (See accompanying file LICENSE_1_0.txt or copy at
 //           http://www.boost.org/LICENSE_1_0.txt)
 
+//    M6Queue is a bounded multi producer, multi consumer queue used to
+//    pass work between the threads of the import pipeline. Items are
+//    stored in a ring buffer of slots, each carrying a sequence number
+//    (after Dmitry Vyukov's bounded MPMC queue). Put and Get claim a slot
+//    with a single compare and exchange, the mutex and the condition
+//    variables are only used by threads that have to wait for a full or
+//    empty queue. Only when such a thread is sleeping, the other side
+//    takes the mutex to wake it up.
+
 #pragma once
 
-#include <deque>
+#include <atomic>
 #include <boost/thread.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// Statistics to help debug performance issues. A wait is counted each
+// time a thread had to go to sleep because the queue was full or empty,
+// the wait times are in microseconds.
+
+struct M6QueueStats
+{
+    int64            mPut, mGet;
+    int64            mFullWaits, mEmptyWaits;
+    int64            mFullWaitTime, mEmptyWaitTime;
+};
+
+// The ring buffer has N slots rounded up to a power of two, with at least
+// two slots: with a single slot a full slot cannot be told from an empty one.
+template<uint32 N>
+struct M6QueueCapacity
+{
+    static const uint32 value = M6QueueCapacity<(N + 1) / 2>::value * 2;
+};
+
+template<>
+struct M6QueueCapacity<1>
+{
+    static const uint32 value = 2;
+};
 
 template<class T, uint32 N = 100>
 class M6Queue
@@ -17,29 +52,70 @@ class M6Queue
                         ~M6Queue();
 
     void                Put(T inValue);
-//    void                Put(T inValue[], uint32 inCount);
     T                    Get();
 
-    // flags to help debug performance issues
-    bool                WasFull() const        { return mWasFull; }
-    bool                WasEmpty() const    { return mWasEmpty; }
+    // The batched versions take the mutex at most once to wake up
+    // sleeping threads. Get returns at least one item and at most
+    // inMaxCount, it only blocks when the queue is empty.
+    void                Put(const T inValues[], uint32 inCount);
+    uint32                Get(T outValues[], uint32 inMaxCount);
+
+    // Waits at most inTimeout for room in the queue, returns false and
+    // leaves ioValue untouched when the queue stayed full.
+    bool                TimedPut(T& ioValue,
+                            const boost::posix_time::time_duration& inTimeout);
+
+    M6QueueStats        GetStats() const;
 
   private:
                         M6Queue(const M6Queue&);
     M6Queue&            operator=(const M6Queue&);
 
-    std::deque<T>        mQueue;
+    static const uint32    kCapacity = M6QueueCapacity<N>::value;
+    static const uint32    kSpinCount = 64;
+
+    bool                TryPut(T& ioValue);
+    bool                TryGet(T& outValue);
+
+    void                WaitPut(T& ioValue);
+    void                WaitGet(T& outValue);
+
+    void                Wake(std::atomic<uint32>& inWaiting,
+                            boost::condition_variable& inCondition, bool inAll);
+
+    struct M6Slot
+    {
+        std::atomic<size_t>    mSequence;
+        T                    mValue;
+    };
+
+    M6Slot                mSlots[kCapacity];
+
+    // the head and tail are written by different threads, keep them apart
+    char                mPad1[64];
+    std::atomic<size_t>    mHead;
+    char                mPad2[64];
+    std::atomic<size_t>    mTail;
+    char                mPad3[64];
+
     boost::mutex        mMutex;
-    std::unique_ptr<boost::condition_variable>
-                        mEmptyCondition, mFullCondition;
-    bool                mWasFull, mWasEmpty;
+    boost::condition_variable
+                        mNotFull, mNotEmpty;
+    std::atomic<uint32>    mWaitingPutters, mWaitingGetters;
+
+    std::atomic<int64>    mPutCount, mGetCount;
+    std::atomic<int64>    mFullWaits, mEmptyWaits;
+    std::atomic<int64>    mFullWaitTime, mEmptyWaitTime;
 };
 
 template<class T, uint32 N>
 M6Queue<T,N>::M6Queue()
-    : mEmptyCondition(new boost::condition_variable), mFullCondition(new boost::condition_variable)
-    , mWasFull(false), mWasEmpty(true)
+    : mHead(0), mTail(0), mWaitingPutters(0), mWaitingGetters(0)
+    , mPutCount(0), mGetCount(0), mFullWaits(0), mEmptyWaits(0)
+    , mFullWaitTime(0), mEmptyWaitTime(0)
 {
+    for (uint32 i = 0; i < kCapacity; ++i)
+        mSlots[i].mSequence.store(i, std::memory_order_relaxed);
 }
 
 template<class T, uint32 N>
@@ -47,56 +123,255 @@ M6Queue<T,N>::~M6Queue()
 {
 }
 
+template<class T, uint32 N>
+bool M6Queue<T,N>::TryPut(T& ioValue)
+{
+    size_t pos = mHead.load(std::memory_order_relaxed);
+    M6Slot* slot;
+
+    for (;;)
+    {
+        slot = &mSlots[pos & (kCapacity - 1)];
+        size_t seq = slot->mSequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0)
+        {
+            // the queue holds at most N items, even if there are more slots
+            if (N < kCapacity and pos - mTail.load(std::memory_order_acquire) >= N)
+                return false;
+
+            if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;    // full
+        else
+            pos = mHead.load(std::memory_order_relaxed);
+    }
+
+    slot->mValue = std::move(ioValue);
+    slot->mSequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+template<class T, uint32 N>
+bool M6Queue<T,N>::TryGet(T& outValue)
+{
+    size_t pos = mTail.load(std::memory_order_relaxed);
+    M6Slot* slot;
+
+    for (;;)
+    {
+        slot = &mSlots[pos & (kCapacity - 1)];
+        size_t seq = slot->mSequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+        if (diff == 0)
+        {
+            if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;    // empty
+        else
+            pos = mTail.load(std::memory_order_relaxed);
+    }
+
+    outValue = std::move(slot->mValue);
+    slot->mSequence.store(pos + kCapacity, std::memory_order_release);
+
+    return true;
+}
+
+// A waiting thread registers itself before it tries once more, while
+// holding the mutex. The other side publishes its item before it checks
+// for waiters. The fences make sure at least one of them sees the other,
+// and so no wakeup is lost.
+
+template<class T, uint32 N>
+void M6Queue<T,N>::Wake(std::atomic<uint32>& inWaiting,
+    boost::condition_variable& inCondition, bool inAll)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (inWaiting.load(std::memory_order_relaxed) > 0)
+    {
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        if (inAll)
+            inCondition.notify_all();
+        else
+            inCondition.notify_one();
+    }
+}
+
+template<class T, uint32 N>
+void M6Queue<T,N>::WaitPut(T& ioValue)
+{
+    for (uint32 i = 0; i < kSpinCount; ++i)
+    {
+        boost::this_thread::yield();
+        if (TryPut(ioValue))
+            return;
+    }
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+
+        ++mWaitingPutters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        while (not TryPut(ioValue))
+            mNotFull.wait(lock);
+
+        --mWaitingPutters;
+    }
+
+    mFullWaits += 1;
+    mFullWaitTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+}
+
+template<class T, uint32 N>
+void M6Queue<T,N>::WaitGet(T& outValue)
+{
+    for (uint32 i = 0; i < kSpinCount; ++i)
+    {
+        boost::this_thread::yield();
+        if (TryGet(outValue))
+            return;
+    }
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+
+        ++mWaitingGetters;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        while (not TryGet(outValue))
+            mNotEmpty.wait(lock);
+
+        --mWaitingGetters;
+    }
+
+    mEmptyWaits += 1;
+    mEmptyWaitTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+}
+
 template<class T, uint32 N>
 void M6Queue<T,N>::Put(T inValue)
 {
-    boost::unique_lock<boost::mutex> lock(mMutex);
+    if (not TryPut(inValue))
+        WaitPut(inValue);
+
+    mPutCount.fetch_add(1, std::memory_order_relaxed);
+    Wake(mWaitingGetters, mNotEmpty, false);
+}
 
-    mWasFull = false;
-    while (mQueue.size() >= N)
+template<class T, uint32 N>
+bool M6Queue<T,N>::TimedPut(T& ioValue, const boost::posix_time::time_duration& inTimeout)
+{
+    if (not TryPut(ioValue))
     {
-        mFullCondition->wait(lock);
-        mWasFull = true;
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        boost::system_time deadline = boost::get_system_time() + inTimeout;
+        bool put;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+
+            ++mWaitingPutters;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            while (not (put = TryPut(ioValue)))
+            {
+                if (not mNotFull.timed_wait(lock, deadline))
+                {
+                    put = TryPut(ioValue);
+                    break;
+                }
+            }
+
+            --mWaitingPutters;
+        }
+
+        mFullWaits += 1;
+        mFullWaitTime += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+        if (not put)
+            return false;
     }
 
-    mQueue.push_back(inValue);
+    mPutCount.fetch_add(1, std::memory_order_relaxed);
+    Wake(mWaitingGetters, mNotEmpty, false);
 
-    mEmptyCondition->notify_one();
+    return true;
 }
 
-//template<class T, uint32 N>
-//void M6Queue<T,N>::Put(T inValue[], uint32 inCount)
-//{
-//    boost::mutex::scoped_lock lock(mMutex);
-//
-//    mWasFull = false;
-//    while (mQueue.size() >= N)
-//    {
-//        mFullCondition->wait(lock);
-//        mWasFull = true;
-//    }
-//
-//    mQueue.append(inValue, inValue + inCount);
-//
-//    mEmptyCondition->notify_one();
-//}
+template<class T, uint32 N>
+void M6Queue<T,N>::Put(const T inValues[], uint32 inCount)
+{
+    for (uint32 i = 0; i < inCount; ++i)
+    {
+        T value(inValues[i]);
+        if (not TryPut(value))
+        {
+            // the getters must see what was put so far before we sleep
+            Wake(mWaitingGetters, mNotEmpty, true);
+            WaitPut(value);
+        }
+    }
+
+    mPutCount.fetch_add(inCount, std::memory_order_relaxed);
+    Wake(mWaitingGetters, mNotEmpty, true);
+}
 
 template<class T, uint32 N>
 T M6Queue<T,N>::Get()
 {
-    boost::unique_lock<boost::mutex> lock(mMutex);
+    T result;
+    if (not TryGet(result))
+        WaitGet(result);
 
-    mWasEmpty = false;
-    while (mQueue.empty())
+    mGetCount.fetch_add(1, std::memory_order_relaxed);
+    Wake(mWaitingPutters, mNotFull, false);
+
+    return result;
+}
+
+template<class T, uint32 N>
+uint32 M6Queue<T,N>::Get(T outValues[], uint32 inMaxCount)
+{
+    uint32 result = 0;
+
+    if (inMaxCount > 0)
     {
-        mEmptyCondition->wait(lock);
-        mWasEmpty = true;
+        if (not TryGet(outValues[0]))
+            WaitGet(outValues[0]);
+
+        result = 1;
+        while (result < inMaxCount and TryGet(outValues[result]))
+            ++result;
+
+        mGetCount.fetch_add(result, std::memory_order_relaxed);
+        Wake(mWaitingPutters, mNotFull, true);
     }
 
-    T result = mQueue.front();
-    mQueue.pop_front();
+    return result;
+}
 
-    mFullCondition->notify_one();
+template<class T, uint32 N>
+M6QueueStats M6Queue<T,N>::GetStats() const
+{
+    M6QueueStats result = {
+        mPutCount.load(), mGetCount.load(),
+        mFullWaits.load(), mEmptyWaits.load(),
+        mFullWaitTime.load(), mEmptyWaitTime.load()
+    };
 
     return result;
 }
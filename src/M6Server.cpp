@@ -26,6 +26,8 @@
 #include <boost/random/random_device.hpp>
 #include <boost/chrono.hpp>
 #include <boost/stacktrace.hpp>
+#include <boost/function.hpp>
+#include <boost/iostreams/stream.hpp>
 
 #include <zeep/envelope.hpp>
 
@@ -52,6 +54,7 @@ namespace fs = boost::filesystem;
 namespace ba = boost::algorithm;
 namespace pt = boost::posix_time;
 namespace po = boost::program_options;
+namespace io = boost::iostreams;
 
 const string kM6ServerNS = "http://mrs.cmbi.ru.nl/mrs-web/ml";
 
@@ -63,6 +66,200 @@ struct M6Redirect
     uint32    nr;
 };
 
+// --------------------------------------------------------------------
+//    M6EntrySequenceSource concatenates a list of entries into a single
+//    stream. Entries are opened one at a time, when the previous one is
+//    exhausted, so a bulk download never holds more than one entry.
+//    The entries must have been checked before the reply starts, an error
+//    while reading can no longer change the reply status. It is logged and
+//    leaves the stream in an error state.
+
+class M6EntrySequenceSource : public io::source
+{
+  public:
+    typedef char                                char_type;
+    typedef io::source_tag                        category;
+
+    typedef boost::function<istream*()>            M6EntryOpener;
+    typedef deque<M6EntryOpener>                M6EntryOpenerList;
+
+                    M6EntrySequenceSource(const M6EntryOpenerList& inEntries)
+                        : mEntries(new M6EntryOpenerList(inEntries)) {}
+
+    streamsize        read(char* s, streamsize n);
+
+  private:
+    shared_ptr<M6EntryOpenerList>    mEntries;
+    shared_ptr<istream>                mCurrent;
+};
+
+streamsize M6EntrySequenceSource::read(char* s, streamsize n)
+{
+    streamsize result = 0;
+
+    try
+    {
+        while (result == 0)
+        {
+            if (not mCurrent)
+            {
+                if (mEntries->empty())
+                    break;
+
+                mCurrent.reset(mEntries->front()());
+                mEntries->pop_front();
+            }
+
+            mCurrent->read(s, n);
+            result = mCurrent->gcount();
+
+            if (result == 0)
+            {
+                if (mCurrent->bad())
+                    THROW(("Error reading entry"));
+                mCurrent.reset();
+            }
+        }
+    }
+    catch (exception& e)
+    {
+        LOG(ERROR, "error streaming entries, reply is truncated: %s", e.what());
+
+        mEntries->clear();
+        mCurrent.reset();
+        throw;
+    }
+
+    if (result == 0)
+        result = -1;
+
+    return result;
+}
+
+// --------------------------------------------------------------------
+//    M6EntryCache keeps the most recently rendered entry pages, up to a
+//    maximum total size. Entries are keyed by databank UUID, document number,
+//    format and the mobile flag, the ETag is derived from the content and
+//    the mobile flag. Pages are cached without the query, it is added to
+//    a copy for each request.
+//    The links to other databanks in a page can come from any loaded
+//    databank, the key therefore also contains a digest of their UUIDs.
+
+class M6EntryCache
+{
+  public:
+    struct M6Entry
+    {
+        string        mContent;
+        string        mContentType;
+        string        mETag;
+    };
+
+                    M6EntryCache(size_t inMaxSize)
+                        : mMaxSize(inMaxSize), mSize(0) {}
+
+    bool            Get(const string& inKey, M6Entry& outEntry);
+    void            Put(const string& inKey, const M6Entry& inEntry);
+
+  private:
+    typedef list<pair<string,M6Entry>>        M6EntryList;
+
+    boost::mutex    mMutex;
+    M6EntryList        mEntries;    // most recently used first
+    map<string,M6EntryList::iterator>
+                    mIndex;
+    size_t            mMaxSize, mSize;
+};
+
+bool M6EntryCache::Get(const string& inKey, M6Entry& outEntry)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+
+    bool result = false;
+
+    auto i = mIndex.find(inKey);
+    if (i != mIndex.end())
+    {
+        mEntries.splice(mEntries.begin(), mEntries, i->second);
+        outEntry = i->second->second;
+        result = true;
+    }
+
+    return result;
+}
+
+void M6EntryCache::Put(const string& inKey, const M6Entry& inEntry)
+{
+    size_t size = inKey.length() + inEntry.mContent.length();
+    if (size > mMaxSize / 4)    // don't let a single huge entry flush the cache
+        return;
+
+    boost::mutex::scoped_lock lock(mMutex);
+
+    if (mIndex.count(inKey))
+        return;
+
+    mEntries.push_front(make_pair(inKey, inEntry));
+    mIndex[inKey] = mEntries.begin();
+    mSize += size;
+
+    while (mSize > mMaxSize and not mEntries.empty())
+    {
+        auto& e = mEntries.back();
+        mSize -= e.first.length() + e.second.mContent.length();
+        mIndex.erase(e.first);
+        mEntries.pop_back();
+    }
+}
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+// If-None-Match holds * or a list of entity tags, these are compared
+// with the weak comparison function of RFC 7232, W/ prefixes are ignored.
+bool ETagMatches(const string& inIfNoneMatch, const string& inETag)
+{
+    string etag(inETag);
+    if (ba::starts_with(etag, "W/"))
+        etag.erase(0, 2);
+
+    bool result = false;
+
+    string::size_type i = 0, n = inIfNoneMatch.length();
+    while (i < n and not result)
+    {
+        if (isspace(inIfNoneMatch[i]) or inIfNoneMatch[i] == ',')
+        {
+            ++i;
+            continue;
+        }
+
+        if (inIfNoneMatch.compare(i, 2, "W/") == 0)
+            i += 2;
+
+        string::size_type e;
+        if (i < n and inIfNoneMatch[i] == '"')
+        {
+            e = inIfNoneMatch.find('"', i + 1);
+            e = e == string::npos ? n : e + 1;
+        }
+        else
+            e = min(inIfNoneMatch.find(',', i), n);
+
+        string tag = inIfNoneMatch.substr(i, e - i);
+        ba::trim(tag);
+        result = tag == "*" or tag == etag;
+
+        i = e;
+    }
+
+    return result;
+}
+
+}
+
 // --------------------------------------------------------------------
 
 M6Server* M6Server::sInstance;
@@ -72,6 +269,7 @@ M6Server::M6Server(const zx::element* inConfig)
     , mConfig(inConfig)
     , mAlignEnabled(false)
     , mConfigCopy(nullptr)
+    , mEntryCache(nullptr)
 {
     LOG(INFO,"M6Server: loading databanks..");
 
@@ -142,6 +340,13 @@ M6Server::M6Server(const zx::element* inConfig)
             mBaseURL += '/';
     }
 
+    // size of the rendered entry cache in megabytes, zero disables it
+    size_t entryCacheSize = 64;
+    if (not mConfig->get_attribute("entry-cache-size").empty())
+        entryCacheSize = boost::lexical_cast<size_t>(mConfig->get_attribute("entry-cache-size"));
+    if (entryCacheSize > 0)
+        mEntryCache = new M6EntryCache(entryCacheSize * 1024 * 1024);
+
     LOG(DEBUG,"M6Server: getting clustal");
 
     fs::path clustalo(M6Config::GetTool("clustalo"));
@@ -232,6 +437,7 @@ M6Server::~M6Server()
         delete ws;
 
     delete mConfigCopy;
+    delete mEntryCache;
 
     if (sInstance == this)
         sInstance = nullptr;
@@ -275,7 +481,8 @@ void M6Server::LoadAllDatabanks()
 
             M6Parser* parser = nullptr;
             if (not config->get_attribute("parser").empty())
-                parser = new M6Parser(config->get_attribute("parser"));
+                parser = new M6Parser(config->get_attribute("parser"),
+                    config->get_attribute("native-parser") == "true");
 
             set<string> aliases;
             for (zx::element* alias : config->find("aliases/alias"))
@@ -312,8 +519,13 @@ void M6Server::LoadAllDatabanks()
         }
     }
 
+    M6MD5 uuids;
     for (M6LoadedDatabank& db : mLoadedDatabanks)
+    {
         db.mDatabank->InitLinkMap(mLinkMap);
+        uuids.Update(db.mDatabank->GetUUID());
+    }
+    mLinkedUUIDs = uuids.Finalise();
 
     // setup the mBlastDatabanks list
     for (auto& blastAlias : blastAliases)
@@ -394,12 +606,16 @@ tuple<M6Databank*,uint32> M6Server::GetEntryDatabankAndNr(const string& inDataba
 
 string M6Server::GetEntry(M6Databank* inDatabank, const string& inFormat, uint32 inDocNr)
 {
+    string result;
+
+    // use the pre-rendered fasta if the databank has it
+    if (inFormat == "fasta" and inDatabank->GetFasta(inDocNr, result))
+        return result;
+
     unique_ptr<M6Document> doc(inDatabank->Fetch(inDocNr));
     if (not doc)
         THROW(("Unable to fetch document"));
 
-    string result;
-
     if (inFormat == "title")
         result = doc->GetAttribute("title");
     else
@@ -426,6 +642,50 @@ string M6Server::GetEntry(M6Databank* inDatabank, const string& inFormat, uint32
     return result;
 }
 
+istream* M6Server::GetEntryStream(M6Databank* inDatabank, const string& inFormat,
+    uint32 inDocNr, uint32 inOffset)
+{
+    if (inFormat == "title" or inFormat == "fasta")
+    {
+        string entry = GetEntry(inDatabank, inFormat, inDocNr);
+        return new istringstream(entry.substr(min<size_t>(inOffset, entry.length())));
+    }
+
+    unique_ptr<M6Document> doc(inDatabank->Fetch(inDocNr));
+    if (not doc)
+        THROW(("Unable to fetch document"));
+
+    // blocked documents only inflate the blocks from inOffset on
+    M6OutputDocument* outDoc = dynamic_cast<M6OutputDocument*>(doc.get());
+    if (outDoc != nullptr)
+        return outDoc->GetTextStream(inOffset);
+
+    istream* result = doc->GetTextStream();
+    result->ignore(inOffset);
+    return result;
+}
+
+string M6Server::GetEntry(M6Databank* inDatabank, const string& inFormat,
+    uint32 inDocNr, uint32 inOffset, uint32 inLength)
+{
+    if (inFormat == "title" or inFormat == "fasta")
+    {
+        string entry = GetEntry(inDatabank, inFormat, inDocNr);
+        return entry.substr(min<size_t>(inOffset, entry.length()), inLength);
+    }
+
+    unique_ptr<M6Document> doc(inDatabank->Fetch(inDocNr));
+    if (not doc)
+        THROW(("Unable to fetch document"));
+
+    M6OutputDocument* outDoc = dynamic_cast<M6OutputDocument*>(doc.get());
+    if (outDoc != nullptr)
+        return outDoc->GetText(inOffset, inLength);
+
+    string text = doc->GetText();
+    return text.substr(min<size_t>(inOffset, text.length()), inLength);
+}
+
 string M6Server::GetEntry(M6Databank* inDatabank,
     const string& inFormat, const string& inIndex, const string& inValue)
 {
@@ -538,7 +798,7 @@ void M6Server::Find(const string& inDatabank, const string& inQuery, bool inAllT
                 break;
 
             if (token == eM6TokenWord or token == eM6TokenNumber)
-                q << tokenizer.GetTokenString() << ' ';
+                q.write(tokenizer.GetTokenValue(), tokenizer.GetTokenLength()) << ' ';
         }
 
         ParseQuery(*databank, q.str(), inAllTermsRequired, queryTerms, filter, isBooleanQuery);
@@ -903,12 +1163,21 @@ void M6Server::handle_download(const zh::request& request, const el::scope& scop
         string db = params.get("db", "").as<string>();
 
         string id;
-        stringstream ss;
+        M6EntrySequenceSource::M6EntryOpenerList entries;
         uint32 n = 0;
 
         LOG(INFO, "download request recieved, format=%s, db=%s",
                    format.c_str (), db.c_str ());
 
+        // Resolve all entries to a databank and document number first, so
+        // unknown entries are reported before the reply is sent. The text
+        // itself, in any format, is only rendered when the stream reaches
+        // the entry.
+        auto addEntry = [this, &entries, &format](M6Databank* inDatabank, uint32 inDocNr)
+        {
+            entries.push_back(boost::bind(&M6Server::GetEntryStream, this, inDatabank, format, inDocNr, 0));
+        };
+
         for (auto& p : params)
         {
             if (p.first == "id")
@@ -929,7 +1198,11 @@ void M6Server::handle_download(const zh::request& request, const el::scope& scop
                         id = id.substr (pos + 1);
                 }
 
-                ss << GetEntry (m_db, id, format);
+                M6Databank* databank;
+                uint32 docNr;
+                tie(databank, docNr) = GetEntryDatabankAndNr(m_db, id);
+
+                addEntry(databank, docNr);
                 ++n;
             }
             else if (p.first == "nr")
@@ -938,13 +1211,17 @@ void M6Server::handle_download(const zh::request& request, const el::scope& scop
                 if (databank == nullptr)
                     THROW(("Databank %s not loaded", db.c_str()));
 
+                uint32 docNr = boost::lexical_cast<uint32>(p.second.as<string>());
+
+                if (not databank->Exists(docNr))
+                    THROW(("Entry %d does not exist in databank %s", docNr, db.c_str()));
 
-                ss << GetEntry(databank, format, boost::lexical_cast<uint32>(p.second.as<string>()));
+                addEntry(databank, docNr);
                 ++n;
             }
         }
 
-        reply.set_content(ss.str(), "text/plain");
+        reply.set_content(new io::stream<M6EntrySequenceSource>(M6EntrySequenceSource(entries)), "text/plain");
 
         if (n != 1 or id.empty())
             id = "mrs-data";
@@ -1048,16 +1325,116 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
         else
         {
             docNr = boost::lexical_cast<uint32>(nr);
-            unique_ptr<M6Document> doc(mdb->Fetch(docNr));
-            if (doc)
-                id = doc->GetAttribute("id");
+
+            // Document numbers change when the segments of a databank are
+            // merged, entry links therefore carry the id as well. A unique
+            // id takes precedence over the number. Links with only a number
+            // are redirected to a link with the id.
+            if (not id.empty())
+            {
+                bool exists;
+                uint32 idDocNr;
+                tie(exists, idDocNr) = mdb->Exists("id", id);
+                if (not exists)
+                    THROW(("Entry %s does not exist in databank %s", id.c_str(), db.c_str()));
+                if (idDocNr != 0)
+                    docNr = idDocNr;
+            }
+            else
+            {
+                unique_ptr<M6Document> document(mdb->Fetch(docNr));
+                if (not document)
+                    THROW(("Entry %d does not exist in databank %s, entry numbers can change when a databank is updated",
+                        docNr, db.c_str()));
+
+                string location = mBaseURL +
+                    (boost::format("entry?db=%1%&nr=%2%&id=%3%")
+                        % zh::encode_url(db)
+                        % docNr
+                        % zh::encode_url(document->GetAttribute("id"))
+                    ).str();
+
+                if (format != "entry")
+                    location += "&format=" + zh::encode_url(format);
+                if (not q.empty())
+                    location += "&q=" + zh::encode_url(q);
+                if (not rq.empty())
+                    location += "&rq=" + zh::encode_url(rq);
+
+                reply = zh::reply::redirect(location);
+
+                LOG(INFO, "redirecting entry request for db=%s nr=%s to its id", db.c_str(), nr.c_str());
+                return;
+            }
+        }
+
+        // The query is not part of the cached page, it is echoed and its terms
+        // are highlighted afterwards, see add_query_to_entry. Rendered pages
+        // do depend on the entry, on the databanks linking to it and on
+        // whether the mobile layout is used, which is derived from the User-Agent.
+        bool mobile = scope["mobile"].as<bool>();
+        string cacheKey = mdb->GetUUID() + '\t' + mLinkedUUIDs + '\t' + to_string(docNr) + '\t' + format +
+            '\t' + (mobile ? "m" : "d");
+        string ifNoneMatch = request.get_header("If-None-Match");
+
+        bool redirect = false;
+        if (q.empty() and not rq.empty())
+        {
+            q = rq;
+            redirect = true;
+        }
+
+        // returns the reply with the query added to the cached page, the
+        // ETag of such a page is derived from that of the cached page
+        auto replyWithQuery = [&](const M6EntryCache::M6Entry& inEntry)
+        {
+            string etag = inEntry.mETag;
+            if (not q.empty())
+                etag = '"' + M6MD5(inEntry.mETag + '\t' + q + '\t' + (redirect ? "r" : "")).Finalise() +
+                    (mobile ? "-m" : "") + '"';
+
+            if (ETagMatches(ifNoneMatch, etag))
+            {
+                reply = zh::reply();
+                reply.set_status(zh::not_modified);
+            }
+            else if (q.empty())
+                reply.set_content(inEntry.mContent, inEntry.mContentType);
+            else
+            {
+                zx::document doc;
+                doc.set_preserve_cdata(true);
+                doc.read(inEntry.mContent);
+
+                add_query_to_entry(doc.child(), q, redirect);
+
+                reply.set_content(doc);
+            }
+
+            reply.set_header("ETag", etag);
+            reply.set_header("Vary", "User-Agent");
+        };
+
+        M6EntryCache::M6Entry cached;
+        if (mEntryCache != nullptr and mEntryCache->Get(cacheKey, cached))
+        {
+            replyWithQuery(cached);
+
+            LOG(INFO, "returning cached entry format=%s db=%s id=%s nr=%s",
+                      format.c_str (), db.c_str (), id.c_str (), nr.c_str ());
+            return;
         }
 
+        // document numbers of merged segments no longer exist, see above
         unique_ptr<M6Document> document(mdb->Fetch(docNr));
+        if (not document)
+            THROW(("Entry %d does not exist in databank %s", docNr, db.c_str()));
+
+        id = document->GetAttribute("id");
 
         el::scope sub(scope);
         sub.put("db", el::object(db));
-        sub.put("id", document->GetAttribute("id"));
+        sub.put("id", el::object(id));
         sub.put("nr", el::object(docNr));
         sub.put("text", document->GetText());
         sub.put("blastable", el::object(find_if(mBlastDatabanks.begin(), mBlastDatabanks.end(),
@@ -1073,14 +1450,6 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
             sub.put("links", el::object(linked));
         }
 
-        if (not q.empty())
-            sub.put("q", el::object(q));
-        else if (not rq.empty())
-        {
-            q = rq;
-            sub.put("redirect", el::object(rq));
-            sub.put("q", el::object(rq));
-        }
         sub.put("format", el::object(format));
 
         const zx::element* dbConfig = M6Config::GetEnabledDatabank(db);
@@ -1141,29 +1510,16 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
                 }
             }
 
-            if (not q.empty())
-            {
-                try
-                {
-                    vector<string> terms;
-                    AnalyseQuery(q, terms);
-                    if (not terms.empty())
-                    {
-                        string pattern = ba::join(terms, "|");
+            reply.set_content(doc);
 
-                        if (uc::contains_han(pattern))
-                            pattern = string("(") + pattern + ")";
-                        else
-                            pattern = string("\\b(") + pattern + ")\\b";
+            cached.mContent = reply.get_content();
+            cached.mContentType = reply.get_header("Content-Type");
+            cached.mETag = '"' + M6MD5(cached.mContent).Finalise() + (mobile ? "-m" : "") + '"';
 
-                        boost::regex re(pattern, boost::regex_constants::icase);
-                        highlight_query_terms(root, re);
-                    }
-                }
-                catch (...) {}
-            }
+            if (mEntryCache != nullptr)
+                mEntryCache->Put(cacheKey, cached);
 
-            reply.set_content(doc);
+            replyWithQuery(cached);
         }
         catch (M6Redirect& redirect)
         {
@@ -1183,6 +1539,51 @@ void M6Server::handle_entry(const zh::request& request, const el::scope& scope,
     }
 }
 
+// The query an entry page was opened with is echoed in the search field,
+// when it was a redirect from a search with only one hit this is
+// announced, and the query terms are highlighted in the entry.
+
+void M6Server::add_query_to_entry(zx::element* root, const string& q, bool redirect)
+{
+    for (zx::element* input : root->find("//input[@id='q']"))
+        input->set_attribute("value", q);
+
+    zx::element* main = root->find_first("//div[@id='main']");
+    if (redirect and main != nullptr and main->begin() != main->end())
+    {
+        zx::element* onlyone = new zx::element("div");
+        onlyone->set_attribute("id", "onlyone");
+        onlyone->set_attribute("class", "redirect");
+        onlyone->add_text("Only one hit for query '" + q + "'");
+
+        zx::element* script = new zx::element("script");
+        script->set_attribute("language", "JavaScript");
+        script->add_text("$(\"#onlyone\").delay(2000).slideUp();");
+
+        main->insert(*main->begin(), script);
+        main->insert(*main->begin(), onlyone);
+    }
+
+    try
+    {
+        vector<string> terms;
+        AnalyseQuery(q, terms);
+        if (not terms.empty())
+        {
+            string pattern = ba::join(terms, "|");
+
+            if (uc::contains_han(pattern))
+                pattern = string("(") + pattern + ")";
+            else
+                pattern = string("\\b(") + pattern + ")\\b";
+
+            boost::regex re(pattern, boost::regex_constants::icase);
+            highlight_query_terms(root, re);
+        }
+    }
+    catch (...) {}
+}
+
 void M6Server::highlight_query_terms(zx::element* node, boost::regex& expr)
 {
     for (zx::element* e : *node)
@@ -1281,9 +1682,10 @@ void M6Server::create_link_tags(zx::element* node, boost::regex& expr,
 
                     if (docNr != 0)
                         a->set_attribute("href",
-                            (boost::format("entry?db=%1%&nr=%2%%3%%4%")
+                            (boost::format("entry?db=%1%&nr=%2%%3%%4%%5%")
                                 % zeep::http::encode_url(db)
                                 % docNr
+                                % (ix != "id" ? "" : ("&id=" + zeep::http::encode_url(id)).c_str())
                                 % (q.empty() ? "" : ("&q=" + zeep::http::encode_url(q)).c_str())
                                 % (an.empty() ? "" : (string("#") + zeep::http::encode_url(an)).c_str())
                             ).str());
@@ -1618,6 +2020,7 @@ void M6Server::handle_linked(const zh::request& request, const el::scope& scope,
         sdb = params.get("s", "").as<string>();
         ddb = params.get("d", "").as<string>();
         nr = params.get("nr", "0").as<uint32>();
+        string id = params.get("id", "").as<string>();
         page = params.get("page", 1).as<uint32>();
 
         LOG(INFO, "handling linked request for s=%s, d=%s, nr=%d, page=%d",
@@ -1635,7 +2038,7 @@ void M6Server::handle_linked(const zh::request& request, const el::scope& scope,
         sub.put("page", el::object(page));
         sub.put("db", el::object(ddb));
 
-        if (nr == 0 or sdb.empty() or ddb.empty())
+        if ((nr == 0 and id.empty()) or sdb.empty() or ddb.empty())
             THROW(("Invalid linked reference"));
 
         M6Databank* msdb = Load(sdb);
@@ -1644,11 +2047,15 @@ void M6Server::handle_linked(const zh::request& request, const el::scope& scope,
         if (msdb == nullptr or mddb == nullptr)
             THROW(("Invalid databanks"));
 
-        unique_ptr<M6Document> doc(msdb->Fetch(nr));
-        if (not doc)
-            THROW(("Document not found"));
+        // links made before the id was added only have the document number
+        if (id.empty())
+        {
+            unique_ptr<M6Document> doc(msdb->Fetch(nr));
+            if (not doc)
+                THROW(("Document not found"));
 
-        string id = doc->GetAttribute("id");
+            id = doc->GetAttribute("id");
+        }
 
         el::object linkedInfo;
         linkedInfo["db"] = sdb;
@@ -2578,6 +2985,8 @@ void M6Server::handle_rest_entry(const zh::request& request, const el::scope& sc
         get_parameters(scope, params);
 
         string format = params.get("format", "entry").as<string>();
+        uint32 offset = params.get("offset", 0).as<uint32>();
+        uint32 length = params.get("length", 0).as<uint32>();
 
         fs::path path(scope["baseuri"].as<string>());
         fs::path::iterator p = path.begin();
@@ -2600,7 +3009,24 @@ void M6Server::handle_rest_entry(const zh::request& request, const el::scope& sc
         if (db.empty())
             THROW(("No db specified"));
 
-        reply.set_content(GetEntry(db, id, format), "text/plain");
+        if (format == "fasta")
+        {
+            string fasta = GetEntry(db, id, format);
+            reply.set_content(fasta.substr(min<size_t>(offset, fasta.length()),
+                length > 0 ? length : string::npos), "text/plain");
+        }
+        else
+        {
+            M6Databank* mdb;
+            uint32 docNr;
+            tie(mdb, docNr) = GetEntryDatabankAndNr(db, id);
+
+            // a length asks for a part of the entry only, fetch just that
+            if (length > 0)
+                reply.set_content(GetEntry(mdb, format, docNr, offset, length), "text/plain");
+            else
+                reply.set_content(GetEntryStream(mdb, format, docNr, offset), "text/plain");
+        }
 
         LOG(INFO, "done generating rest entry response for id=%s, db=%s",
                   id.c_str(), db.c_str());
@@ -2725,11 +3151,13 @@ void M6Server::process_mrs_link(zx::element* node, const el::scope& scope, fs::p
 
     zx::element* a = new zx::element("a");
 
+    // the id keeps the link valid when the document is renumbered, see handle_entry
     if (not nr.empty())
         a->set_attribute("href",
-            (boost::format("entry?db=%1%&nr=%2%%3%%4%")
+            (boost::format("entry?db=%1%&nr=%2%%3%%4%%5%")
                 % zh::encode_url(db)
                 % zh::encode_url(nr)
+                % (id.empty() ? "" : ("&id=" + zh::encode_url(id)).c_str())
                 % (q.empty() ? "" : ("&q=" + zh::encode_url(q)).c_str())
                 % (an.empty() ? "" : (string("#") + zh::encode_url(an)).c_str())
             ).str());
@@ -2823,11 +3251,19 @@ void M6Server::create_redirect(const string& databank, const string& inIndex, co
             string location;
             if (docNr != 0)
             {
+                string id = inValue;
+                if (inIndex != "id")
+                {
+                    unique_ptr<M6Document> document(mdb->Fetch(docNr));
+                    id = document ? document->GetAttribute("id") : "";
+                }
+
                 location =
-                    (boost::format("http://%1%/entry?db=%2%&nr=%3%&%4%=%5%")
+                    (boost::format("http://%1%/entry?db=%2%&nr=%3%&id=%4%&%5%=%6%")
                         % host
                         % zh::encode_url(databank)
                         % docNr
+                        % zh::encode_url(id)
                         % (redirectForQuery ? "rq" : "q")
                         % zh::encode_url(q)
                     ).str();
@@ -2888,11 +3324,14 @@ void M6Server::create_redirect(const string& databank, uint32 inDocNr,
     }
     else
     {
+        unique_ptr<M6Document> document(mdb->Fetch(inDocNr));
+
         string location =
-            (boost::format("http://%1%/entry?db=%2%&nr=%3%&%4%=%5%")
+            (boost::format("http://%1%/entry?db=%2%&nr=%3%&id=%4%&%5%=%6%")
                 % host
                 % zh::encode_url(databank)
                 % inDocNr
+                % zh::encode_url(document ? document->GetAttribute("id") : string())
                 % (redirectForQuery ? "rq" : "q")
                 % zh::encode_url(q)
             ).str();
@@ -26,6 +26,7 @@ class M6Databank;
 class M6Parser;
 class M6WSSearch;
 class M6WSBlast;
+class M6EntryCache;
 
 typedef std::map<std::string,std::set<M6Databank*>> M6LinkMap;
 
@@ -74,6 +75,18 @@ class M6Server : public zh::webapp
     std::string        GetEntry(const std::string& inDB, const std::string& inID,
                         const std::string& inFormat);
 
+    // GetEntryStream returns a stream on the entry, for plain text entries
+    // the text is decompressed from the document store on the fly.
+    // The stream starts inOffset bytes into the entry.
+    // The caller owns the returned stream.
+    std::istream*    GetEntryStream(M6Databank* inDatabank, const std::string& inFormat,
+                        uint32 inDocNr, uint32 inOffset = 0);
+
+    // Return at most inLength bytes of the entry starting at inOffset,
+    // for plain text entries only the blocks holding this range are read.
+    std::string        GetEntry(M6Databank* inDatabank, const std::string& inFormat,
+                        uint32 inDocNr, uint32 inOffset, uint32 inLength);
+
     void            Find(const std::string& inDatabank, const std::string& inQuery,
                         bool inAllTermsRequired, uint32 inResultOffset,
                         uint32 inMaxResultCount, bool inAddLinks,
@@ -143,6 +156,7 @@ class M6Server : public zh::webapp
                         const std::string& q, bool redirectForQuery,
                         const zh::request& req, zh::reply& rep);
 
+    void            add_query_to_entry(zx::element* root, const std::string& q, bool redirect);
     void            highlight_query_terms(zx::element* node, boost::regex& expr);
     void            create_link_tags(zx::element* node, boost::regex& expr, const std::string& inDatabank,
                         const std::string& inIndex, const std::string& inID, const std::string& inAnchor);
@@ -164,6 +178,8 @@ class M6Server : public zh::webapp
     bool            mAlignEnabled;
 
     M6Config::File*    mConfigCopy;
+    M6EntryCache*    mEntryCache;
+    std::string        mLinkedUUIDs;    // digest of the UUIDs of all loaded databanks
 
     std::vector<zeep::dispatcher*>
                     mWebServices;
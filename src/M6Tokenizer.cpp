@@ -14,6 +14,10 @@
 #include <iostream>
 #include <tuple>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define M6_SSE2 1
+#endif
 
 #include "M6Tokenizer.h"
 //#include "M6Unicode.h"
@@ -127,35 +131,49 @@ OutputIterator WriteUTF8(uint32 inUnicode, OutputIterator inIterator)
 namespace uc
 {
 
-uint8 GetProperty(uint32 inUnicode)
+// All there is to know about a character is found with a single two
+// level lookup. Values outside the unicode range are letters without
+// a case fold or decomposition.
+
+const M6UnicodeInfoAtom kInvalidCharInfo = { { 0, 0 }, 0, 0, kLETTER, 0 };
+
+inline const M6UnicodeInfoAtom& GetInfo(uint32 inUnicode)
 {
-    uint8 result = 0;
+    if (inUnicode >= 0x110000)
+        return kInvalidCharInfo;
 
-    if (inUnicode < 0x110000)
-    {
-        uint32 ix = inUnicode >> 8;
-        uint32 p_ix = inUnicode & 0x00FF;
+    uint32 ix = kM6UnicodeInfo.block_index[inUnicode >> kM6UnicodeBlockShift];
+    return kM6UnicodeInfo.data[ix][inUnicode & kM6UnicodeBlockMask];
+}
 
-        ix = kM6UnicodeInfo.page_index[ix];
-        result = kM6UnicodeInfo.data[ix][p_ix].prop;
-    }
+inline uint8 GetProperty(uint32 inUnicode)
+{
+    return GetInfo(inUnicode).prop;
+}
 
-    return result;
+inline uint8 GetCanonicalCombiningClass(uint32 inUnicode)
+{
+    return GetInfo(inUnicode).ccc;
 }
 
-uint8 GetCanonicalCombiningClass(uint32 inUnicode)
+// Returns the case folded character for characters that fold into a single
+// character without a decomposition, zero for all others.
+inline uint32 GetSimpleFold(uint32 inUnicode)
 {
-    uint8 result = 0;
+    const M6UnicodeInfoAtom* info = &GetInfo(inUnicode);
+    if (info->full_fold)
+        return 0;
 
-    if (inUnicode < 0x110000)
+    uint32 result = inUnicode;
+    if (info->lower != 0)
     {
-        uint32 ix = inUnicode >> 8;
-        uint32 p_ix = inUnicode & 0x00FF;
-
-        ix = kM6UnicodeInfo.page_index[ix];
-        result = kM6UnicodeInfo.data[ix][p_ix].ccc;
+        result = info->lower;
+        info = &GetInfo(result);
     }
 
+    if (info->decomposed[0] != 0 and info->decomposed[0] != result)
+        result = 0;
+
     return result;
 }
 
@@ -343,29 +361,107 @@ inline bool isspace(uint32 c)
         uc::isspace(c);
 }
 
+inline bool isasciispace(uint8 c)
+{
+    return c == ' ' or c == '\r' or c == '\n' or c == '\t';
 }
 
-// --------------------------------------------------------------------
+// Returns the length of the ASCII word at the start of inText, words
+// consist of letters, digits, underscores and hyphens. The character
+// following is either not part of a word or is not ASCII. ioUpperCase
+// is set when the word contains upper case letters.
 
-bool Decompose(uint32 inUnicode, vector<uint32>& outChars)
+inline size_t ScanASCIIWord(const uint8* inText, size_t inLength, bool& ioUpperCase)
 {
-    bool result = false;
-    uint32 c1 = inUnicode, c2 = 0;
+    size_t n = 0;
+
+#if M6_SSE2
+    // classify 16 characters at a time. Bytes with the high bit set are
+    // negative and fall outside all ranges tested.
+    const __m128i
+        kBeforeA = _mm_set1_epi8('a' - 1), kAfterZ = _mm_set1_epi8('z' + 1),
+        kBefore0 = _mm_set1_epi8('0' - 1), kAfter9 = _mm_set1_epi8('9' + 1),
+        kUnderscore = _mm_set1_epi8('_'), kHyphen = _mm_set1_epi8('-'),
+        kLowerMask = _mm_set1_epi8(kToLowerMask);
+
+    for (; n + 16 <= inLength; n += 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inText + n));
+        __m128i l = _mm_or_si128(c, kLowerMask);
+
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(l, kBeforeA), _mm_cmplt_epi8(l, kAfterZ));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, kBefore0), _mm_cmplt_epi8(c, kAfter9));
+        __m128i other = _mm_or_si128(_mm_cmpeq_epi8(c, kUnderscore), _mm_cmpeq_epi8(c, kHyphen));
 
-    if (inUnicode < 0x110000)
+        uint32 word = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), other));
+        uint32 upper = _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(c, l), letter));
+
+        if (word != 0x0ffff)
+        {
+            uint32 m = 1;
+            while (word & m)
+            {
+                if (upper & m)
+                    ioUpperCase = true;
+                m <<= 1;
+                ++n;
+            }
+            return n;
+        }
+
+        if (upper != 0)
+            ioUpperCase = true;
+    }
+#endif
+
+    for (; n < inLength; ++n)
     {
-        uint32 ix = inUnicode >> 8;
-        uint32 p_ix = inUnicode & 0x00FF;
+        uint8 c = inText[n];
+        if (c >= 0x080 or (c != '-' and (kCharPropTable[c] & kCharIsAlNumMask) == 0))
+            break;
 
-        ix = kM6NormalisationInfo.page_index[ix];
+        if (c >= 'A' and c <= 'Z')
+            ioUpperCase = true;
+    }
 
-        c1 = kM6NormalisationInfo.data[ix][p_ix][0];
-        c2 = kM6NormalisationInfo.data[ix][p_ix][1];
+    return n;
+}
+
+inline void ToLowerASCII(const uint8* inText, size_t inLength, char* outText)
+{
+    for (size_t i = 0; i < inLength; ++i)
+    {
+        uint8 c = inText[i];
+        if (c >= 'A' and c <= 'Z')
+            c |= kToLowerMask;
+        outText[i] = static_cast<char>(c);
     }
+}
+
+inline bool IsASCII(const string& inText)
+{
+    for (char ch : inText)
+    {
+        if (ch & 0x080)
+            return false;
+    }
+    return true;
+}
+
+}
+
+// --------------------------------------------------------------------
+
+bool Decompose(uint32 inUnicode, vector<uint32>& outChars)
+{
+    bool result = false;
+
+    const M6UnicodeInfoAtom& info = uc::GetInfo(inUnicode);
+    uint32 c1 = info.decomposed[0], c2 = info.decomposed[1];
 
     if (c1 == 0 or c1 == inUnicode)
     {
-        result = uc::GetProperty(inUnicode) == kCOMBININGMARK;
+        result = info.prop == kCOMBININGMARK;
         outChars.push_back(inUnicode);
     }
     else
@@ -383,35 +479,24 @@ inline bool ToLower(uint32 inUnicode, vector<uint32>& outChars)
 {
     bool result = false;
 
-    uint32 ix = inUnicode >> 8;
-    uint32 p_ix = inUnicode & 0x00FF;
+    const M6UnicodeInfoAtom& info = uc::GetInfo(inUnicode);
 
-    ix = kM6UnicodeInfo.page_index[ix];
-    if (kM6UnicodeInfo.data[ix][p_ix].lower == 0)
-        result = Decompose(inUnicode, outChars);
-    else if (kM6UnicodeInfo.data[ix][p_ix].lower != 1)
-        result = Decompose(kM6UnicodeInfo.data[ix][p_ix].lower, outChars);
-    else
+    if (info.full_fold)
     {
         // need a full mapping here
-        int L = 0, R = sizeof(kM6FullCaseFolds) / sizeof(M6FullCaseFold) - 1;
-        while (R >= L)
-        {
-            int i = (L + R) / 2;
-            if (kM6FullCaseFolds[i].uc > inUnicode)
-                R = i - 1;
-            else
-                L = i + 1;
-        }
+        const M6FullCaseFold& fold = kM6FullCaseFolds[info.lower];
+        assert(fold.uc == inUnicode);
 
-        assert(kM6FullCaseFolds[R].uc == inUnicode);
-
-        for (uint32* f = kM6FullCaseFolds[R].folded; *f != 0; ++f)
+        for (const uint32* f = fold.folded; f < fold.folded + 3 and *f != 0; ++f)
         {
             if (Decompose(*f, outChars))
                 result = true;
         }
     }
+    else if (info.lower == 0)
+        result = Decompose(inUnicode, outChars);
+    else
+        result = Decompose(info.lower, outChars);
 
     return result;
 }
@@ -419,14 +504,14 @@ inline bool ToLower(uint32 inUnicode, vector<uint32>& outChars)
 // --------------------------------------------------------------------
 
 M6Tokenizer::M6Tokenizer(const char* inData, size_t inLength)
-    : mTokenLength(0), mLookaheadLength(0)
+    : mToken(mTokenText), mTokenLength(0), mLookaheadLength(0)
     , mPtr(reinterpret_cast<const uint8*>(inData)), mEnd(mPtr + inLength)
 {
 //    assert(inLength > 0);
 }
 
 M6Tokenizer::M6Tokenizer(const string& inData)
-    : mTokenLength(0), mLookaheadLength(0)
+    : mToken(mTokenText), mTokenLength(0), mLookaheadLength(0)
     , mPtr(reinterpret_cast<const uint8*>(inData.c_str()))
     , mEnd(mPtr + inData.length())
 {
@@ -453,19 +538,21 @@ uint32 M6Tokenizer::GetNextCharacter()
     }
     else    // decode utf-8
     {
+        uint32 ch = 0;
+
         if ((mPtr[0] & 0x0E0) == 0x0C0 and (mPtr[1] & 0x0c0) == 0x080)
         {
-            ToLower(((mPtr[0] & 0x01F) << 6) | (mPtr[1] & 0x03F));
+            ch = ((mPtr[0] & 0x01F) << 6) | (mPtr[1] & 0x03F);
             mPtr += 2;
         }
         else if ((mPtr[0] & 0x0F0) == 0x0E0 and (mPtr[1] & 0x0c0) == 0x080 and (mPtr[2] & 0x0c0) == 0x080)
         {
-            ToLower(((mPtr[0] & 0x00F) << 12) | ((mPtr[1] & 0x03F) << 6) | (mPtr[2] & 0x03F));
+            ch = ((mPtr[0] & 0x00F) << 12) | ((mPtr[1] & 0x03F) << 6) | (mPtr[2] & 0x03F);
             mPtr += 3;
         }
         else if ((mPtr[0] & 0x0F8) == 0x0F0 and (mPtr[1] & 0x0c0) == 0x080 and (mPtr[2] & 0x0c0) == 0x080 and (mPtr[3] & 0x0c0) == 0x080)
         {
-            ToLower(((mPtr[0] & 0x007) << 18) | ((mPtr[1] & 0x03F) << 12) | ((mPtr[2] & 0x03F) << 6) | (mPtr[3] & 0x03F));
+            ch = ((mPtr[0] & 0x007) << 18) | ((mPtr[1] & 0x03F) << 12) | ((mPtr[2] & 0x03F) << 6) | (mPtr[3] & 0x03F);
             mPtr += 4;
         }
         else
@@ -474,11 +561,19 @@ uint32 M6Tokenizer::GetNextCharacter()
             ++mPtr;
         }
 
-        if (result == 0)
+        if (ch != 0)
         {
-            assert(mLookaheadLength > 0);
-            --mLookaheadLength;
-            result = mLookahead[mLookaheadLength];
+            // most characters do not need the lookahead buffer
+            result = uc::GetSimpleFold(ch);
+
+            if (result == 0)
+            {
+                ToLower(ch);
+
+                assert(mLookaheadLength > 0);
+                --mLookaheadLength;
+                result = mLookahead[mLookaheadLength];
+            }
         }
     }
 
@@ -487,48 +582,32 @@ uint32 M6Tokenizer::GetNextCharacter()
 
 void M6Tokenizer::ToLower(uint32 inUnicode)
 {
-    uint32 ix = inUnicode >> 8;
-    uint32 p_ix = inUnicode & 0x00FF;
+    const M6UnicodeInfoAtom& info = uc::GetInfo(inUnicode);
 
-    ix = kM6UnicodeInfo.page_index[ix];
-    if (kM6UnicodeInfo.data[ix][p_ix].lower == 0)
-        Decompose(inUnicode);
-    else if (kM6UnicodeInfo.data[ix][p_ix].lower != 1)
-        Decompose(kM6UnicodeInfo.data[ix][p_ix].lower);
-    else
+    if (info.full_fold)
     {
         // need a full mapping here
-        int L = 0, R = sizeof(kM6FullCaseFolds) / sizeof(M6FullCaseFold) - 1;
-        while (R >= L)
-        {
-            int i = (L + R) / 2;
-            if (kM6FullCaseFolds[i].uc > inUnicode)
-                R = i - 1;
-            else
-                L = i + 1;
-        }
+        const M6FullCaseFold& fold = kM6FullCaseFolds[info.lower];
+        assert(fold.uc == inUnicode);
 
-        assert(kM6FullCaseFolds[R].uc == inUnicode);
+        // the lookahead buffer is a stack, push the last character first
+        size_t n = 0;
+        while (n < 3 and fold.folded[n] != 0)
+            ++n;
 
-        for (uint32* f = kM6FullCaseFolds[R].folded; *f != 0; ++f)
-            Decompose(*f);
+        while (n-- > 0)
+            Decompose(fold.folded[n]);
     }
+    else if (info.lower == 0)
+        Decompose(inUnicode);
+    else
+        Decompose(info.lower);
 }
 
 void M6Tokenizer::Decompose(uint32 inUnicode)
 {
-    uint32 c1 = inUnicode, c2 = 0;
-
-    if (inUnicode < 0x110000)
-    {
-        uint32 ix = inUnicode >> 8;
-        uint32 p_ix = inUnicode & 0x00FF;
-
-        ix = kM6NormalisationInfo.page_index[ix];
-
-        c1 = kM6NormalisationInfo.data[ix][p_ix][0];
-        c2 = kM6NormalisationInfo.data[ix][p_ix][1];
-    }
+    const M6UnicodeInfoAtom& info = uc::GetInfo(inUnicode);
+    uint32 c1 = info.decomposed[0], c2 = info.decomposed[1];
 
     if (c1 == 0 or c1 == inUnicode)
     {
@@ -570,13 +649,93 @@ inline void M6Tokenizer::WriteUTF8(uint32 inString[], size_t inLength)
         t = ::WriteUTF8(inString[i], t);
     }
 
+    mToken = mTokenText;
     mTokenLength = static_cast<uint32>(t - mTokenText);
 }
 
+// Most text is plain ASCII. Tokens are found here without decoding, the
+// result is the same as that of the code in GetNextWord. As soon as a
+// character is seen that might need the Unicode tables, the token is
+// tokenized again by the full version. Tokens without upper case letters
+// are not copied, mToken then points into the text.
+
+bool M6Tokenizer::GetNextASCIIWord(M6Token& outToken)
+{
+    if (mLookaheadLength > 0)
+        return false;
+
+    const uint8* p = mPtr;
+    while (p < mEnd and fast::isasciispace(*p))
+        ++p;
+
+    // skipping white space is always safe
+    mPtr = p;
+
+    if (p == mEnd or *p >= 0x080)
+        return false;
+
+    uint8 c = *p;
+    uint8 prop = fast::kCharPropTable[c];
+    size_t maxLength = min<size_t>(mEnd - p, kMaxTokenLength);
+    size_t n;
+    bool upperCase = false;
+    M6Token token;
+
+    if ((prop & fast::kCharIsDigitMask) or c == '-')
+    {
+        // a number, or an identifier starting with a digit
+        token = eM6TokenNumber;
+
+        n = 1;
+        while (n < maxLength and p[n] < 0x080 and (fast::kCharPropTable[p[n]] & fast::kCharIsDigitMask))
+            ++n;
+
+        if (n < maxLength and p[n] < 0x080 and (fast::kCharPropTable[p[n]] & fast::kCharIsAlphaMask))
+        {
+            token = eM6TokenWord;
+            n += fast::ScanASCIIWord(p + n, maxLength - n, upperCase);
+        }
+    }
+    else if (prop & fast::kCharIsAlphaMask)
+    {
+        token = eM6TokenWord;
+        n = fast::ScanASCIIWord(p, maxLength, upperCase);
+    }
+    else if (prop & fast::kCharIsPunctMask)
+    {
+        token = eM6TokenPunctuation;
+        n = 1;
+    }
+    else
+        return false;
+
+    // a token may continue with non-ASCII characters, and overlong tokens
+    // are returned as undefined
+    if (n == kMaxTokenLength or (p + n < mEnd and p[n] >= 0x080 and token != eM6TokenPunctuation))
+        return false;
+
+    if (upperCase)
+    {
+        fast::ToLowerASCII(p, n, mTokenText);
+        mToken = mTokenText;
+    }
+    else
+        mToken = reinterpret_cast<const char*>(p);
+
+    outToken = token;
+    mTokenLength = static_cast<uint32>(n);
+    mPtr = p + n;
+    return true;
+}
+
 M6Token M6Tokenizer::GetNextWord()
 {
     M6Token result = eM6TokenNone;
 
+    if (GetNextASCIIWord(result))
+        return result;
+
+    mToken = mTokenText;
     mTokenLength = 0;
     uint32 token[kMaxTokenLength + 1];
     uint32* t = token;
@@ -682,6 +841,7 @@ M6Token M6Tokenizer::GetNextQueryToken()
 
     const uint8* b = mPtr;
 
+    mToken = mTokenText;
     mTokenLength = 0;
     uint32 token[kMaxTokenLength];
     uint32* t = token;
@@ -845,7 +1005,9 @@ M6Token M6Tokenizer::GetNextQueryToken()
 
             // matched a digit, allow only integers or an identifier starting with a digit
             case 20:
-                if (fast::isalpha(c))
+                if ((c == '-' or c == '+') and t == token + 1)
+                    ;    // the sign of a number restarted from state 201 or 202
+                else if (fast::isalpha(c))
                     state = 30;
                 else if (c == '?' or c == '*')
                 {
@@ -951,6 +1113,16 @@ M6Token M6Tokenizer::GetNextQueryToken()
 
 void M6Tokenizer::CaseFold(string& ioString)
 {
+    if (fast::IsASCII(ioString))
+    {
+        for (char& ch : ioString)
+        {
+            if (ch >= 'A' and ch <= 'Z')
+                ch |= fast::kToLowerMask;
+        }
+        return;
+    }
+
     vector<uint32> s;
     s.reserve(ioString.length());
 
@@ -981,6 +1153,9 @@ void M6Tokenizer::CaseFold(string& ioString)
 
 void M6Tokenizer::Normalize(string& ioString)
 {
+    if (fast::IsASCII(ioString))
+        return;
+
     vector<uint32> s;
     s.reserve(ioString.length());
 
@@ -1026,7 +1201,7 @@ void M6Tokenizer::Reorder(uint32 inString[], size_t inLength)
         }
 
         uint32* s2 = s + 1;
-        while (uc::GetProperty(*s2) == kCOMBININGMARK)
+        while (s2 < t and uc::GetProperty(*s2) == kCOMBININGMARK)
             ++s2;
 
         if (s2 > s + 1)
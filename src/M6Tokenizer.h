@@ -19,6 +19,7 @@
 */
 
 #include <string>
+#include <utility>
 #include <exception>
 
 // --------------------------------------------------------------------
@@ -70,15 +71,26 @@ class M6Tokenizer
 
     static const uint32 kMaxTokenLength = 255, kTokenBufferLength = 4 * kMaxTokenLength + 32;
 
+    // Increment kVersion whenever the tokens produced for some input change.
+    // A databank records the version it was built with, mrs update warns
+    // about databanks built with another version, mrs build rebuilds them.
+    // 2: full case folds are written in order, U+FB01 is indexed as "fi"
+    static const uint32 kVersion = 2;
+
                     M6Tokenizer(const std::string& inData);
                     M6Tokenizer(const char* inData, size_t inLength);
 
     M6Token            GetNextWord();
     M6Token            GetNextQueryToken();
 
-    const char*        GetTokenValue() const            { return mTokenText; }
+    // The token text is only valid until the next token is requested. Tokens
+    // that did not need case folding or normalization are not copied, the
+    // value then points into the text passed to the constructor.
+    const char*        GetTokenValue() const            { return mToken; }
     size_t            GetTokenLength() const            { return mTokenLength; }
     std::string        GetTokenString() const            { return std::string(GetTokenValue(), GetTokenLength()); }
+    std::pair<const char*,size_t>
+                    GetTokenSpan() const            { return std::make_pair(mToken, static_cast<size_t>(mTokenLength)); }
 
     // code reuse
     static void        CaseFold(std::string& ioString);
@@ -89,6 +101,10 @@ class M6Tokenizer
     uint32            GetNextCharacter();
     void            Retract(uint32 inUnicode);
 
+    // GetNextWord for 7-bit ASCII text, returns false if the next token
+    // has to be handled by the full Unicode version.
+    bool            GetNextASCIIWord(M6Token& outToken);
+
     void            ToLower(uint32 inUnicode);
     void            Decompose(uint32 inUnicode);
 
@@ -96,6 +112,7 @@ class M6Tokenizer
     void            WriteUTF8(uint32 inString[], size_t inLength);
 
     char            mTokenText[kTokenBufferLength];    // private buffer
+    const char*        mToken;
     uint32            mTokenLength;
 
     uint32            mLookahead[32];
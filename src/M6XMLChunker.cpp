@@ -0,0 +1,892 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#include "M6Lib.h"
+
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "M6XMLChunker.h"
+#include "M6Error.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+
+namespace
+{
+
+const size_t kBlockSize = 64 * 1024;
+
+inline bool IsSpace(char inChar)
+{
+    return inChar == ' ' or inChar == '\t' or inChar == '\n' or inChar == '\r';
+}
+
+inline bool IsNameStart(char inChar)
+{
+    return isalpha(static_cast<unsigned char>(inChar)) or inChar == '_' or (inChar & 0x80);
+}
+
+inline bool IsNameChar(char inChar)
+{
+    return IsNameStart(inChar) or isdigit(static_cast<unsigned char>(inChar)) or
+        inChar == '-' or inChar == '.' or inChar == ':';
+}
+
+inline void SkipSpace(const char*& ioText, const char* inEnd)
+{
+    while (ioText != inEnd and IsSpace(*ioText))
+        ++ioText;
+}
+
+bool Accept(const char*& ioText, const char* inEnd, const char* inToken)
+{
+    size_t length = strlen(inToken);
+    bool result = static_cast<size_t>(inEnd - ioText) >= length and strncmp(ioText, inToken, length) == 0;
+    if (result)
+        ioText += length;
+    return result;
+}
+
+bool ParseName(const char*& ioText, const char* inEnd, string& outName)
+{
+    if (ioText == inEnd or not IsNameStart(*ioText))
+        return false;
+
+    const char* name = ioText;
+    while (ioText != inEnd and IsNameChar(*ioText))
+        ++ioText;
+    outName.assign(name, ioText);
+    return true;
+}
+
+bool ParseLiteral(const char*& ioText, const char* inEnd, string& outValue)
+{
+    if (ioText == inEnd or (*ioText != '"' and *ioText != '\''))
+        return false;
+
+    char quote = *ioText++;
+    const char* value = ioText;
+    while (ioText != inEnd and *ioText != quote)
+        ++ioText;
+    if (ioText == inEnd)
+        return false;
+    outValue.assign(value, ioText++);
+    return true;
+}
+
+void AppendUTF8(string& ioText, uint32 inUnicode)
+{
+    if (inUnicode < 0x080)
+        ioText += static_cast<char>(inUnicode);
+    else if (inUnicode < 0x0800)
+    {
+        ioText += static_cast<char>(0x0c0 | (inUnicode >> 6));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+    else if (inUnicode < 0x00010000)
+    {
+        ioText += static_cast<char>(0x0e0 | (inUnicode >> 12));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 6) & 0x3f));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+    else
+    {
+        ioText += static_cast<char>(0x0f0 | (inUnicode >> 18));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 12) & 0x3f));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 6) & 0x3f));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+}
+
+// Append the character data in inText to ioText, replacing the predefined
+// entities and character references and normalizing line ends. Attribute
+// values have their white space replaced by spaces. Entities declared in
+// a DTD are left as is.
+
+void AppendDecoded(string& ioText, const char* inText, const char* inEnd, bool inAttribute)
+{
+    while (inText != inEnd)
+    {
+        const char* run = inText;
+        while (inText != inEnd and *inText != '&' and *inText != '\r' and
+                not (inAttribute and (*inText == '\n' or *inText == '\t')))
+            ++inText;
+        ioText.append(run, inText);
+
+        if (inText == inEnd)
+            break;
+
+        char ch = *inText++;
+        if (ch == '\r')
+        {
+            if (inText != inEnd and *inText == '\n')
+                ++inText;
+            ioText += inAttribute ? ' ' : '\n';
+        }
+        else if (ch != '&')
+            ioText += ' ';
+        else
+        {
+            const char* name = inText;
+            const char* end = find(name, min(inEnd, name + 10), ';');
+
+            uint32 unicode = 0;
+            if (end == inEnd or *end != ';')
+                unicode = 0;
+            else if (end - name == 2 and strncmp(name, "lt", 2) == 0)
+                unicode = '<';
+            else if (end - name == 2 and strncmp(name, "gt", 2) == 0)
+                unicode = '>';
+            else if (end - name == 3 and strncmp(name, "amp", 3) == 0)
+                unicode = '&';
+            else if (end - name == 4 and strncmp(name, "quot", 4) == 0)
+                unicode = '"';
+            else if (end - name == 4 and strncmp(name, "apos", 4) == 0)
+                unicode = '\'';
+            else if (end - name > 1 and *name == '#')
+            {
+                char* e;
+                if (name[1] == 'x')
+                    unicode = strtoul(name + 2, &e, 16);
+                else
+                    unicode = strtoul(name + 1, &e, 10);
+                if (e != end or unicode > 0x10ffff)
+                    unicode = 0;
+            }
+
+            if (unicode == 0)
+                ioText += '&';
+            else
+            {
+                AppendUTF8(ioText, unicode);
+                inText = end + 1;
+            }
+        }
+    }
+}
+
+}
+
+// --------------------------------------------------------------------
+
+M6XMLChunker* M6XMLChunker::Create(const string& inChunkXPath)
+{
+    string path = ba::trim_copy(inChunkXPath);
+    const char* p = path.c_str();
+    const char* e = p + path.length();
+
+    vector<M6Step> steps;
+    if (not Accept(p, e, "/") or not ParseSteps(p, e, steps, nullptr))
+        return nullptr;
+
+    unique_ptr<M6XMLChunker> result(new M6XMLChunker);
+    for (M6Step& step : steps)
+    {
+        if (step.mTest != M6Step::eNone)
+            return nullptr;
+        result->mChunkPath.push_back(step.mName);
+    }
+
+    return result.release();
+}
+
+bool M6XMLChunker::ParseSteps(const char*& ioPath, const char* inEnd,
+    vector<M6Step>& outSteps, string* outAttr)
+{
+    for (;;)
+    {
+        if (ioPath != inEnd and *ioPath == '@')
+        {
+            ++ioPath;
+            if (outAttr == nullptr)
+                return false;
+            if (Accept(ioPath, inEnd, "*"))
+                *outAttr = "*";
+            else if (not ParseName(ioPath, inEnd, *outAttr))
+                return false;
+            return ioPath == inEnd;
+        }
+
+        M6Step step = { "", M6Step::eNone, "", "" };
+        if (Accept(ioPath, inEnd, "*"))
+            step.mName = "*";
+        else if (not ParseName(ioPath, inEnd, step.mName))
+            return false;
+
+        if (Accept(ioPath, inEnd, "["))
+        {
+            SkipSpace(ioPath, inEnd);
+
+            bool attr = Accept(ioPath, inEnd, "@");
+            if (attr)
+            {
+                if (not ParseName(ioPath, inEnd, step.mAttr))
+                    return false;
+            }
+            else if (not Accept(ioPath, inEnd, "name()"))
+                return false;
+
+            SkipSpace(ioPath, inEnd);
+
+            bool equals = Accept(ioPath, inEnd, "=");
+            if (not equals and not Accept(ioPath, inEnd, "!="))
+                return false;
+
+            SkipSpace(ioPath, inEnd);
+            if (not ParseLiteral(ioPath, inEnd, step.mValue))
+                return false;
+            SkipSpace(ioPath, inEnd);
+            if (not Accept(ioPath, inEnd, "]"))
+                return false;
+
+            if (attr)
+                step.mTest = equals ? M6Step::eAttrEquals : M6Step::eAttrNotEquals;
+            else
+                step.mTest = equals ? M6Step::eNameEquals : M6Step::eNameNotEquals;
+        }
+
+        outSteps.push_back(step);
+
+        if (ioPath == inEnd)
+            return true;
+        if (*ioPath++ != '/')
+            return false;
+    }
+}
+
+bool M6XMLChunker::AddIndex(const string& inXPath, bool inConcatenate)
+{
+    string path = ba::trim_copy(inXPath);
+    const char* p = path.c_str();
+    const char* e = p + path.length();
+
+    M6Expr expr = { vector<M6Step>(), false, false, "", inConcatenate };
+
+    if (Accept(p, e, "/"))
+    {
+        // an absolute path should lead through the chunk element
+        vector<M6Step> steps;
+        if (not ParseSteps(p, e, steps, &expr.mAttr) or steps.size() < mChunkPath.size())
+            return false;
+
+        for (size_t i = 0; i < mChunkPath.size(); ++i)
+        {
+            if (steps[i].mName != mChunkPath[i] or steps[i].mTest != M6Step::eNone)
+                return false;
+        }
+
+        expr.mSteps.assign(steps.begin() + mChunkPath.size(), steps.end());
+    }
+    else if (path != ".")
+    {
+        if (Accept(p, e, ".//"))
+            expr.mDescendant = true;
+        else
+            Accept(p, e, "./");
+
+        if (not ParseSteps(p, e, expr.mSteps, &expr.mAttr))
+            return false;
+    }
+
+    // the matching steps are kept in a bit set
+    if (expr.mSteps.size() >= 32)
+        return false;
+
+    expr.mAttribute = not expr.mAttr.empty();
+    if (expr.mAttribute)
+        mNeedAttributes = true;
+
+    for (M6Step& step : expr.mSteps)
+    {
+        if (step.mTest == M6Step::eAttrEquals or step.mTest == M6Step::eAttrNotEquals)
+            mNeedAttributes = true;
+    }
+
+    mExprs.push_back(expr);
+    return true;
+}
+
+// --------------------------------------------------------------------
+
+// The scanner reads the input in blocks, only the data starting at the
+// current position, or at the start of the current chunk, is kept. For
+// each open element in a chunk mStates contains a bit set per expression
+// telling how many of its steps matched up to this element, an element
+// is selected when all of them did.
+//
+// The values for an expression are stored in document order of the
+// selected nodes. Only when selected elements are nested, the text nodes
+// end up out of order and these are sorted by selection at the end.
+
+class M6XMLChunker::M6Scanner
+{
+  public:
+                    M6Scanner(const M6XMLChunker& inChunker, istream& inStream,
+                        M6ChunkHandler& inHandler);
+
+    bool            Prolog();
+    void            Run();
+
+    string&            GetBuffer()                    { return mBuffer; }
+
+  private:
+
+    bool            Fill();
+    bool            StartsWith(const char* inText);
+    size_t            Find(const char* inText, size_t inLength, size_t inOffset);
+    size_t            FindTagEnd();
+
+    void            StartElement(size_t inEnd);
+    void            EndElement();
+    void            Enter(const char* inAttributes, const char* inEnd);
+    void            Leave();
+    void            Text(const char* inText, const char* inEnd, bool inCData);
+    void            ParseAttributes(const char* inText, const char* inEnd);
+    bool            Matches(const M6Step& inStep) const;
+    void            EndChunk(size_t inEnd);
+
+    const M6XMLChunker&    mChunker;
+    istream&        mStream;
+    M6ChunkHandler&    mHandler;
+    string            mBuffer;
+    size_t            mPos, mChunkStart;
+    vector<string>    mPath;
+    uint32            mDepth;
+    string            mName, mText;
+    vector<pair<string,string>>
+                    mAttributes;
+    size_t            mAttributeCount;
+    vector<uint32>    mStates;
+    vector<vector<uint32>>
+                    mOpen, mSlots;
+    uint32            mOpenCount;
+    vector<uint32>    mNextSlot;
+    vector<bool>    mNested;
+    M6IndexValues    mValues;
+};
+
+M6XMLChunker::M6Scanner::M6Scanner(const M6XMLChunker& inChunker, istream& inStream,
+        M6ChunkHandler& inHandler)
+    : mChunker(inChunker), mStream(inStream), mHandler(inHandler)
+    , mPos(0), mChunkStart(string::npos), mDepth(0), mAttributeCount(0), mOpenCount(0)
+{
+    size_t n = mChunker.mExprs.size();
+    mOpen.resize(n);
+    mSlots.resize(n);
+    mNextSlot.resize(n);
+    mNested.resize(n);
+    mValues.resize(n);
+}
+
+bool M6XMLChunker::M6Scanner::Fill()
+{
+    size_t keep = min(mPos, mChunkStart);
+    if (keep > 0)
+    {
+        mBuffer.erase(0, keep);
+        mPos -= keep;
+        if (mChunkStart != string::npos)
+            mChunkStart -= keep;
+    }
+
+    size_t size = mBuffer.size();
+    mBuffer.resize(size + kBlockSize);
+    mStream.read(&mBuffer[size], kBlockSize);
+    mBuffer.resize(size + mStream.gcount());
+
+    return mBuffer.size() > size;
+}
+
+bool M6XMLChunker::M6Scanner::StartsWith(const char* inText)
+{
+    size_t length = strlen(inText);
+    while (mBuffer.size() - mPos < length)
+    {
+        if (not Fill())
+            return false;
+    }
+    return mBuffer.compare(mPos, length, inText) == 0;
+}
+
+// Find returns the offset of inText relative to the current position
+
+size_t M6XMLChunker::M6Scanner::Find(const char* inText, size_t inLength, size_t inOffset)
+{
+    for (;;)
+    {
+        size_t p = mBuffer.find(inText, mPos + inOffset, inLength);
+        if (p != string::npos)
+            return p - mPos;
+
+        size_t size = mBuffer.size() - mPos;
+        if (size >= inLength)
+            inOffset = max(inOffset, size - inLength + 1);
+
+        if (not Fill())
+            return string::npos;
+    }
+}
+
+size_t M6XMLChunker::M6Scanner::FindTagEnd()
+{
+    char quote = 0;
+    for (size_t offset = 1; ; ++offset)
+    {
+        if (mPos + offset == mBuffer.size() and not Fill())
+            THROW(("Unexpected end of XML file"));
+
+        char ch = mBuffer[mPos + offset];
+        if (quote != 0)
+        {
+            if (ch == quote)
+                quote = 0;
+        }
+        else if (ch == '"' or ch == '\'')
+            quote = ch;
+        else if (ch == '>')
+            return offset;
+    }
+}
+
+bool M6XMLChunker::M6Scanner::Prolog()
+{
+    // keep everything read, in case we have to hand it back
+    mChunkStart = 0;
+
+    bool result = true;
+
+    if (StartsWith("\xef\xbb\xbf"))
+        mPos += 3;
+
+    for (;;)
+    {
+        while (StartsWith(" ") or StartsWith("\t") or StartsWith("\n") or StartsWith("\r"))
+            ++mPos;
+
+        if (StartsWith("<?"))
+        {
+            size_t end = Find("?>", 2, 2);
+            if (end == string::npos)
+                break;
+
+            if (StartsWith("<?xml") and IsSpace(mBuffer[mPos + 5]))
+            {
+                string decl = mBuffer.substr(mPos, end);
+                string::size_type e = decl.find("encoding");
+                if (e != string::npos)
+                {
+                    const char* p = decl.c_str() + e + 8;
+                    const char* pe = decl.c_str() + decl.length();
+
+                    string encoding;
+                    SkipSpace(p, pe);
+                    Accept(p, pe, "=");
+                    SkipSpace(p, pe);
+                    ParseLiteral(p, pe, encoding);
+
+                    ba::to_lower(encoding);
+                    if (encoding != "utf-8" and encoding != "utf8" and
+                        encoding != "us-ascii" and encoding != "ascii")
+                    {
+                        result = false;
+                        break;
+                    }
+                }
+            }
+
+            mPos += end + 2;
+        }
+        else if (StartsWith("<!--"))
+        {
+            size_t end = Find("-->", 3, 4);
+            if (end == string::npos)
+                break;
+            mPos += end + 3;
+        }
+        else if (StartsWith("<!"))
+        {
+            // a doctype, with an internal subset it may declare entities
+            size_t end = FindTagEnd();
+            if (mBuffer.find('[', mPos) < mPos + end)
+            {
+                result = false;
+                break;
+            }
+            mPos += end + 1;
+        }
+        else
+            break;
+    }
+
+    mChunkStart = string::npos;
+
+    return result;
+}
+
+void M6XMLChunker::M6Scanner::Run()
+{
+    for (;;)
+    {
+        size_t next = Find("<", 1, 0);
+        if (next == string::npos)
+            break;
+
+        if (next > 0)
+        {
+            if (mOpenCount > 0)
+                Text(&mBuffer[mPos], &mBuffer[mPos] + next, false);
+            mPos += next;
+        }
+
+        if (StartsWith("</"))
+        {
+            mPos += FindTagEnd() + 1;
+            EndElement();
+        }
+        else if (StartsWith("<?"))
+        {
+            size_t end = Find("?>", 2, 2);
+            if (end == string::npos)
+                THROW(("Unexpected end of XML file"));
+            mPos += end + 2;
+        }
+        else if (StartsWith("<!--"))
+        {
+            size_t end = Find("-->", 3, 4);
+            if (end == string::npos)
+                THROW(("Unexpected end of XML file"));
+            mPos += end + 3;
+        }
+        else if (StartsWith("<![CDATA["))
+        {
+            size_t end = Find("]]>", 3, 9);
+            if (end == string::npos)
+                THROW(("Unexpected end of XML file"));
+            if (mOpenCount > 0)
+                Text(&mBuffer[mPos] + 9, &mBuffer[mPos] + end, true);
+            mPos += end + 3;
+        }
+        else if (StartsWith("<!"))
+            mPos += FindTagEnd() + 1;
+        else
+            StartElement(FindTagEnd());
+    }
+
+    if (mChunkStart != string::npos)
+        THROW(("Unexpected end of XML file"));
+}
+
+void M6XMLChunker::M6Scanner::StartElement(size_t inEnd)
+{
+    const char* p = &mBuffer[mPos] + 1;
+    const char* e = &mBuffer[mPos] + inEnd;
+
+    bool empty = e[-1] == '/';
+    if (empty)
+        --e;
+
+    const char* name = p;
+    while (p != e and not IsSpace(*p))
+        ++p;
+    mName.assign(name, p);
+
+    if (mChunkStart != string::npos)
+    {
+        ++mDepth;
+        Enter(p, e);
+    }
+    else
+    {
+        const vector<string>& chunk = mChunker.mChunkPath;
+
+        bool match = mPath.size() + 1 == chunk.size();
+        for (size_t i = 0; match and i < chunk.size(); ++i)
+        {
+            const string& n = i < mPath.size() ? mPath[i] : mName;
+            match = chunk[i] == "*" or chunk[i] == n;
+        }
+
+        if (match)
+        {
+            mChunkStart = mPos;
+            mDepth = 0;
+            Enter(p, e);
+        }
+        else if (not empty)
+            mPath.push_back(mName);
+    }
+
+    mPos += inEnd + 1;
+
+    if (empty and mChunkStart != string::npos)
+        EndElement();
+}
+
+void M6XMLChunker::M6Scanner::EndElement()
+{
+    if (mChunkStart == string::npos)
+    {
+        if (not mPath.empty())
+            mPath.pop_back();
+    }
+    else
+    {
+        Leave();
+
+        if (mDepth == 0)
+            EndChunk(mPos);
+        else
+            --mDepth;
+    }
+}
+
+void M6XMLChunker::M6Scanner::Enter(const char* inAttributes, const char* inEnd)
+{
+    const vector<M6Expr>& exprs = mChunker.mExprs;
+    size_t n = exprs.size();
+
+    if (mChunker.mNeedAttributes)
+        ParseAttributes(inAttributes, inEnd);
+
+    mStates.resize((mDepth + 1) * n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        const M6Expr& expr = exprs[i];
+
+        uint32 state = 1;
+        if (mDepth > 0)
+        {
+            uint32 parent = mStates[(mDepth - 1) * n + i];
+
+            state = expr.mDescendant ? 1 : 0;
+            for (uint32 s = 0; s < expr.mSteps.size(); ++s)
+            {
+                if ((parent & (1U << s)) and Matches(expr.mSteps[s]))
+                    state |= 1U << (s + 1);
+            }
+        }
+
+        mStates[mDepth * n + i] = state;
+
+        if ((state & (1U << expr.mSteps.size())) == 0)
+            continue;
+
+        if (expr.mAttribute)
+        {
+            for (size_t a = 0; a < mAttributeCount; ++a)
+            {
+                const string& name = mAttributes[a].first;
+
+                if (expr.mAttr == "*" ?
+                        (name != "xmlns" and not ba::starts_with(name, "xmlns:")) :
+                        name == expr.mAttr)
+                {
+                    mValues[i].push_back(mAttributes[a].second);
+                    mSlots[i].push_back(mNextSlot[i]++);
+                }
+            }
+        }
+        else
+        {
+            uint32 slot = mNextSlot[i]++;
+
+            if (expr.mConcatenate)
+            {
+                mOpen[i].push_back(static_cast<uint32>(mValues[i].size()));
+                mValues[i].push_back(string());
+                mSlots[i].push_back(slot);
+            }
+            else
+            {
+                if (not mOpen[i].empty())
+                    mNested[i] = true;
+                mOpen[i].push_back(slot);
+            }
+
+            ++mOpenCount;
+        }
+    }
+}
+
+void M6XMLChunker::M6Scanner::Leave()
+{
+    const vector<M6Expr>& exprs = mChunker.mExprs;
+    size_t n = exprs.size();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        const M6Expr& expr = exprs[i];
+
+        if (not expr.mAttribute and (mStates[mDepth * n + i] & (1U << expr.mSteps.size())))
+        {
+            mOpen[i].pop_back();
+            --mOpenCount;
+        }
+    }
+
+    mStates.resize(mDepth * n);
+}
+
+void M6XMLChunker::M6Scanner::Text(const char* inText, const char* inEnd, bool inCData)
+{
+    mText.clear();
+    if (inCData)
+        mText.assign(inText, inEnd);
+    else
+        AppendDecoded(mText, inText, inEnd, false);
+
+    // text nodes containing only white space are not indexed on their own
+    bool blank = find_if(mText.begin(), mText.end(), [](char ch) { return not IsSpace(ch); }) == mText.end();
+
+    for (size_t i = 0; i < mOpen.size(); ++i)
+    {
+        if (mChunker.mExprs[i].mConcatenate)
+        {
+            for (uint32 ix : mOpen[i])
+                mValues[i][ix] += mText;
+        }
+        else if (not blank)
+        {
+            for (uint32 slot : mOpen[i])
+            {
+                mValues[i].push_back(mText);
+                mSlots[i].push_back(slot);
+            }
+        }
+    }
+}
+
+void M6XMLChunker::M6Scanner::ParseAttributes(const char* inText, const char* inEnd)
+{
+    mAttributeCount = 0;
+
+    for (;;)
+    {
+        SkipSpace(inText, inEnd);
+
+        const char* name = inText;
+        while (inText != inEnd and *inText != '=' and not IsSpace(*inText))
+            ++inText;
+        const char* nameEnd = inText;
+
+        SkipSpace(inText, inEnd);
+        if (not Accept(inText, inEnd, "="))
+            break;
+        SkipSpace(inText, inEnd);
+        if (inText == inEnd or (*inText != '"' and *inText != '\''))
+            break;
+
+        char quote = *inText++;
+        const char* value = inText;
+        while (inText != inEnd and *inText != quote)
+            ++inText;
+
+        if (mAttributeCount == mAttributes.size())
+            mAttributes.push_back(pair<string,string>());
+
+        pair<string,string>& attr = mAttributes[mAttributeCount++];
+        attr.first.assign(name, nameEnd);
+        attr.second.clear();
+        AppendDecoded(attr.second, value, inText, true);
+
+        if (inText != inEnd)
+            ++inText;
+    }
+}
+
+bool M6XMLChunker::M6Scanner::Matches(const M6Step& inStep) const
+{
+    if (inStep.mName != mName and inStep.mName != "*")
+        return false;
+
+    bool result = true;
+
+    switch (inStep.mTest)
+    {
+        case M6Step::eNone:
+            break;
+
+        case M6Step::eNameEquals:
+            result = mName == inStep.mValue;
+            break;
+
+        case M6Step::eNameNotEquals:
+            result = mName != inStep.mValue;
+            break;
+
+        case M6Step::eAttrEquals:
+        case M6Step::eAttrNotEquals:
+            result = false;
+            for (size_t a = 0; a < mAttributeCount; ++a)
+            {
+                if (mAttributes[a].first == inStep.mAttr)
+                {
+                    result = (mAttributes[a].second == inStep.mValue) ==
+                             (inStep.mTest == M6Step::eAttrEquals);
+                    break;
+                }
+            }
+            break;
+    }
+
+    return result;
+}
+
+void M6XMLChunker::M6Scanner::EndChunk(size_t inEnd)
+{
+    string text(mBuffer, mChunkStart, inEnd - mChunkStart);
+    mChunkStart = string::npos;
+
+    for (size_t i = 0; i < mValues.size(); ++i)
+    {
+        if (not mNested[i])
+            continue;
+
+        vector<uint32> order(mValues[i].size());
+        iota(order.begin(), order.end(), 0);
+        const vector<uint32>& slots = mSlots[i];
+        stable_sort(order.begin(), order.end(),
+            [&slots](uint32 a, uint32 b) -> bool { return slots[a] < slots[b]; });
+
+        vector<string> values;
+        values.reserve(order.size());
+        for (uint32 ix : order)
+            values.push_back(move(mValues[i][ix]));
+        mValues[i].swap(values);
+    }
+
+    mHandler(text, mValues);
+
+    for (size_t i = 0; i < mValues.size(); ++i)
+    {
+        mValues[i].clear();
+        mSlots[i].clear();
+        mNextSlot[i] = 0;
+        mNested[i] = false;
+    }
+}
+
+// --------------------------------------------------------------------
+
+bool M6XMLChunker::Process(istream& inStream, M6ChunkHandler inHandler, string& outHead) const
+{
+    M6Scanner scanner(*this, inStream, inHandler);
+
+    bool result = scanner.Prolog();
+    if (result)
+        scanner.Run();
+    else
+        swap(outHead, scanner.GetBuffer());
+
+    return result;
+}
@@ -0,0 +1,116 @@
+//   Copyright Maarten L. Hekkelman, Radboud University 2012.
+//  Distributed under the Boost Software License, Version 1.0.
+//     (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <algorithm>
+#include <functional>
+
+#include <boost/iostreams/categories.hpp>
+
+// M6XMLChunker cuts the documents out of an XML file without building a
+// DOM. The input is scanned once, the text of a document is the span of
+// its chunk element in the input, taken as is. While scanning, the values
+// for the indices are collected. This works for the simple path
+// expressions used in parser configurations:
+//
+//    name/*/name[@attr="value"]    child steps, relative to the chunk
+//    /root/chunk/name              absolute, starting with the chunk path
+//    @name, name/@*, .//@*         attributes
+//    .//name                       descendants
+//    *[name() != "name"]           a test on the element name
+//
+// Create returns nullptr and AddIndex returns false for anything else,
+// the caller should use zeep's XPath implementation in that case.
+
+class M6XMLChunker
+{
+  public:
+    // The values for each index, in the order the indices were added
+    typedef std::vector<std::vector<std::string>>    M6IndexValues;
+    typedef std::function<void(const std::string& inText, const M6IndexValues& inValues)>
+                                                    M6ChunkHandler;
+
+    static M6XMLChunker*
+                    Create(const std::string& inChunkXPath);
+
+    // When inConcatenate is true a selected element results in one value
+    // containing all its text, otherwise each text node is a value.
+    bool            AddIndex(const std::string& inXPath, bool inConcatenate);
+
+    // Returns false without processing any chunk when the file needs
+    // more than this scanner offers: an encoding other than UTF-8 or a
+    // DTD internal subset. outHead then contains the data read so far.
+    bool            Process(std::istream& inStream, M6ChunkHandler inHandler,
+                        std::string& outHead) const;
+
+  private:
+                    M6XMLChunker() : mNeedAttributes(false) {}
+
+    struct M6Step
+    {
+        enum M6Test { eNone, eAttrEquals, eAttrNotEquals, eNameEquals, eNameNotEquals };
+
+        std::string    mName;            // element name, or *
+        M6Test        mTest;
+        std::string    mAttr, mValue;
+    };
+
+    struct M6Expr
+    {
+        std::vector<M6Step>
+                    mSteps;
+        bool        mDescendant;    // the expression started with .//
+        bool        mAttribute;        // selects attributes, named mAttr
+        std::string    mAttr;
+        bool        mConcatenate;
+    };
+
+    class M6Scanner;
+
+    static bool        ParseSteps(const char*& ioPath, const char* inEnd,
+                        std::vector<M6Step>& outSteps, std::string* outAttr);
+
+    std::vector<std::string>
+                    mChunkPath;
+    std::vector<M6Expr>
+                    mExprs;
+    bool            mNeedAttributes;
+};
+
+// M6PrefixedSource returns the text in inHead followed by the rest of
+// inStream, a file M6XMLChunker::Process gave up on can be handed to
+// zeep as an io::stream<M6PrefixedSource>.
+
+struct M6PrefixedSource
+{
+    typedef char                            char_type;
+    typedef boost::iostreams::source_tag    category;
+
+                    M6PrefixedSource(const std::string& inHead, std::istream& inStream)
+                        : mHead(inHead), mOffset(0), mStream(inStream) {}
+
+    std::streamsize    read(char* s, std::streamsize n)
+                    {
+                        if (mOffset < mHead.length())
+                        {
+                            n = std::min<std::streamsize>(n, mHead.length() - mOffset);
+                            std::copy(mHead.begin() + mOffset, mHead.begin() + mOffset + n, s);
+                            mOffset += static_cast<size_t>(n);
+                            return n;
+                        }
+
+                        mStream.read(s, n);
+                        return mStream.gcount() > 0 ? mStream.gcount() : -1;
+                    }
+
+    const std::string&
+                    mHead;
+    size_t            mOffset;
+    std::istream&    mStream;
+};
@@ -30,7 +30,6 @@ unless ( -f 'UnicodeData.txt' and -f 'CaseFolding.txt')
 }
 
 my $kUC_COUNT = 1114112;
-my $kUC_PAGE_COUNT = 4352;
 
 my (%codes, @data);
 
@@ -41,6 +40,7 @@ for (my $uc = 0; $uc < $kUC_COUNT; ++$uc) {
 		prop	=> 'kOTHER',
 		ccc		=> 0,
 		lower	=> 0,
+		full	=> 0,
 		1	=> 0,
 		2	=> 0,
 	);
@@ -147,15 +147,25 @@ while (my $line = <$h>) {
 		$data[$uc]->{'lower'} = hex($l[0]);
 	}
 	else {
-		$data[$uc]->{'lower'} = 1;
 		$folded{$uc} = \@l;
 	}
 }
 close($h);
 
-# now build the tables
+# full case folds are stored in a table of their own, the character
+# records contain the index in this table
 
-# table 1, the character break class information
+my @folds = sort { $a <=> $b } keys %folded;
+for (my $ix = 0; $ix < scalar(@folds); ++$ix) {
+	$data[$folds[$ix]]->{'lower'} = $ix;
+	$data[$folds[$ix]]->{'full'} = 1;
+}
+
+# now build the table. All information for a character is combined in a
+# single record, the records are stored in blocks of 128 characters and
+# identical blocks are stored only once.
+
+my $kUC_BLOCK_SIZE = 128;
 
 my $UnicodeInfoMapping = <<EOF;
 
@@ -173,67 +183,38 @@ enum M6UnicodeProperty : uint8
 
 struct M6UnicodeInfoAtom
 {
-	unsigned int	ccc		: 8;	// canonical combining class
-	unsigned int	prop	: 3;	// unicode property
-	unsigned int	lower	: 20;
+	uint16			decomposed[2];		// canonical decomposition
+	unsigned int	lower		: 20;	// simple case fold, or index in kM6FullCaseFolds
+	unsigned int	full_fold	: 1;	// lower is an index in kM6FullCaseFolds
+	unsigned int	prop		: 3;	// unicode property
+	unsigned int	ccc			: 8;	// canonical combining class
 };
 
-// BOOST_STATIC_ASSERT(sizeof(M6UnicodeInfoAtom) == sizeof(uint32));
+const uint32 kM6UnicodeBlockShift = 7, kM6UnicodeBlockMask = 0x7f;
 
-typedef M6UnicodeInfoAtom	M6UnicodeInfoPage[256];
+typedef M6UnicodeInfoAtom	M6UnicodeInfoBlock[$kUC_BLOCK_SIZE];
 
-struct M6UnicodeInfo {
-	int16				page_index[%d];
-	M6UnicodeInfoPage	data[%d];
+const struct M6UnicodeInfo {
+	uint8				block_index[%d];
+	M6UnicodeInfoBlock	data[%d];
 } kM6UnicodeInfo = {
 EOF
 
 my $table = new Table(header => $UnicodeInfoMapping);
 
-foreach my $pageNr (0 .. $kUC_PAGE_COUNT - 1)
+foreach my $blockNr (0 .. $kUC_COUNT / $kUC_BLOCK_SIZE - 1)
 {
-	my $page = "\t\t{\n";
-	
-	foreach my $uc ($pageNr * 256 .. ($pageNr + 1) * 256 - 1) {
-		$page .= sprintf("\t\t\t{%d, %s, 0x%5.5x },\n",
-			$data[$uc]->{'ccc'}, $data[$uc]->{'prop'}, $data[$uc]->{'lower'});
-	}
-	
-	$page .= "\t\t},\n";
-	
-	$table->addPage($pageNr, $page);
-}
-
-$table->print_out();
-
-# table 2, the mapping from Composed to Decomposed
+	my $block = "\t\t{\n";
 
-my $ComposedDecomposedMapping = <<EOF;
-
-typedef uint16				M6NormalisedForm[2];
-typedef M6NormalisedForm	M6NormalisedPage[256];
-
-struct M6NormalisationInfo
-{
-	int16				page_index[%d];
-	M6NormalisedPage	data[%d];
-} kM6NormalisationInfo = {
-EOF
+	foreach my $uc ($blockNr * $kUC_BLOCK_SIZE .. ($blockNr + 1) * $kUC_BLOCK_SIZE - 1) {
+		$block .= sprintf("\t\t\t{ { %d, %d }, 0x%5.5x, %d, %s, %d },\n",
+			$data[$uc]->{1}, $data[$uc]->{2}, $data[$uc]->{'lower'},
+			$data[$uc]->{'full'}, $data[$uc]->{'prop'}, $data[$uc]->{'ccc'});
+	}
 
-$table = new Table(header => $ComposedDecomposedMapping);
+	$block .= "\t\t},\n";
 
-foreach my $pageNr (0 .. $kUC_PAGE_COUNT - 1)
-{
-	my $page = "\t\t{\n";
-	
-	foreach my $uc ($pageNr * 256 .. ($pageNr + 1) * 256 - 1) {
-		$page .= sprintf("\t\t\t { %s, %s },\n",
-			$data[$uc]->{1}, $data[$uc]->{2});
-	}
-	
-	$page .= "\t\t},\n";
-	
-	$table->addPage($pageNr, $page);
+	$table->addBlock($block);
 }
 
 $table->print_out();
@@ -242,14 +223,14 @@ $table->print_out();
 
 print <<EOF;
 
-struct M6FullCaseFold
+const struct M6FullCaseFold
 {
 	uint32			uc;
 	uint32			folded[3];
 } kM6FullCaseFolds[] = {
 EOF
 
-foreach my $fold (sort { int($a) <=> int($b) } keys %folded) {
+foreach my $fold (@folds) {
 	printf "\t0x%5.5x, { %s },\n", $fold,
 		join(", ", map { sprintf("0x%s", $_) } @{$folded{$fold}});
 }
@@ -264,71 +245,60 @@ sub new
 {
 	my $invocant = shift;
 	my $self = {
-		indexCount	=> 0,
-		pageIndex	=> [],
-		pages		=> [],
+		blockIndex	=> [],
+		blocks		=> [],
+		known		=> {},
 		@_
 	};
-	
+
 	return bless $self, "Table";
 }
 
-sub addPage
+sub addBlock
 {
-	my ($self, $pageNr, $page) = @_;
-	
-	my $pageIx = -1;
-	
-	for (my $pn = 0; $pn < scalar($self->{'pages'}); ++$pn)
-	{
-		last unless defined @{$self->{'pages'}}[$pn];
+	my ($self, $block) = @_;
 
-		if (@{$self->{'pages'}}[$pn] eq $page)
-		{
-			$pageIx = $pn;
-			last;
-		}
-	}
-	
-	if ($pageIx == -1)
+	my $blockIx = $self->{'known'}->{$block};
+
+	unless (defined $blockIx)
 	{
-		$pageIx = push @{$self->{'pages'}}, $page;
-		$pageIx -= 1;
+		$blockIx = push(@{$self->{'blocks'}}, $block) - 1;
+		$self->{'known'}->{$block} = $blockIx;
 	}
-	
-	push @{$self->{'pageIndex'}}, $pageIx;
+
+	push @{$self->{'blockIndex'}}, $blockIx;
 }
 
 sub print_out
 {
 	my $self = shift;
-	
-	my $pageIndexSize = scalar(@{$self->{'pageIndex'}});
-	my $pageCount = scalar(@{$self->{'pages'}});
-	
+
+	my $blockIndexSize = scalar(@{$self->{'blockIndex'}});
+	my $blockCount = scalar(@{$self->{'blocks'}});
+
 	die "Hey, geen header!\n" unless $self->{header};
-	printf $self->{header}, $pageIndexSize, $pageCount;
+	die "Too many blocks for an 8 bit index\n" if $blockCount > 256;
+	printf $self->{header}, $blockIndexSize, $blockCount;
 
 	print "\t{";
-	
+
 	# the index
-	
-	for (my $ix = 0; $ix < $pageIndexSize; ++$ix)
+
+	for (my $ix = 0; $ix < $blockIndexSize; ++$ix)
 	{
 		print "\n\t\t" if ($ix % 16) == 0;
-		printf "%3d,", @{$self->{'pageIndex'}}[$ix];
+		printf "%3d,", @{$self->{'blockIndex'}}[$ix];
 	}
-	
+
 	print "\n\t},\n\t{\n";
 
-	# the data pages
+	# the data blocks
 
 	my $n = 0;
-	foreach my $page (@{$self->{'pages'}}) {
-		print "// page $n\n"; ++$n;
-		print $page;
+	foreach my $block (@{$self->{'blocks'}}) {
+		print "// block $n\n"; ++$n;
+		print $block;
 	}
 
 	print "\n\t}\n};\n";
 }
-
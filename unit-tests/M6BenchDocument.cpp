@@ -0,0 +1,146 @@
+// Memory allocations made while indexing documents. Build with make bench,
+// usage:
+//
+//    bench_document file [repeat]
+//
+// The file is split in records at lines containing // only, as in the
+// sample files in unit-tests/data. Each record is indexed as full text
+// in an M6InputDocument, which is then tokenized and compressed as the
+// builder does. The counts include the copy of the text in the document.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <new>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace pt = boost::posix_time;
+
+int VERBOSE = 0;
+
+// Count all allocations, the benchmark is single threaded
+
+static uint64 sAllocations, sAllocated;
+
+void* operator new(size_t inSize)
+{
+    ++sAllocations;
+    sAllocated += inSize;
+
+    void* result = malloc(inSize == 0 ? 1 : inSize);
+    if (result == nullptr)
+        throw bad_alloc();
+    return result;
+}
+
+void* operator new[](size_t inSize)
+{
+    return operator new(inSize);
+}
+
+void operator delete(void* inPtr) noexcept
+{
+    free(inPtr);
+}
+
+void operator delete[](void* inPtr) noexcept
+{
+    free(inPtr);
+}
+
+vector<string> ReadRecords(const fs::path& inFile)
+{
+    fs::ifstream file(inFile);
+    if (not file.is_open())
+    {
+        cerr << "could not open " << inFile << endl;
+        exit(1);
+    }
+
+    vector<string> result;
+    string line, record;
+
+    while (getline(file, line))
+    {
+        record += line + '\n';
+        if (line == "//")
+        {
+            result.push_back(record);
+            record.clear();
+        }
+    }
+
+    if (not record.empty())
+        result.push_back(record);
+
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "usage: bench_document file [repeat]" << endl;
+        exit(1);
+    }
+
+    vector<string> records = ReadRecords(argv[1]);
+    uint32 repeat = argc > 2 ? atoi(argv[2]) : 1;
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path("bench-document-%%%%%%.m6");
+
+    {
+        unique_ptr<M6Databank> databank(M6Databank::CreateNew("bench", path.string(), "0",
+            vector<pair<string,string>>()));
+        M6Lexicon lexicon(M6Lexicon::kConcurrentShardCount);
+
+        uint64 documents = 0, bytes = 0;
+        uint64 allocations = sAllocations, allocated = sAllocated;
+
+        pt::ptime start = pt::microsec_clock::universal_time();
+
+        for (uint32 i = 0; i < repeat; ++i)
+        {
+            for (const string& record : records)
+            {
+                unique_ptr<M6InputDocument> doc(new M6InputDocument(*databank, record));
+
+                doc->Index("text", eM6TextData, false, record.c_str(), record.length());
+                doc->Tokenize(lexicon, 0);
+                doc->Compress();
+
+                ++documents;
+                bytes += record.length();
+            }
+        }
+
+        double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+        allocations = sAllocations - allocations;
+        allocated = sAllocated - allocated;
+
+        cout << boost::format("%u documents, %.1f KB/document, %.1f allocations/document, %.1f KB allocated/document, %.0f documents/s")
+                % documents % (bytes / 1024.0 / documents)
+                % (double(allocations) / documents) % (allocated / 1024.0 / documents)
+                % (documents / seconds)
+             << endl;
+    }
+
+    fs::remove_all(path);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+// Memory allocations and peak memory use of a full text batch import.
+// Build with make bench, usage:
+//
+//    bench_fulltext [documents] [words]
+//
+// A databank is built from synthetic documents of the given number of
+// words, 50000 documents of 40 words by default, using a text index that
+// stores in-document locations. Only the allocations made by the worker
+// threads of the databank are counted, the documents themselves are
+// created on the main thread. The import stage runs the store and index
+// threads, the finish stage writes the indices.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace pt = boost::posix_time;
+
+int VERBOSE = 0;
+
+// Count the allocations made outside the main thread
+
+static atomic<uint64> sAllocations;
+static thread::id sMainThread;
+
+void* operator new(size_t inSize)
+{
+    if (this_thread::get_id() != sMainThread)
+        ++sAllocations;
+
+    void* result = malloc(inSize == 0 ? 1 : inSize);
+    if (result == nullptr)
+        throw bad_alloc();
+    return result;
+}
+
+void* operator new[](size_t inSize)
+{
+    return operator new(inSize);
+}
+
+void operator delete(void* inPtr) noexcept
+{
+    free(inPtr);
+}
+
+void operator delete[](void* inPtr) noexcept
+{
+    free(inPtr);
+}
+
+int main(int argc, char* argv[])
+{
+    sMainThread = this_thread::get_id();
+
+    uint32 documents = argc > 1 ? atoi(argv[1]) : 50000;
+    uint32 words = argc > 2 ? atoi(argv[2]) : 40;
+
+    // a vocabulary of 20000 words with a skewed distribution, like real text
+    vector<string> vocabulary;
+    for (uint32 i = 0; i < 20000; ++i)
+        vocabulary.push_back((boost::format("w%x") % (i * 2654435761U)).str());
+
+    mt19937 rng(42);
+    geometric_distribution<uint32> pick(0.001);
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path("bench-fulltext-%%%%%%.m6");
+
+    {
+        unique_ptr<M6Databank> databank(M6Databank::CreateNew("bench", path.string(), "0",
+            vector<pair<string,string>>()));
+        M6Lexicon lexicon(M6Lexicon::kConcurrentShardCount);
+
+        databank->StartBatchImport(lexicon);
+
+        uint64 allocations = sAllocations;
+        pt::ptime start = pt::microsec_clock::universal_time();
+
+        auto report = [&](const char* inStage)
+        {
+            pt::ptime now = pt::microsec_clock::universal_time();
+            double seconds = (now - start).total_microseconds() / 1e6;
+            uint64 count = sAllocations - allocations;
+
+            cout << boost::format("%s: %.1fs, %u allocations, %.0f allocations/s")
+                    % inStage % seconds % count % (count / seconds)
+                 << endl;
+
+            allocations = sAllocations;
+            start = now;
+        };
+
+        for (uint32 d = 0; d < documents; ++d)
+        {
+            string text;
+            for (uint32 w = 0; w < words; ++w)
+            {
+                if (w > 0)
+                    text += ' ';
+                text += vocabulary[pick(rng) % vocabulary.size()];
+            }
+
+            M6InputDocument* doc = new M6InputDocument(*databank, text);
+
+            doc->Index("text", eM6TextData, false, text.c_str(), text.length());
+            doc->Tokenize(lexicon, 0);
+            doc->Compress();
+
+            databank->Store(doc);
+        }
+
+        databank->EndBatchImport();
+        report("import");
+
+        databank->FinishBatchImport();
+        report("finish");
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        cout << boost::format("%u documents of %u words, peak RSS %u MB")
+                % documents % words % (usage.ru_maxrss / 1024)
+             << endl;
+    }
+
+    fs::remove_all(path);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Benchmarks for M6Lexicon. Build with make bench, usage:
+//
+//    bench_lexicon contention [documents]
+//    bench_lexicon terms file [repeat]
+//
+// The contention benchmark has 1 to 32 threads store the words of
+// synthetic documents in one shared lexicon, with a single shard and with
+// the number of shards used by the builder.
+//
+// The terms benchmark tokenizes a file the way documents are indexed and
+// times storing and then looking up each of the terms found, in the
+// order they appear in the file.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/thread.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6Lexicon.h"
+#include "M6Tokenizer.h"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+// A document has 150 words, most come from a vocabulary of 50000 words with
+// a skewed distribution, one in five is an identifier unique to the document.
+
+void MakeDocument(uint32 inNr, vector<string>& outWords)
+{
+    outWords.clear();
+
+    uint32 x = inNr * 2654435761U + 1;
+    for (int i = 0; i < 150; ++i)
+    {
+        x = x * 1103515245 + 12345;
+
+        char word[32];
+        if ((x >> 16) % 5 == 0)
+            sprintf(word, "id%u_%d", inNr, i);
+        else
+        {
+            uint32 r = (x >> 8) % 50000;
+            sprintf(word, "w%u", r * r / 50000);
+        }
+
+        outWords.push_back(word);
+    }
+}
+
+void Contention(uint32 inDocuments)
+{
+    for (uint32 shards : { 1U, M6Lexicon::kConcurrentShardCount })
+    {
+        for (uint32 threads : { 1, 2, 4, 8, 16, 32 })
+        {
+            M6Lexicon lexicon(shards);
+            atomic<uint32> next(0);
+
+            pt::ptime start = pt::microsec_clock::universal_time();
+
+            boost::thread_group group;
+            for (uint32 t = 0; t < threads; ++t)
+            {
+                group.create_thread([&]()
+                {
+                    vector<string> words;
+                    for (uint32 d = next++; d < inDocuments; d = next++)
+                    {
+                        MakeDocument(d, words);
+                        for (const string& w : words)
+                            lexicon.Store(w);
+                    }
+                });
+            }
+            group.join_all();
+
+            double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+            cout << boost::format("%2d shards, %2d threads: %8.0f documents/s, %u words")
+                    % shards % threads % (inDocuments / seconds) % (lexicon.Count() - 1)
+                 << endl;
+        }
+    }
+}
+
+void Terms(const char* inFile, uint32 inRepeat)
+{
+    ifstream file(inFile, ios::binary);
+    if (not file.is_open())
+    {
+        cerr << "could not open " << inFile << endl;
+        exit(1);
+    }
+
+    stringstream data;
+    data << file.rdbuf();
+    string text = data.str();
+
+    vector<string> terms;
+    for (uint32 i = 0; i < inRepeat; ++i)
+    {
+        M6Tokenizer tokenizer(text);
+        for (;;)
+        {
+            M6Token token = tokenizer.GetNextWord();
+            if (token == eM6TokenEOF)
+                break;
+            if (token == eM6TokenWord or token == eM6TokenNumber)
+                terms.push_back(tokenizer.GetTokenString());
+        }
+    }
+
+    for (uint32 shards : { 1U, M6Lexicon::kConcurrentShardCount })
+    {
+        M6Lexicon lexicon(shards);
+        uint64 check = 0;
+
+        pt::ptime start = pt::microsec_clock::universal_time();
+
+        for (const string& t : terms)
+            check += lexicon.Store(t.c_str(), t.length());
+
+        pt::ptime stored = pt::microsec_clock::universal_time();
+
+        for (const string& t : terms)
+            check -= lexicon.Lookup(t.c_str(), t.length());
+
+        pt::ptime looked = pt::microsec_clock::universal_time();
+
+        if (check != 0)
+            cerr << "lookup did not return the stored numbers" << endl;
+
+        double storeTime = (stored - start).total_microseconds() / 1e6;
+        double lookupTime = (looked - stored).total_microseconds() / 1e6;
+
+        cout << boost::format("%2d shards: %u terms, %u distinct, store %.2fs (%.2f M terms/s), lookup %.2fs (%.2f M terms/s)")
+                % shards % terms.size() % (lexicon.Count() - 1)
+                % storeTime % (terms.size() / storeTime / 1e6)
+                % lookupTime % (terms.size() / lookupTime / 1e6)
+             << endl;
+    }
+}
+
+void Usage()
+{
+    cerr << "usage: bench_lexicon contention [documents]" << endl
+         << "       bench_lexicon terms file [repeat]" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+        Usage();
+
+    string mode = argv[1];
+    if (mode == "contention")
+        Contention(argc > 2 ? atoi(argv[2]) : 200000);
+    else if (mode == "terms" and argc > 2)
+        Terms(argv[2], argc > 3 ? atoi(argv[3]) : 1);
+    else
+        Usage();
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+// Throughput of M6Queue with a growing number of producers, items are
+// passed one at a time and in batches. Build with make bench, usage:
+//
+//    bench_queue [items] [consumers]
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+
+#include <boost/thread.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6Queue.h"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+typedef M6Queue<uintptr_t>    M6BenchQueue;
+
+const uint32 kBatchSize = 100;
+
+// Each producer puts the numbers 1 to inCount, zero tells a consumer to stop.
+// Returns the number of items per second.
+
+double Run(uint32 inProducers, uint32 inConsumers, uint32 inCount, bool inBatched,
+    M6QueueStats& outStats)
+{
+    M6BenchQueue queue;
+    atomic<uint64> sum(0);
+
+    pt::ptime start = pt::microsec_clock::universal_time();
+
+    boost::thread_group consumers, producers;
+
+    for (uint32 c = 0; c < inConsumers; ++c)
+    {
+        consumers.create_thread([&]()
+        {
+            uintptr_t items[kBatchSize];
+            uint64 s = 0;
+            bool done = false;
+
+            while (not done)
+            {
+                uint32 n = inBatched ? queue.Get(items, kBatchSize) : 1;
+                if (not inBatched)
+                    items[0] = queue.Get();
+
+                for (uint32 i = 0; i < n; ++i)
+                {
+                    if (items[i] == 0)
+                    {
+                        // pass on the sentinels taken with this batch
+                        for (uint32 j = i + 1; j < n; ++j)
+                        {
+                            if (items[j] == 0)
+                                queue.Put(0);
+                            else
+                                s += items[j];
+                        }
+                        done = true;
+                        break;
+                    }
+                    s += items[i];
+                }
+            }
+
+            sum += s;
+        });
+    }
+
+    for (uint32 p = 0; p < inProducers; ++p)
+    {
+        producers.create_thread([&]()
+        {
+            if (inBatched)
+            {
+                uintptr_t items[kBatchSize];
+                for (uint32 i = 1; i <= inCount; i += kBatchSize)
+                {
+                    uint32 n = min(kBatchSize, inCount + 1 - i);
+                    for (uint32 j = 0; j < n; ++j)
+                        items[j] = i + j;
+                    queue.Put(items, n);
+                }
+            }
+            else
+            {
+                for (uint32 i = 1; i <= inCount; ++i)
+                    queue.Put(i);
+            }
+        });
+    }
+
+    producers.join_all();
+    for (uint32 c = 0; c < inConsumers; ++c)
+        queue.Put(0);
+    consumers.join_all();
+
+    double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    if (sum != uint64(inCount) * (inCount + 1) / 2 * inProducers)
+        cerr << "items were lost" << endl;
+
+    outStats = queue.GetStats();
+    return uint64(inCount) * inProducers / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32 items = argc > 1 ? atoi(argv[1]) : 2000000;
+    uint32 consumers = argc > 2 ? atoi(argv[2]) : 4;
+
+    cout << boost::thread::hardware_concurrency() << " cores, "
+         << items << " items, " << consumers << " consumers" << endl;
+
+    for (uint32 producers : { 1, 2, 4, 8, 16, 32 })
+    {
+        for (bool batched : { false, true })
+        {
+            M6QueueStats stats;
+            double rate = Run(producers, consumers, items / producers, batched, stats);
+
+            cout << boost::format("%2d producers, %-7s %7.2f M items/s, full %lld times (%.2fs), empty %lld times (%.2fs)")
+                    % producers % (batched ? "batched" : "single") % (rate / 1e6)
+                    % stats.mFullWaits % (stats.mFullWaitTime / 1e6)
+                    % stats.mEmptyWaits % (stats.mEmptyWaitTime / 1e6)
+                 << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Throughput of the record splitter used for files without a header or
+// trailer. Build with make bench, usage:
+//
+//    bench_splitter file [repeat] [lastdocline [firstdocline]]
+//
+// The lines are given like the values in a parser script, e.g. // or a
+// Perl expression like (?^:^ID   .+). By default records end at a line
+// containing // only, as in the sample files in unit-tests/data.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6LineMatcher.h"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "usage: bench_splitter file [repeat] [lastdocline [firstdocline]]" << endl;
+        exit(1);
+    }
+
+    ifstream file(argv[1], ios::binary);
+    if (not file.is_open())
+    {
+        cerr << "could not open " << argv[1] << endl;
+        exit(1);
+    }
+
+    uint32 repeat = argc > 2 ? atoi(argv[2]) : 1;
+    M6LineMatcher lastline(argc > 3 ? argv[3] : "//");
+    M6LineMatcher firstline(argc > 4 ? argv[4] : "");
+
+    // the input is the file repeated, read from memory
+    stringstream data;
+    data << file.rdbuf();
+    string text;
+    for (uint32 i = 0; i < repeat; ++i)
+        text += data.str();
+
+    size_t lines = count(text.begin(), text.end(), '\n');
+    size_t records = 0, bytes = 0;
+
+    istringstream in(text);
+
+    pt::ptime start = pt::microsec_clock::universal_time();
+
+    M6SplitRecords(in, firstline, lastline,
+        [&](const shared_ptr<const string>& inBlock, size_t inOffset, size_t inLength)
+        {
+            ++records;
+            bytes += inLength;
+        });
+
+    double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    cout << boost::format("%u lines, %u records (%.1f MB), %.2f M lines/s, %.1f MB/s")
+            % lines % records % (bytes / 1e6)
+            % (lines / seconds / 1e6) % (text.length() / seconds / 1e6)
+         << endl;
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+// Benchmarks for M6Tokenizer. Build with make bench, usage:
+//
+//    bench_tokenizer words file [repeat]
+//    bench_tokenizer normalize [file [repeat]]
+//
+// The words benchmark splits the file in words using GetNextWord, the way
+// documents are tokenized for indexing, e.g. on test/test-doc.txt.
+//
+// The normalize benchmark runs CaseFold and Normalize on each white space
+// separated word of the file. Without a file, 2 MB of words in Latin,
+// Greek, Cyrillic, Hebrew, Arabic, Han and Deseret script is used, some
+// followed by combining marks.
+
+#include "M6Lib.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "M6Tokenizer.h"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+string ReadFile(const char* inFile)
+{
+    ifstream file(inFile, ios::binary);
+    if (not file.is_open())
+    {
+        cerr << "could not open " << inFile << endl;
+        exit(1);
+    }
+
+    stringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+void Words(const string& inText, uint32 inRepeat)
+{
+    size_t tokens = 0, words = 0;
+
+    pt::ptime start = pt::microsec_clock::universal_time();
+
+    for (uint32 i = 0; i < inRepeat; ++i)
+    {
+        M6Tokenizer tokenizer(inText);
+        for (;;)
+        {
+            M6Token token = tokenizer.GetNextWord();
+            if (token == eM6TokenEOF)
+                break;
+
+            ++tokens;
+            if (token == eM6TokenWord or token == eM6TokenNumber)
+                ++words;
+        }
+    }
+
+    double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    cout << boost::format("%u tokens, %u words and numbers, %.2f M tokens/s, %.1f MB/s")
+            % tokens % words % (tokens / seconds / 1e6)
+            % (inText.length() * double(inRepeat) / seconds / 1e6)
+         << endl;
+}
+
+void AppendUTF8(string& ioText, uint32 inUnicode)
+{
+    if (inUnicode < 0x080)
+        ioText += static_cast<char>(inUnicode);
+    else if (inUnicode < 0x0800)
+    {
+        ioText += static_cast<char>(0x0c0 | (inUnicode >> 6));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+    else if (inUnicode < 0x00010000)
+    {
+        ioText += static_cast<char>(0x0e0 | (inUnicode >> 12));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 6) & 0x3f));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+    else
+    {
+        ioText += static_cast<char>(0x0f0 | (inUnicode >> 18));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 12) & 0x3f));
+        ioText += static_cast<char>(0x080 | ((inUnicode >> 6) & 0x3f));
+        ioText += static_cast<char>(0x080 | (inUnicode & 0x3f));
+    }
+}
+
+string MixedScriptText()
+{
+    const uint32 kRanges[][2] = {
+        { 0x00041, 0x0005a }, { 0x00061, 0x0007a }, { 0x000c0, 0x0017f },
+        { 0x00391, 0x003c9 }, { 0x00400, 0x0044f }, { 0x005d0, 0x005ea },
+        { 0x00627, 0x0064a }, { 0x01e00, 0x01eff }, { 0x04e00, 0x04fff },
+        { 0x10400, 0x1044f }
+    };
+    const uint32 kCombining[] = { 0x0301, 0x0323, 0x0308, 0x0327 };
+
+    string result;
+    uint32 x = 7;
+
+    while (result.length() < 2 * 1024 * 1024)
+    {
+        x = x * 1103515245 + 12345;
+        const uint32* range = kRanges[(x >> 16) % (sizeof(kRanges) / sizeof(kRanges[0]))];
+
+        x = x * 1103515245 + 12345;
+        uint32 length = 2 + (x >> 16) % 8;
+
+        for (uint32 i = 0; i < length; ++i)
+        {
+            x = x * 1103515245 + 12345;
+            AppendUTF8(result, range[0] + (x >> 8) % (range[1] - range[0] + 1));
+        }
+
+        x = x * 1103515245 + 12345;
+        if ((x >> 16) % 5 == 0)
+            AppendUTF8(result, kCombining[(x >> 8) % 4]);
+
+        result += ' ';
+    }
+
+    return result;
+}
+
+void Normalize(const string& inText, uint32 inRepeat)
+{
+    vector<string> words;
+    stringstream s(inText);
+    string word;
+    while (s >> word)
+        words.push_back(word);
+
+    const char* kNames[] = { "case fold", "normalize" };
+    for (int f = 0; f < 2; ++f)
+    {
+        size_t length = 0;
+
+        pt::ptime start = pt::microsec_clock::universal_time();
+
+        for (uint32 i = 0; i < inRepeat; ++i)
+        {
+            for (const string& w : words)
+            {
+                string copy(w);
+                if (f == 0)
+                    M6Tokenizer::CaseFold(copy);
+                else
+                    M6Tokenizer::Normalize(copy);
+                length += copy.length();
+            }
+        }
+
+        double seconds = (pt::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+        cout << boost::format("%-9s %u words, %.2f M words/s, %.1f MB/s")
+                % kNames[f] % (words.size() * inRepeat)
+                % (words.size() * double(inRepeat) / seconds / 1e6)
+                % (inText.length() * double(inRepeat) / seconds / 1e6)
+             << endl;
+    }
+}
+
+void Usage()
+{
+    cerr << "usage: bench_tokenizer words file [repeat]" << endl
+         << "       bench_tokenizer normalize [file [repeat]]" << endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+        Usage();
+
+    string mode = argv[1];
+    uint32 repeat = argc > 3 ? atoi(argv[3]) : 1;
+
+    if (mode == "words" and argc > 2)
+        Words(ReadFile(argv[2]), repeat);
+    else if (mode == "normalize")
+        Normalize(argc > 2 ? ReadFile(argv[2]) : MixedScriptText(), repeat);
+    else
+        Usage();
+
+    return 0;
+}
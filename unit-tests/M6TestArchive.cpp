@@ -0,0 +1,207 @@
+#include "M6Lib.h"
+
+#include <iostream>
+#include <sstream>
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/thread.hpp>
+
+#define BOOST_TEST_MODULE Archive_Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6DataSource.h"
+#include "M6Progress.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+// --------------------------------------------------------------------
+//    The members of a tar archive are passed to M6ProcessArchive, small
+//    members are handled by the pool of threads, the others on the
+//    calling thread.
+
+namespace
+{
+
+// a ustar header followed by the contents padded to a multiple of 512
+void AddMember(string& ioTar, const string& inName, const string& inText)
+{
+    char header[512] = {};
+
+    inName.copy(header, 99);
+    snprintf(header + 100, 8, "%07o", 0644);
+    snprintf(header + 108, 8, "%07o", 0);
+    snprintf(header + 116, 8, "%07o", 0);
+    snprintf(header + 124, 12, "%011o", static_cast<uint32>(inText.length()));
+    snprintf(header + 136, 12, "%011o", 0);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    memset(header + 148, ' ', 8);
+    uint32 sum = 0;
+    for (unsigned char c : header)
+        sum += c;
+    snprintf(header + 148, 7, "%06o", sum);
+
+    ioTar.append(header, sizeof(header));
+    ioTar += inText;
+    ioTar.append((512 - inText.length() % 512) % 512, 0);
+}
+
+// member i has i + 1 lines, member 7 is larger than the others
+string CreateTar(uint32 inMemberCount, map<string,uint32>& outLines)
+{
+    string result;
+
+    for (uint32 i = 0; i < inMemberCount; ++i)
+    {
+        stringstream text;
+        uint32 n = i == 7 ? 500 : i + 1;
+        for (uint32 j = 0; j < n; ++j)
+        {
+            stringstream line;
+            line << "member-" << i << " doc-" << j;
+            text << line.str() << endl;
+            outLines[line.str()] = 0;
+        }
+
+        stringstream name;
+        name << "member-" << i << ".dat";
+        AddMember(result, name.str(), text.str());
+    }
+
+    // end of archive
+    result.append(1024, 0);
+
+    return result;
+}
+
+fs::path WriteTar(const string& inData)
+{
+    fs::path file = fs::temp_directory_path() / fs::unique_path("m6-test-%%%%-%%%%.tar");
+    fs::ofstream out(file, ios::binary);
+    out.write(inData.data(), inData.length());
+    return file;
+}
+
+// runs M6ProcessArchive on a separate thread, a hang aborts the test
+void ProcessArchive(const fs::path& inFile, uint32 inNrOfThreads, M6MemberHandler inHandler)
+{
+    exception_ptr error;
+
+    boost::thread thread([&]()
+    {
+        try
+        {
+            M6Progress progress("test", fs::file_size(inFile), "reading");
+            M6DataSource data(inFile, progress);
+            M6ProcessArchive(data, inNrOfThreads, 4096, inHandler);
+        }
+        catch (...)
+        {
+            error = current_exception();
+        }
+    });
+
+    if (not thread.timed_join(boost::posix_time::seconds(60)))
+    {
+        cerr << "M6ProcessArchive did not return" << endl;
+        abort();
+    }
+
+    if (not (error == exception_ptr()))
+        rethrow_exception(error);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_members)
+{
+    cout << "testing members of a tar archive" << endl;
+
+    map<string,uint32> expected;
+    fs::path file = WriteTar(CreateTar(50, expected));
+
+    for (uint32 threads : { 1, 4 })
+    {
+        map<string,uint32> lines(expected);
+        boost::mutex mutex;
+        bool unknown = false;
+
+        ProcessArchive(file, threads, [&](const string& inFileName, istream& inStream)
+        {
+            string line;
+            while (getline(inStream, line))
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                if (lines.count(line))
+                    ++lines[line];
+                else
+                    unknown = true;
+            }
+        });
+
+        BOOST_CHECK(not unknown);
+        for (auto& line : lines)
+            BOOST_CHECK_MESSAGE(line.second == 1, line.first << " seen " << line.second << " times");
+    }
+
+    fs::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_truncated_archive)
+{
+    cout << "testing a truncated tar archive" << endl;
+
+    map<string,uint32> lines;
+    string data = CreateTar(50, lines);
+
+    // cut the archive in the middle of the header of the last member
+    data.resize(data.rfind("member-49.dat") + 100);
+    fs::path file = WriteTar(data);
+
+    for (uint32 threads : { 1, 4 })
+    {
+        BOOST_CHECK_THROW(ProcessArchive(file, threads, [](const string& inFileName, istream& inStream)
+        {
+            string line;
+            while (getline(inStream, line))
+                ;
+        }), exception);
+    }
+
+    fs::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_handler_error)
+{
+    cout << "testing an error in a member" << endl;
+
+    map<string,uint32> lines;
+    fs::path file = WriteTar(CreateTar(200, lines));
+
+    for (uint32 threads : { 1, 4 })
+    {
+        // the handlers are slow, the reader waits for room in the queue
+        // when the error is thrown
+        BOOST_CHECK_THROW(ProcessArchive(file, threads, [](const string& inFileName, istream& inStream)
+        {
+            if (inFileName == "member-100.dat")
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+                throw runtime_error("error in " + inFileName);
+            }
+
+            string line;
+            while (getline(inStream, line))
+                ;
+            boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        }), runtime_error);
+    }
+
+    fs::remove(file);
+}
@@ -2,7 +2,9 @@
 
 #include <iostream>
 #include <numeric>
-#include <boost/test/unit_test.hpp>
+
+#define BOOST_TEST_MODULE BitStream_Test
+#include <boost/test/included/unit_test.hpp>
 
 #include "M6BitStream.h"
 
@@ -43,39 +45,30 @@ BOOST_AUTO_TEST_CASE(test_bit_stream_2)
     cout << "bitsize: " << bits.Size() << endl;
 
     M6IBitStream ibits(bits);
-    M6CompressedArray arr(ibits, 1000);
-
-    auto ai = a.begin();
-    auto bi = arr.begin();
+    M6CompressedArrayIterator arr(ibits, 1000);
 
-    for (int i = 0; i < 1000; ++i)
+    uint32 v;
+    for (uint32 ai : a)
     {
-        BOOST_CHECK_EQUAL(*ai, *bi);
-        ++ai;
-        ++bi;
+        BOOST_REQUIRE(arr.Next(v));
+        BOOST_CHECK_EQUAL(ai, v);
     }
 
-    BOOST_CHECK(ai == a.end());
-    BOOST_CHECK(bi == arr.end());
+    BOOST_CHECK(not arr.Next(v));
 
     M6OBitStream b2;
     CopyBits(b2, bits);
 
     M6IBitStream ibits2(b2);
-    M6CompressedArray arr2(ibits2, 1000);
-
-    auto a2i = a.begin();
-    auto b2i = arr2.begin();
+    M6CompressedArrayIterator arr2(ibits2, 1000);
 
-    for (int i = 0; i < 1000; ++i)
+    for (uint32 ai : a)
     {
-        BOOST_CHECK_EQUAL(*a2i, *b2i);
-        ++a2i;
-        ++b2i;
+        BOOST_REQUIRE(arr2.Next(v));
+        BOOST_CHECK_EQUAL(ai, v);
     }
 
-    BOOST_CHECK(a2i == a.end());
-    BOOST_CHECK(b2i == arr2.end());
+    BOOST_CHECK(not arr2.Next(v));
 }
 
 BOOST_AUTO_TEST_CASE(test_bit_stream_3)
@@ -284,3 +277,37 @@ BOOST_AUTO_TEST_CASE(test_bit_stream_9)
     BOOST_CHECK(docs == d2);
 }
 
+
+BOOST_AUTO_TEST_CASE(test_bit_stream_10)
+{
+    cout << "testing bitstream 10" << endl;
+
+    // WriteBits from a raw buffer should produce the same as from an M6OBitStream
+    for (uint32 n = 1; n < 200; n += 7)
+    {
+        vector<uint32> a(n);
+        iota(a.begin(), a.end(), 3);
+
+        M6OBitStream b1;
+        WriteArray(b1, a);
+        size_t bitCount = b1.BitSize();
+
+        M6OBitStream b2;
+        b2 << 1;
+        WriteBits(b2, b1);
+        b2.Sync();
+
+        b1.Sync();
+
+        M6OBitStream b3;
+        b3 << 1;
+        WriteBits(b3, b1.Peek(), bitCount);
+        b3.Sync();
+
+        BOOST_CHECK_EQUAL(b2.Size(), b3.Size());
+
+        M6IBitStream ib2(b2), ib3(b3);
+        for (size_t i = 0; i < b2.BitSize(); ++i)
+            BOOST_CHECK_EQUAL(ib2(), ib3());
+    }
+}
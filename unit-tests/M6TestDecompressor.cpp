@@ -0,0 +1,286 @@
+#include "M6Lib.h"
+
+#include <iostream>
+#include <sstream>
+
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+
+#define BOOST_TEST_MODULE Decompressor_Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6ParallelDecompressor.h"
+#include "M6Progress.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+
+// --------------------------------------------------------------------
+//    The parallel decompressor is compared with the sequential
+//    decompressors from boost::iostreams.
+
+namespace
+{
+
+// text with words from a small vocabulary, compresses about as well as
+// a flat file databank
+string CreateText(size_t inSize, uint32 inSeed)
+{
+    const char* kWords[] = {
+        "ID", "AC", "DE", "protein", "kinase", "Homo", "sapiens", "ATP", "binding",
+        "transferase", "MKTAYIAKQRQISFVKSHFSRQ", "LEERLGLIEVQAPILSRVGDGTQDNLSGAEKAVQVKVKALPDAQ",
+        "//", "1.2.3.4", "0", "12345", "nucleus", "membrane", "\n"
+    };
+    const size_t kWordCount = sizeof(kWords) / sizeof(const char*);
+
+    string result;
+    result.reserve(inSize + 64);
+
+    uint32 r = inSeed;
+    while (result.length() < inSize)
+    {
+        r = r * 1103515245 + 12345;
+        result += kWords[(r >> 16) % kWordCount];
+        result += ' ';
+    }
+
+    result.resize(inSize);
+    return result;
+}
+
+string GZip(const string& inText)
+{
+    string result;
+    io::filtering_ostream out;
+    out.push(io::gzip_compressor());
+    out.push(io::back_inserter(result));
+    out.write(inText.data(), inText.length());
+    out.reset();
+    return result;
+}
+
+string BZip2(const string& inText)
+{
+    // block size 1, 100k, results in many blocks
+    string result;
+    io::filtering_ostream out;
+    out.push(io::bzip2_compressor(io::bzip2_params(1)));
+    out.push(io::back_inserter(result));
+    out.write(inText.data(), inText.length());
+    out.reset();
+    return result;
+}
+
+// BGZF, as written by bgzip: gzip members of at most 64k with an extra
+// field BC holding the member size, followed by an empty member.
+string BGZF(const string& inText)
+{
+    string result;
+
+    auto put16 = [&result](uint32 v) { result += char(v & 0xff); result += char(v >> 8); };
+    auto put32 = [&put16](uint32 v) { put16(v & 0xffff); put16(v >> 16); };
+
+    size_t offset = 0;
+    do
+    {
+        size_t n = min<size_t>(inText.length() - offset, 60000);
+        const Bytef* data = reinterpret_cast<const Bytef*>(inText.data() + offset);
+
+        z_stream z = {};
+        BOOST_REQUIRE(deflateInit2(&z, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+        string deflated(deflateBound(&z, n), 0);
+        z.next_in = const_cast<Bytef*>(data);
+        z.avail_in = static_cast<uInt>(n);
+        z.next_out = reinterpret_cast<Bytef*>(&deflated[0]);
+        z.avail_out = static_cast<uInt>(deflated.length());
+        BOOST_REQUIRE(deflate(&z, Z_FINISH) == Z_STREAM_END);
+        deflated.resize(z.total_out);
+        deflateEnd(&z);
+
+        const char header[] = { '\x1f', '\x8b', 8, 4, 0, 0, 0, 0, 0, '\xff', 6, 0, 'B', 'C', 2, 0 };
+        result.append(header, sizeof(header));
+        put16(static_cast<uint32>(sizeof(header) + 2 + deflated.length() + 8 - 1));
+        result += deflated;
+        put32(crc32(crc32(0, nullptr, 0), data, static_cast<uInt>(n)));
+        put32(static_cast<uint32>(n));
+
+        offset += n;
+    }
+    while (offset < inText.length());
+
+    // end of file marker
+    const char eof[] = "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+    result.append(eof, sizeof(eof) - 1);
+
+    return result;
+}
+
+template<class Decompressor>
+string Decompress(const string& inData, Decompressor inDecompressor)
+{
+    string result;
+    io::filtering_istream in;
+    in.push(inDecompressor);
+    in.push(io::array_source(inData.data(), inData.length()));
+    io::copy(in, io::back_inserter(result));
+    return result;
+}
+
+string ParallelDecompress(const string& inData, uint32 inNrOfThreads)
+{
+    fs::path file = fs::temp_directory_path() / fs::unique_path("m6-test-%%%%-%%%%");
+
+    {
+        fs::ofstream out(file, ios::binary);
+        out.write(inData.data(), inData.length());
+    }
+
+    string result;
+
+    try
+    {
+        M6Progress progress("test", inData.length(), "decompressing");
+        M6ParallelDecompressor decompressor(file, progress, inNrOfThreads);
+
+        vector<char> buffer(64 * 1024);
+        for (;;)
+        {
+            streamsize n = decompressor.read(&buffer[0], buffer.size());
+            if (n <= 0)
+                break;
+            result.append(&buffer[0], static_cast<size_t>(n));
+        }
+    }
+    catch (...)
+    {
+        fs::remove(file);
+        throw;
+    }
+
+    fs::remove(file);
+    return result;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_bzip2)
+{
+    cout << "testing bzip2" << endl;
+
+    string text = CreateText(2500000, 1);
+    string data = BZip2(text);
+
+    BOOST_CHECK(Decompress(data, io::bzip2_decompressor()) == text);
+
+    for (uint32 threads : { 1, 4 })
+        BOOST_CHECK(ParallelDecompress(data, threads) == text);
+}
+
+BOOST_AUTO_TEST_CASE(test_bzip2_multi_stream)
+{
+    cout << "testing bzip2 with multiple streams" << endl;
+
+    string a = CreateText(700000, 2), b = CreateText(300000, 3);
+    string data = BZip2(a) + BZip2("") + BZip2(b);
+
+    string expected = Decompress(data, io::bzip2_decompressor());
+    BOOST_CHECK(expected == a + b);
+
+    for (uint32 threads : { 1, 4 })
+        BOOST_CHECK(ParallelDecompress(data, threads) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_gzip)
+{
+    cout << "testing gzip" << endl;
+
+    string a = CreateText(1500000, 4), b = CreateText(100000, 5);
+
+    string data = GZip(a);
+    BOOST_CHECK(Decompress(data, io::gzip_decompressor()) == a);
+    BOOST_CHECK(ParallelDecompress(data, 4) == a);
+
+    // multiple members, as written by concatenating gzip files
+    data = GZip(a) + GZip(b);
+    BOOST_CHECK(Decompress(data, io::gzip_decompressor()) == a + b);
+    BOOST_CHECK(ParallelDecompress(data, 4) == a + b);
+}
+
+BOOST_AUTO_TEST_CASE(test_bgzf)
+{
+    cout << "testing bgzf" << endl;
+
+    string text = CreateText(1000000, 6);
+    string data = BGZF(text);
+
+    BOOST_CHECK(Decompress(data, io::gzip_decompressor()) == text);
+
+    for (uint32 threads : { 1, 4 })
+        BOOST_CHECK(ParallelDecompress(data, threads) == text);
+}
+
+BOOST_AUTO_TEST_CASE(test_empty)
+{
+    cout << "testing empty input" << endl;
+
+    BOOST_CHECK(ParallelDecompress(GZip(""), 4).empty());
+    BOOST_CHECK(ParallelDecompress(BZip2(""), 4).empty());
+    BOOST_CHECK(ParallelDecompress(BGZF(""), 4).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_truncated)
+{
+    cout << "testing truncated input" << endl;
+
+    string text = CreateText(500000, 7);
+
+    for (string data : { GZip(text), BZip2(text), BGZF(text) })
+    {
+        data.resize(data.length() / 2);
+        BOOST_CHECK_THROW(ParallelDecompress(data, 4), exception);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_corrupt)
+{
+    cout << "testing corrupt input" << endl;
+
+    string text = CreateText(500000, 8);
+
+    for (string data : { GZip(text), BZip2(text), BGZF(text) })
+    {
+        for (size_t i = data.length() / 2; i < data.length() / 2 + 16; ++i)
+            data[i] = ~data[i];
+        BOOST_CHECK_THROW(ParallelDecompress(data, 4), exception);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_bzip2_false_magic)
+{
+    cout << "testing bzip2 with false block magics" << endl;
+
+    string text = CreateText(2500000, 9);
+    string data = BZip2(text);
+
+    // the first part of each block fails quickly, while the rest of the
+    // block is still being decompressed by another worker
+    for (uint32 offset : { 1000, 8001 })
+    {
+        M6ParallelDecompressor::sTestFalseMagicOffset = offset;
+
+        for (uint32 threads : { 1, 4 })
+            BOOST_CHECK(ParallelDecompress(data, threads) == text);
+    }
+
+    M6ParallelDecompressor::sTestFalseMagicOffset = 0;
+}
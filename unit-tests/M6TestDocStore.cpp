@@ -4,12 +4,15 @@
 #include <map>
 #include <algorithm>
 
+#define BOOST_TEST_MODULE DocStoreTest
+#include <boost/test/included/unit_test.hpp>
+
 #include <boost/filesystem.hpp>
-#include <zeep/xml/document.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 //#include <boost/timer/timer.hpp>
 #include <boost/regex.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "M6Lib.h"
 #include "M6File.h"
@@ -20,45 +23,67 @@
 #include "M6DocStore.h"
 #include "M6Document.h"
 #include "M6Databank.h"
-
-#include <boost/test/unit_test.hpp>
+#include "M6Progress.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 namespace ba = boost::algorithm;
 namespace io = boost::iostreams;
 
+int VERBOSE = 0;
+
 vector<string> testdocs;
 
 BOOST_AUTO_TEST_CASE(test_store_0)
 {
     cout << "testing document store (initialising)" << endl;
 
-    ifstream text("test/pdbfind2-head.txt");
-    BOOST_REQUIRE(text.is_open());
-
-    stringstream doc;
+    const char* kFiles[] = {
+        "unit-tests/data/uniprot.dat", "unit-tests/data/embl.dat", "unit-tests/data/genbank.gb"
+    };
 
-    for (;;)
+    for (const char* file : kFiles)
     {
-        string line;
-        getline(text, line);
+        ifstream text(file);
+        BOOST_REQUIRE(text.is_open());
+
+        stringstream doc;
 
-        if (line.empty())
+        for (;;)
         {
-            if (text.eof())
-                break;
-            continue;
+            string line;
+            getline(text, line);
+
+            if (line.empty())
+            {
+                if (text.eof())
+                    break;
+                continue;
+            }
+
+            doc << line << endl;
+
+            if (line == "//")
+            {
+                testdocs.push_back(doc.str());
+                doc.str("");
+                doc.clear();
+            }
         }
+    }
 
-        doc << line << endl;
+    // add generated documents, from a single line up to several pages
+    // long, and a few that are large enough to be stored in blocks
+    for (uint32 i = 0; i < 500; ++i)
+    {
+        uint32 lines = i % 50 == 49 ? 12000 : (i * 7919) % 400 + 1;
 
-        if (line == "//")
-        {
-            testdocs.push_back(doc.str());
-            doc.str("");
-            doc.clear();
-        }
+        string doc = "ID   DOC" + boost::lexical_cast<string>(i) + "\n";
+        for (uint32 l = 0; l < lines; ++l)
+            doc += (boost::format("CC   line %d of document %d, %x\n") % l % i % (l * i * 2654435761U)).str();
+        doc += "//\n";
+
+        testdocs.push_back(doc);
     }
 }
 
@@ -74,7 +99,7 @@ BOOST_AUTO_TEST_CASE(test_store_1)
     M6DocStore store("test/pdbfind2.docs", eReadWrite);
 
     for (const string& doc : testdocs)
-        store.StoreDocument(doc.c_str(), doc.length());
+        store.StoreDocument(store.GetNextDocumentNumber(), doc.c_str(), doc.length(), doc.length());
     store.Commit();
 
 //    store.Dump();
@@ -141,40 +166,174 @@ BOOST_AUTO_TEST_CASE(test_store_3)
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_store_3a)
+{
+    cout << "testing document store (page aligned, random access)" << endl;
+
+    if (fs::exists("test/aligned.docs"))
+        fs::remove("test/aligned.docs");
+
+    string data;
+    for (uint32 i = 0; data.length() < 100000; ++i)
+        data += boost::lexical_cast<string>(i) + ' ';
+
+    {
+        M6DocStore store("test/aligned.docs", eReadWrite);
+
+        store.StoreDocument(store.GetNextDocumentNumber(), testdocs[0].c_str(), testdocs[0].length(), testdocs[0].length());
+        store.StoreDocument(store.GetNextDocumentNumber(), data.c_str(), data.length(), data.length(), true);
+        store.Commit();
+    }
+
+    M6DocStore store("test/aligned.docs", eReadOnly);
+
+    uint32 docPage, docSize;
+    bool pageAligned;
+    BOOST_REQUIRE(store.FetchDocument(1, docPage, docSize, pageAligned));
+    BOOST_CHECK(not pageAligned);
+
+    // a document that is not page aligned can only be read from the start
+    {
+        io::filtering_stream<io::input> is;
+        BOOST_CHECK_THROW(store.OpenDataStream(1, docPage, docSize, pageAligned, 1, 10, is), M6Exception);
+    }
+
+    {
+        io::filtering_stream<io::input> is;
+        store.OpenDataStream(1, docPage, docSize, pageAligned, 0, 10, is);
+
+        string s(10, 0);
+        is.read(&s[0], 10);
+        BOOST_CHECK_EQUAL(s, testdocs[0].substr(0, 10));
+    }
+
+    BOOST_REQUIRE(store.FetchDocument(2, docPage, docSize, pageAligned));
+    BOOST_CHECK(pageAligned);
+    BOOST_CHECK_EQUAL(docSize, data.length());
+
+    for (uint32 offset : { 0, 1, 16377, 16378, 16379, 50000, 99990 })
+    {
+        uint32 length = min(100U, docSize - offset);
+
+        io::filtering_stream<io::input> is;
+        store.OpenDataStream(2, docPage, docSize, pageAligned, offset, length, is);
+
+        string s(length, 0);
+        is.read(&s[0], length);
+
+        BOOST_CHECK_EQUAL(is.gcount(), length);
+        BOOST_CHECK_EQUAL(s, data.substr(offset, length));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_store_3b)
+{
+    cout << "testing document store (erase and vacuum)" << endl;
+
+    if (fs::exists("test/vacuum.docs"))
+        fs::remove("test/vacuum.docs");
+
+    M6DocStore store("test/vacuum.docs", eReadWrite);
+
+    // every third document is stored page aligned
+    vector<string> docs(testdocs);
+    for (uint32 i = 0; i < docs.size(); i += 3)
+        docs[i] += string(20000, 'x');
+
+    int64 rawSize = 0;
+    for (uint32 i = 0; i < docs.size(); ++i)
+    {
+        const string& doc = docs[i];
+        store.StoreDocument(store.GetNextDocumentNumber(), doc.c_str(), doc.length(), doc.length(), i % 3 == 0);
+        if (i % 2 == 1)
+            rawSize += doc.length();
+    }
+
+    for (uint32 i = 1; i <= docs.size(); i += 2)
+        store.EraseDocument(i, docs[i - 1].length());
+    store.Commit();
+
+    uint32 docCount;
+    int64 fileSize, storedRawSize;
+    store.GetInfo(docCount, fileSize, storedRawSize);
+    BOOST_CHECK_EQUAL(docCount, docs.size() / 2);
+    BOOST_CHECK_EQUAL(storedRawSize, rawSize);
+
+    int64 size = fs::file_size("test/vacuum.docs");
+
+    M6Progress progress("test", docs.size(), "vacuum");
+    int64 reclaimed = store.Vacuum(progress);
+
+    BOOST_CHECK_LE(fs::file_size("test/vacuum.docs"), size);
+    BOOST_CHECK_EQUAL(reclaimed, size - static_cast<int64>(fs::file_size("test/vacuum.docs")));
+    BOOST_CHECK_EQUAL(store.size(), docs.size() / 2);
+
+    store.GetInfo(docCount, fileSize, storedRawSize);
+    BOOST_CHECK_EQUAL(storedRawSize, rawSize);
+
+    for (uint32 i = 1; i <= docs.size(); ++i)
+    {
+        uint32 docPage, docSize;
+        bool pageAligned;
+        bool found = store.FetchDocument(i, docPage, docSize, pageAligned);
+
+        BOOST_CHECK_EQUAL(found, i % 2 == 0);
+        if (not found)
+            continue;
+
+        BOOST_CHECK_EQUAL(pageAligned, (i - 1) % 3 == 0);
+
+        io::filtering_stream<io::input> is;
+        store.OpenDataStream(i, docPage, docSize, is);
+
+        string doc(docSize, 0);
+        is.read(&doc[0], docSize);
+
+        BOOST_CHECK_EQUAL(doc, docs[i - 1]);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_store_4)
 {
     cout << "testing document store (store using M6Databank)" << endl;
 
-    boost::regex re("^ID\\s*:\\s+(.{4})");
+    boost::regex re("^(?:ID|LOCUS)\\s+(\\S+)");
 
 //    boost::timer::auto_cpu_timer t;
 
-    if (fs::exists("test/pdbfind2.m6"))
-        fs::remove_all("test/pdbfind2.m6");
+    if (fs::exists("test/docstore.m6"))
+        fs::remove_all("test/docstore.m6");
 
-    M6Databank db("test/pdbfind2.m6", eReadWrite);
+    unique_ptr<M6Databank> db(M6Databank::CreateNew("test", "test/docstore.m6", "0.0.0",
+        vector<pair<string,string>>()));
 
     M6Lexicon lexicon;
-    db.StartBatchImport(lexicon);
+    db->StartBatchImport(lexicon);
 
     for (const string& text : testdocs)
     {
-        M6InputDocument* doc = new M6InputDocument(db, text);
+        M6InputDocument* doc = new M6InputDocument(*db, text);
 
         boost::smatch m;
         BOOST_REQUIRE(boost::regex_search(text, m, re));
 
         string attr(m[1]);
         doc->SetAttribute("id", attr.c_str(), attr.length());
+        doc->SetAttribute("title", text.c_str(), text.find('\n'));
 
-        db.Store(doc);
+        doc->Index("text", eM6TextData, false, text.c_str(), text.length());
+        doc->Tokenize(lexicon, 0);
+        doc->Compress();
+
+        db->Store(doc);
     }
 
-    db.CommitBatchImport();
+    db->EndBatchImport();
+    db->FinishBatchImport();
 
-    db.Validate();
+    db->Validate();
 
-    BOOST_CHECK_EQUAL(db.size(), testdocs.size());
+    BOOST_CHECK_EQUAL(db->size(), testdocs.size());
 }
 
 BOOST_AUTO_TEST_CASE(test_store_5)
@@ -183,7 +342,7 @@ BOOST_AUTO_TEST_CASE(test_store_5)
 
 //    boost::timer::auto_cpu_timer t;
 
-    M6Databank db("test/pdbfind2.m6", eReadOnly);
+    M6Databank db("test/docstore.m6", eReadOnly);
 
     db.Validate();
 
@@ -208,11 +367,11 @@ BOOST_AUTO_TEST_CASE(test_store_6)
 {
     cout << "testing document store (retrieve attribute)" << endl;
 
-    boost::regex re("^ID\\s*:\\s+(.{4})");
+    boost::regex re("^(?:ID|LOCUS)\\s+(\\S+)");
 
 //    boost::timer::auto_cpu_timer t;
 
-    M6Databank db("test/pdbfind2.m6", eReadOnly);
+    M6Databank db("test/docstore.m6", eReadOnly);
     BOOST_CHECK_EQUAL(db.size(), testdocs.size());
 
     for (uint32 i = 1; i <= testdocs.size(); ++i)
@@ -234,11 +393,11 @@ BOOST_AUTO_TEST_CASE(test_store_6)
 
 BOOST_AUTO_TEST_CASE(test_store_7)
 {
-    cout << "dumping pdbfinder" << endl;
+    cout << "dumping test databank" << endl;
 
 //    boost::timer::auto_cpu_timer t;
 
-    M6Databank db("test/pdbfinder.m6", eReadOnly);
+    M6Databank db("test/docstore.m6", eReadOnly);
     uint32 size = db.size();
 
     for (uint32 i = 1; i <= size; ++i)
@@ -256,3 +415,67 @@ BOOST_AUTO_TEST_CASE(test_store_7)
         delete doc;
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_store_8)
+{
+    cout << "testing document store (blocked documents using M6Databank)" << endl;
+
+    if (fs::exists("test/blocked.m6"))
+        fs::remove_all("test/blocked.m6");
+
+    string large;
+    for (uint32 i = 0; large.length() < 400000; ++i)
+        large += "line " + boost::lexical_cast<string>(i) + '\n';
+
+    vector<string> texts = { testdocs[0], large };
+
+    {
+        unique_ptr<M6Databank> db(M6Databank::CreateNew("test", "test/blocked.m6", "0.0.0",
+            vector<pair<string,string>>()));
+
+        M6Lexicon lexicon;
+        db->StartBatchImport(lexicon);
+
+        for (const string& text : texts)
+        {
+            M6InputDocument* doc = new M6InputDocument(*db, text);
+
+            doc->SetAttribute("title", text.c_str(), text.find('\n'));
+            doc->Index("text", eM6TextData, false, text.c_str(), text.length());
+            doc->Tokenize(lexicon, 0);
+            doc->Compress();
+
+            db->Store(doc);
+        }
+
+        db->EndBatchImport();
+        db->FinishBatchImport();
+    }
+
+    M6Databank db("test/blocked.m6", eReadOnly);
+
+    for (uint32 i = 1; i <= texts.size(); ++i)
+    {
+        const string& text = texts[i - 1];
+
+        unique_ptr<M6Document> doc(db.Fetch(i));
+        BOOST_REQUIRE(doc);
+
+        BOOST_CHECK_EQUAL(doc->GetText(), text);
+        BOOST_CHECK_EQUAL(doc->GetAttribute("title"), text.substr(0, text.find('\n')));
+
+        M6OutputDocument* outDoc = dynamic_cast<M6OutputDocument*>(doc.get());
+        BOOST_REQUIRE(outDoc != nullptr);
+
+        uint32 blockSize = M6DocStore::GetPageDataSize();
+
+        for (uint32 offset : { 0U, 1U, 100U, blockSize - 1, blockSize, 4 * blockSize + 7, 200000U, 399990U })
+        {
+            if (offset >= text.length())
+                continue;
+
+            BOOST_CHECK_EQUAL(outDoc->GetText(offset, 100), text.substr(offset, 100));
+            BOOST_CHECK_EQUAL(outDoc->GetText(offset, 3 * blockSize), text.substr(offset, 3 * blockSize));
+        }
+    }
+}
@@ -4,10 +4,13 @@
 #include <map>
 #include <algorithm>
 
+#define BOOST_TEST_MODULE Lex_Test
+#include <boost/test/included/unit_test.hpp>
+
 #include <boost/filesystem.hpp>
-#include <zeep/xml/document.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
+#include <boost/thread.hpp>
 
 #include "M6Lib.h"
 #include "M6File.h"
@@ -16,8 +19,6 @@
 #include "M6Error.h"
 #include "M6Lexicon.h"
 
-#include <boost/test/unit_test.hpp>
-
 using namespace std;
 namespace fs = boost::filesystem;
 namespace ba = boost::algorithm;
@@ -45,6 +46,20 @@ struct M6TokenTest
         { "1e", "0", "1e", "1" }
     },
 
+    // ASCII words that continue with non-ASCII characters
+    {
+        "Aap-Noot ori\xc3\xabntaal 12AB -5 3\xc2\xb5m",
+        { eM6TokenWord, eM6TokenWord, eM6TokenWord, eM6TokenNumber, eM6TokenWord, eM6TokenEOF },
+        { "aap-noot", "orie\xcc\x88ntaal", "12ab", "-5", "3\xce\xbcm" }
+    },
+
+    // full case folds
+    {
+        "\xef\xac\x81ne \xef\xac\x83 Stra\xc3\x9f" "e",
+        { eM6TokenWord, eM6TokenWord, eM6TokenWord, eM6TokenEOF },
+        { "fine", "ffi", "strasse" }
+    },
+
 //    { "10a 1e0a", { eM6TokenWord, eM6TokenWord, eM6TokenEOF } },
 //    { "Q92834; B1ARN3; O00702;",
 //        { eM6TokenWord, eM6TokenPunctuation, eM6TokenWord, eM6TokenPunctuation, eM6TokenWord, eM6TokenPunctuation, eM6TokenEOF } },
@@ -201,6 +216,39 @@ BOOST_AUTO_TEST_CASE(test_lex_1)
         BOOST_CHECK_EQUAL(lexicon.GetString(t), wordmap[t]);
 }
 
+BOOST_AUTO_TEST_CASE(test_lex_3)
+{
+    cout << "testing lexicon 3 (concurrent store)" << endl;
+
+    M6Lexicon lexicon(M6Lexicon::kConcurrentShardCount);
+
+    const uint32 kThreads = 4, kWords = 20000;
+    vector<vector<uint32>> numbers(kThreads, vector<uint32>(kWords));
+
+    // all threads store the same words, in a different order
+    boost::thread_group threads;
+    for (uint32 i = 0; i < kThreads; ++i)
+    {
+        threads.create_thread([&lexicon, &numbers, i]()
+        {
+            for (uint32 w = 0; w < kWords; ++w)
+            {
+                uint32 word = (w + i * 7919) % kWords;
+                numbers[i][word] = lexicon.Store((boost::format("word-%1%") % word).str());
+            }
+        });
+    }
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(lexicon.Count(), kWords + 1);
+
+    for (uint32 w = 0; w < kWords; ++w)
+    {
+        for (uint32 i = 1; i < kThreads; ++i)
+            BOOST_CHECK_EQUAL(numbers[i][w], numbers[0][w]);
+        BOOST_CHECK_EQUAL(lexicon.GetString(numbers[0][w]), (boost::format("word-%1%") % w).str());
+    }
+}
 
 BOOST_AUTO_TEST_CASE(test_lex_2)
 {
@@ -0,0 +1,434 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#define BOOST_TEST_MODULE ParserTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+
+#include <zeep/xml/document.hpp>
+#include <zeep/xml/xpath.hpp>
+
+#include "M6Lib.h"
+#include "M6Parser.h"
+#include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Config.h"
+#include "M6XMLChunker.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+namespace ba = boost::algorithm;
+namespace zx = zeep::xml;
+
+int VERBOSE = 0;
+
+// The native parsers should produce exactly the same documents as the Perl
+// scripts they replace. The entries in the sample files are parsed with
+// both and everything stored in the documents is compared.
+
+vector<string> ReadEntries(const fs::path& inFile, const string& inLastLine)
+{
+    vector<string> result;
+
+    fs::ifstream file(inFile);
+    BOOST_REQUIRE(file.is_open());
+
+    string line, entry;
+    while (getline(file, line))
+    {
+        entry += line + '\n';
+        if (not inLastLine.empty() and line == inLastLine)
+        {
+            result.push_back(entry);
+            entry.clear();
+        }
+    }
+
+    if (not entry.empty())
+        result.push_back(entry);
+
+    return result;
+}
+
+string Describe(M6InputDocument& inDoc, M6Lexicon& inLexicon)
+{
+    stringstream s;
+
+    const char* kAttributes[] = { "id", "title", "ac" };
+    for (const char* a : kAttributes)
+        s << "attribute " << a << ": " << inDoc.GetAttribute(a) << endl;
+
+    vector<string> values;
+    for (auto& v : inDoc.GetIndexValues())
+    {
+        values.push_back((boost::format("value %1% (%2%%3%): %4% %5%")
+            % v.mIndexName % v.mDataType % (v.mUnique ? ", unique" : "")
+            % v.mIndexValue % v.mIndexFloatValue).str());
+    }
+
+    // the Perl parsers may index values in hash order
+    sort(values.begin(), values.end());
+    for (auto& v : values)
+        s << v << endl;
+
+    inDoc.Tokenize(inLexicon, 0);
+
+    vector<string> tokens;
+    for (auto& ix : inDoc.GetIndexTokens())
+    {
+        vector<string> words;
+        for (uint32 t : ix.mTokens)
+            words.push_back(t == 0 ? "|" : inLexicon.GetString(t));
+
+        if (ix.mDataType != eM6TextData)
+            sort(words.begin(), words.end());
+
+        tokens.push_back("index " + ix.mIndexName + ": " + boost::algorithm::join(words, " "));
+    }
+
+    sort(tokens.begin(), tokens.end());
+    for (auto& t : tokens)
+        s << t << endl;
+
+    for (auto& l : inDoc.GetLinks())
+    {
+        for (auto& id : l.second)
+            s << "link " << l.first << ": " << id << endl;
+    }
+
+    return s.str();
+}
+
+string ToFasta(M6Parser& inParser, const string& inEntry)
+{
+    string result;
+
+    try
+    {
+        inParser.ToFasta(inEntry, "db", "id", "title", result);
+    }
+    catch (exception& e)
+    {
+        result = "error";
+    }
+
+    return result;
+}
+
+void CompareParsers(const string& inParser, const fs::path& inSample, bool inCompareFasta)
+{
+    M6Parser perl(inParser), native(inParser, true);
+
+    BOOST_REQUIRE(native.IsNative());
+    BOOST_REQUIRE(not perl.IsNative());
+
+    const char* kValues[] = { "header", "lastheaderline", "trailer", "firstdocline", "lastdocline" };
+    for (const char* v : kValues)
+        BOOST_CHECK_EQUAL(native.GetValue(v), perl.GetValue(v));
+
+    vector<pair<string,string>> perlIndexNames, nativeIndexNames;
+    perl.GetIndexNames(perlIndexNames);
+    native.GetIndexNames(nativeIndexNames);
+    sort(perlIndexNames.begin(), perlIndexNames.end());
+    sort(nativeIndexNames.begin(), nativeIndexNames.end());
+    BOOST_CHECK(perlIndexNames == nativeIndexNames);
+
+    unique_ptr<M6Databank> databank(M6Databank::CreateNew(inParser, "test/parser-test.m6",
+        "0.0.0", vector<pair<string,string>>()));
+    M6Lexicon lexicon;
+
+    for (const string& entry : ReadEntries(inSample, native.GetValue("lastdocline")))
+    {
+        M6InputDocument a(*databank, entry), b(*databank, entry);
+
+        perl.ParseDocument(&a, inSample.string(), "");
+        native.ParseDocument(&b, inSample.string(), "");
+
+        BOOST_CHECK_EQUAL(Describe(a, lexicon), Describe(b, lexicon));
+
+        if (inCompareFasta)
+            BOOST_CHECK_EQUAL(ToFasta(perl, entry), ToFasta(native, entry));
+    }
+}
+
+struct M6ParserTestFixture
+{
+    M6ParserTestFixture()
+    {
+        M6Config::SetConfigFilePath("config/mrs-config.xml.dist");
+    }
+};
+
+BOOST_GLOBAL_FIXTURE(M6ParserTestFixture);
+
+BOOST_AUTO_TEST_CASE(TestUniProtParser)
+{
+    CompareParsers("uniprot", "unit-tests/data/uniprot.dat", true);
+}
+
+BOOST_AUTO_TEST_CASE(TestEmblParser)
+{
+    CompareParsers("embl", "unit-tests/data/embl.dat", false);
+}
+
+BOOST_AUTO_TEST_CASE(TestGenBankParser)
+{
+    CompareParsers("genbank", "unit-tests/data/genbank.gb", false);
+}
+
+BOOST_AUTO_TEST_CASE(TestPDBParser)
+{
+    // a single chain with a sequence, the Perl parser writes chains in hash order
+    CompareParsers("pdb", "unit-tests/data/pdb1hew.ent", false);
+}
+
+// --------------------------------------------------------------------
+// M6XMLChunker should find the same documents and index values as the
+// zeep XPath implementation it replaces in the builder. The values are
+// collected the way M6Processor::ParseXML does.
+
+typedef vector<pair<string,bool>>                M6XPaths;    // XPath and concatenate
+typedef vector<M6XMLChunker::M6IndexValues>        M6ChunkValues;
+
+void CollectText(zx::node* inNode, vector<string>& outValues)
+{
+    zx::element* el = dynamic_cast<zx::element*>(inNode);
+    if (el == nullptr)
+        outValues.push_back(inNode->str());
+    else
+    {
+        for (zx::node* node : el->nodes())
+            CollectText(node, outValues);
+    }
+}
+
+M6ChunkValues ChunkWithZeep(istream& inStream, const string& inChunkXPath, const M6XPaths& inXPaths)
+{
+    vector<zx::xpath> xpaths;
+    for (auto& x : inXPaths)
+        xpaths.push_back(zx::xpath(x.first));
+
+    M6ChunkValues result;
+
+    zx::process_document_elements(inStream, inChunkXPath, [&](zx::node* root, zx::element* xml) -> bool
+    {
+        M6XMLChunker::M6IndexValues values(xpaths.size());
+
+        for (size_t i = 0; i < xpaths.size(); ++i)
+        {
+            for (zx::node* n : xpaths[i].evaluate<zx::node>(*xml))
+            {
+                if (inXPaths[i].second)
+                    values[i].push_back(n->str());
+                else
+                    CollectText(n, values[i]);
+            }
+        }
+
+        result.push_back(values);
+        return true;
+    });
+
+    return result;
+}
+
+M6ChunkValues ChunkWithChunker(istream& inStream, const string& inChunkXPath,
+    const M6XPaths& inXPaths, vector<string>& outTexts)
+{
+    unique_ptr<M6XMLChunker> chunker(M6XMLChunker::Create(inChunkXPath));
+    BOOST_REQUIRE(chunker);
+
+    for (auto& x : inXPaths)
+        BOOST_REQUIRE_MESSAGE(chunker->AddIndex(x.first, x.second), x.first);
+
+    M6ChunkValues result;
+    string head;
+
+    bool processed = chunker->Process(inStream,
+        [&](const string& inText, const M6XMLChunker::M6IndexValues& inValues)
+        {
+            outTexts.push_back(inText);
+            result.push_back(inValues);
+        }, head);
+    BOOST_REQUIRE(processed);
+
+    return result;
+}
+
+void CompareChunkers(const string& inXML, const string& inChunkXPath, const M6XPaths& inXPaths,
+    size_t inExpectedChunks)
+{
+    istringstream a(inXML), b(inXML);
+    vector<string> texts;
+
+    M6ChunkValues chunked = ChunkWithChunker(a, inChunkXPath, inXPaths, texts);
+    M6ChunkValues zeeped = ChunkWithZeep(b, inChunkXPath, inXPaths);
+
+    BOOST_REQUIRE_EQUAL(chunked.size(), inExpectedChunks);
+    BOOST_REQUIRE_EQUAL(zeeped.size(), inExpectedChunks);
+
+    // the text of a chunk is the element as found in the input
+    string name = inChunkXPath.substr(inChunkXPath.rfind('/') + 1);
+    for (const string& text : texts)
+    {
+        BOOST_CHECK(ba::starts_with(text, "<" + name));
+        BOOST_CHECK(ba::ends_with(text, "</" + name + ">"));
+    }
+
+    for (size_t c = 0; c < inExpectedChunks; ++c)
+    {
+        for (size_t i = 0; i < inXPaths.size(); ++i)
+        {
+            BOOST_TEST_CHECKPOINT("chunk " << c << ", " << inXPaths[i].first);
+            BOOST_CHECK_EQUAL(ba::join(chunked[c][i], "|"), ba::join(zeeped[c][i], "|"));
+        }
+    }
+}
+
+void CompareChunkers(const string& inParser, const fs::path& inSample, size_t inExpectedChunks)
+{
+    const zx::element* parser = M6Config::GetParser(inParser);
+    BOOST_REQUIRE(parser != nullptr);
+
+    M6XPaths xpaths;
+    for (zx::element* ix : parser->find("index"))
+        xpaths.push_back(make_pair(ix->get_attribute("xpath"), ix->get_attribute("attr") == "true"));
+
+    fs::ifstream file(inSample, ios::binary);
+    BOOST_REQUIRE(file.is_open());
+    stringstream xml;
+    xml << file.rdbuf();
+
+    CompareChunkers(xml.str(), parser->get_attribute("chunk"), xpaths, inExpectedChunks);
+}
+
+const char kChunkerXML[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<db>\n"
+    "<info version=\"1\"/>\n"
+    "<entry id=\"E1\" type=\"a\">"
+        "<name type=\"full\">A &amp; B &#233;&#x00e8;</name>"
+        "<name type=\"short\">AB</name>"
+        "<desc>one <b>two <i>three</i> four <b>five</b></b> six</desc>"
+        "<note><![CDATA[x < y & z]]></note>"
+        "<xref db=\"pdb\" key=\"1HEW\"/>"
+    "</entry>\n"
+    "<entry id=\"E2\" type=\"b\">"
+        "<name type=\"full\">&lt;second&gt;</name>"
+        "<desc>&quot;plain&apos;</desc>"
+    "</entry>\n"
+    "</db>\n";
+
+BOOST_AUTO_TEST_CASE(TestXMLChunkerPaths)
+{
+    M6XPaths xpaths = {
+        { "@id", true },
+        { "name[@type=\"full\"]", true },
+        { "name[@type != 'full']", false },
+        { "*[name() != \"name\"]", false },
+        { ".//@*", false },
+        { "xref/@*", false },
+        { ".//b", false },
+        { "/db/entry/desc", true },
+        { "desc", false },
+        { "note", false }
+    };
+
+    CompareChunkers(kChunkerXML, "/db/entry", xpaths, 2);
+
+    // and some of the values spelled out
+    istringstream in(kChunkerXML);
+    vector<string> texts;
+    M6ChunkValues values = ChunkWithChunker(in, "/db/entry", xpaths, texts);
+
+    BOOST_REQUIRE_EQUAL(values.size(), 2U);
+    BOOST_CHECK_EQUAL(values[0][0].front(), "E1");
+    BOOST_CHECK_EQUAL(values[0][1].front(), "A & B \xc3\xa9\xc3\xa8");
+    BOOST_CHECK_EQUAL(ba::join(values[0][2], "|"), "AB");
+    BOOST_CHECK_EQUAL(ba::join(values[0][4], "|"), "E1|a|full|short|pdb|1HEW");
+    BOOST_CHECK_EQUAL(ba::join(values[0][5], "|"), "pdb|1HEW");
+    BOOST_CHECK_EQUAL(ba::join(values[0][6], "|"), "two |three| four |five|five");
+    BOOST_CHECK_EQUAL(values[0][7].front(), "one two three four five six");
+    BOOST_CHECK_EQUAL(ba::join(values[0][9], "|"), "x < y & z");
+    BOOST_CHECK_EQUAL(values[1][1].front(), "<second>");
+    BOOST_CHECK_EQUAL(values[1][7].front(), "\"plain'");
+    BOOST_CHECK(values[1][9].empty());
+
+    BOOST_CHECK_EQUAL(texts[1], "<entry id=\"E2\" type=\"b\"><name type=\"full\">&lt;second&gt;</name>"
+        "<desc>&quot;plain&apos;</desc></entry>");
+}
+
+// Files the chunker cannot handle are passed on to zeep, prefixed with the
+// data the chunker already read.
+
+void CheckChunkerFallback(const string& inXML, const M6XPaths& inXPaths)
+{
+    unique_ptr<M6XMLChunker> chunker(M6XMLChunker::Create("/db/entry"));
+    BOOST_REQUIRE(chunker);
+    for (auto& x : inXPaths)
+        BOOST_REQUIRE(chunker->AddIndex(x.first, x.second));
+
+    istringstream a(inXML), b(inXML);
+    string head;
+    uint32 chunks = 0;
+
+    BOOST_CHECK(not chunker->Process(a,
+        [&chunks](const string&, const M6XMLChunker::M6IndexValues&) { ++chunks; }, head));
+    BOOST_CHECK_EQUAL(chunks, 0U);
+    BOOST_CHECK(not head.empty());
+
+    M6ChunkValues expected = ChunkWithZeep(b, "/db/entry", inXPaths);
+    BOOST_CHECK_EQUAL(expected.size(), 2U);
+
+    io::stream<M6PrefixedSource> in(M6PrefixedSource(head, a));
+    M6ChunkValues values = ChunkWithZeep(in, "/db/entry", inXPaths);
+
+    BOOST_CHECK(values == expected);
+}
+
+BOOST_AUTO_TEST_CASE(TestXMLChunkerFallback)
+{
+    M6XPaths xpaths = { { "@id", true }, { "name", false } };
+
+    // a padded entry, so the head is only part of the file
+    string padding(100000, ' ');
+
+    // a different encoding
+    CheckChunkerFallback(
+        "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+        "<db><entry id=\"E1\"><name>M\xfcller</name></entry>" + padding +
+        "<entry id=\"E2\"><name>Smith</name></entry></db>\n", xpaths);
+
+    // a DTD with an internal subset, the entity is expanded by zeep
+    CheckChunkerFallback(
+        "<?xml version=\"1.0\"?>\n"
+        "<!DOCTYPE db [\n<!ENTITY ec \"enzyme commission\">\n]>\n"
+        "<db><entry id=\"E1\"><name>&ec;</name></entry>" + padding +
+        "<entry id=\"E2\"><name>Smith</name></entry></db>\n", xpaths);
+
+    // the prefixed source returns the head followed by the rest of the stream
+    string head = "<db>", text;
+    istringstream rest("<entry/></db>");
+    io::stream<M6PrefixedSource> in(M6PrefixedSource(head, rest));
+    getline(in, text);
+    BOOST_CHECK_EQUAL(text, "<db><entry/></db>");
+}
+
+BOOST_AUTO_TEST_CASE(TestXMLChunkerPMC)
+{
+    CompareChunkers("pmc", "unit-tests/data/pmc.nxml", 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestXMLChunkerInterPro)
+{
+    CompareChunkers("interpro", "unit-tests/data/interpro.xml", 2);
+}
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <limits>
+#include <cstring>
 
 #define BOOST_TEST_MODULE QueryTest
 #include <boost/test/included/unit_test.hpp>
@@ -9,8 +11,15 @@
 #include "M6Query.h"
 #include "M6Iterator.h"
 #include "M6Databank.h"
+#include "M6Document.h"
+#include "M6Lexicon.h"
+#include "M6Tokenizer.h"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
 
 using namespace std;
+namespace fs = boost::filesystem;
 
 
 int VERBOSE = 0;
@@ -32,3 +41,439 @@ BOOST_AUTO_TEST_CASE(TestQuery1)
     ParseQuery(*(databank.get()), "hyhel -5", true, terms, filter, isBooleanQuery);
     BOOST_CHECK_EQUAL(2, terms.size());
 }
+
+// A signed number after a word, as in "hyhel -5", used to make
+// GetNextQueryToken return empty number tokens forever
+BOOST_AUTO_TEST_CASE(TestQueryTokens)
+{
+    const struct { const char* query; const char* number; } kQueries[] = {
+        { "hyhel -5", "-5" },
+        { "hyhel +5", "+5" },
+        { "hyhel -12 lysozyme", "-12" }
+    };
+
+    for (auto& q : kQueries)
+    {
+        M6Tokenizer tokenizer(q.query, strlen(q.query));
+
+        BOOST_CHECK_EQUAL(tokenizer.GetNextQueryToken(), eM6TokenWord);
+        BOOST_CHECK_EQUAL(tokenizer.GetTokenString(), "hyhel");
+
+        BOOST_CHECK_EQUAL(tokenizer.GetNextQueryToken(), eM6TokenNumber);
+        BOOST_CHECK_EQUAL(tokenizer.GetTokenString(), q.number);
+
+        // the remainder must end, and not in an empty token
+        uint32 n = 0;
+        M6Token token;
+        while ((token = tokenizer.GetNextQueryToken()) != eM6TokenEOF and n++ < 10)
+            BOOST_CHECK(tokenizer.GetTokenLength() > 0);
+        BOOST_CHECK_EQUAL(token, eM6TokenEOF);
+    }
+}
+
+// Build a databank in inPath with documents containing "alpha" and inWord
+static void BuildTestDatabank(const fs::path& inPath, uint32 inDocCount, const string& inWord)
+{
+    unique_ptr<M6Databank> databank(M6Databank::CreateNew("test-db", inPath, "0.0.0",
+        vector<pair<string,string>>()));
+
+    M6Lexicon lexicon;
+    databank->StartBatchImport(lexicon);
+
+    for (uint32 i = 0; i < inDocCount; ++i)
+    {
+        string text = "alpha " + inWord + " doc" + boost::lexical_cast<string>(i);
+
+        M6InputDocument* doc = new M6InputDocument(*databank, text);
+        doc->Index("text", eM6TextData, false, text.c_str(), text.length());
+        doc->Tokenize(lexicon, 0);
+        doc->Compress();
+        databank->Store(doc);
+    }
+
+    databank->EndBatchImport();
+    databank->FinishBatchImport();
+}
+
+// A ranked search without a report limit, on a databank with a segment
+// and a deleted document
+BOOST_AUTO_TEST_CASE(TestQuery2)
+{
+    fs::path path("test/test-segments.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "base");
+    fs::create_directory(path / "segments");
+    BuildTestDatabank(path / "segments" / "s1", 2, "delta");
+    M6Databank::AddSegment(path, "s1", 10, vector<uint32>(1, 3));
+
+    M6Databank databank(path, eReadOnly);
+    BOOST_CHECK_EQUAL(databank.size(), 11);
+
+    unique_ptr<M6Iterator> iter(databank.Find("alpha", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+
+    uint32 docNr, count = 0;
+    float rank;
+    while (iter->Next(docNr, rank))
+    {
+        BOOST_CHECK(docNr != 3);
+        ++count;
+    }
+
+    BOOST_CHECK_EQUAL(count, 11);
+
+    // the deleted document is not counted, not even when it is not
+    // among the documents returned
+    iter.reset(databank.Find("alpha", false, 2));
+    BOOST_REQUIRE(iter);
+    BOOST_CHECK_EQUAL(iter->GetCount(), 11);
+}
+
+// Merging segments leaves gaps in the document numbers, a query for all
+// documents should return only documents that exist
+BOOST_AUTO_TEST_CASE(TestQuery3)
+{
+    fs::path path("test/test-merged.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "base");
+    fs::create_directory(path / "segments");
+
+    // segments are added and merged the way M6Builder does
+    const char* kSegments[] = { "s1", "s2" };
+    for (const char* segment : kSegments)
+    {
+        uint32 docBase = M6Databank(path, eReadOnly).GetMaxDocNr();
+        BuildTestDatabank(path / "segments" / segment, 2, "delta");
+        M6Databank::AddSegment(path, segment, docBase, vector<uint32>(1, 3));
+    }
+
+    M6SegmentInfoList segments;
+    M6Databank::GetSegments(path, segments);
+    uint32 docBase = segments.back().mDocBase + segments.back().mDocCount;
+
+    vector<string> merged(kSegments, kSegments + 2);
+    vector<uint32> docMap;
+    M6Databank::CreateMergedSegment(path, "test-db", merged, "m1", docMap);
+    M6Databank::MergeSegments(path, merged, "m1", docBase);
+
+    // the merged segments are kept until they are collected as garbage
+    for (const char* segment : kSegments)
+        BOOST_CHECK(fs::exists(path / "segments" / segment));
+
+    M6Databank::CollectGarbage(path);
+
+    for (const char* segment : kSegments)
+        BOOST_CHECK(not fs::exists(path / "segments" / segment));
+    BOOST_CHECK(fs::exists(path / "segments" / "m1"));
+
+    M6Databank databank(path, eReadOnly);
+
+    unique_ptr<M6Iterator> iter(databank.Find("*", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+
+    uint32 docNr, count = 0;
+    float rank;
+    while (iter->Next(docNr, rank))
+    {
+        BOOST_CHECK(docNr != 3);
+
+        unique_ptr<M6Document> doc(databank.Fetch(docNr));
+        BOOST_CHECK(doc);
+        ++count;
+    }
+
+    BOOST_CHECK_EQUAL(count, 13);
+}
+
+// Phrase searches read the in-document locations written while the index
+// is assembled
+BOOST_AUTO_TEST_CASE(TestQuery4)
+{
+    fs::path path("test/test-phrase.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 100, "beta");
+
+    M6Databank databank(path, eReadOnly);
+
+    const struct { const char* phrase; uint32 count; } kPhrases[] = {
+        { "alpha beta", 100 },
+        { "beta alpha", 0 },
+        { "beta doc42", 1 },
+        { "alpha doc42", 0 }
+    };
+
+    for (auto& p : kPhrases)
+    {
+        uint32 count = 0;
+
+        unique_ptr<M6Iterator> iter(databank.FindString("text", p.phrase));
+        if (iter)
+        {
+            uint32 docNr;
+            float rank;
+            while (iter->Next(docNr, rank))
+                ++count;
+        }
+
+        BOOST_CHECK_EQUAL(count, p.count);
+    }
+}
+
+// Documents with the same text have the same full text weights, that
+// includes the first and the last doc/term pair read back while the
+// index is assembled
+BOOST_AUTO_TEST_CASE(TestQuery5)
+{
+    fs::path path("test/test-weights.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "beta");
+
+    M6Databank databank(path, eReadOnly);
+
+    unique_ptr<M6Iterator> iter(databank.Find("alpha", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+
+    uint32 docNr, count = 0;
+    float rank, firstRank;
+    while (iter->Next(docNr, rank))
+    {
+        if (count++ == 0)
+            firstRank = rank;
+        else
+            BOOST_CHECK_CLOSE(rank, firstRank, 0.001);
+    }
+
+    BOOST_CHECK_EQUAL(count, 10);
+
+    iter.reset(databank.Find("doc9", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+
+    count = 0;
+    while (iter->Next(docNr, rank))
+    {
+        BOOST_CHECK_EQUAL(docNr, 10);
+        ++count;
+    }
+
+    BOOST_CHECK_EQUAL(count, 1);
+}
+
+// A vacuum erases the deleted documents of the base from the document
+// store, they stay out of search results and the document count
+BOOST_AUTO_TEST_CASE(TestQuery6)
+{
+    fs::path path("test/test-vacuum.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "base");
+    fs::create_directory(path / "segments");
+    BuildTestDatabank(path / "segments" / "s1", 2, "delta");
+    M6Databank::AddSegment(path, "s1", 10, vector<uint32>(1, 3));
+
+    M6Databank(path, eReadWrite).Vacuum();
+
+    M6Databank databank(path, eReadOnly);
+    BOOST_CHECK_EQUAL(databank.size(), 11);
+    BOOST_CHECK(databank.Fetch(3) == nullptr);
+
+    M6DatabankInfo info;
+    databank.GetInfo(info);
+    BOOST_CHECK_EQUAL(info.mDocCount, 11);
+
+    unique_ptr<M6Iterator> iter(databank.Find("alpha", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+    BOOST_CHECK_EQUAL(iter->GetCount(), 11);
+
+    uint32 docNr;
+    float rank;
+    while (iter->Next(docNr, rank))
+        BOOST_CHECK(docNr != 3);
+}
+
+// A merged segment holds the documents of the merged segments that were
+// not deleted, renumbered from one, along with their index entries
+BOOST_AUTO_TEST_CASE(TestQuery7)
+{
+    fs::path path("test/test-merge.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "base");
+    fs::create_directory(path / "segments");
+
+    // enough documents to fill more than one page of the indices
+    BuildTestDatabank(path / "segments" / "s1", 1000, "delta");
+    M6Databank::AddSegment(path, "s1", 10, vector<uint32>(1, 12));
+
+    uint32 docBase = M6Databank(path, eReadOnly).GetMaxDocNr();
+    BuildTestDatabank(path / "segments" / "s2", 5, "gamma");
+    M6Databank::AddSegment(path, "s2", docBase, vector<uint32>(1, docBase + 2));
+
+    vector<string> merged = { "s1", "s2" };
+    vector<uint32> docMap;
+    M6Databank::CreateMergedSegment(path, "test-db", merged, "m1", docMap);
+
+    BOOST_REQUIRE(docMap.size() > docBase + 5);
+    BOOST_CHECK_EQUAL(docMap[11], 1);
+    BOOST_CHECK_EQUAL(docMap[12], 0);
+    BOOST_CHECK_EQUAL(docMap[13], 2);
+    BOOST_CHECK_EQUAL(docMap[docBase + 1], 1000);
+    BOOST_CHECK_EQUAL(docMap[docBase + 2], 0);
+    BOOST_CHECK_EQUAL(docMap[docBase + 5], 1003);
+
+    M6Databank segment(path / "segments" / "m1", eReadOnly);
+    BOOST_CHECK_EQUAL(segment.size(), 1003);
+
+    // the documents are copied unchanged
+    const struct { const char* segment; uint32 docNr, mergedDocNr; } kDocs[] = {
+        { "s1", 3, 2 },
+        { "s2", 5, 1003 }
+    };
+
+    for (auto& d : kDocs)
+    {
+        M6Databank sourceSegment(path / "segments" / d.segment, eReadOnly);
+
+        unique_ptr<M6Document> doc(segment.Fetch(d.mergedDocNr));
+        unique_ptr<M6Document> source(sourceSegment.Fetch(d.docNr));
+        BOOST_REQUIRE(doc and source);
+        BOOST_CHECK_EQUAL(doc->GetText(), source->GetText());
+    }
+
+    const struct { const char* word; uint32 count; uint32 docNr; } kWords[] = {
+        { "alpha", 1003, 0 },
+        { "delta", 999, 0 },
+        { "gamma", 4, 0 },
+        { "doc0", 2, 1000 },
+        { "doc2", 2, 2 },
+        { "doc999", 1, 999 }
+    };
+
+    for (auto& w : kWords)
+    {
+        unique_ptr<M6Iterator> iter(segment.Find(w.word, false, numeric_limits<uint32>::max()));
+        BOOST_REQUIRE(iter);
+
+        uint32 docNr, count = 0;
+        float rank;
+        bool found = w.docNr == 0;
+        while (iter->Next(docNr, rank))
+        {
+            found = found or docNr == w.docNr;
+            ++count;
+        }
+
+        BOOST_CHECK_MESSAGE(count == w.count, w.word << " found " << count << " times");
+        BOOST_CHECK_MESSAGE(found, w.word << " not found in document " << w.docNr);
+    }
+
+    // the in-document locations are copied as well
+    unique_ptr<M6Iterator> iter(segment.FindString("text", "gamma doc4"));
+    BOOST_REQUIRE(iter);
+
+    uint32 docNr;
+    float rank;
+    BOOST_CHECK(iter->Next(docNr, rank));
+    BOOST_CHECK_EQUAL(docNr, 1003);
+    BOOST_CHECK(not iter->Next(docNr, rank));
+}
+
+// Databanks built before tokenizer.txt was written report version 1. They
+// stay usable and adding a segment does not mark them as current.
+BOOST_AUTO_TEST_CASE(TestQuery8)
+{
+    fs::path path("test/test-tokenizer.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    BuildTestDatabank(path, 10, "base");
+    BOOST_CHECK_EQUAL(M6Databank::GetTokenizerVersion(path), static_cast<uint32>(M6Tokenizer::kVersion));
+
+    fs::remove(path / "tokenizer.txt");
+    BOOST_CHECK_EQUAL(M6Databank::GetTokenizerVersion(path), 1);
+
+    fs::create_directory(path / "segments");
+    BuildTestDatabank(path / "segments" / "s1", 2, "delta");
+    M6Databank::AddSegment(path, "s1", 10, vector<uint32>());
+
+    BOOST_CHECK_EQUAL(M6Databank::GetTokenizerVersion(path), 1);
+
+    M6Databank databank(path, eReadOnly);
+    BOOST_CHECK_EQUAL(databank.size(), 12);
+
+    unique_ptr<M6Iterator> iter(databank.Find("delta", false, numeric_limits<uint32>::max()));
+    BOOST_REQUIRE(iter);
+    BOOST_CHECK_EQUAL(iter->GetCount(), 2);
+}
+
+// A unique key stored for more than one document belongs to the first of
+// these, also when a later document is indexed first. Document numbers
+// are assigned when a document is created, so storing the documents in
+// reverse order indexes the later ones first.
+BOOST_AUTO_TEST_CASE(TestQuery9)
+{
+    fs::path path("test/test-unique.m6");
+    if (fs::exists(path))
+        fs::remove_all(path);
+
+    const uint32 kKeyCount = 50, kDocCount = 3 * kKeyCount;
+
+    {
+        unique_ptr<M6Databank> databank(M6Databank::CreateNew("test-db", path, "0.0.0",
+            vector<pair<string,string>>()));
+
+        M6Lexicon lexicon;
+        databank->StartBatchImport(lexicon);
+
+        vector<M6InputDocument*> docs;
+        for (uint32 i = 0; i < kDocCount; ++i)
+        {
+            string text = "alpha doc" + boost::lexical_cast<string>(i);
+            string id = "id" + boost::lexical_cast<string>(i % kKeyCount);
+
+            M6InputDocument* doc = new M6InputDocument(*databank, text);
+            doc->Index("text", eM6TextData, false, text.c_str(), text.length());
+            doc->Index("id", eM6StringData, true, id.c_str(), id.length());
+            doc->Index("fl", true, i % kKeyCount + 0.25);
+            doc->Tokenize(lexicon, 0);
+            doc->Compress();
+            docs.push_back(doc);
+        }
+
+        for (auto doc = docs.rbegin(); doc != docs.rend(); ++doc)
+            databank->Store(*doc);
+
+        databank->EndBatchImport();
+        databank->FinishBatchImport();
+    }
+
+    M6Databank databank(path, eReadOnly);
+    BOOST_CHECK_EQUAL(databank.size(), kDocCount);
+
+    for (uint32 k = 0; k < kKeyCount; ++k)
+    {
+        bool exists;
+        uint32 docNr;
+
+        tie(exists, docNr) = databank.Exists("id", "id" + boost::lexical_cast<string>(k));
+        BOOST_CHECK(exists);
+        BOOST_CHECK_EQUAL(docNr, k + 1);
+
+        tie(exists, docNr) = databank.Exists("fl", boost::lexical_cast<string>(k + 0.25));
+        BOOST_CHECK(exists);
+        BOOST_CHECK_EQUAL(docNr, k + 1);
+    }
+
+    BOOST_CHECK(databank.Exists(1));
+    BOOST_CHECK(databank.Exists(kDocCount));
+    BOOST_CHECK(not databank.Exists(kDocCount + 1));
+}
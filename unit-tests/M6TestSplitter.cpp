@@ -0,0 +1,198 @@
+#include "M6Lib.h"
+
+#include <iostream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#define BOOST_TEST_MODULE Splitter_Test
+#include <boost/test/included/unit_test.hpp>
+
+#include "M6LineMatcher.h"
+
+using namespace std;
+namespace ba = boost::algorithm;
+
+// --------------------------------------------------------------------
+//    M6SplitRecords is compared with the line based state machine that
+//    M6Processor::ParseFile uses for files with a header or trailer, on
+//    random input cut into blocks of various sizes.
+
+namespace
+{
+
+// The records as found by ParseFile, without header and trailer
+vector<string> SplitLines(const string& inText,
+    const M6LineMatcher& inFirstLine, const M6LineMatcher& inLastLine)
+{
+    vector<string> result;
+
+    istringstream in(inText);
+    bool inDoc = false;
+    string document, line;
+
+    for (;;)
+    {
+        line.clear();
+        getline(in, line);
+
+        if (ba::ends_with(line, "\r"))
+            line.erase(line.end() - 1);
+
+        if (line.empty() and in.eof())
+        {
+            if (not document.empty())
+                result.push_back(document);
+            break;
+        }
+
+        if (not inDoc)
+        {
+            if (not inFirstLine or inFirstLine.Match(line))
+            {
+                document.assign(line).append(1, '\n');
+                inDoc = true;
+            }
+        }
+        else if (not inLastLine and inFirstLine and inFirstLine.Match(line))
+        {
+            result.push_back(document);
+            document.assign(line).append(1, '\n');
+        }
+        else
+        {
+            document.append(line).append(1, '\n');
+            if (inLastLine and inLastLine.Match(line))
+            {
+                result.push_back(document);
+                document.clear();
+                inDoc = false;
+            }
+        }
+    }
+
+    return result;
+}
+
+// The records as found by M6SplitRecords, with the line ends of files in
+// DOS format converted like M6Processor::GetText does.
+vector<string> SplitBlocks(const string& inText,
+    const M6LineMatcher& inFirstLine, const M6LineMatcher& inLastLine, size_t inBlockSize)
+{
+    vector<string> result;
+
+    istringstream in(inText);
+    M6SplitRecords(in, inFirstLine, inLastLine,
+        [&result](const shared_ptr<const string>& inBlock, size_t inOffset, size_t inLength)
+        {
+            string text(*inBlock, inOffset, inLength);
+
+            string::iterator e = text.begin();
+            for (string::iterator i = text.begin(); i != text.end(); ++i)
+            {
+                if (*i == '\r' and i + 1 != text.end() and *(i + 1) == '\n')
+                    continue;
+                *e++ = *i;
+            }
+            text.erase(e, text.end());
+
+            result.push_back(text);
+        }, inBlockSize);
+
+    return result;
+}
+
+// random input built from lines that do and do not match the
+// delimiters, with DOS line ends and a missing final newline now and then
+string CreateInput(uint32& ioSeed)
+{
+    const char* kLines[] = {
+        "ID   P12345; Reviewed", "ID", "AC   Q00001;", "//", "// ", ">sp|P12345|KIN", ">",
+        "SQ   SEQUENCE", "MKTAYIAKQRQISFVKSHFSRQ", "", "<entry>", "</entry>", "x//"
+    };
+    const uint32 kLineCount = sizeof(kLines) / sizeof(const char*);
+
+    auto next = [&ioSeed](uint32 inMax) -> uint32
+    {
+        ioSeed = ioSeed * 1103515245 + 12345;
+        return (ioSeed >> 16) % inMax;
+    };
+
+    bool dos = next(4) == 0;
+
+    string result;
+    for (uint32 i = next(40); i > 0; --i)
+    {
+        result += kLines[next(kLineCount)];
+        result += dos and next(2) ? "\r\n" : "\n";
+    }
+
+    if (not result.empty() and next(4) == 0)
+        result.erase(result.end() - 1);
+
+    return result;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_splitter)
+{
+    cout << "testing record splitter" << endl;
+
+    // first and last line as they appear in the parser scripts
+    const char* kDelimiters[][2] = {
+        { "", "//" },                            // uniprot, embl
+        { "(?^:^ID   .+)", "//" },
+        { "(?^:^>)", "" },                        // fasta
+        { "(?^:^>.*)", "" },
+        { "(?^:^<entry>$)", "(?^:^</entry>\\s*$)" }
+    };
+
+    uint32 seed = 1;
+
+    for (auto& delimiter : kDelimiters)
+    {
+        M6LineMatcher firstLine(delimiter[0]), lastLine(delimiter[1]);
+
+        for (uint32 i = 0; i < 4000; ++i)
+        {
+            string text = CreateInput(seed);
+            vector<string> expected = SplitLines(text, firstLine, lastLine);
+
+            for (size_t blockSize : { 7, 64, 4 * 1024 * 1024 })
+            {
+                vector<string> records = SplitBlocks(text, firstLine, lastLine, blockSize);
+
+                BOOST_CHECK(records == expected);
+                if (records != expected)
+                {
+                    cerr << "first line: " << delimiter[0] << ", last line: " << delimiter[1]
+                         << ", block size " << blockSize << endl
+                         << "input:" << endl << text << endl;
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_large_record)
+{
+    cout << "testing record splitter with a record much larger than a block" << endl;
+
+    // a record of 16 MB read in blocks of 64 bytes, copying the unfinished
+    // record into each new block would take forever here
+    string sequence(16 * 1024 * 1024, 'A');
+    for (size_t i = 60; i < sequence.length(); i += 61)
+        sequence[i] = '\n';
+    sequence += '\n';
+
+    string text = "ID   CON1\n" + sequence + "//\nID   CON2\nSQ   SEQUENCE\n//\n";
+
+    M6LineMatcher firstLine("(?^:^ID   .+)"), lastLine("//");
+
+    vector<string> records = SplitBlocks(text, firstLine, lastLine, 64);
+
+    BOOST_REQUIRE_EQUAL(records.size(), 2);
+    BOOST_CHECK(records[0] == "ID   CON1\n" + sequence + "//\n");
+    BOOST_CHECK(records[1] == "ID   CON2\nSQ   SEQUENCE\n//\n");
+}